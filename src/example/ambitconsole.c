@@ -3,30 +3,126 @@
 #include <string.h>
 #include <libambit.h>
 
+#define EXPORT_BUFFER_SIZE  65536
+#define TRACE_PACKETS       65536   /* about 6 MB, the last few minutes of a sync */
+
+typedef enum export_format_e {
+    export_format_none,
+    export_format_gpx,
+    export_format_tcx
+} export_format_t;
+
+/* State of a streaming export. Only the values last seen are kept, so
+ * memory use does not depend on the size of the logs */
+typedef struct export_state_s {
+    export_format_t format;
+    FILE *out;
+    uint32_t since;                 /* yyyymmdd of oldest log, 0 for all */
+    int max_count;                  /* 0 for all */
+    int selected;
+    int in_entry;
+
+    int hr;                         /* bpm, -1 until known */
+    int altitude_valid;
+    double altitude;                /* m */
+    int distance_valid;
+    uint32_t distance;              /* m */
+    int position_valid;
+    int32_t latitude;               /* degree, scale: 0.0000001 */
+    int32_t longitude;              /* degree, scale: 0.0000001 */
+    int latitude_pending;           /* periodic values come one by one */
+    int longitude_pending;
+} export_state_t;
+
 static int log_skip_cb(void *ambit_object, ambit_log_header_t *log_header);
 static void log_data_cb(void *object, ambit_log_entry_t *log_entry);
+static void benchmark_chunk_sizes(ambit_object_t *ambit_object);
+
+static int export_logs(ambit_object_t *ambit_object, export_state_t *state);
+static int export_skip_cb(void *ref, ambit_log_header_t *log_header);
+static void export_sample_cb(void *ref, ambit_log_header_t *log_header, ambit_log_sample_t *sample);
+static void export_push_cb(void *ref, ambit_log_entry_t *log_entry);
+static void export_entry_begin(export_state_t *state, ambit_log_header_t *log_header, ambit_log_sample_t *sample);
+static void export_position(export_state_t *state, ambit_log_sample_t *sample);
+static void export_trackpoint(export_state_t *state, ambit_log_sample_t *sample);
+static void export_time(FILE *out, const ambit_date_time_t *utc_time);
+static void export_escaped(FILE *out, const char *string);
+static void usage(const char *name);
+static void write_trace(ambit_object_t *ambit_object, const char *path, FILE *msg);
 
 int main(int argc, char *argv[])
 {
-    ambit_device_info_t *info = libambit_enumerate();
+    ambit_device_info_t *info;
     ambit_object_t *ambit_object;
     ambit_device_status_t status;
     ambit_personal_settings_t settings;
+    export_state_t export_state;
+    int benchmark = 0;
+    const char *trace_path = NULL;
+    int year, month, day;
+    int ret = 0;
+    int i;
+    FILE *msg;
+
+    memset(&export_state, 0, sizeof(export_state));
+    for (i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = 1;
+        }
+        else if (strcmp(argv[i], "--gpx") == 0) {
+            export_state.format = export_format_gpx;
+        }
+        else if (strcmp(argv[i], "--tcx") == 0) {
+            export_state.format = export_format_tcx;
+        }
+        else if (strcmp(argv[i], "--since") == 0 && i+1 < argc &&
+                 sscanf(argv[i+1], "%d-%d-%d", &year, &month, &day) == 3) {
+            export_state.since = year*10000 + month*100 + day;
+            i++;
+        }
+        else if (strcmp(argv[i], "--count") == 0 && i+1 < argc) {
+            export_state.max_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+            trace_path = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
+    // Exports own stdout, everything else is reported on stderr then
+    msg = (export_state.format != export_format_none ? stderr : stdout);
+
+    info = libambit_enumerate();
     if (info) {
-        printf("Device: %s, serial: %s\n", info->name, info->serial);
+        fprintf(msg, "Device: %s, serial: %s\n", info->name, info->serial);
         if (0 == info->access_status) {
-          printf("F/W version: %d.%d.%d\n", info->fw_version[0], info->fw_version[1], (info->fw_version[2] << 0) | (info->fw_version[3] << 8));
+          fprintf(msg, "F/W version: %d.%d.%d\n", info->fw_version[0], info->fw_version[1], (info->fw_version[2] << 0) | (info->fw_version[3] << 8));
             if (!info->is_supported) {
-                printf("Device is not supported yet!\n");
+                fprintf(msg, "Device is not supported yet!\n");
             }
         }
         else {
-            printf("%s: %s\n", info->path, strerror(info->access_status));
+            fprintf(msg, "%s: %s\n", info->path, strerror(info->access_status));
         }
 
         ambit_object = libambit_new(info);
-        if (ambit_object) {
+        if (ambit_object && trace_path != NULL && libambit_trace_enable(ambit_object, TRACE_PACKETS) != 0) {
+            fprintf(msg, "Failed to start USB trace\n");
+        }
+        if (ambit_object && benchmark) {
+            benchmark_chunk_sizes(ambit_object);
+            write_trace(ambit_object, trace_path, msg);
+            libambit_close(ambit_object);
+        }
+        else if (ambit_object && export_state.format != export_format_none) {
+            ret = export_logs(ambit_object, &export_state);
+            write_trace(ambit_object, trace_path, msg);
+            libambit_close(ambit_object);
+        }
+        else if (ambit_object) {
 
             if (libambit_device_status_get(ambit_object, &status) == 0) {
                 printf("Current charge: %d%%\n", status.charge);
@@ -42,15 +138,40 @@ int main(int argc, char *argv[])
             }
 
             libambit_log_read(ambit_object, log_skip_cb, log_data_cb, NULL, ambit_object);
+            write_trace(ambit_object, trace_path, msg);
             libambit_close(ambit_object);
         }
     }
     else {
-        printf("No clock found, exiting\n");
+        fprintf(msg, "No clock found, exiting\n");
+        ret = 1;
     }
     libambit_free_enumeration(info);
 
-    return 0;
+    return ret;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--benchmark | --gpx | --tcx] [--since YYYY-MM-DD] [--count N] [--trace FILE]\n", name);
+    fprintf(stderr, "  --gpx, --tcx  stream logs to stdout as they are read from the device\n");
+    fprintf(stderr, "  --since       only export logs started on or after the date\n");
+    fprintf(stderr, "  --count       export at most N logs\n");
+    fprintf(stderr, "  --trace       write the last USB packets to FILE in pcap format\n");
+}
+
+static void write_trace(ambit_object_t *ambit_object, const char *path, FILE *msg)
+{
+    int count;
+
+    if (path != NULL) {
+        if ((count = libambit_trace_write_pcap(ambit_object, path)) < 0) {
+            fprintf(msg, "Failed to write USB trace to %s\n", path);
+        }
+        else {
+            fprintf(msg, "Wrote %d USB packets to %s\n", count, path);
+        }
+    }
 }
 
 static int log_skip_cb(void *ambit_object, ambit_log_header_t *log_header)
@@ -75,3 +196,281 @@ static void log_data_cb(void *object, ambit_log_entry_t *log_entry)
         printf("Sample #%d, type: %d, time: %04u-%02u-%02u %02u:%02u:%2.3f\n", i, log_entry->samples[i].type, log_entry->samples[i].utc_time.year, log_entry->samples[i].utc_time.month, log_entry->samples[i].utc_time.day, log_entry->samples[i].utc_time.hour, log_entry->samples[i].utc_time.minute, (1.0*log_entry->samples[i].utc_time.msec)/1000);
     }
 }
+
+static void benchmark_chunk_sizes(ambit_object_t *ambit_object)
+{
+    static const uint16_t chunk_sizes[] = { 0x0100, 0x0200, 0x0400, 0x0800, 0x1000 };
+    uint32_t length = 0x10000;
+    uint32_t rate;
+    int i;
+
+    printf("Log read throughput, %u bytes per chunk size\n", length);
+    for (i=0; i<sizeof(chunk_sizes)/sizeof(chunk_sizes[0]); i++) {
+        if (libambit_log_read_benchmark(ambit_object, chunk_sizes[i], length, &rate) == 0) {
+            printf("Chunk size 0x%04x: %u bytes/s\n", chunk_sizes[i], rate);
+        }
+        else {
+            printf("Chunk size 0x%04x: failed\n", chunk_sizes[i]);
+        }
+    }
+}
+
+static int export_logs(ambit_object_t *ambit_object, export_state_t *state)
+{
+    int count;
+
+    state->out = stdout;
+    setvbuf(state->out, NULL, _IOFBF, EXPORT_BUFFER_SIZE);
+
+    fprintf(state->out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    if (state->format == export_format_gpx) {
+        fprintf(state->out, "<gpx version=\"1.1\" creator=\"ambitconsole\" xmlns=\"http://www.topografix.com/GPX/1/1\" "
+                            "xmlns:gpxtpx=\"http://www.garmin.com/xmlschemas/TrackPointExtension/v1\">\n");
+    }
+    else {
+        fprintf(state->out, "<TrainingCenterDatabase xmlns=\"http://www.garmin.com/xmlschemas/TrainingCenterDatabase/v2\">\n");
+        fprintf(state->out, "<Activities>\n");
+    }
+
+    // Samples are passed on as they are parsed, none are collected
+    count = libambit_log_read_stream(ambit_object, export_skip_cb, export_sample_cb, export_push_cb, NULL, state);
+
+    if (state->format == export_format_gpx) {
+        fprintf(state->out, "</gpx>\n");
+    }
+    else {
+        fprintf(state->out, "</Activities>\n");
+        fprintf(state->out, "</TrainingCenterDatabase>\n");
+    }
+    fflush(state->out);
+
+    if (count < 0) {
+        fprintf(stderr, "Failed to read logs\n");
+        return 1;
+    }
+    fprintf(stderr, "Exported %d logs\n", count);
+
+    return 0;
+}
+
+static int export_skip_cb(void *ref, ambit_log_header_t *log_header)
+{
+    export_state_t *state = (export_state_t*)ref;
+    uint32_t date = log_header->date_time.year*10000 + log_header->date_time.month*100 + log_header->date_time.day;
+
+    if (date < state->since || (state->max_count > 0 && state->selected >= state->max_count)) {
+        return 0;
+    }
+    state->selected++;
+
+    return 1;
+}
+
+static void export_sample_cb(void *ref, ambit_log_header_t *log_header, ambit_log_sample_t *sample)
+{
+    export_state_t *state = (export_state_t*)ref;
+    int i;
+
+    // Entries start at the first sample with a UTC time, before that the
+    // time of the samples is not known
+    if (!state->in_entry) {
+        if (sample->utc_time.year == 0) {
+            return;
+        }
+        export_entry_begin(state, log_header, sample);
+    }
+
+    switch (sample->type) {
+      case ambit_log_sample_type_periodic:
+        for (i=0; i<sample->u.periodic.value_count; i++) {
+            ambit_log_sample_periodic_value_t *value = &sample->u.periodic.values[i];
+            switch (value->type) {
+              case ambit_log_sample_periodic_type_hr:
+                if (value->u.hr != 0xff) {
+                    state->hr = value->u.hr;
+                }
+                break;
+              case ambit_log_sample_periodic_type_altitude:
+                state->altitude = value->u.altitude;
+                state->altitude_valid = 1;
+                break;
+              case ambit_log_sample_periodic_type_distance:
+                state->distance = value->u.distance;
+                state->distance_valid = 1;
+                break;
+              case ambit_log_sample_periodic_type_latitude:
+                state->latitude = value->u.latitude;
+                state->latitude_pending = 1;
+                break;
+              case ambit_log_sample_periodic_type_longitude:
+                state->longitude = value->u.longitude;
+                state->longitude_pending = 1;
+                break;
+              default:
+                break;
+            }
+        }
+        if (state->latitude_pending && state->longitude_pending) {
+            state->latitude_pending = state->longitude_pending = 0;
+            state->position_valid = 1;
+            export_position(state, sample);
+        }
+        if (state->format == export_format_tcx) {
+            export_trackpoint(state, sample);
+        }
+        break;
+      case ambit_log_sample_type_gps_base:
+        state->latitude = sample->u.gps_base.latitude;
+        state->longitude = sample->u.gps_base.longitude;
+        state->position_valid = 1;
+        export_position(state, sample);
+        break;
+      case ambit_log_sample_type_gps_small:
+        state->latitude = sample->u.gps_small.latitude;
+        state->longitude = sample->u.gps_small.longitude;
+        state->position_valid = 1;
+        export_position(state, sample);
+        break;
+      case ambit_log_sample_type_gps_tiny:
+        state->latitude = sample->u.gps_tiny.latitude;
+        state->longitude = sample->u.gps_tiny.longitude;
+        state->position_valid = 1;
+        export_position(state, sample);
+        break;
+      case ambit_log_sample_type_position:
+        state->latitude = sample->u.position.latitude;
+        state->longitude = sample->u.position.longitude;
+        state->position_valid = 1;
+        export_position(state, sample);
+        break;
+      default:
+        break;
+    }
+}
+
+static void export_push_cb(void *ref, ambit_log_entry_t *log_entry)
+{
+    export_state_t *state = (export_state_t*)ref;
+
+    if (state->in_entry) {
+        if (state->format == export_format_gpx) {
+            fprintf(state->out, "</trkseg>\n</trk>\n");
+        }
+        else {
+            fprintf(state->out, "</Track>\n</Lap>\n</Activity>\n");
+        }
+        state->in_entry = 0;
+
+        // Let consumers of the stream see each log as soon as it is done
+        fflush(state->out);
+    }
+
+    fprintf(stderr, "Exported log %d-%02d-%02d %02d:%02d\n", log_entry->header.date_time.year, log_entry->header.date_time.month, log_entry->header.date_time.day, log_entry->header.date_time.hour, log_entry->header.date_time.minute);
+    libambit_log_entry_free(log_entry);
+}
+
+static void export_entry_begin(export_state_t *state, ambit_log_header_t *log_header, ambit_log_sample_t *sample)
+{
+    state->in_entry = 1;
+    state->hr = -1;
+    state->altitude_valid = 0;
+    state->distance_valid = 0;
+    state->position_valid = 0;
+    state->latitude_pending = 0;
+    state->longitude_pending = 0;
+
+    if (state->format == export_format_gpx) {
+        fprintf(state->out, "<trk>\n<name>");
+        export_escaped(state->out, log_header->activity_name);
+        fprintf(state->out, "</name>\n<trkseg>\n");
+    }
+    else {
+        fprintf(state->out, "<Activity Sport=\"Other\">\n<Id>");
+        export_time(state->out, &sample->utc_time);
+        fprintf(state->out, "</Id>\n<Lap StartTime=\"");
+        export_time(state->out, &sample->utc_time);
+        fprintf(state->out, "\">\n");
+        fprintf(state->out, "<TotalTimeSeconds>%.1f</TotalTimeSeconds>\n", log_header->duration/1000.0);
+        fprintf(state->out, "<DistanceMeters>%u</DistanceMeters>\n", log_header->distance);
+        fprintf(state->out, "<Calories>%u</Calories>\n", log_header->energy_consumption);
+        if (log_header->heartrate_avg > 0) {
+            fprintf(state->out, "<AverageHeartRateBpm><Value>%u</Value></AverageHeartRateBpm>\n", log_header->heartrate_avg);
+            fprintf(state->out, "<MaximumHeartRateBpm><Value>%u</Value></MaximumHeartRateBpm>\n", log_header->heartrate_max);
+        }
+        fprintf(state->out, "<Intensity>Active</Intensity>\n<TriggerMethod>Manual</TriggerMethod>\n<Track>\n");
+    }
+}
+
+static void export_position(export_state_t *state, ambit_log_sample_t *sample)
+{
+    if (state->format != export_format_gpx || sample->utc_time.year == 0) {
+        return;
+    }
+
+    fprintf(state->out, "<trkpt lat=\"%.7f\" lon=\"%.7f\">", state->latitude/10000000.0, state->longitude/10000000.0);
+    if (state->altitude_valid) {
+        fprintf(state->out, "<ele>%.1f</ele>", state->altitude);
+    }
+    fprintf(state->out, "<time>");
+    export_time(state->out, &sample->utc_time);
+    fprintf(state->out, "</time>");
+    if (state->hr >= 0) {
+        fprintf(state->out, "<extensions><gpxtpx:TrackPointExtension><gpxtpx:hr>%d</gpxtpx:hr></gpxtpx:TrackPointExtension></extensions>", state->hr);
+    }
+    fprintf(state->out, "</trkpt>\n");
+}
+
+static void export_trackpoint(export_state_t *state, ambit_log_sample_t *sample)
+{
+    if (sample->utc_time.year == 0) {
+        return;
+    }
+
+    fprintf(state->out, "<Trackpoint><Time>");
+    export_time(state->out, &sample->utc_time);
+    fprintf(state->out, "</Time>");
+    if (state->position_valid) {
+        fprintf(state->out, "<Position><LatitudeDegrees>%.7f</LatitudeDegrees><LongitudeDegrees>%.7f</LongitudeDegrees></Position>",
+                state->latitude/10000000.0, state->longitude/10000000.0);
+    }
+    if (state->altitude_valid) {
+        fprintf(state->out, "<AltitudeMeters>%.1f</AltitudeMeters>", state->altitude);
+    }
+    if (state->distance_valid) {
+        fprintf(state->out, "<DistanceMeters>%u</DistanceMeters>", state->distance);
+    }
+    if (state->hr >= 0) {
+        fprintf(state->out, "<HeartRateBpm><Value>%d</Value></HeartRateBpm>", state->hr);
+    }
+    fprintf(state->out, "</Trackpoint>\n");
+}
+
+static void export_time(FILE *out, const ambit_date_time_t *utc_time)
+{
+    fprintf(out, "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ", utc_time->year, utc_time->month, utc_time->day,
+            utc_time->hour, utc_time->minute, utc_time->msec/1000, utc_time->msec%1000);
+}
+
+static void export_escaped(FILE *out, const char *string)
+{
+    if (string == NULL) {
+        return;
+    }
+
+    for (; *string != '\0'; string++) {
+        switch (*string) {
+          case '<':
+            fputs("&lt;", out);
+            break;
+          case '>':
+            fputs("&gt;", out);
+            break;
+          case '&':
+            fputs("&amp;", out);
+            break;
+          default:
+            fputc(*string, out);
+            break;
+        }
+    }
+}
@@ -0,0 +1,420 @@
+/*
+ * Replay a recorded sync session through libambit and report throughput
+ * and time spent per phase as JSON. Built from the libambit sources with
+ * the pcapsimulate HID backend and LIBAMBIT_BENCH instrumentation.
+ *
+ * Usage: libambit-bench <capture.pcap>
+ *        libambit-bench --decode [options] <entry.pmem>...
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <libambit.h>
+#include <bench.h>
+#include <pmem20.h>
+
+#define MAX_LOGS 1024
+
+typedef struct phase_result_s {
+    const char *name;
+    uint64_t wall_ns;
+    uint64_t counters[libambit_bench_counter_count];
+    uint64_t allocations;
+} phase_result_t;
+
+typedef struct log_result_s {
+    uint32_t samples;
+    uint64_t allocations;
+} log_result_t;
+
+static void phase_begin(phase_result_t *phase, const char *name);
+static void phase_end(phase_result_t *phase);
+static void print_phase(const phase_result_t *phase, int last);
+static double per_second(uint64_t value, uint64_t ns);
+static void log_push_cb(void *ref, ambit_log_entry_t *log_entry);
+static int decode_main(int argc, char *argv[]);
+static uint8_t *read_dump(const char *path, uint32_t *length);
+static void print_entry(const char *path, const ambit_log_entry_t *log_entry);
+
+/* Allocation counting, the link wraps malloc, calloc and realloc */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static uint64_t allocations = 0;
+static uint64_t log_allocations_mark = 0;
+static log_result_t logs[MAX_LOGS];
+static size_t log_count = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+int main(int argc, char *argv[])
+{
+    ambit_device_info_t *info;
+    ambit_object_t *ambit_object = NULL;
+    ambit_device_status_t status;
+    ambit_personal_settings_t settings;
+    phase_result_t phases[4];
+    size_t phase_count = 0, i;
+    uint64_t samples = 0;
+    int res = 0;
+
+    if (argc >= 2 && strcmp(argv[1], "--decode") == 0) {
+        return decode_main(argc, argv);
+    }
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <capture.pcap>\n", argv[0]);
+        fprintf(stderr, "       %s --decode [--iterations N] [--min-samples-per-second N]\n"
+                        "           [--max-allocations-per-log N] [--print] <entry.pmem>...\n", argv[0]);
+        return 1;
+    }
+    setenv("HIDAPI_PCAPSIMULATE_FILENAME", argv[1], 1);
+
+    phase_begin(&phases[phase_count], "open");
+    info = libambit_enumerate();
+    if (info != NULL && info->access_status == 0) {
+        ambit_object = libambit_new(info);
+    }
+    phase_end(&phases[phase_count++]);
+
+    if (ambit_object == NULL) {
+        fprintf(stderr, "No device found in %s\n", argv[1]);
+        libambit_free_enumeration(info);
+        return 1;
+    }
+
+    phase_begin(&phases[phase_count], "device_status");
+    res |= libambit_device_status_get(ambit_object, &status);
+    phase_end(&phases[phase_count++]);
+
+    phase_begin(&phases[phase_count], "personal_settings");
+    res |= libambit_personal_settings_get(ambit_object, &settings);
+    phase_end(&phases[phase_count++]);
+
+    phase_begin(&phases[phase_count], "log_read");
+    log_allocations_mark = allocations;
+    res |= libambit_log_read(ambit_object, NULL, log_push_cb, NULL, NULL);
+    phase_end(&phases[phase_count++]);
+
+    printf("{\n");
+    printf("  \"capture\": \"%s\",\n", argv[1]);
+    printf("  \"device\": { \"name\": \"%s\", \"serial\": \"%s\", \"fw_version\": \"%d.%d.%d\" },\n",
+           info->name, info->serial, info->fw_version[0], info->fw_version[1], (info->fw_version[2] << 0) | (info->fw_version[3] << 8));
+    printf("  \"success\": %s,\n", res == 0 ? "true" : "false");
+    printf("  \"phases\": [\n");
+    for (i=0; i<phase_count; i++) {
+        print_phase(&phases[i], i == phase_count - 1);
+    }
+    printf("  ],\n");
+    printf("  \"logs\": {\n");
+    printf("    \"count\": %zu,\n", log_count);
+    for (i=0; i<log_count; i++) {
+        samples += logs[i].samples;
+    }
+    printf("    \"samples\": %llu,\n", (unsigned long long)samples);
+    printf("    \"allocations_per_log\": %.1f,\n", log_count > 0 ? (double)(phases[phase_count-1].allocations) / log_count : 0.0);
+    printf("    \"entries\": [");
+    for (i=0; i<log_count; i++) {
+        printf("%s\n      { \"samples\": %u, \"allocations\": %llu }", i > 0 ? "," : "", logs[i].samples, (unsigned long long)logs[i].allocations);
+    }
+    printf("%s]\n", log_count > 0 ? "\n    " : "");
+    printf("  }\n");
+    printf("}\n");
+
+    libambit_close(ambit_object);
+    libambit_free_enumeration(info);
+
+    return res == 0 ? 0 : 1;
+}
+
+static void phase_begin(phase_result_t *phase, const char *name)
+{
+    memset(phase, 0, sizeof(*phase));
+    phase->name = name;
+    memcpy(phase->counters, libambit_bench_counters, sizeof(phase->counters));
+    phase->allocations = allocations;
+    phase->wall_ns = libambit_bench_time_ns();
+}
+
+static void phase_end(phase_result_t *phase)
+{
+    int i;
+
+    phase->wall_ns = libambit_bench_time_ns() - phase->wall_ns;
+    phase->allocations = allocations - phase->allocations;
+    for (i=0; i<libambit_bench_counter_count; i++) {
+        phase->counters[i] = libambit_bench_counters[i] - phase->counters[i];
+    }
+}
+
+static void print_phase(const phase_result_t *phase, int last)
+{
+    const uint64_t *c = phase->counters;
+    uint64_t bytes = c[libambit_bench_bytes_sent] + c[libambit_bench_bytes_received];
+
+    printf("    {\n");
+    printf("      \"name\": \"%s\",\n", phase->name);
+    printf("      \"seconds\": %.6f,\n", phase->wall_ns / 1e9);
+    printf("      \"commands\": %llu,\n", (unsigned long long)c[libambit_bench_commands]);
+    printf("      \"commands_per_second\": %.1f,\n", per_second(c[libambit_bench_commands], phase->wall_ns));
+    printf("      \"bytes_sent\": %llu,\n", (unsigned long long)c[libambit_bench_bytes_sent]);
+    printf("      \"bytes_received\": %llu,\n", (unsigned long long)c[libambit_bench_bytes_received]);
+    printf("      \"bytes_per_second\": %.1f,\n", per_second(bytes, phase->wall_ns));
+    printf("      \"protocol_command_seconds\": %.6f,\n", c[libambit_bench_protocol_command_ns] / 1e9);
+    printf("      \"parse_sample_seconds\": %.6f,\n", c[libambit_bench_parse_sample_ns] / 1e9);
+    printf("      \"correct_samples_seconds\": %.6f,\n", c[libambit_bench_correct_samples_ns] / 1e9);
+    printf("      \"allocations\": %llu\n", (unsigned long long)phase->allocations);
+    printf("    }%s\n", last ? "" : ",");
+}
+
+static double per_second(uint64_t value, uint64_t ns)
+{
+    return ns > 0 ? value * 1e9 / ns : 0.0;
+}
+
+static void log_push_cb(void *ref, ambit_log_entry_t *log_entry)
+{
+    if (log_count < MAX_LOGS) {
+        logs[log_count].samples = log_entry->samples_count;
+        logs[log_count].allocations = allocations - log_allocations_mark;
+        log_count++;
+    }
+    libambit_log_entry_free(log_entry);
+    log_allocations_mark = allocations;
+}
+
+/*
+ * Decode PMEM log entry dumps, the raw bytes of one entry from its entry
+ * header on, without a device or capture. Reports parser throughput and
+ * allocations and the sample memory as decoded and as a compact sample
+ * pack, and fails when below the given limits, so that parser
+ * changes can be gated on a corpus of dumps. --print writes the decoded
+ * entries instead, for comparison with known good output
+ */
+static int decode_main(int argc, char *argv[])
+{
+    int iterations = 10, print = 0, first_file = 0, i, j;
+    double min_samples_per_second = 0, max_allocations_per_log = 0;
+    double samples_per_second, allocations_per_log;
+    uint64_t start, wall_ns = 0, samples = 0, entry_allocations = 0;
+    uint64_t sample_bytes = 0, pack_bytes = 0;
+    uint64_t counters[libambit_bench_counter_count];
+    ambit_log_sample_pack_t *pack;
+    uint32_t k;
+    ambit_log_entry_t *log_entry;
+    uint8_t *dump;
+    uint32_t length;
+    size_t entries = 0;
+    int res = 0;
+
+    for (i=2; i<argc && first_file == 0; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i+1 < argc) {
+            iterations = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--min-samples-per-second") == 0 && i+1 < argc) {
+            min_samples_per_second = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-allocations-per-log") == 0 && i+1 < argc) {
+            max_allocations_per_log = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--print") == 0) {
+            print = 1;
+        }
+        else {
+            first_file = i;
+        }
+    }
+    if (first_file == 0 || iterations < 1) {
+        fprintf(stderr, "No log entry dumps given\n");
+        return 1;
+    }
+
+    memcpy(counters, libambit_bench_counters, sizeof(counters));
+
+    for (i=first_file; i<argc; i++) {
+        if ((dump = read_dump(argv[i], &length)) == NULL) {
+            fprintf(stderr, "Failed to read %s\n", argv[i]);
+            res = 1;
+            continue;
+        }
+
+        for (j=0; j<(print ? 1 : iterations); j++) {
+            uint64_t mark = allocations;
+
+            start = libambit_bench_time_ns();
+            log_entry = libambit_pmem20_log_decode_entry(dump, length);
+            wall_ns += libambit_bench_time_ns() - start;
+
+            if (log_entry == NULL) {
+                fprintf(stderr, "Failed to decode %s\n", argv[i]);
+                res = 1;
+                break;
+            }
+            entry_allocations += allocations - mark;
+            samples += log_entry->samples_count;
+            entries++;
+
+            if (print) {
+                print_entry(argv[i], log_entry);
+            }
+            else if (j == 0) {
+                // Resident sample memory, as decoded and as compact pack
+                sample_bytes += log_entry->samples_count*sizeof(ambit_log_sample_t);
+                for (k=0; k<log_entry->samples_count; k++) {
+                    if (log_entry->samples[k].type == ambit_log_sample_type_periodic) {
+                        sample_bytes += log_entry->samples[k].u.periodic.value_count*sizeof(ambit_log_sample_periodic_value_t);
+                    }
+                    else if (log_entry->samples[k].type == ambit_log_sample_type_gps_base) {
+                        sample_bytes += log_entry->samples[k].u.gps_base.satellites_count*sizeof(ambit_log_gps_satellite_t);
+                    }
+                }
+                if ((pack = libambit_log_sample_pack_new(log_entry)) != NULL) {
+                    pack_bytes += libambit_log_sample_pack_size(pack);
+                    libambit_log_sample_pack_free(pack);
+                }
+            }
+            libambit_log_entry_free(log_entry);
+        }
+
+        free(dump);
+    }
+
+    if (print) {
+        return res;
+    }
+
+    samples_per_second = per_second(samples, wall_ns);
+    allocations_per_log = entries > 0 ? (double)entry_allocations / entries : 0.0;
+
+    printf("{\n");
+    printf("  \"entries\": %zu,\n", entries);
+    printf("  \"samples\": %llu,\n", (unsigned long long)samples);
+    printf("  \"seconds\": %.6f,\n", wall_ns / 1e9);
+    printf("  \"samples_per_second\": %.1f,\n", samples_per_second);
+    printf("  \"parse_sample_seconds\": %.6f,\n", (libambit_bench_counters[libambit_bench_parse_sample_ns] - counters[libambit_bench_parse_sample_ns]) / 1e9);
+    printf("  \"correct_samples_seconds\": %.6f,\n", (libambit_bench_counters[libambit_bench_correct_samples_ns] - counters[libambit_bench_correct_samples_ns]) / 1e9);
+    printf("  \"allocations_per_log\": %.1f,\n", allocations_per_log);
+    printf("  \"sample_bytes\": %llu,\n", (unsigned long long)sample_bytes);
+    printf("  \"sample_pack_bytes\": %llu\n", (unsigned long long)pack_bytes);
+    printf("}\n");
+
+    if (min_samples_per_second > 0 && samples_per_second < min_samples_per_second) {
+        fprintf(stderr, "Decoded %.1f samples/s, less than %.1f\n", samples_per_second, min_samples_per_second);
+        res = 1;
+    }
+    if (max_allocations_per_log > 0 && allocations_per_log > max_allocations_per_log) {
+        fprintf(stderr, "Made %.1f allocations per log, more than %.1f\n", allocations_per_log, max_allocations_per_log);
+        res = 1;
+    }
+
+    return res;
+}
+
+static uint8_t *read_dump(const char *path, uint32_t *length)
+{
+    FILE *file;
+    uint8_t *data = NULL;
+    long size;
+
+    if ((file = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0 &&
+        (data = malloc(size)) != NULL) {
+        if (fread(data, 1, size, file) == (size_t)size) {
+            *length = size;
+        }
+        else {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+
+    return data;
+}
+
+static void print_entry(const char *path, const ambit_log_entry_t *log_entry)
+{
+    const ambit_log_header_t *header = &log_entry->header;
+    const ambit_log_sample_t *sample;
+    const ambit_log_sample_periodic_value_t *value;
+    uint32_t i, j;
+
+    printf("entry %s\n", path);
+    printf("header %04u-%02u-%02u %02u:%02u:%05u duration %u distance %u samples %u hr %u/%u/%u activity %u \"%s\"\n",
+           header->date_time.year, header->date_time.month, header->date_time.day,
+           header->date_time.hour, header->date_time.minute, header->date_time.msec,
+           header->duration, header->distance, header->samples_count,
+           header->heartrate_min, header->heartrate_avg, header->heartrate_max,
+           header->activity_type, header->activity_name != NULL ? header->activity_name : "");
+
+    // Only the fields whose meaning is known, so that the output doesn't
+    // change with the bytes the parser leaves unset
+    for (i=0; i<log_entry->samples_count; i++) {
+        sample = &log_entry->samples[i];
+        printf("sample %u type 0x%04x time %u utc %04u-%02u-%02u %02u:%02u:%05u",
+               i, sample->type, sample->time,
+               sample->utc_time.year, sample->utc_time.month, sample->utc_time.day,
+               sample->utc_time.hour, sample->utc_time.minute, sample->utc_time.msec);
+
+        switch (sample->type) {
+        case ambit_log_sample_type_periodic:
+            for (j=0; j<sample->u.periodic.value_count; j++) {
+                value = &sample->u.periodic.values[j];
+                switch (value->type) {
+                case ambit_log_sample_periodic_type_latitude:
+                    printf(" lat %d", value->u.latitude);
+                    break;
+                case ambit_log_sample_periodic_type_longitude:
+                    printf(" lon %d", value->u.longitude);
+                    break;
+                case ambit_log_sample_periodic_type_distance:
+                    printf(" distance %u", value->u.distance);
+                    break;
+                case ambit_log_sample_periodic_type_speed:
+                    printf(" speed %u", value->u.speed);
+                    break;
+                case ambit_log_sample_periodic_type_hr:
+                    printf(" hr %u", value->u.hr);
+                    break;
+                case ambit_log_sample_periodic_type_altitude:
+                    printf(" altitude %d", value->u.altitude);
+                    break;
+                case ambit_log_sample_periodic_type_cadence:
+                    printf(" cadence %u", value->u.cadence);
+                    break;
+                default:
+                    printf(" 0x%04x", value->type);
+                    break;
+                }
+            }
+            break;
+        case ambit_log_sample_type_gps_base:
+            printf(" lat %d lon %d", sample->u.gps_base.latitude, sample->u.gps_base.longitude);
+            break;
+        case ambit_log_sample_type_lapinfo:
+            printf(" lap 0x%02x duration %u distance %u", sample->u.lapinfo.event_type, sample->u.lapinfo.duration, sample->u.lapinfo.distance);
+            break;
+        default:
+            break;
+        }
+        printf("\n");
+    }
+}
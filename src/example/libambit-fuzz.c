@@ -0,0 +1,33 @@
+/*
+ * libFuzzer entry point for the PMEM log entry parser. Each input is the
+ * raw bytes of one log entry, the same dumps libambit-bench --decode
+ * reads, so a corpus of dumps seeds the fuzzer directly.
+ *
+ * Usage: libambit-fuzz [libFuzzer options] <corpus dir>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <libambit.h>
+#include <pmem20.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    ambit_log_entry_t *log_entry;
+    uint8_t *buffer;
+
+    if (size > UINT32_MAX || (buffer = malloc(size > 0 ? size : 1)) == NULL) {
+        return 0;
+    }
+    memcpy(buffer, data, size);
+
+    // A private copy so that reads past the end are caught by the sanitizer
+    if ((log_entry = libambit_pmem20_log_decode_entry(buffer, size)) != NULL) {
+        libambit_log_entry_order(log_entry);
+        libambit_log_entry_columns(log_entry);
+        libambit_log_entry_free(log_entry);
+    }
+
+    free(buffer);
+
+    return 0;
+}
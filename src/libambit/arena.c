@@ -0,0 +1,126 @@
+/*
+ * (C) Copyright 2014 Emil Ljungdahl
+ *
+ * This file is part of libambit.
+ *
+ * libambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local definitions
+ */
+#define ARENA_ALIGN                   8
+
+typedef struct arena_block_s {
+    struct arena_block_s *next;
+    size_t size;
+    size_t used;
+} arena_block_t;
+
+struct libambit_arena_s {
+    arena_block_t *blocks;                      // Current block first
+    size_t block_size;
+};
+
+/*
+ * Static functions
+ */
+static arena_block_t *block_new(size_t size, arena_block_t *next);
+
+/*
+ * Public functions
+ */
+libambit_arena_t *libambit_arena_new(size_t block_size)
+{
+    libambit_arena_t *arena;
+
+    if ((arena = calloc(1, sizeof(libambit_arena_t))) != NULL) {
+        arena->block_size = block_size;
+    }
+
+    return arena;
+}
+
+void *libambit_arena_alloc(libambit_arena_t *arena, size_t size)
+{
+    arena_block_t *block = arena->blocks;
+    uint8_t *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (block == NULL || block->size - block->used < size) {
+        if (size > arena->block_size / 4) {
+            // Large allocation, give it a block of its own, behind the
+            // current one so that its free space is not lost
+            if ((block = block_new(size, block != NULL ? block->next : NULL)) == NULL) {
+                return NULL;
+            }
+            if (arena->blocks != NULL) {
+                arena->blocks->next = block;
+            }
+            else {
+                arena->blocks = block;
+            }
+        }
+        else {
+            if ((block = block_new(arena->block_size, arena->blocks)) == NULL) {
+                return NULL;
+            }
+            arena->blocks = block;
+        }
+    }
+
+    ptr = (uint8_t*)block + sizeof(arena_block_t) + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void libambit_arena_free(libambit_arena_t *arena)
+{
+    arena_block_t *block, *next;
+
+    if (arena != NULL) {
+        for (block = arena->blocks; block != NULL; block = next) {
+            next = block->next;
+            free(block);
+        }
+        free(arena);
+    }
+}
+
+/*
+ * Static functions implementation
+ */
+static arena_block_t *block_new(size_t size, arena_block_t *next)
+{
+    arena_block_t *block;
+
+    // Header size is a multiple of ARENA_ALIGN on all sane platforms
+    if ((block = malloc(sizeof(arena_block_t) + size)) != NULL) {
+        block->next = next;
+        block->size = size;
+        block->used = 0;
+    }
+
+    return block;
+}
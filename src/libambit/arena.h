@@ -0,0 +1,52 @@
+/*
+ * (C) Copyright 2014 Emil Ljungdahl
+ *
+ * This file is part of libambit.
+ *
+ * libambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include "libambit.h"
+
+#define LIBAMBIT_ARENA_BLOCK_SIZE     0x10000
+
+/**
+ * Create new arena
+ * \param block_size Size of memory blocks to allocate from
+ * \return Arena, or NULL on error
+ */
+libambit_arena_t *libambit_arena_new(size_t block_size);
+
+/**
+ * Allocate zeroed memory from arena. Memory is only released all at once,
+ * with libambit_arena_free()
+ * \param arena Arena to allocate from
+ * \param size Number of bytes
+ * \return Pointer to memory, or NULL on error
+ */
+void *libambit_arena_alloc(libambit_arena_t *arena, size_t size);
+
+/**
+ * Release arena and all memory allocated from it
+ * \param arena Arena to release
+ */
+void libambit_arena_free(libambit_arena_t *arena);
+
+#endif /* __ARENA_H__ */
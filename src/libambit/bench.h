@@ -0,0 +1,62 @@
+/*
+ * (C) Copyright 2014 Emil Ljungdahl
+ *
+ * This file is part of libambit.
+ *
+ * libambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Instrumentation counters, only compiled in when building libambit-bench.
+ * Counters are process global and not thread safe.
+ */
+typedef enum libambit_bench_counter_e {
+    libambit_bench_commands,
+    libambit_bench_bytes_sent,
+    libambit_bench_bytes_received,
+    libambit_bench_protocol_command_ns,
+    libambit_bench_parse_sample_ns,
+    libambit_bench_correct_samples_ns,
+    libambit_bench_counter_count
+} libambit_bench_counter_t;
+
+#ifdef LIBAMBIT_BENCH
+extern uint64_t libambit_bench_counters[libambit_bench_counter_count];
+
+static inline uint64_t libambit_bench_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+#define BENCH_COUNT(counter, value) libambit_bench_counters[counter] += (value)
+#define BENCH_TIMER_START(start) uint64_t start = libambit_bench_time_ns()
+#define BENCH_TIMER_STOP(counter, start) BENCH_COUNT(counter, libambit_bench_time_ns() - start)
+#else
+#define BENCH_COUNT(counter, value)
+#define BENCH_TIMER_START(start)
+#define BENCH_TIMER_STOP(counter, start)
+#endif
+
+#endif /* __BENCH_H__ */
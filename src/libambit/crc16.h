@@ -28,4 +28,14 @@
 uint16_t crc16_ccitt_false(unsigned char *buf, size_t buflen);
 uint16_t crc16_ccitt_false_init(unsigned char *buf, size_t buflen, uint16_t crc);
 
+/**
+ * Copy data and continue CRC calculation over it in the same pass
+ * \param dst Destination buffer
+ * \param src Source buffer
+ * \param len Number of bytes to copy
+ * \param crc CRC value to continue from
+ * \return Updated CRC
+ */
+uint16_t crc16_ccitt_false_copy(unsigned char *dst, const unsigned char *src, size_t len, uint16_t crc);
+
 #endif /* __CRC16_H__ */
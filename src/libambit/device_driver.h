@@ -34,9 +34,15 @@ typedef struct ambit_device_driver_s {
     int (*date_time_set)(ambit_object_t *object, struct tm *tm);
     int (*status_get)(ambit_object_t *object, ambit_device_status_t *status);
     int (*personal_settings_get)(ambit_object_t *object, ambit_personal_settings_t *settings);
-    int (*log_read)(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+    int (*log_read)(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+    int (*log_read_batch)(ambit_object_t *object, ambit_log_select_cb select_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
     int (*gps_orbit_header_read)(ambit_object_t *object, uint8_t data[8]);
     int (*gps_orbit_write)(ambit_object_t *object, uint8_t *data, size_t datalen);
+    int (*log_chunk_size_set)(ambit_object_t *object, uint16_t chunk_size);
+    int (*log_read_benchmark)(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *elapsed);
+    int (*log_cache_size_set)(ambit_object_t *object, uint32_t cache_size);
+    int (*log_pipeline_set)(ambit_object_t *object, uint8_t depth);
+    int (*log_decode_thread_set)(ambit_object_t *object, uint8_t depth);
 } ambit_device_driver_t;
 
 extern ambit_device_driver_t ambit_device_driver_ambit;  // Ambit & Ambit2
@@ -46,9 +46,14 @@ struct ambit_device_driver_data_s {
 static void init(ambit_object_t *object, uint32_t driver_param);
 static void deinit(ambit_object_t *object);
 static int personal_settings_get(ambit_object_t *object, ambit_personal_settings_t *settings);
-static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
 static int gps_orbit_header_read(ambit_object_t *object, uint8_t data[8]);
 static int gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen);
+static int log_chunk_size_set(ambit_object_t *object, uint16_t chunk_size);
+static int log_read_benchmark(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *elapsed);
+static int log_cache_size_set(ambit_object_t *object, uint32_t cache_size);
+static int log_pipeline_set(ambit_object_t *object, uint8_t depth);
+static bool date_time_equal(const ambit_date_time_t *a, const ambit_date_time_t *b);
 
 /*
  * Global variables
@@ -61,8 +66,14 @@ ambit_device_driver_t ambit_device_driver_ambit = {
     libambit_device_driver_status_get,
     personal_settings_get,
     log_read,
+    NULL,
     gps_orbit_header_read,
-    gps_orbit_write
+    gps_orbit_write,
+    log_chunk_size_set,
+    log_read_benchmark,
+    log_cache_size_set,
+    log_pipeline_set,
+    NULL
 };
 
 /*
@@ -109,7 +120,7 @@ static int personal_settings_get(ambit_object_t *object, ambit_personal_settings
     return ret;
 }
 
-static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
 {
     int entries_read = 0;
 
@@ -121,6 +132,12 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
     uint32_t more = 0x00000400;
 
     bool read_pmem = false;
+    bool use_cursor = object->sync_cursor_set && object->sync_cursor_valid && skip_cb != NULL;
+    ambit_log_sync_cursor_t newest;
+    bool newest_valid = false;
+    bool newest_stopped = false;        // An entry failed, later ones are not synced
+    uint32_t entry_address;
+    int next_ret = 0;
 
     ambit_log_header_t log_header;
     ambit_log_entry_t *log_entry;
@@ -147,7 +164,13 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
      * the logs...
      */
 
-    if (skip_cb != NULL) {
+    if (use_cursor) {
+        // Cursor from a previous sync tells where to start in PMEM, the
+        // header walk would only tell us what the cursor already does
+        LOG_INFO("Using sync cursor at address=%08x", object->sync_cursor.address);
+        read_pmem = true;
+    }
+    else if (skip_cb != NULL) {
         LOG_INFO("Look in headers for new logs");
         // Rewind
         if (libambit_protocol_command(object, ambit_command_log_head_first, NULL, 0, &reply_data, &replylen, 0) != 0) {
@@ -214,8 +237,34 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
             return -1;
         }
 
+        if (use_cursor) {
+            use_cursor = false;
+            if (libambit_pmem20_log_seek(&object->driver_data->pmem20, object->sync_cursor.address) == 0 &&
+                libambit_pmem20_log_next_header(&object->driver_data->pmem20, &log_header) == 1) {
+                if (date_time_equal(&log_header.date_time, &object->sync_cursor.date_time)) {
+                    // Entries up to and including the cursor are already synced
+                    use_cursor = true;
+                    newest = object->sync_cursor;
+                    newest_valid = true;
+                }
+                if (log_header.activity_name != NULL) {
+                    free(log_header.activity_name);
+                    log_header.activity_name = NULL;
+                }
+            }
+            if (!use_cursor) {
+                LOG_INFO("Sync cursor no longer valid, walking all entries");
+                if (libambit_pmem20_log_init(&object->driver_data->pmem20, PMEM20_LOG_START, PMEM20_LOG_SIZE) != 0) {
+                    return -1;
+                }
+            }
+        }
+
         // Loop through all log entries, first check headers
-        while (log_entries_walked < log_entries_total && libambit_pmem20_log_next_header(&object->driver_data->pmem20, &log_header) == 1) {
+        while (log_entries_walked < log_entries_total &&
+               !(use_cursor && object->driver_data->pmem20.log.current.current == object->driver_data->pmem20.log.last_entry) &&
+               (next_ret = libambit_pmem20_log_next_header(&object->driver_data->pmem20, &log_header)) == 1) {
+            entry_address = object->driver_data->pmem20.log.current.current;
             LOG_INFO("Reading header of log %d of %d", log_entries_walked + 1, log_entries_total);
             if (progress_cb != NULL) {
                 progress_cb(userref, log_entries_total, log_entries_walked+1, 100*log_entries_walked/log_entries_total);
@@ -223,22 +272,46 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
             // Check if this entry needs to be read
             if (skip_cb == NULL || skip_cb(userref, &log_header) != 0) {
                 LOG_INFO("Reading data of log %d of %d", log_entries_walked + 1, log_entries_total);
-                log_entry = libambit_pmem20_log_read_entry(&object->driver_data->pmem20);
+                if (sample_cb != NULL) {
+                    log_entry = libambit_pmem20_log_read_entry_stream(&object->driver_data->pmem20, sample_cb, userref);
+                }
+                else {
+                    log_entry = libambit_pmem20_log_read_entry(&object->driver_data->pmem20);
+                }
                 if (log_entry != NULL) {
                     if (push_cb != NULL) {
                         push_cb(userref, log_entry);
                     }
+                    else {
+                        newest_stopped = true;
+                    }
                     entries_read++;
                 }
+                else {
+                    newest_stopped = true;
+                }
             }
             else {
                 LOG_INFO("Log %d of %d already exists, skip reading data", log_entries_walked + 1, log_entries_total);
             }
+            // The cursor only moves past entries that are synced
+            if (!newest_stopped) {
+                newest.date_time = log_header.date_time;
+                newest.address = entry_address;
+                newest_valid = true;
+            }
             log_entries_walked++;
             if (progress_cb != NULL) {
                 progress_cb(userref, log_entries_total, log_entries_walked, 100*log_entries_walked/log_entries_total);
             }
         }
+
+        // Only move cursor if all entries were walked successfully, and
+        // then only past the entries synced
+        if (newest_valid && next_ret >= 0) {
+            object->sync_cursor = newest;
+            object->sync_cursor_valid = true;
+        }
     }
 
     LOG_INFO("%d entries read", entries_read);
@@ -268,25 +341,25 @@ static int gps_orbit_header_read(ambit_object_t *object, uint8_t data[8])
 static int gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen)
 {
     uint8_t header[8], cmpheader[8];
+    libambit_pmem20_orbit_hashes_t *hashes = object->orbit_hashes;
     int ret = -1;
 
     LOG_INFO("Writing GPS orbit data");
 
     libambit_protocol_command(object, ambit_command_write_start, NULL, 0, NULL, NULL, 0);
 
-    if (object->driver->gps_orbit_header_read(object, header) == 0) {
-        cmpheader[0] = data[7]; // Year, swap bytes
-        cmpheader[1] = data[6];
-        cmpheader[2] = data[8];
-        cmpheader[3] = data[9];
-        cmpheader[4] = data[13]; // 4 byte swap
-        cmpheader[5] = data[12];
-        cmpheader[6] = data[11];
-        cmpheader[7] = data[10];
-
+    if (libambit_gps_orbit_data_header(data, datalen, cmpheader) == 0 &&
+        object->driver->gps_orbit_header_read(object, header) == 0) {
         // Check if new data differs 
         if (memcmp(header, cmpheader, 8) != 0) {
-            ret = libambit_pmem20_gps_orbit_write(&object->driver_data->pmem20, data, datalen, false);
+            if (hashes != NULL && memcmp(header, hashes->header, 8) != 0) {
+                // Device does not hold what we wrote last time, write all
+                libambit_pmem20_orbit_hashes_clear(hashes);
+            }
+            ret = libambit_pmem20_gps_orbit_write(&object->driver_data->pmem20, data, datalen, false, hashes);
+            if (ret == 0 && hashes != NULL) {
+                memcpy(hashes->header, cmpheader, 8);
+            }
         }
         else {
             LOG_INFO("Current GPS orbit data is already up to date, skipping");
@@ -297,3 +370,28 @@ static int gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen
     return ret;
 }
 
+static int log_chunk_size_set(ambit_object_t *object, uint16_t chunk_size)
+{
+    return libambit_pmem20_set_chunk_size(&object->driver_data->pmem20, chunk_size);
+}
+
+static int log_read_benchmark(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *elapsed)
+{
+    return libambit_pmem20_log_read_benchmark(&object->driver_data->pmem20, PMEM20_LOG_START, PMEM20_LOG_SIZE, chunk_size, length, elapsed);
+}
+
+static int log_cache_size_set(ambit_object_t *object, uint32_t cache_size)
+{
+    return libambit_pmem20_set_cache_size(&object->driver_data->pmem20, cache_size);
+}
+
+static int log_pipeline_set(ambit_object_t *object, uint8_t depth)
+{
+    return libambit_pmem20_set_pipeline_depth(&object->driver_data->pmem20, depth > 0 ? depth : 1);
+}
+
+static bool date_time_equal(const ambit_date_time_t *a, const ambit_date_time_t *b)
+{
+    return a->year == b->year && a->month == b->month && a->day == b->day &&
+           a->hour == b->hour && a->minute == b->minute && a->msec == b->msec;
+}
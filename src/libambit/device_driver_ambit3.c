@@ -29,6 +29,7 @@
 #include "utils.h"
 #include "debug.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +37,8 @@
 /*
  * Local definitions
  */
+#define LOG_DECODE_DEPTH_MAX 8
+
 typedef struct memory_map_entry_s {
     uint32_t start;
     uint32_t size;
@@ -57,6 +60,7 @@ struct ambit_device_driver_data_s {
         memory_map_entry_t event_log;
         memory_map_entry_t ble_pairing;
     } memory_maps;
+    uint8_t log_decode_depth;                       // 0 = decode in reading thread
 };
 
 typedef struct ambit3_log_header_s {
@@ -66,15 +70,46 @@ typedef struct ambit3_log_header_s {
     uint8_t synced;
 } ambit3_log_header_t;
 
+typedef struct log_decode_job_s {
+    uint8_t *buffer;
+    uint32_t length;
+} log_decode_job_t;
+
+typedef struct log_decode_queue_s {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    log_decode_job_t jobs[LOG_DECODE_DEPTH_MAX];
+    size_t depth;
+    size_t first;
+    size_t count;
+    bool done;
+    ambit_log_push_cb push_cb;
+    void *userref;
+    int entries_read;                               // Only valid after join
+} log_decode_queue_t;
+
 /*
  * Static functions
  */
 static void init(ambit_object_t *object, uint32_t driver_param);
 static void deinit(ambit_object_t *object);
 static int personal_settings_get(ambit_object_t *object, ambit_personal_settings_t *settings);
-static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+static int log_read_batch(ambit_object_t *object, ambit_log_select_cb select_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+static int log_read_headers(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_select_cb select_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+static bool *log_select(ambit_object_t *object, libambit_sbem0102_data_t *reply_data_object, ambit_log_select_cb select_cb, void *userref, size_t *count);
 static int gps_orbit_header_read(ambit_object_t *object, uint8_t data[8]);
 static int gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen);
+static int log_chunk_size_set(ambit_object_t *object, uint16_t chunk_size);
+static int log_read_benchmark(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *elapsed);
+static int log_cache_size_set(ambit_object_t *object, uint32_t cache_size);
+static int log_pipeline_set(ambit_object_t *object, uint8_t depth);
+static int log_decode_thread_set(ambit_object_t *object, uint8_t depth);
+static int log_decode_queue_start(log_decode_queue_t *queue, size_t depth, ambit_log_push_cb push_cb, void *userref);
+static void log_decode_queue_put(log_decode_queue_t *queue, uint8_t *buffer, uint32_t length);
+static int log_decode_queue_finish(log_decode_queue_t *queue);
+static void *log_decode_worker(void *arg);
 
 static int parse_log_header(const uint8_t *data, ambit3_log_header_t *log_header);
 static int get_memory_maps(ambit_object_t *object);
@@ -90,8 +125,14 @@ ambit_device_driver_t ambit_device_driver_ambit3 = {
     libambit_device_driver_status_get,
     personal_settings_get,
     log_read,
+    log_read_batch,
     gps_orbit_header_read,
-    gps_orbit_write
+    gps_orbit_write,
+    log_chunk_size_set,
+    log_read_benchmark,
+    log_cache_size_set,
+    log_pipeline_set,
+    log_decode_thread_set
 };
 
 /*
@@ -186,16 +227,38 @@ static int personal_settings_get(ambit_object_t *object, ambit_personal_settings
     return 0;
 }
 
-static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+{
+    return log_read_headers(object, skip_cb, NULL, sample_cb, push_cb, progress_cb, userref);
+}
+
+static int log_read_batch(ambit_object_t *object, ambit_log_select_cb select_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+{
+    return log_read_headers(object, NULL, select_cb, NULL, push_cb, progress_cb, userref);
+}
+
+/**
+ * Read log entries chosen by either skip_cb (per header) or select_cb (all
+ * headers at once)
+ */
+static int log_read_headers(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_select_cb select_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
 {
     int entries_read = 0;
 
     uint16_t log_entries_total = 0;
     uint16_t log_entries_walked = 0;
     uint16_t log_entries_notsynced = 0;
+    uint16_t log_entries_unsynced_seen = 0;
+    bool notsynced_known = false;
+    bool done = false;
 
     ambit3_log_header_t log_header;
     ambit_log_entry_t *log_entry;
+    log_decode_queue_t queue;
+    bool pipelined = false;
+    uint8_t *buffer;
+    bool *selected = NULL;
+    size_t selected_count = 0, header_index = 0;
 
     libambit_sbem0102_data_t send_data_object, reply_data_object;
 
@@ -216,10 +279,27 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
         }
     }
 
+    // All headers are already here, let the application choose among them
+    // before reading anything
+    if (select_cb != NULL) {
+        selected = log_select(object, &reply_data_object, select_cb, userref, &selected_count);
+        libambit_sbem0102_data_reset(&reply_data_object);
+    }
+
     // Initialize PMEM20 log before starting to read logs
     libambit_pmem20_log_init(&object->driver_data->pmem20, object->driver_data->memory_maps.excercise_log.start, object->driver_data->memory_maps.excercise_log.size);
 
-    while (libambit_sbem0102_data_next(&reply_data_object) == 0) {
+    // Decode in a separate thread, so that the device is kept busy
+    if (sample_cb == NULL && object->driver_data->log_decode_depth > 0) {
+        if (log_decode_queue_start(&queue, object->driver_data->log_decode_depth, push_cb, userref) == 0) {
+            pipelined = true;
+        }
+        else {
+            LOG_WARNING("Failed to start log decode thread, decoding in place");
+        }
+    }
+
+    while (!done && libambit_sbem0102_data_next(&reply_data_object) == 0) {
         switch (libambit_sbem0102_data_id(&reply_data_object)) {
           case 0x4e:
             log_entries_total = read16(libambit_sbem0102_data_ptr(&reply_data_object), 0);
@@ -228,13 +308,37 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
           case 0x4f:
             log_entries_notsynced = read16(libambit_sbem0102_data_ptr(&reply_data_object), 0);
             LOG_INFO("Number of logs marked as not syncronized=%d", log_entries_notsynced);
+            notsynced_known = true;
             break;
           case 0x7e:
+            header_index++;
             if (parse_log_header(libambit_sbem0102_data_ptr(&reply_data_object), &log_header) == 0) {
                 LOG_INFO("Log header parsed successfully");
-                if (skip_cb(userref, &log_header.header) != 0) {
+                if (log_header.synced == 0) {
+                    log_entries_unsynced_seen++;
+                }
+                if (object->log_unsynced_only && log_header.synced != 0) {
+                    LOG_INFO("Log entry marked as syncronized, skipping");
+                }
+                else if (select_cb != NULL ? (header_index <= selected_count && selected[header_index-1]) :
+                         (skip_cb == NULL || skip_cb(userref, &log_header.header) != 0)) {
                     LOG_INFO("Reading data of log %d of %d", log_entries_walked + 1, log_entries_total);
-                    log_entry = libambit_pmem20_log_read_entry_address(&object->driver_data->pmem20, log_header.address, log_header.end_address - log_header.address);
+                    if (pipelined) {
+                        buffer = libambit_pmem20_log_fetch_entry_address(&object->driver_data->pmem20, log_header.address, log_header.end_address - log_header.address);
+                        if (buffer != NULL) {
+                            log_decode_queue_put(&queue, buffer, log_header.end_address - log_header.address);
+                        }
+                        else {
+                            LOG_WARNING("Failed to read log %d of %d", log_entries_walked + 1, log_entries_total);
+                        }
+                        log_entry = NULL;
+                    }
+                    else if (sample_cb != NULL) {
+                        log_entry = libambit_pmem20_log_read_entry_address_stream(&object->driver_data->pmem20, log_header.address, log_header.end_address - log_header.address, sample_cb, userref);
+                    }
+                    else {
+                        log_entry = libambit_pmem20_log_read_entry_address(&object->driver_data->pmem20, log_header.address, log_header.end_address - log_header.address);
+                    }
                     if (log_entry != NULL) {
                         if (push_cb != NULL) {
                             push_cb(userref, log_entry);
@@ -253,18 +357,106 @@ static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log
             if (progress_cb != NULL) {
                 progress_cb(userref, log_entries_total, log_entries_walked, 100*log_entries_walked/log_entries_total);
             }
+            if (object->log_unsynced_only && notsynced_known && log_entries_unsynced_seen >= log_entries_notsynced) {
+                LOG_INFO("All logs marked as not syncronized read, skipping the rest");
+                if (progress_cb != NULL && log_entries_walked < log_entries_total) {
+                    progress_cb(userref, log_entries_total, log_entries_total, 100);
+                }
+                done = true;
+            }
             break;
           default:
             break;
         }
     }
 
+    if (pipelined) {
+        entries_read += log_decode_queue_finish(&queue);
+    }
+
     libambit_sbem0102_data_free(&send_data_object);
     libambit_sbem0102_data_free(&reply_data_object);
+    free(selected);
 
     return entries_read;
 }
 
+/**
+ * Parse all log headers of a log headers reply and pass them to select_cb
+ * \param count Set to number of log header elements in reply
+ * \return Per log header element, true if it should be read, or NULL if
+ *         nothing should be read
+ */
+static bool *log_select(ambit_object_t *object, libambit_sbem0102_data_t *reply_data_object, ambit_log_select_cb select_cb, void *userref, size_t *count)
+{
+    ambit3_log_header_t log_header;
+    ambit_log_header_t *headers = NULL, *tmp_headers;
+    size_t *header_elements = NULL, *tmp_elements;
+    size_t element_count = 0, header_count = 0, allocated = 0, i;
+    bool *offered_read = NULL, *selected = NULL;
+    bool failed = false;
+
+    memset(&log_header, 0, sizeof(log_header));
+    *count = 0;
+
+    while (libambit_sbem0102_data_next(reply_data_object) == 0) {
+        if (libambit_sbem0102_data_id(reply_data_object) != 0x7e) {
+            continue;
+        }
+        element_count++;
+        log_header.header.activity_name = NULL;
+        if (parse_log_header(libambit_sbem0102_data_ptr(reply_data_object), &log_header) != 0) {
+            free(log_header.header.activity_name);
+            continue;
+        }
+        // Entries the read would skip anyway are not offered
+        if (object->log_unsynced_only && log_header.synced != 0) {
+            free(log_header.header.activity_name);
+            continue;
+        }
+        if (header_count == allocated) {
+            allocated = (allocated == 0 ? 64 : allocated*2);
+            tmp_headers = realloc(headers, allocated*sizeof(ambit_log_header_t));
+            if (tmp_headers != NULL) {
+                headers = tmp_headers;
+            }
+            tmp_elements = realloc(header_elements, allocated*sizeof(size_t));
+            if (tmp_elements != NULL) {
+                header_elements = tmp_elements;
+            }
+            if (tmp_headers == NULL || tmp_elements == NULL) {
+                free(log_header.header.activity_name);
+                failed = true;
+                break;
+            }
+        }
+        headers[header_count] = log_header.header;
+        header_elements[header_count] = element_count - 1;
+        header_count++;
+    }
+
+    LOG_INFO("Selecting among %d log headers", (int)header_count);
+
+    if (!failed && header_count > 0 &&
+        (offered_read = calloc(header_count, sizeof(bool))) != NULL &&
+        (selected = calloc(element_count, sizeof(bool))) != NULL) {
+        select_cb(userref, headers, header_count, offered_read);
+        for (i=0; i<header_count; i++) {
+            selected[header_elements[i]] = offered_read[i];
+        }
+        *count = element_count;
+    }
+
+    for (i=0; i<header_count; i++) {
+        free(headers[i].activity_name);
+    }
+    free(headers);
+    free(header_elements);
+    free(offered_read);
+
+    return selected;
+}
+
 static int gps_orbit_header_read(ambit_object_t *object, uint8_t data[8])
 {
     uint8_t *reply_data = NULL;
@@ -287,25 +479,25 @@ static int gps_orbit_header_read(ambit_object_t *object, uint8_t data[8])
 static int gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen)
 {
     uint8_t header[8], cmpheader[8];
+    libambit_pmem20_orbit_hashes_t *hashes = object->orbit_hashes;
     int ret = -1;
 
     LOG_INFO("Writing GPS orbit data");
 
     libambit_protocol_command(object, ambit_command_write_start, NULL, 0, NULL, NULL, 0);
 
-    if (object->driver->gps_orbit_header_read(object, header) == 0) {
-        cmpheader[0] = data[7]; // Year, swap bytes
-        cmpheader[1] = data[6];
-        cmpheader[2] = data[8];
-        cmpheader[3] = data[9];
-        cmpheader[4] = data[13]; // 4 byte swap
-        cmpheader[5] = data[12];
-        cmpheader[6] = data[11];
-        cmpheader[7] = data[10];
-
+    if (libambit_gps_orbit_data_header(data, datalen, cmpheader) == 0 &&
+        object->driver->gps_orbit_header_read(object, header) == 0) {
         // Check if new data differs 
         if (memcmp(header, cmpheader, 8) != 0) {
-            ret = libambit_pmem20_gps_orbit_write(&object->driver_data->pmem20, data, datalen, true);
+            if (hashes != NULL && memcmp(header, hashes->header, 8) != 0) {
+                // Device does not hold what we wrote last time, write all
+                libambit_pmem20_orbit_hashes_clear(hashes);
+            }
+            ret = libambit_pmem20_gps_orbit_write(&object->driver_data->pmem20, data, datalen, true, hashes);
+            if (ret == 0 && hashes != NULL) {
+                memcpy(hashes->header, cmpheader, 8);
+            }
         }
         else {
             LOG_INFO("Current GPS orbit data is already up to date, skipping");
@@ -316,6 +508,148 @@ static int gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen
     return ret;
 }
 
+static int log_chunk_size_set(ambit_object_t *object, uint16_t chunk_size)
+{
+    return libambit_pmem20_set_chunk_size(&object->driver_data->pmem20, chunk_size);
+}
+
+static int log_read_benchmark(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *elapsed)
+{
+    if (object->driver_data->memory_maps.initialized == 0) {
+        if (get_memory_maps(object) != 0) {
+            return -1;
+        }
+    }
+
+    return libambit_pmem20_log_read_benchmark(&object->driver_data->pmem20, object->driver_data->memory_maps.excercise_log.start, object->driver_data->memory_maps.excercise_log.size, chunk_size, length, elapsed);
+}
+
+static int log_cache_size_set(ambit_object_t *object, uint32_t cache_size)
+{
+    return libambit_pmem20_set_cache_size(&object->driver_data->pmem20, cache_size);
+}
+
+static int log_pipeline_set(ambit_object_t *object, uint8_t depth)
+{
+    return libambit_pmem20_set_pipeline_depth(&object->driver_data->pmem20, depth > 0 ? depth : 1);
+}
+
+static int log_decode_thread_set(ambit_object_t *object, uint8_t depth)
+{
+    if (depth > LOG_DECODE_DEPTH_MAX) {
+        LOG_WARNING("Invalid log decode queue depth %d (0-%d)", depth, LOG_DECODE_DEPTH_MAX);
+        return -1;
+    }
+
+    object->driver_data->log_decode_depth = depth;
+
+    return 0;
+}
+
+/**
+ * Start log decode thread
+ * \param depth Max number of queued entries
+ * \return 0 on success, else -1
+ */
+static int log_decode_queue_start(log_decode_queue_t *queue, size_t depth, ambit_log_push_cb push_cb, void *userref)
+{
+    memset(queue, 0, sizeof(log_decode_queue_t));
+    queue->depth = depth;
+    queue->push_cb = push_cb;
+    queue->userref = userref;
+
+    if (pthread_mutex_init(&queue->mutex, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_cond_init(&queue->cond, NULL) != 0) {
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+    if (pthread_create(&queue->thread, NULL, log_decode_worker, queue) != 0) {
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->mutex);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Queue raw log entry for decoding, blocks while the queue is full
+ * \param buffer Raw entry data, owned by the queue from now on
+ */
+static void log_decode_queue_put(log_decode_queue_t *queue, uint8_t *buffer, uint32_t length)
+{
+    log_decode_job_t *job;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count >= queue->depth) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    job = &queue->jobs[(queue->first + queue->count) % queue->depth];
+    job->buffer = buffer;
+    job->length = length;
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Wait for all queued entries to be decoded and pushed, and stop thread
+ * \return Number of entries decoded
+ */
+static int log_decode_queue_finish(log_decode_queue_t *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->done = true;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+
+    pthread_join(queue->thread, NULL);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+
+    return queue->entries_read;
+}
+
+static void *log_decode_worker(void *arg)
+{
+    log_decode_queue_t *queue = arg;
+    log_decode_job_t job;
+    ambit_log_entry_t *log_entry;
+
+    while (true) {
+        pthread_mutex_lock(&queue->mutex);
+        while (queue->count == 0 && !queue->done) {
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+        }
+        if (queue->count == 0) {
+            // Done, and nothing left to decode
+            pthread_mutex_unlock(&queue->mutex);
+            break;
+        }
+        job = queue->jobs[queue->first];
+        queue->first = (queue->first + 1) % queue->depth;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->mutex);
+
+        log_entry = libambit_pmem20_log_decode_entry(job.buffer, job.length);
+        free(job.buffer);
+        if (log_entry != NULL) {
+            if (queue->push_cb != NULL) {
+                queue->push_cb(queue->userref, log_entry);
+            }
+            queue->entries_read++;
+        }
+        else {
+            LOG_WARNING("Failed to decode log entry");
+        }
+    }
+
+    return NULL;
+}
+
 static int parse_log_header(const uint8_t *data, ambit3_log_header_t *log_header)
 {
     struct tm tm;
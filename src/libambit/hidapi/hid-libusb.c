@@ -71,11 +71,21 @@ libusb HIDAPI programs are encouraged to use the interface number
 instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
-/* Linked List of input reports received from the device. */
+/* Size of each slot in the input report ring. Full speed interrupt
+   endpoints never deliver more than 64 bytes per transfer. */
+#define INPUT_REPORT_SIZE 64
+
+/* Number of slots in the input report ring. Must be a power of two. */
+#define INPUT_RING_SIZE 64
+
+/* Number of interrupt IN transfers kept in flight simultaneously, so
+   that there is always a transfer queued while one is being handled. */
+#define NUM_READ_TRANSFERS 4
+
+/* Slot of the ring of input reports received from the device. */
 struct input_report {
-	uint8_t *data;
+	uint8_t data[INPUT_REPORT_SIZE];
 	size_t len;
-	struct input_report *next;
 };
 
 
@@ -101,21 +111,30 @@ struct hid_device_ {
 
 	/* Read thread objects */
 	pthread_t thread;
-	pthread_mutex_t mutex; /* Protects input_reports */
+	pthread_mutex_t mutex; /* Only used for blocking waits on condition */
 	pthread_cond_t condition;
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	int shutdown_thread;
 	int cancelled;
-	struct libusb_transfer *transfer;
-
-	/* List of received input reports. */
-	struct input_report *input_reports;
+	int transfers_active;
+	struct libusb_transfer *transfers[NUM_READ_TRANSFERS];
+
+	/* Single producer (read_thread) / single consumer (hid_read()) ring
+	   of received input reports. input_head is only written by the
+	   producer and input_tail only by the consumer; both are free
+	   running and accessed atomically. */
+	struct input_report input_ring[INPUT_RING_SIZE];
+	unsigned int input_head;
+	unsigned int input_tail;
+	unsigned int input_dropped;
+	int reader_waiting; /* Set while hid_read() sleeps on condition */
 };
 
 static libusb_context *usb_context = NULL;
 
 uint16_t get_usb_code_for_current_locale(void);
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static void input_ring_push(hid_device *dev, const uint8_t *data, size_t len);
+static int input_ring_pop(hid_device *dev, unsigned char *data, size_t length);
 
 static hid_device *new_hid_device(void)
 {
@@ -642,54 +661,29 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 	return handle;
 }
 
+static void read_transfer_retired(hid_device *dev)
+{
+	/* Called from read_callback() when a transfer will not be
+	   resubmitted. Once all are gone, read_thread() can finish. */
+	dev->shutdown_thread = 1;
+	if (--dev->transfers_active <= 0)
+		dev->cancelled = 1;
+}
+
 static void read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
 	int res;
 
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
-
-		struct input_report *rpt = malloc(sizeof(*rpt));
-		rpt->data = malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
-
-		pthread_mutex_lock(&dev->mutex);
-
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
-			pthread_cond_signal(&dev->condition);
-		}
-		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
-			}
-			cur->next = rpt;
-
-			/* Pop one off if we've reached 30 in the queue. This
-			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
-			}
-		}
-		pthread_mutex_unlock(&dev->mutex);
+		input_ring_push(dev, transfer->buffer, transfer->actual_length);
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
-		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
+		read_transfer_retired(dev);
 		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
-		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
+		read_transfer_retired(dev);
 		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
@@ -699,12 +693,16 @@ static void read_callback(struct libusb_transfer *transfer)
 		LOG("Unknown transfer code: %d\n", transfer->status);
 	}
 
-	/* Re-submit the transfer object. */
+	/* Re-submit the transfer object. The other transfers in flight keep
+	   the endpoint busy meanwhile. */
+	if (dev->shutdown_thread) {
+		read_transfer_retired(dev);
+		return;
+	}
 	res = libusb_submit_transfer(transfer);
 	if (res != 0) {
 		LOG("Unable to submit URB. libusb error code: %d\n", res);
-		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
+		read_transfer_retired(dev);
 	}
 }
 
@@ -714,22 +712,29 @@ static void *read_thread(void *param)
 	hid_device *dev = param;
 	unsigned char *buf;
 	const size_t length = dev->input_ep_max_packet_size;
+	int i;
 
-	/* Set up the transfer object. */
-	buf = malloc(length);
-	dev->transfer = libusb_alloc_transfer(0);
-	libusb_fill_interrupt_transfer(dev->transfer,
-		dev->device_handle,
-		dev->input_endpoint,
-		buf,
-		length,
-		read_callback,
-		dev,
-		5000/*timeout*/);
-
-	/* Make the first submission. Further submissions are made
-	   from inside read_callback() */
-	libusb_submit_transfer(dev->transfer);
+	/* Set up the transfer objects and make the first submissions.
+	   Further submissions are made from inside read_callback() */
+	for (i = 0; i < NUM_READ_TRANSFERS; i++) {
+		buf = malloc(length);
+		dev->transfers[i] = libusb_alloc_transfer(0);
+		libusb_fill_interrupt_transfer(dev->transfers[i],
+			dev->device_handle,
+			dev->input_endpoint,
+			buf,
+			length,
+			read_callback,
+			dev,
+			5000/*timeout*/);
+
+		if (libusb_submit_transfer(dev->transfers[i]) == 0)
+			dev->transfers_active++;
+	}
+	if (dev->transfers_active == 0) {
+		dev->shutdown_thread = 1;
+		dev->cancelled = 1;
+	}
 
 	/* Notify the main thread that the read thread is up and running. */
 	pthread_barrier_wait(&dev->barrier);
@@ -752,13 +757,18 @@ static void *read_thread(void *param)
 		}
 	}
 
-	/* Cancel any transfer that may be pending. This call will fail
-	   if no transfers are pending, but that's OK. */
-	libusb_cancel_transfer(dev->transfer);
+	/* Cancel any transfers that may be pending. These calls will fail
+	   for transfers which are not pending, but that's OK. */
+	dev->shutdown_thread = 1;
+	for (i = 0; i < NUM_READ_TRANSFERS; i++)
+		libusb_cancel_transfer(dev->transfers[i]);
 
 	while (!dev->cancelled)
 		libusb_handle_events_completed(usb_context, &dev->cancelled);
 
+	if (dev->input_dropped > 0)
+		LOG("read_thread(): dropped %u input reports\n", dev->input_dropped);
+
 	/* Now that the read thread is stopping, Wake any threads which are
 	   waiting on data (in hid_read_timeout()). Do this under a mutex to
 	   make sure that a thread which is about to go to sleep waiting on
@@ -768,9 +778,9 @@ static void *read_thread(void *param)
 	pthread_cond_broadcast(&dev->condition);
 	pthread_mutex_unlock(&dev->mutex);
 
-	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
-	   in hid_close(). They are not cleaned up here because this thread
-	   could end either due to a disconnect or due to a user
+	/* The dev->transfers[]->buffer and dev->transfers[] objects are
+	   cleaned up in hid_close(). They are not cleaned up here because
+	   this thread could end either due to a disconnect or due to a user
 	   call to hid_close(). In both cases the objects can be safely
 	   cleaned up after the call to pthread_join() (in hid_close()), but
 	   since hid_close() calls libusb_cancel_transfer(), on these objects,
@@ -963,19 +973,139 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	}
 }
 
-/* Helper function, to simplify hid_read().
-   This should be called with dev->mutex locked. */
-static int return_data(hid_device *dev, unsigned char *data, size_t length)
+struct write_train {
+	pthread_mutex_t mutex; /* Protects completed */
+	size_t completed;
+};
+
+static void write_train_callback(struct libusb_transfer *transfer)
+{
+	struct write_train *train = transfer->user_data;
+
+	pthread_mutex_lock(&train->mutex);
+	train->completed++;
+	pthread_mutex_unlock(&train->mutex);
+}
+
+int HID_API_EXPORT hid_write_train(hid_device *dev, const unsigned char *data, size_t length, size_t count)
+{
+	struct libusb_transfer **transfers;
+	struct write_train train;
+	struct timeval tv;
+	size_t i, submitted, written = 0;
+	int done = 0;
+
+	if (dev->output_endpoint <= 0 || count == 0 || data[0] == 0x0) {
+		/* Control Endpoint or unnumbered reports, write one by one */
+		for (i = 0; i < count; i++) {
+			if (hid_write(dev, data + i*length, length) != (int)length)
+				break;
+		}
+		return i;
+	}
+
+	transfers = calloc(count, sizeof(*transfers));
+	if (!transfers)
+		return -1;
+
+	pthread_mutex_init(&train.mutex, NULL);
+	train.completed = 0;
+
+	/* Queue all reports on the interrupt out endpoint at once, they are
+	   sent in submission order */
+	for (submitted = 0; submitted < count; submitted++) {
+		transfers[submitted] = libusb_alloc_transfer(0);
+		if (!transfers[submitted])
+			break;
+		libusb_fill_interrupt_transfer(transfers[submitted],
+			dev->device_handle,
+			dev->output_endpoint,
+			(unsigned char *)data + submitted*length,
+			length,
+			write_train_callback,
+			&train,
+			1000/*timeout millis*/);
+		if (libusb_submit_transfer(transfers[submitted]) < 0) {
+			libusb_free_transfer(transfers[submitted]);
+			transfers[submitted] = NULL;
+			break;
+		}
+	}
+
+	/* Wait for all queued transfers. Events might as well be handled by
+	   read_thread(), so only use a short timeout per iteration */
+	while (!done) {
+		pthread_mutex_lock(&train.mutex);
+		done = (train.completed >= submitted);
+		pthread_mutex_unlock(&train.mutex);
+		if (!done) {
+			tv.tv_sec = 0;
+			tv.tv_usec = 100000;
+			libusb_handle_events_timeout_completed(usb_context, &tv, NULL);
+		}
+	}
+
+	/* Count reports written before the first failure */
+	for (i = 0; i < submitted; i++) {
+		if (written == i &&
+		    transfers[i]->status == LIBUSB_TRANSFER_COMPLETED &&
+		    transfers[i]->actual_length == (int)length)
+			written++;
+		libusb_free_transfer(transfers[i]);
+	}
+	free(transfers);
+	pthread_mutex_destroy(&train.mutex);
+
+	return written;
+}
+
+/* Helper function for read_callback(), runs on the read thread (the
+   only producer). If the ring is full the report is dropped: the
+   consumer owns input_tail, so the oldest entry can't be discarded
+   here without a lock. */
+static void input_ring_push(hid_device *dev, const uint8_t *data, size_t len)
+{
+	struct input_report *rpt;
+	unsigned int head = dev->input_head;
+	unsigned int tail = __atomic_load_n(&dev->input_tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= INPUT_RING_SIZE) {
+		dev->input_dropped++;
+		return;
+	}
+
+	rpt = &dev->input_ring[head & (INPUT_RING_SIZE - 1)];
+	rpt->len = (len < INPUT_REPORT_SIZE)? len: INPUT_REPORT_SIZE;
+	memcpy(rpt->data, data, rpt->len);
+
+	/* Publish the slot, then wake the reader only if it is (about to
+	   be) asleep. Both sides use sequentially consistent accesses so
+	   either this thread sees reader_waiting or the reader sees the new
+	   head before going to sleep. */
+	__atomic_store_n(&dev->input_head, head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&dev->reader_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&dev->mutex);
+		pthread_cond_signal(&dev->condition);
+		pthread_mutex_unlock(&dev->mutex);
+	}
+}
+
+/* Helper function, to simplify hid_read(). Only to be called from the
+   consumer side. Returns the report length, or -1 if the ring is empty. */
+static int input_ring_pop(hid_device *dev, unsigned char *data, size_t length)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
+	struct input_report *rpt;
+	size_t len;
+	unsigned int tail = dev->input_tail;
+
+	if (__atomic_load_n(&dev->input_head, __ATOMIC_SEQ_CST) == tail)
+		return -1;
+
+	rpt = &dev->input_ring[tail & (INPUT_RING_SIZE - 1)];
+	len = (length < rpt->len)? length: rpt->len;
 	if (len > 0)
 		memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+	__atomic_store_n(&dev->input_tail, tail + 1, __ATOMIC_RELEASE);
 	return len;
 }
 
@@ -997,33 +1127,38 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return transferred;
 #endif
 
-	pthread_mutex_lock(&dev->mutex);
-	pthread_cleanup_push(&cleanup_mutex, dev);
-
-	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
-		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
-		goto ret;
-	}
+	/* There's an input report queued up. Return it without taking
+	   the mutex. */
+	bytes_read = input_ring_pop(dev, data, length);
+	if (bytes_read >= 0)
+		return bytes_read;
 
 	if (dev->shutdown_thread) {
 		/* This means the device has been disconnected.
 		   An error code of -1 should be returned. */
-		bytes_read = -1;
-		goto ret;
+		return -1;
 	}
 
+	if (milliseconds == 0) {
+		/* Purely non-blocking */
+		return 0;
+	}
+
+	pthread_mutex_lock(&dev->mutex);
+	pthread_cleanup_push(&cleanup_mutex, dev);
+
+	/* Tell read_callback() to signal the condition from now on, then
+	   look at the ring again before sleeping. */
+	__atomic_store_n(&dev->reader_waiting, 1, __ATOMIC_SEQ_CST);
+
 	if (milliseconds == -1) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while ((bytes_read = input_ring_pop(dev, data, length)) < 0 &&
+		       !dev->shutdown_thread) {
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
-		if (dev->input_reports) {
-			bytes_read = return_data(dev, data, length);
-		}
 	}
-	else if (milliseconds > 0) {
+	else {
 		/* Non-blocking, but called with timeout. */
 		int res;
 		struct timespec ts;
@@ -1035,36 +1170,30 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			ts.tv_nsec -= 1000000000L;
 		}
 
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while ((bytes_read = input_ring_pop(dev, data, length)) < 0 &&
+		       !dev->shutdown_thread) {
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
-			if (res == 0) {
-				if (dev->input_reports) {
-					bytes_read = return_data(dev, data, length);
-					break;
-				}
-
-				/* If we're here, there was a spurious wake up
-				   or the read thread was shutdown. Run the
-				   loop again (ie: don't break). */
-			}
-			else if (res == ETIMEDOUT) {
+			if (res == ETIMEDOUT) {
 				/* Timed out. */
-				bytes_read = 0;
+				bytes_read = input_ring_pop(dev, data, length);
+				if (bytes_read < 0)
+					bytes_read = 0;
 				break;
 			}
-			else {
+			else if (res != 0) {
 				/* Error. */
 				bytes_read = -1;
 				break;
 			}
+
+			/* If we're here, there was a wake up for new data,
+			   a spurious wake up or the read thread was shutdown.
+			   Run the loop again (ie: don't break). */
 		}
 	}
-	else {
-		/* Purely non-blocking */
-		bytes_read = 0;
-	}
 
-ret:
+	__atomic_store_n(&dev->reader_waiting, 0, __ATOMIC_SEQ_CST);
+
 	pthread_mutex_unlock(&dev->mutex);
 	pthread_cleanup_pop(0);
 
@@ -1147,19 +1276,24 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
+	int i;
+
 	if (!dev)
 		return;
 
 	/* Cause read_thread() to stop. */
 	dev->shutdown_thread = 1;
-	libusb_cancel_transfer(dev->transfer);
+	for (i = 0; i < NUM_READ_TRANSFERS; i++)
+		libusb_cancel_transfer(dev->transfers[i]);
 
 	/* Wait for read_thread() to end. */
 	pthread_join(dev->thread, NULL);
 
 	/* Clean up the Transfer objects allocated in read_thread(). */
-	free(dev->transfer->buffer);
-	libusb_free_transfer(dev->transfer);
+	for (i = 0; i < NUM_READ_TRANSFERS; i++) {
+		free(dev->transfers[i]->buffer);
+		libusb_free_transfer(dev->transfers[i]);
+	}
 
 	/* release the interface */
 	libusb_release_interface(dev->device_handle, dev->interface);
@@ -1167,13 +1301,6 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Close the handle */
 	libusb_close(dev->device_handle);
 
-	/* Clear out the queue of received reports. */
-	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
-	pthread_mutex_unlock(&dev->mutex);
-
 	free_hid_device(dev);
 }
 
@@ -1215,6 +1342,38 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 }
 
 
+/* The reports arrive through libusb transfers, there is no per device
+   descriptor to wait on */
+int HID_API_EXPORT hid_get_fd(hid_device *dev)
+{
+	return -1;
+}
+
+hid_event_loop * HID_API_EXPORT hid_event_loop_new(void)
+{
+	return NULL;
+}
+
+int HID_API_EXPORT hid_event_loop_add(hid_event_loop *loop, hid_device *dev, hid_read_callback callback, void *userref)
+{
+	return -1;
+}
+
+int HID_API_EXPORT hid_event_loop_remove(hid_event_loop *loop, hid_device *dev)
+{
+	return -1;
+}
+
+int HID_API_EXPORT hid_event_loop_run(hid_event_loop *loop, int milliseconds)
+{
+	return -1;
+}
+
+void HID_API_EXPORT hid_event_loop_free(hid_event_loop *loop)
+{
+}
+
+
 struct lang_map_entry {
 	const char *name;
 	const char *string_code;
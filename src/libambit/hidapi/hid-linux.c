@@ -36,6 +36,7 @@
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -77,6 +78,26 @@ struct hid_device_ {
 	int uses_numbered_reports;
 };
 
+/* Largest report hidraw hands out (HID_MAX_BUFFER_SIZE in the kernel) */
+#define EVENT_LOOP_REPORT_SIZE 4096
+
+/* Number of epoll events fetched per hid_event_loop_run() */
+#define EVENT_LOOP_MAX_EVENTS 16
+
+/* A device registered in an event loop */
+struct hid_event_source {
+	hid_device *dev; /* NULL once removed during dispatch */
+	hid_read_callback callback;
+	void *userref;
+	struct hid_event_source *next;
+};
+
+struct hid_event_loop_ {
+	int epoll_fd;
+	int dispatching;
+	struct hid_event_source *sources;
+};
+
 
 static __u32 kernel_version = 0;
 
@@ -673,10 +694,42 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT hid_write_train(hid_device *dev, const unsigned char *data, size_t length, size_t count)
+{
+	size_t i;
+
+	/* hidraw takes exactly one report per write() */
+	for (i = 0; i < count; i++) {
+		if (hid_write(dev, data + i*length, length) != (int)length)
+			break;
+	}
+
+	return i;
+}
+
+static int read_report(hid_device *dev, unsigned char *data, size_t length)
 {
 	int bytes_read;
 
+	bytes_read = read(dev->device_handle, data, length);
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EINPROGRESS))
+		bytes_read = 0;
+
+	if (bytes_read >= 0 &&
+	    kernel_version != 0 &&
+	    kernel_version < KERNEL_VERSION(2,6,34) &&
+	    dev->uses_numbered_reports) {
+		/* Work around a kernel bug. Chop off the first byte. */
+		memmove(data, data+1, bytes_read);
+		bytes_read--;
+	}
+
+	return bytes_read;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+
 	if (milliseconds >= 0) {
 		/* Milliseconds is either 0 (non-blocking) or > 0 (contains
 		   a valid timeout). In both cases we want to call poll()
@@ -703,20 +756,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		}
 	}
 
-	bytes_read = read(dev->device_handle, data, length);
-	if (bytes_read < 0 && (errno == EAGAIN || errno == EINPROGRESS))
-		bytes_read = 0;
-
-	if (bytes_read >= 0 &&
-	    kernel_version != 0 &&
-	    kernel_version < KERNEL_VERSION(2,6,34) &&
-	    dev->uses_numbered_reports) {
-		/* Work around a kernel bug. Chop off the first byte. */
-		memmove(data, data+1, bytes_read);
-		bytes_read--;
-	}
-
-	return bytes_read;
+	return read_report(dev, data, length);
 }
 
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
@@ -768,6 +808,152 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 }
 
 
+int HID_API_EXPORT hid_get_fd(hid_device *dev)
+{
+	return dev->device_handle;
+}
+
+hid_event_loop * HID_API_EXPORT hid_event_loop_new(void)
+{
+	hid_event_loop *loop = calloc(1, sizeof(hid_event_loop));
+
+	if (loop == NULL)
+		return NULL;
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+int HID_API_EXPORT hid_event_loop_add(hid_event_loop *loop, hid_device *dev, hid_read_callback callback, void *userref)
+{
+	struct hid_event_source *source;
+	struct epoll_event ev;
+
+	source = calloc(1, sizeof(struct hid_event_source));
+	if (source == NULL)
+		return -1;
+
+	source->dev = dev;
+	source->callback = callback;
+	source->userref = userref;
+
+	/* Level triggered, so a device with several reports queued stays
+	   ready until all of them have been dispatched */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, dev->device_handle, &ev) < 0) {
+		free(source);
+		return -1;
+	}
+
+	source->next = loop->sources;
+	loop->sources = source;
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_event_loop_remove(hid_event_loop *loop, hid_device *dev)
+{
+	struct hid_event_source **pp = &loop->sources, *source;
+
+	while (*pp != NULL && (*pp)->dev != dev)
+		pp = &(*pp)->next;
+	if (*pp == NULL || dev == NULL)
+		return -1;
+
+	source = *pp;
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, dev->device_handle, NULL);
+
+	if (loop->dispatching) {
+		/* Pending events may still point at the source, free it
+		   when hid_event_loop_run() is done with them */
+		source->dev = NULL;
+	}
+	else {
+		*pp = source->next;
+		free(source);
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_event_loop_run(hid_event_loop *loop, int milliseconds)
+{
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	unsigned char data[EVENT_LOOP_REPORT_SIZE];
+	struct hid_event_source **pp, *source;
+	int count, i, res, dispatched = 0;
+
+	count = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, milliseconds);
+	if (count < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	loop->dispatching = 1;
+	for (i = 0; i < count; i++) {
+		source = events[i].data.ptr;
+		if (source->dev == NULL)
+			continue;
+
+		res = -1;
+		if (events[i].events & EPOLLIN)
+			res = read_report(source->dev, data, sizeof(data));
+		else if (!(events[i].events & (EPOLLERR | EPOLLHUP)))
+			continue;
+
+		if (res == 0)
+			continue;
+
+		if (res < 0) {
+			/* Disconnected, stop watching before telling */
+			hid_device *dev = source->dev;
+			hid_event_loop_remove(loop, dev);
+			source->callback(dev, NULL, -1, source->userref);
+		}
+		else {
+			source->callback(source->dev, data, res, source->userref);
+		}
+		dispatched++;
+	}
+	loop->dispatching = 0;
+
+	/* Release sources removed during dispatch */
+	pp = &loop->sources;
+	while (*pp != NULL) {
+		source = *pp;
+		if (source->dev == NULL) {
+			*pp = source->next;
+			free(source);
+		}
+		else {
+			pp = &source->next;
+		}
+	}
+
+	return dispatched;
+}
+
+void HID_API_EXPORT hid_event_loop_free(hid_event_loop *loop)
+{
+	struct hid_event_source *source, *next;
+
+	if (!loop)
+		return;
+
+	for (source = loop->sources; source != NULL; source = next) {
+		next = source->next;
+		free(source);
+	}
+	close(loop->epoll_fd);
+	free(loop);
+}
+
+
 int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
 {
 	return get_device_string(dev, DEVICE_STRING_MANUFACTURER, string, maxlen);
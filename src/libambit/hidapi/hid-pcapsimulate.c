@@ -16,13 +16,32 @@
 
 /* Local definitions */
 struct hid_device_ {
-    pcap_t *pcap;
-    char errbuf[PCAP_ERRBUF_SIZE];
+    size_t position;
     uint16_t last_write_command;
     uint16_t last_sequence_number;
     uint8_t reading_parts;
 };
 
+/* A request packet (first part) found in the capture */
+typedef struct capture_request_s {
+    uint16_t command;
+    uint8_t len;
+    uint32_t payload_hash;
+    size_t position;
+} capture_request_t;
+
+/* The HID packets of the capture, read once and shared by all devices.
+ * Requests are indexed by command and payload so that replaying one is a
+ * binary search instead of a scan through the file. */
+typedef struct capture_s {
+    size_t count;
+    u_char (*packets)[64];
+    size_t *next_reply;                 /* First reply start at or after each position */
+    size_t request_count;
+    capture_request_t *by_payload;      /* Sorted on command, len, hash, position */
+    capture_request_t *by_command;      /* Sorted on command, position */
+} capture_t;
+
 typedef struct device_id_mappings_s {
     uint16_t vendor_id;
     uint16_t product_id;
@@ -36,10 +55,15 @@ uint16_t crc16_ccitt_false(unsigned char *buf, size_t buflen);
 uint16_t crc16_ccitt_false_init(unsigned char *buf, size_t buflen, uint16_t crc);
 
 /* Static functions */
-static pcap_t *pcap_file_reopen(pcap_t *old_pcap, char *errbuf);
+static capture_t *capture_load(void);
+static void capture_free(capture_t *capture);
 static const u_char *pcap_file_get_next(pcap_t *pcap);
-static const u_char *pcap_file_find_next_pkt(pcap_t *pcap, uint16_t command, uint8_t recv_not_send, const u_char *data);
-static uint16_t pcap_file_find_next_pkt_reass(pcap_t *pcap, uint16_t command, uint8_t recv_not_send, const u_char *data, u_char **buf);
+static uint32_t payload_hash(const u_char *data, size_t len);
+static int compare_request_payload(const void *a, const void *b);
+static int compare_request_command(const void *a, const void *b);
+static size_t request_lower_bound(const capture_request_t *table, size_t lo, size_t hi, const capture_request_t *key, int (*compare)(const void *, const void *));
+static const capture_request_t *capture_find_request(const capture_t *capture, uint16_t command, const u_char *data, uint8_t len, size_t from);
+static uint16_t capture_reassemble(const capture_t *capture, size_t position, u_char **buf);
 
 static hid_device *new_hid_device(void);
 static wchar_t *utf8_to_wchar_t(const char *utf8);
@@ -56,25 +80,32 @@ static device_id_mappings_t device_id_mapping[] = {
 };
 static const device_id_mappings_t *detected_device = NULL;
 static char *detected_device_serial = NULL;
+static capture_t *capture = NULL;
 
 int HID_API_EXPORT hid_init(void)
 {
-    pcap_t *pcap;
-    char errbuf[PCAP_ERRBUF_SIZE];
-    u_char *pktbuf;
-    uint16_t pktbuf_len;
+    u_char *pktbuf = NULL;
+    uint16_t pktbuf_len = 0;
     char *model_string;
     char *serial_string;
+    size_t pos;
     int i;
 
-    if (detected_device == NULL) {
-        pcap = pcap_file_reopen(NULL, errbuf);
-        if (pcap == NULL) {
+    if (capture == NULL) {
+        capture = capture_load();
+        if (capture == NULL) {
             return -1;
         }
+    }
 
+    if (detected_device == NULL) {
         // Try to find device info in PCAP file
-        pktbuf_len = pcap_file_find_next_pkt_reass(pcap, 0x0002, 1, NULL, &pktbuf);
+        for (pos = capture->next_reply[0]; pos < capture->count; pos = capture->next_reply[pos + 1]) {
+            if (be16toh(*(uint16_t*)(capture->packets[pos] + 8)) == 0x0002) {
+                pktbuf_len = capture_reassemble(capture, pos, &pktbuf);
+                break;
+            }
+        }
 
         if (pktbuf_len > 0) {
             model_string = (char*)pktbuf;
@@ -89,6 +120,7 @@ int HID_API_EXPORT hid_init(void)
                 }
             }
         }
+        free(pktbuf);
     }
 
     return 0;
@@ -96,6 +128,9 @@ int HID_API_EXPORT hid_init(void)
 
 int HID_API_EXPORT hid_exit(void)
 {
+    capture_free(capture);
+    capture = NULL;
+
     return 0;
 }
 
@@ -156,12 +191,8 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 
     hid_init();
 
-    if (detected_device != NULL) {
+    if (detected_device != NULL && capture != NULL) {
         dev = new_hid_device();
-        dev->pcap = pcap_file_reopen(NULL, dev->errbuf);
-        if (dev->pcap == NULL) {
-            return NULL;
-        }
     }
 
     return dev;
@@ -170,7 +201,7 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 
 int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
 {
-    const u_char *pkt;
+    const capture_request_t *request = NULL;
     uint16_t command;
     uint8_t pkt_part;
     uint8_t len;
@@ -183,34 +214,38 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
     // If this is a contineous write, we have to assume this is just fine, do
     // nothing
     if (pkt_part == 0x5d) {
-        // First try, search to end
-        pkt = pcap_file_find_next_pkt(dev->pcap, command, 0, len != 20 ? data + 20 : NULL);
-        if (pkt != NULL) {
-        }
-        // Second try, read from top
-        if (pkt == NULL) {
-            dev->pcap = pcap_file_reopen(dev->pcap, dev->errbuf);
-            pkt = pcap_file_find_next_pkt(dev->pcap, command, 0, len != 20 ? data + 20 : NULL);
-        }
-        if (pkt != NULL) {
-        }
-        // Third try, do not care about data
-        if (pkt == NULL) {
-            dev->pcap = pcap_file_reopen(dev->pcap, dev->errbuf);
-            pkt = pcap_file_find_next_pkt(dev->pcap, command, 0, NULL);
-        }
-        if (pkt != NULL) {
+        // First try the same request after the current position, wrapping
+        // around to the top. Second try, do not care about data, from top.
+        request = capture_find_request(capture, command, len != 20 ? data + 20 : NULL, len, dev->position);
+        if (request == NULL) {
+            request = capture_find_request(capture, command, NULL, len, 0);
         }
+        // Nothing to reply unless the request was found
+        dev->position = request != NULL ? request->position + 1 : capture->count;
 
         dev->last_write_command = command;
         dev->last_sequence_number = le16toh(*(uint16_t*)(data + 14));
         dev->reading_parts = 0;
+
+        return request != NULL ? 0 : -1;
     }
-    
-    return pkt != NULL ? 0 : -1;
+
+    return 0;
 }
 
 
+int HID_API_EXPORT hid_write_train(hid_device *dev, const unsigned char *data, size_t length, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (hid_write(dev, data + i*length, length) != 0)
+            break;
+    }
+
+    return i;
+}
+
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
     const u_char *pkt = NULL;
@@ -219,12 +254,12 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
     // If we have already started to read parts, we should just continue with
     // next valid packet, else we need to resolve first packet
-    if (dev->reading_parts) {
-        pkt = pcap_file_get_next(dev->pcap);
+    if (!dev->reading_parts) {
+        // Skip to next receive packet
+        dev->position = capture->next_reply[dev->position];
     }
-    else {
-        // Search for next receive packet
-        pkt = pcap_file_find_next_pkt(dev->pcap, 0xffff, 1, NULL);
+    if (dev->position < capture->count) {
+        pkt = capture->packets[dev->position++];
     }
 
     if (pkt != NULL) {
@@ -277,7 +312,7 @@ void HID_API_EXPORT hid_close(hid_device *dev)
     if (!dev)
         return;
 
-    pcap_close(dev->pcap);
+    free(dev);
 }
 
 
@@ -307,14 +342,46 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
     return NULL;
 }
 
-static pcap_t *pcap_file_reopen(pcap_t *old_pcap, char *errbuf)
+
+/* Replayed reports are always available, there is nothing to wait on */
+int HID_API_EXPORT hid_get_fd(hid_device *dev)
+{
+    return -1;
+}
+
+hid_event_loop * HID_API_EXPORT hid_event_loop_new(void)
+{
+    return NULL;
+}
+
+int HID_API_EXPORT hid_event_loop_add(hid_event_loop *loop, hid_device *dev, hid_read_callback callback, void *userref)
+{
+    return -1;
+}
+
+int HID_API_EXPORT hid_event_loop_remove(hid_event_loop *loop, hid_device *dev)
+{
+    return -1;
+}
+
+int HID_API_EXPORT hid_event_loop_run(hid_event_loop *loop, int milliseconds)
+{
+    return -1;
+}
+
+void HID_API_EXPORT hid_event_loop_free(hid_event_loop *loop)
+{
+}
+
+static capture_t *capture_load(void)
 {
     char *pcap_file;
+    char errbuf[PCAP_ERRBUF_SIZE];
     pcap_t *pcap = NULL;
-
-    if (old_pcap != NULL) {
-        pcap_close(old_pcap);
-    }
+    capture_t *capture;
+    const u_char *pkt;
+    size_t allocated = 0, i;
+    void *tmp;
 
     pcap_file = getenv("HIDAPI_PCAPSIMULATE_FILENAME");
     if (pcap_file != NULL) {
@@ -327,7 +394,71 @@ static pcap_t *pcap_file_reopen(pcap_t *old_pcap, char *errbuf)
         printf("Error: No HIDAPI_PCAPSIMULATE_FILENAME variable defined\n");
     }
 
-    return pcap;
+    if (pcap == NULL || (capture = calloc(1, sizeof(capture_t))) == NULL) {
+        if (pcap != NULL) {
+            pcap_close(pcap);
+        }
+        return NULL;
+    }
+
+    // Read all HID packets in one pass
+    while ((pkt = pcap_file_get_next(pcap)) != NULL) {
+        if (capture->count == allocated) {
+            allocated = allocated ? 2*allocated : 1024;
+            if ((tmp = realloc(capture->packets, allocated*64)) == NULL) {
+                break;
+            }
+            capture->packets = tmp;
+        }
+        memcpy(capture->packets[capture->count++], pkt, 64);
+    }
+    pcap_close(pcap);
+
+    capture->next_reply = malloc((capture->count + 1)*sizeof(size_t));
+    if (capture->count > 0) {
+        capture->by_payload = malloc(capture->count*sizeof(capture_request_t));
+        capture->by_command = malloc(capture->count*sizeof(capture_request_t));
+    }
+    if (capture->next_reply == NULL || (capture->count > 0 && (capture->by_payload == NULL || capture->by_command == NULL))) {
+        capture_free(capture);
+        return NULL;
+    }
+
+    // Index the first part of each request, and remember where the next
+    // reply starts from every position
+    capture->next_reply[capture->count] = capture->count;
+    for (i = capture->count; i-- > 0; ) {
+        pkt = capture->packets[i];
+        capture->next_reply[i] = capture->next_reply[i + 1];
+        if (pkt[2] == 0x5d) {
+            if ((pkt[10] & 0x03) >> 1) {
+                capture->next_reply[i] = i;
+            }
+            else {
+                capture_request_t *request = &capture->by_payload[capture->request_count++];
+                request->command = be16toh(*(uint16_t*)(pkt + 8));
+                request->len = pkt[1];
+                request->payload_hash = payload_hash(pkt + 20, pkt[1] > 20 ? pkt[1] - 20 : 0);
+                request->position = i;
+            }
+        }
+    }
+    memcpy(capture->by_command, capture->by_payload, capture->request_count*sizeof(capture_request_t));
+    qsort(capture->by_payload, capture->request_count, sizeof(capture_request_t), compare_request_payload);
+    qsort(capture->by_command, capture->request_count, sizeof(capture_request_t), compare_request_command);
+
+    return capture;
+}
+
+static void capture_free(capture_t *capture)
+{
+    if (capture != NULL) {
+        free(capture->packets);
+        free(capture->next_reply);
+        free(capture->by_payload);
+        free(capture->by_command);
+        free(capture);
+    }
 }
 
 static const u_char *pcap_file_get_next(pcap_t *pcap)
@@ -349,66 +480,133 @@ static const u_char *pcap_file_get_next(pcap_t *pcap)
     return NULL;
 }
 
-static const u_char *pcap_file_find_next_pkt(pcap_t *pcap, uint16_t command, uint8_t recv_not_send, const u_char *data)
+static uint32_t payload_hash(const u_char *data, size_t len)
 {
-    const u_char *pktdata;
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    size_t i;
 
-    do {
-        pktdata = pcap_file_get_next(pcap);
-        if (pktdata != NULL) {
-            uint8_t len = pktdata[1];
-            uint8_t pkttype = pktdata[2];
-            uint16_t pktcommand = be16toh(*(uint16_t*)(pktdata + 8));
-            uint8_t send_recv = (pktdata[10] & 0x03) >> 1;
-            if (pkttype == 0x5d &&
-                (command == 0xffff || pktcommand == command) &&
-                send_recv == recv_not_send) {
-                if (data != NULL) {
-                    // Compare data as well
-                    if (memcmp(data, pktdata + 20, len - 20) == 0) {
-                        break;
-                    }
-                }
-                else {
-                    break;
-                }
-            }
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static int compare_request_payload(const void *a, const void *b)
+{
+    const capture_request_t *ra = a, *rb = b;
+
+    if (ra->command != rb->command) {
+        return ra->command < rb->command ? -1 : 1;
+    }
+    if (ra->len != rb->len) {
+        return ra->len < rb->len ? -1 : 1;
+    }
+    if (ra->payload_hash != rb->payload_hash) {
+        return ra->payload_hash < rb->payload_hash ? -1 : 1;
+    }
+    if (ra->position != rb->position) {
+        return ra->position < rb->position ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compare_request_command(const void *a, const void *b)
+{
+    const capture_request_t *ra = a, *rb = b;
+
+    if (ra->command != rb->command) {
+        return ra->command < rb->command ? -1 : 1;
+    }
+    if (ra->position != rb->position) {
+        return ra->position < rb->position ? -1 : 1;
+    }
+    return 0;
+}
+
+static size_t request_lower_bound(const capture_request_t *table, size_t lo, size_t hi, const capture_request_t *key, int (*compare)(const void *, const void *))
+{
+    size_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (compare(&table[mid], key) < 0) {
+            lo = mid + 1;
         }
-    } while(pktdata != NULL);
+        else {
+            hi = mid;
+        }
+    }
 
-    return pktdata;
+    return lo;
 }
 
-static uint16_t pcap_file_find_next_pkt_reass(pcap_t *pcap, uint16_t command, uint8_t recv_not_send, const u_char *data, u_char **buf)
+/**
+ * Find the first request matching command (and payload, if data is given)
+ * at or after from, else the first one from the top of the capture.
+ */
+static const capture_request_t *capture_find_request(const capture_t *capture, uint16_t command, const u_char *data, uint8_t len, size_t from)
 {
-    const u_char *pkt;
+    capture_request_t key;
+    const capture_request_t *table = data != NULL ? capture->by_payload : capture->by_command;
+    int (*compare)(const void *, const void *) = data != NULL ? compare_request_payload : compare_request_command;
+    size_t payload_len = len > 20 ? len - 20 : 0;
+    size_t first, last, start, i;
+
+    key.command = command;
+    key.len = len;
+    key.payload_hash = data != NULL ? payload_hash(data, payload_len) : 0;
+
+    // Range of entries with the same key, and where from falls into it
+    key.position = 0;
+    first = request_lower_bound(table, 0, capture->request_count, &key, compare);
+    key.position = SIZE_MAX;
+    last = request_lower_bound(table, first, capture->request_count, &key, compare);
+    key.position = from;
+    start = request_lower_bound(table, first, last, &key, compare);
+
+    // Hashes may collide, so confirm the payload
+    for (i = start; i < last; i++) {
+        if (data == NULL || memcmp(data, capture->packets[table[i].position] + 20, payload_len) == 0) {
+            return &table[i];
+        }
+    }
+    for (i = first; i < start; i++) {
+        if (data == NULL || memcmp(data, capture->packets[table[i].position] + 20, payload_len) == 0) {
+            return &table[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint16_t capture_reassemble(const capture_t *capture, size_t position, u_char **buf)
+{
+    const u_char *pkt = capture->packets[position];
     u_char *retbuf = NULL;
     uint16_t retlen = 0;
     uint16_t msg_parts, msg_part;
     uint16_t pkts_captured = 1;
 
-    pkt = pcap_file_find_next_pkt(pcap, command, recv_not_send, data);
-
-    if (pkt != NULL) {
-        // Check how many packets this entry should consist of
-        msg_parts = le16toh(*(uint16_t*)(pkt + 4));
-        retlen = le32toh(*(uint32_t*)(pkt + 16));
-        retbuf = malloc(44 + 56*(msg_parts-1));
-
-        if (retbuf != NULL) {
-            memcpy(retbuf, pkt + 20, 44);
-            while (msg_parts > pkts_captured) {
-                pkt = pcap_file_get_next(pcap);
-                if (pkt == NULL) {
-                    free(retbuf);
-                    retbuf = NULL;
-                    retlen = 0;
-                    break;
-                }
-                msg_part = le16toh(*(uint16_t*)(pkt + 4));
-                memcpy(retbuf + 44 + 56*(msg_part-1), pkt + 8, 56);
-                pkts_captured++;
+    // Check how many packets this entry should consist of
+    msg_parts = le16toh(*(uint16_t*)(pkt + 4));
+    retlen = le32toh(*(uint32_t*)(pkt + 16));
+    retbuf = malloc(44 + 56*(msg_parts-1));
+
+    if (retbuf != NULL) {
+        memcpy(retbuf, pkt + 20, 44);
+        while (msg_parts > pkts_captured) {
+            if (++position >= capture->count) {
+                free(retbuf);
+                retbuf = NULL;
+                retlen = 0;
+                break;
             }
+            pkt = capture->packets[position];
+            msg_part = le16toh(*(uint16_t*)(pkt + 4));
+            memcpy(retbuf + 44 + 56*(msg_part-1), pkt + 8, 56);
+            pkts_captured++;
         }
     }
 
@@ -202,6 +202,25 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *device, const unsigned char *data, size_t length);
 
+		/** @brief Write a train of Output reports to a HID device.
+
+			Writes @p count reports of @p length bytes each, stored
+			back to back in @p data[]. Each report follows the same
+			rules as for hid_write(). Backends that can, queue all
+			reports at once instead of waiting for each one.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data The reports to send.
+			@param length The length in bytes of each report.
+			@param count The number of reports to send.
+
+			@returns
+				This function returns the number of leading reports
+				that were completely written, and -1 on error.
+		*/
+		int  HID_API_EXPORT HID_API_CALL hid_write_train(hid_device *device, const unsigned char *data, size_t length, size_t count);
+
 		/** @brief Read an Input report from a HID device with timeout.
 
 			Input reports are returned
@@ -379,6 +398,120 @@ extern "C" {
 		*/
 		HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *device);
 
+		struct hid_event_loop_;
+		typedef struct hid_event_loop_ hid_event_loop; /**< opaque event loop structure */
+
+		/** @brief Callback invoked by hid_event_loop_run() for a device.
+
+			@ingroup API
+			@param device The device the event belongs to.
+			@param data The Input report read from the device, NULL
+				if @p length is -1.
+			@param length The length in bytes of the report, or -1 if
+				the device has been disconnected or failed. In that
+				case the device has already been removed from the
+				event loop when the callback is called.
+			@param userref The pointer given to hid_event_loop_add().
+		*/
+		typedef void (HID_API_CALL *hid_read_callback)(hid_device *device, const unsigned char *data, int length, void *userref);
+
+		/** @brief Get the file descriptor of a HID device.
+
+			The descriptor becomes readable when an Input report is
+			available. It could be handed to an external main loop
+			(e.g. a QSocketNotifier) which then calls hid_read() with
+			a zero timeout. The descriptor is owned by @p device.
+
+			Only the hidraw backend (hid-linux.c) has a descriptor,
+			the libusb and pcapsimulate backends return -1.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns the file descriptor, or -1 if the
+				backend has no pollable descriptor for the device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_fd(hid_device *device);
+
+		/** @brief Create an event loop waiting on several devices.
+
+			An event loop lets one thread service the Input reports
+			of any number of devices, instead of one thread blocking
+			in hid_read() per device.
+
+			The event loop is groundwork only: libambit neither uses
+			it nor exposes it through libambit.h, and openambit still
+			runs one thread per device. Only the hidraw backend
+			(hid-linux.c) implements it, the libusb and pcapsimulate
+			backends return NULL or -1 from all hid_event_loop_*()
+			functions.
+
+			@ingroup API
+
+			@returns
+				This function returns a pointer to the event loop, or
+				NULL if the backend doesn't support event loops.
+		*/
+		HID_API_EXPORT hid_event_loop * HID_API_CALL hid_event_loop_new(void);
+
+		/** @brief Add a device to an event loop.
+
+			@ingroup API
+			@param loop An event loop returned from hid_event_loop_new().
+			@param device A device handle returned from hid_open().
+			@param callback Function called for each Input report read
+				from @p device.
+			@param userref Passed on to @p callback.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_event_loop_add(hid_event_loop *loop, hid_device *device, hid_read_callback callback, void *userref);
+
+		/** @brief Remove a device from an event loop.
+
+			May be called from within a callback. The device must be
+			removed before it is closed.
+
+			@ingroup API
+			@param loop An event loop returned from hid_event_loop_new().
+			@param device A device previously added with
+				hid_event_loop_add().
+
+			@returns
+				This function returns 0 on success and -1 if the device
+				wasn't part of the event loop.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_event_loop_remove(hid_event_loop *loop, hid_device *device);
+
+		/** @brief Wait for and dispatch Input reports.
+
+			Waits until at least one of the devices in @p loop has an
+			Input report available, then reads one report from each
+			ready device and calls its callback.
+
+			@ingroup API
+			@param loop An event loop returned from hid_event_loop_new().
+			@param milliseconds timeout in milliseconds, 0 to only
+				dispatch what is already available, or -1 for
+				blocking wait.
+
+			@returns
+				This function returns the number of callbacks made, 0
+				on timeout and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_event_loop_run(hid_event_loop *loop, int milliseconds);
+
+		/** @brief Free an event loop.
+
+			The devices in the loop are not closed.
+
+			@ingroup API
+			@param loop An event loop returned from hid_event_loop_new().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_event_loop_free(hid_event_loop *loop);
+
 #ifdef __cplusplus
 }
 #endif
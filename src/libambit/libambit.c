@@ -23,11 +23,14 @@
 #include "libambit_int.h"
 #include "device_support.h"
 #include "device_driver.h"
+#include "arena.h"
+#include "pmem20.h"
 #include "protocol.h"
 #include "utils.h"
 #include "debug.h"
 
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +39,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 /*
  * Local definitions
@@ -43,49 +47,118 @@
 #define LIBAMBIT_MODEL_LENGTH    16
 #define LIBAMBIT_SERIAL_LENGTH   16
 
+#define LIBAMBIT_DEVICE_CACHE_ENTRIES        8
+#define LIBAMBIT_CHUNK_SIZE_PROBE_LENGTH     0x8000
+#define SAMPLE_PRESENTATION_RANKS            4    /* see sample_presentation_rank() */
+#define TRACK_EARTH_RADIUS                   6371000.0    /* meters */
+
+typedef struct device_cache_entry_s {
+    char serial[LIBAMBIT_SERIAL_LENGTH+1];
+    uint8_t fw_version[4];
+    unsigned int refs;                              // Open objects of the device
+    uint16_t chunk_size;                            // 0 = not tuned
+    bool sync_cursor_valid;
+    ambit_log_sync_cursor_t sync_cursor;
+    libambit_pmem20_orbit_hashes_t orbit_hashes;    // Written GPS orbit chunks
+    libambit_pmem20_log_resume_t log_resume;        // Log data of interrupted read
+} device_cache_entry_t;
+
+typedef struct select_adapter_s {
+    ambit_log_select_cb select_cb;
+    ambit_log_push_cb push_cb;
+    ambit_log_progress_cb progress_cb;
+    void *userref;
+} select_adapter_t;
+
+typedef struct enumeration_cache_entry_s {
+    char *hid_serial;                               // Serial as reported by HID
+    ambit_device_info_t *device;
+    struct enumeration_cache_entry_s *next;
+} enumeration_cache_entry_t;
+
 /*
  * Static functions
  */
 static int device_info_get(ambit_object_t *object, ambit_device_info_t *info);
 static ambit_device_info_t * ambit_device_info_new(const struct hid_device_info *dev);
+static ambit_device_info_t * ambit_device_info_copy(const ambit_device_info_t *device);
+static ambit_device_info_t * enumerate(bool use_cache);
+static device_cache_entry_t *device_cache_acquire(const ambit_device_info_t *device);
+static void device_cache_release(device_cache_entry_t *entry);
+static void enumeration_cache_free(enumeration_cache_entry_t *entries);
+static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_select_cb select_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+static int select_adapter_skip_cb(void *userref, ambit_log_header_t *log_header);
+static void select_adapter_push_cb(void *userref, ambit_log_entry_t *log_entry);
+static void select_adapter_progress_cb(void *userref, uint16_t log_count, uint16_t log_current, uint8_t progress_percent);
+static int sample_presentation_rank(const ambit_log_sample_t *sample);
+static bool sample_has_columns(const ambit_log_sample_t *sample);
+static int compare_sample_presentation(const void *userref, uint32_t a, uint32_t b);
+static bool sample_track_point(const ambit_log_sample_t *sample, int32_t *latitude, int32_t *longitude, uint32_t *ehpe);
 
 /*
  * Static variables
  */
 static uint8_t komposti_version[] = { 0x02, 0x00, 0x2d, 0x00 };
 
+// Tuned log chunk sizes and sync cursors, per serial and firmware version.
+// Only kept for the lifetime of the process. The mutex guards the entry
+// list and references, and the enumeration cache; entry contents are only
+// used by the objects holding them.
+static device_cache_entry_t device_cache[LIBAMBIT_DEVICE_CACHE_ENTRIES];
+static size_t device_cache_next = 0;
+static pthread_mutex_t device_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Guards the lazily built views of log entries shared between threads,
+// see libambit_log_entry_columns() and libambit_log_entry_order()
+static pthread_mutex_t log_entry_view_mutex = PTHREAD_MUTEX_INITIALIZER;
+static enumeration_cache_entry_t *enumeration_cache = NULL;
+static unsigned int enumeration_cache_generation = 0; // Bumped on invalidation
+
+static const uint16_t chunk_size_candidates[] = { 0x0200, 0x0400, 0x0800, 0x1000 };
+
 /*
  * Public functions
  */
 ambit_device_info_t * libambit_enumerate(void)
 {
-    ambit_device_info_t *devices = NULL;
+    return enumerate(false);
+}
 
-    struct hid_device_info *devs = hid_enumerate(0, 0);
-    struct hid_device_info *current;
+ambit_device_info_t * libambit_enumerate_cached(void)
+{
+    return enumerate(true);
+}
 
-    if (!devs) {
-      LOG_WARNING("HID: no USB HID devices found");
-      return NULL;
-    }
+void libambit_enumerate_invalidate(void)
+{
+    pthread_mutex_lock(&device_cache_mutex);
+    enumeration_cache_free(enumeration_cache);
+    enumeration_cache = NULL;
+    enumeration_cache_generation++;
+    pthread_mutex_unlock(&device_cache_mutex);
+}
 
-    current = devs;
-    while (current) {
-        ambit_device_info_t *tmp = ambit_device_info_new(current);
+void libambit_enumerate_invalidate_path(const char *path)
+{
+    enumeration_cache_entry_t *entry, **entryptr;
 
-        if (tmp) {
-            if (devices) {
-                tmp->next = devices;
-            }
-            else {
-                devices = tmp;
-            }
-        }
-        current = current->next;
+    if (path == NULL) {
+        return;
     }
-    hid_free_enumeration(devs);
 
-    return devices;
+    pthread_mutex_lock(&device_cache_mutex);
+    for (entryptr = &enumeration_cache; *entryptr != NULL; ) {
+        entry = *entryptr;
+        if (strcmp(entry->device->path, path) == 0) {
+            *entryptr = entry->next;
+            entry->next = NULL;
+            enumeration_cache_free(entry);
+        }
+        else {
+            entryptr = &entry->next;
+        }
+    }
+    enumeration_cache_generation++;
+    pthread_mutex_unlock(&device_cache_mutex);
 }
 
 void libambit_free_enumeration(ambit_device_info_t *devices)
@@ -132,6 +205,19 @@ ambit_object_t * libambit_new(const ambit_device_info_t *device)
 
                 // Initialize driver
                 object->driver->init(object, known_device->driver_param);
+
+                // Use previously tuned chunk size and sync cursor, if any
+                object->cache_entry = device_cache_acquire(&object->device_info);
+                if (object->cache_entry != NULL) {
+                    if (object->cache_entry->chunk_size != 0 && object->driver->log_chunk_size_set != NULL) {
+                        LOG_INFO("Using tuned log chunk size %d", object->cache_entry->chunk_size);
+                        object->driver->log_chunk_size_set(object, object->cache_entry->chunk_size);
+                    }
+                    // Only known to libambit_log_sync_cursor_get() until
+                    // the caller sets it
+                    object->sync_cursor_valid = object->cache_entry->sync_cursor_valid;
+                    object->sync_cursor = object->cache_entry->sync_cursor;
+                }
             }
         }
     }
@@ -168,8 +254,17 @@ ambit_object_t * libambit_new_from_pathname(const char* pathname)
 
 void libambit_close(ambit_object_t *object)
 {
+    size_t i;
+
     LOG_INFO("Closing");
     if (object != NULL) {
+        for (i=0; i<object->stats_count; i++) {
+            LOG_INFO("Command 0x%04x: %u calls, %u failures, %u replies, %llu bytes out, %llu bytes in, average %u us, max %u us",
+                     object->stats[i].command, object->stats[i].calls, object->stats[i].failures, object->stats[i].replies,
+                     (unsigned long long)object->stats[i].bytes_out, (unsigned long long)object->stats[i].bytes_in,
+                     object->stats[i].replies > 0 ? (uint32_t)(object->stats[i].latency_total/object->stats[i].replies) : 0,
+                     object->stats[i].latency_max);
+        }
         if (object->driver != NULL) {
             // Make sure to clear log lock (if possible)
             if (object->driver->lock_log != NULL) {
@@ -182,6 +277,8 @@ void libambit_close(ambit_object_t *object)
         if (object->handle != NULL) {
             hid_close(object->handle);
         }
+        libambit_trace_enable(object, 0);
+        device_cache_release(object->cache_entry);
 
         free((char *) object->device_info.path);
         free(object);
@@ -235,6 +332,9 @@ int libambit_personal_settings_get(ambit_object_t *object, ambit_personal_settin
     int ret = -1;
 
     if (object->driver != NULL && object->driver->personal_settings_get != NULL) {
+        // Padding and fields a driver does not set compare equal, so that
+        // settings can be compared and hashed as a whole
+        memset(settings, 0, sizeof(ambit_personal_settings_t));
         ret = object->driver->personal_settings_get(object, settings);
     }
     else {
@@ -258,12 +358,35 @@ int libambit_gps_orbit_header_read(ambit_object_t *object, uint8_t data[8])
     return ret;
 }
 
+int libambit_gps_orbit_data_header(const uint8_t *data, size_t datalen, uint8_t header[8])
+{
+    if (data == NULL || datalen < 14) {
+        return -1;
+    }
+
+    header[0] = data[7]; // Year, swap bytes
+    header[1] = data[6];
+    header[2] = data[8];
+    header[3] = data[9];
+    header[4] = data[13]; // 4 byte swap
+    header[5] = data[12];
+    header[6] = data[11];
+    header[7] = data[10];
+
+    return 0;
+}
+
 int libambit_gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datalen)
 {
     int ret = -1;
 
     if (object->driver != NULL && object->driver->gps_orbit_write != NULL) {
+        // Lets the driver skip chunks that are unchanged since last write
+        if (object->cache_entry != NULL) {
+            object->orbit_hashes = &object->cache_entry->orbit_hashes;
+        }
         ret = object->driver->gps_orbit_write(object, data, datalen);
+        object->orbit_hashes = NULL;
     }
     else {
         LOG_WARNING("Driver does not support gps_orbit_write");
@@ -273,25 +396,622 @@ int libambit_gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datal
 }
 
 int libambit_log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+{
+    return log_read(object, skip_cb, NULL, NULL, push_cb, progress_cb, userref);
+}
+
+int libambit_log_read_batch(ambit_object_t *object, ambit_log_select_cb select_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+{
+    if (select_cb == NULL) {
+        return -1;
+    }
+
+    return log_read(object, NULL, select_cb, NULL, push_cb, progress_cb, userref);
+}
+
+bool libambit_log_read_batch_native(ambit_object_t *object)
+{
+    return object->driver != NULL && object->driver->log_read_batch != NULL;
+}
+
+int libambit_log_read_stream(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+{
+    if (sample_cb == NULL) {
+        return -1;
+    }
+
+    return log_read(object, skip_cb, NULL, sample_cb, push_cb, progress_cb, userref);
+}
+
+int libambit_log_read_benchmark(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *bytes_per_second)
 {
     int ret = -1;
+    uint32_t elapsed = 0;
 
-    if (object->driver != NULL && object->driver->log_read != NULL) {
-        ret = object->driver->log_read(object, skip_cb, push_cb, progress_cb, userref);
+    if (object->driver != NULL && object->driver->log_read_benchmark != NULL) {
+        ret = object->driver->log_read_benchmark(object, chunk_size, length, &elapsed);
+        if (ret == 0 && bytes_per_second != NULL) {
+            *bytes_per_second = (elapsed > 0 ? (uint64_t)length*1000000/elapsed : 0);
+        }
     }
     else {
-        LOG_WARNING("Driver does not support log_read");
+        LOG_WARNING("Driver does not support log_read_benchmark");
+    }
+
+    return ret;
+}
+
+int libambit_log_cache_size_set(ambit_object_t *object, uint32_t cache_size)
+{
+    int ret = -1;
+
+    if (object->driver != NULL && object->driver->log_cache_size_set != NULL) {
+        ret = object->driver->log_cache_size_set(object, cache_size);
+    }
+    else {
+        LOG_WARNING("Driver does not support log_cache_size_set");
+    }
+
+    return ret;
+}
+
+int libambit_log_pipeline_set(ambit_object_t *object, uint8_t depth)
+{
+    int ret = -1;
+
+    if (object->driver != NULL && object->driver->log_pipeline_set != NULL) {
+        ret = object->driver->log_pipeline_set(object, depth);
+    }
+    else {
+        LOG_WARNING("Driver does not support log_pipeline_set");
+    }
+
+    return ret;
+}
+
+int libambit_log_decode_thread_set(ambit_object_t *object, uint8_t depth)
+{
+    int ret = -1;
+
+    if (object->driver != NULL && object->driver->log_decode_thread_set != NULL) {
+        ret = object->driver->log_decode_thread_set(object, depth);
+    }
+    else {
+        LOG_WARNING("Driver does not support log_decode_thread_set");
+    }
+
+    return ret;
+}
+
+int libambit_log_chunk_size_set(ambit_object_t *object, uint16_t chunk_size)
+{
+    int ret = -1;
+
+    if (object->driver != NULL && object->driver->log_chunk_size_set != NULL) {
+        ret = object->driver->log_chunk_size_set(object, chunk_size);
+        if (ret == 0 && object->cache_entry != NULL) {
+            object->cache_entry->chunk_size = chunk_size;
+        }
+    }
+    else {
+        LOG_WARNING("Driver does not support log_chunk_size_set");
     }
 
     return ret;
 }
 
+int libambit_log_chunk_size_tune(ambit_object_t *object)
+{
+    uint32_t rate, best_rate = 0;
+    uint16_t best_chunk_size = 0;
+    int i;
+
+    if (object->driver == NULL || object->driver->log_read_benchmark == NULL ||
+        object->driver->log_chunk_size_set == NULL) {
+        LOG_WARNING("Driver does not support log chunk size tuning");
+        return -1;
+    }
+
+    for (i=0; i<sizeof(chunk_size_candidates)/sizeof(chunk_size_candidates[0]); i++) {
+        if (libambit_log_read_benchmark(object, chunk_size_candidates[i], LIBAMBIT_CHUNK_SIZE_PROBE_LENGTH, &rate) == 0) {
+            LOG_INFO("Chunk size %d: %u bytes/s", chunk_size_candidates[i], rate);
+            if (rate > best_rate) {
+                best_rate = rate;
+                best_chunk_size = chunk_size_candidates[i];
+            }
+        }
+        else if (best_chunk_size != 0) {
+            // Larger chunks than this are not likely to work either
+            LOG_INFO("Chunk size %d failed, not trying larger", chunk_size_candidates[i]);
+            break;
+        }
+    }
+
+    if (best_chunk_size == 0) {
+        LOG_WARNING("No working log chunk size found, keeping default");
+        return -1;
+    }
+
+    // Also remembered for later connections of the same device
+    if (libambit_log_chunk_size_set(object, best_chunk_size) != 0) {
+        return -1;
+    }
+
+    return best_chunk_size;
+}
+
+void libambit_log_sync_cursor_set(ambit_object_t *object, const ambit_log_sync_cursor_t *cursor)
+{
+    if (cursor != NULL) {
+        object->sync_cursor = *cursor;
+        object->sync_cursor_valid = true;
+        object->sync_cursor_set = true;
+    }
+    else {
+        object->sync_cursor_valid = false;
+        object->sync_cursor_set = false;
+    }
+}
+
+void libambit_log_read_unsynced_only(ambit_object_t *object, bool unsynced_only)
+{
+    object->log_unsynced_only = unsynced_only;
+}
+
+int libambit_stats_get(ambit_object_t *object, ambit_command_stats_t *stats, size_t count)
+{
+    if (object == NULL || (stats == NULL && count > 0)) {
+        return -1;
+    }
+
+    if (count > object->stats_count) {
+        count = object->stats_count;
+    }
+    if (count > 0) {
+        memcpy(stats, object->stats, count*sizeof(ambit_command_stats_t));
+    }
+
+    return object->stats_count;
+}
+
+void libambit_stats_reset(ambit_object_t *object)
+{
+    if (object != NULL) {
+        object->stats_count = 0;
+    }
+}
+
+int libambit_log_sync_cursor_get(ambit_object_t *object, ambit_log_sync_cursor_t *cursor)
+{
+    if (!object->sync_cursor_valid) {
+        return -1;
+    }
+
+    *cursor = object->sync_cursor;
+
+    return 0;
+}
+
+void *libambit_log_entry_alloc(ambit_log_entry_t *log_entry, size_t size)
+{
+    if (log_entry->arena == NULL &&
+        (log_entry->arena = libambit_arena_new(LIBAMBIT_ARENA_BLOCK_SIZE)) == NULL) {
+        return NULL;
+    }
+
+    return libambit_arena_alloc(log_entry->arena, size);
+}
+
+ambit_log_entry_t *libambit_log_entry_copy(const ambit_log_entry_t *log_entry)
+{
+    ambit_log_entry_t *copy;
+    ambit_log_sample_t *sample;
+    size_t size;
+    int i;
+
+    if ((copy = malloc(sizeof(ambit_log_entry_t))) == NULL) {
+        return NULL;
+    }
+    memcpy(copy, log_entry, sizeof(ambit_log_entry_t));
+    copy->header.activity_name = NULL;
+    copy->samples = NULL;
+    copy->samples_count = 0;
+    copy->arena = NULL;
+    copy->columns = NULL;
+    copy->order = NULL;
+
+    if (log_entry->header.activity_name != NULL &&
+        (copy->header.activity_name = strdup(log_entry->header.activity_name)) == NULL) {
+        libambit_log_entry_free(copy);
+        return NULL;
+    }
+
+    if (log_entry->samples != NULL) {
+        // All sample data of the copy goes into one arena
+        if ((copy->arena = libambit_arena_new(LIBAMBIT_ARENA_BLOCK_SIZE)) == NULL ||
+            (copy->samples = malloc(sizeof(ambit_log_sample_t)*log_entry->samples_count)) == NULL) {
+            libambit_log_entry_free(copy);
+            return NULL;
+        }
+        memcpy(copy->samples, log_entry->samples, sizeof(ambit_log_sample_t)*log_entry->samples_count);
+        copy->samples_count = log_entry->samples_count;
+
+        for (i=0; i<copy->samples_count; i++) {
+            sample = &copy->samples[i];
+            if (sample->type == ambit_log_sample_type_periodic && sample->u.periodic.values != NULL) {
+                size = sizeof(ambit_log_sample_periodic_value_t)*sample->u.periodic.value_count;
+                if ((sample->u.periodic.values = libambit_arena_alloc(copy->arena, size)) == NULL) {
+                    break;
+                }
+                memcpy(sample->u.periodic.values, log_entry->samples[i].u.periodic.values, size);
+            }
+            if (sample->type == ambit_log_sample_type_gps_base && sample->u.gps_base.satellites != NULL) {
+                size = sizeof(ambit_log_gps_satellite_t)*sample->u.gps_base.satellites_count;
+                if ((sample->u.gps_base.satellites = libambit_arena_alloc(copy->arena, size)) == NULL) {
+                    break;
+                }
+                memcpy(sample->u.gps_base.satellites, log_entry->samples[i].u.gps_base.satellites, size);
+            }
+            if (sample->type == ambit_log_sample_type_unknown && sample->u.unknown.data != NULL) {
+                size = sample->u.unknown.datalen;
+                if ((sample->u.unknown.data = libambit_arena_alloc(copy->arena, size)) == NULL) {
+                    break;
+                }
+                memcpy(sample->u.unknown.data, log_entry->samples[i].u.unknown.data, size);
+            }
+        }
+        if (i < copy->samples_count) {
+            // Sample data is in arena, or still points to the original,
+            // either way it should not be freed one by one
+            libambit_log_entry_free(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+const ambit_log_columns_t *libambit_log_entry_columns(ambit_log_entry_t *log_entry)
+{
+    ambit_log_columns_t *columns;
+    ambit_log_sample_t *sample;
+    ambit_log_sample_periodic_value_t *value;
+    uint32_t count = 0, row, i, j;
+    size_t header_size;
+    uint8_t *data;
+
+    if (log_entry == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&log_entry_view_mutex);
+    columns = log_entry->columns;
+    pthread_mutex_unlock(&log_entry_view_mutex);
+    if (columns != NULL) {
+        return columns;
+    }
+
+    for (i=0; i<log_entry->samples_count; i++) {
+        if (sample_has_columns(&log_entry->samples[i])) {
+            count++;
+        }
+    }
+
+    // Everything in one block, columns ordered by alignment
+    header_size = (sizeof(ambit_log_columns_t) + 7) & ~(size_t)7;
+    if ((columns = calloc(1, header_size + count*(5*sizeof(uint32_t) + 2*sizeof(uint16_t) + 3*sizeof(uint8_t)))) == NULL) {
+        return NULL;
+    }
+    data = (uint8_t*)columns + header_size;
+    columns->count = count;
+    columns->sample_index = (uint32_t*)data; data += count*sizeof(uint32_t);
+    columns->time = (uint32_t*)data;         data += count*sizeof(uint32_t);
+    columns->distance = (uint32_t*)data;     data += count*sizeof(uint32_t);
+    columns->latitude = (int32_t*)data;      data += count*sizeof(int32_t);
+    columns->longitude = (int32_t*)data;     data += count*sizeof(int32_t);
+    columns->altitude = (int16_t*)data;      data += count*sizeof(int16_t);
+    columns->speed = (uint16_t*)data;        data += count*sizeof(uint16_t);
+    columns->hr = data;                      data += count;
+    columns->cadence = data;                 data += count;
+    columns->valid = data;
+
+    for (i=0, row=0; i<log_entry->samples_count; i++) {
+        sample = &log_entry->samples[i];
+        if (!sample_has_columns(sample)) {
+            continue;
+        }
+        columns->sample_index[row] = i;
+        columns->time[row] = sample->time;
+
+        switch (sample->type) {
+          case ambit_log_sample_type_periodic:
+            for (j=0; j<sample->u.periodic.value_count; j++) {
+                value = &sample->u.periodic.values[j];
+                switch (value->type) {
+                  case ambit_log_sample_periodic_type_hr:
+                    if (value->u.hr != 0xff) {
+                        columns->hr[row] = value->u.hr;
+                        columns->valid[row] |= ambit_log_column_hr;
+                    }
+                    break;
+                  case ambit_log_sample_periodic_type_altitude:
+                    columns->altitude[row] = value->u.altitude;
+                    columns->valid[row] |= ambit_log_column_altitude;
+                    break;
+                  case ambit_log_sample_periodic_type_latitude:
+                    columns->latitude[row] = value->u.latitude;
+                    break;
+                  case ambit_log_sample_periodic_type_longitude:
+                    columns->longitude[row] = value->u.longitude;
+                    columns->valid[row] |= ambit_log_column_position;
+                    break;
+                  case ambit_log_sample_periodic_type_speed:
+                    if (value->u.speed != 0xffff) {
+                        columns->speed[row] = value->u.speed;
+                        columns->valid[row] |= ambit_log_column_speed;
+                    }
+                    break;
+                  case ambit_log_sample_periodic_type_cadence:
+                    if (value->u.cadence != 0xff) {
+                        columns->cadence[row] = value->u.cadence;
+                        columns->valid[row] |= ambit_log_column_cadence;
+                    }
+                    break;
+                  case ambit_log_sample_periodic_type_distance:
+                    columns->distance[row] = value->u.distance;
+                    columns->valid[row] |= ambit_log_column_distance;
+                    break;
+                  default:
+                    break;
+                }
+            }
+            break;
+          case ambit_log_sample_type_gps_base:
+            columns->latitude[row] = sample->u.gps_base.latitude;
+            columns->longitude[row] = sample->u.gps_base.longitude;
+            columns->valid[row] |= ambit_log_column_position;
+            break;
+          case ambit_log_sample_type_gps_small:
+            columns->latitude[row] = sample->u.gps_small.latitude;
+            columns->longitude[row] = sample->u.gps_small.longitude;
+            columns->valid[row] |= ambit_log_column_position;
+            break;
+          case ambit_log_sample_type_gps_tiny:
+            columns->latitude[row] = sample->u.gps_tiny.latitude;
+            columns->longitude[row] = sample->u.gps_tiny.longitude;
+            columns->valid[row] |= ambit_log_column_position;
+            break;
+          default:
+            break;
+        }
+        row++;
+    }
+
+    // Built outside the lock, the first one published wins
+    pthread_mutex_lock(&log_entry_view_mutex);
+    if (log_entry->columns == NULL) {
+        log_entry->columns = columns;
+    }
+    else {
+        free(columns);
+        columns = log_entry->columns;
+    }
+    pthread_mutex_unlock(&log_entry_view_mutex);
+
+    return columns;
+}
+
+int libambit_log_entry_sample_order(const ambit_log_entry_t *log_entry, uint32_t *order)
+{
+    const ambit_log_sample_t *samples;
+    uint32_t start, end, i, k;
+    uint32_t rank_count[SAMPLE_PRESENTATION_RANKS];
+    bool ranked, time_ordered = true;
+    int rank;
+
+    if (log_entry == NULL || order == NULL) {
+        return -1;
+    }
+    samples = log_entry->samples;
+
+    for (i=0; i<log_entry->samples_count; i++) {
+        order[i] = i;
+        if (i > 0 && samples[i].time < samples[i-1].time) {
+            time_ordered = false;
+        }
+    }
+
+    if (!time_ordered) {
+        return libambit_stable_order(order, log_entry->samples_count, compare_sample_presentation, samples);
+    }
+
+    // Samples as logged are in time order, only groups of samples with the
+    // same time need ordering, by rank in one counting pass each
+    for (start=0; start<log_entry->samples_count; start=end) {
+        ranked = true;
+        for (end=start+1; end<log_entry->samples_count && samples[end].time == samples[start].time; end++) {
+            if (sample_presentation_rank(&samples[end]) < sample_presentation_rank(&samples[end-1])) {
+                ranked = false;
+            }
+        }
+        if (ranked) {
+            continue;
+        }
+
+        memset(rank_count, 0, sizeof(rank_count));
+        for (i=start; i<end; i++) {
+            rank_count[sample_presentation_rank(&samples[i])]++;
+        }
+        for (rank=0, k=start; rank<SAMPLE_PRESENTATION_RANKS; rank++) {
+            i = rank_count[rank];
+            rank_count[rank] = k;
+            k += i;
+        }
+        for (i=start; i<end; i++) {
+            order[rank_count[sample_presentation_rank(&samples[i])]++] = i;
+        }
+    }
+
+    return 0;
+}
+
+const uint32_t *libambit_log_entry_order(ambit_log_entry_t *log_entry)
+{
+    uint32_t *order;
+
+    if (log_entry == NULL || log_entry->samples_count == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&log_entry_view_mutex);
+    order = log_entry->order;
+    pthread_mutex_unlock(&log_entry_view_mutex);
+    if (order != NULL) {
+        return order;
+    }
+
+    if ((order = malloc(log_entry->samples_count*sizeof(uint32_t))) == NULL) {
+        return NULL;
+    }
+    if (libambit_log_entry_sample_order(log_entry, order) != 0) {
+        free(order);
+        return NULL;
+    }
+
+    // Built outside the lock, the first one published wins
+    pthread_mutex_lock(&log_entry_view_mutex);
+    if (log_entry->order == NULL) {
+        log_entry->order = order;
+    }
+    else {
+        free(order);
+        order = log_entry->order;
+    }
+    pthread_mutex_unlock(&log_entry_view_mutex);
+
+    return order;
+}
+
+int libambit_log_entry_track_simplify(ambit_log_entry_t *log_entry, double tolerance, uint32_t *sample_index)
+{
+    const uint32_t *order;
+    uint32_t count = 0, stack_count, first, last, i, farthest, kept;
+    int32_t latitude, longitude;
+    uint32_t ehpe;
+    double lat0 = 0, scale = 0, dx, dy, len2, t, px, py, dist2, max_dist2, limit;
+    double *x, *y, *error;
+    uint32_t *stack;
+    bool *keep;
+    void *work;
+
+    if (log_entry == NULL || sample_index == NULL || tolerance < 0) {
+        return -1;
+    }
+    if (log_entry->samples_count == 0) {
+        return 0;
+    }
+    if ((order = libambit_log_entry_order(log_entry)) == NULL) {
+        return -1;
+    }
+
+    // Track points are first collected into sample_index
+    for (i=0; i<log_entry->samples_count; i++) {
+        if (sample_track_point(&log_entry->samples[order[i]], &latitude, &longitude, &ehpe)) {
+            sample_index[count++] = order[i];
+        }
+    }
+    if (count <= 2) {
+        return count;
+    }
+
+    // One block for the work arrays, the stack holds at most one range per
+    // point
+    work = malloc(count*(3*sizeof(double) + 2*sizeof(uint32_t) + sizeof(bool)));
+    if (work == NULL) {
+        return -1;
+    }
+    x = work;
+    y = x + count;
+    error = y + count;
+    stack = (uint32_t*)(error + count);
+    keep = (bool*)(stack + 2*count);
+
+    // Equirectangular projection to meters around the first point, exact
+    // enough for the distances a sample interval covers
+    for (i=0; i<count; i++) {
+        sample_track_point(&log_entry->samples[sample_index[i]], &latitude, &longitude, &ehpe);
+        if (i == 0) {
+            lat0 = latitude/10000000.0*M_PI/180.0;
+            scale = TRACK_EARTH_RADIUS*M_PI/180.0/10000000.0;
+        }
+        x[i] = longitude*scale*cos(lat0);
+        y[i] = latitude*scale;
+        error[i] = ehpe/100.0 > tolerance ? ehpe/100.0 : tolerance;
+        keep[i] = false;
+    }
+    keep[0] = keep[count-1] = true;
+
+    stack[0] = 0;
+    stack[1] = count-1;
+    stack_count = 1;
+    while (stack_count > 0) {
+        stack_count--;
+        first = stack[2*stack_count];
+        last = stack[2*stack_count+1];
+
+        dx = x[last] - x[first];
+        dy = y[last] - y[first];
+        len2 = dx*dx + dy*dy;
+        farthest = first;
+        max_dist2 = -1;
+        for (i=first+1; i<last; i++) {
+            // Distance to the segment, or to its start if it has no length
+            t = len2 > 0 ? ((x[i] - x[first])*dx + (y[i] - y[first])*dy)/len2 : 0;
+            t = t < 0 ? 0 : (t > 1 ? 1 : t);
+            px = x[first] + t*dx - x[i];
+            py = y[first] + t*dy - y[i];
+            dist2 = px*px + py*py;
+            limit = error[i]*error[i];
+            if (dist2 > limit && dist2 - limit > max_dist2) {
+                max_dist2 = dist2 - limit;
+                farthest = i;
+            }
+        }
+
+        if (farthest != first) {
+            keep[farthest] = true;
+            if (farthest - first > 1) {
+                stack[2*stack_count] = first;
+                stack[2*stack_count+1] = farthest;
+                stack_count++;
+            }
+            if (last - farthest > 1) {
+                stack[2*stack_count] = farthest;
+                stack[2*stack_count+1] = last;
+                stack_count++;
+            }
+        }
+    }
+
+    for (i=0, kept=0; i<count; i++) {
+        if (keep[i]) {
+            sample_index[kept++] = sample_index[i];
+        }
+    }
+
+    free(work);
+
+    return kept;
+}
+
 void libambit_log_entry_free(ambit_log_entry_t *log_entry)
 {
     int i;
 
     if (log_entry != NULL) {
-        if (log_entry->samples != NULL) {
+        if (log_entry->arena != NULL) {
+            // All sample data released at once
+            libambit_arena_free(log_entry->arena);
+        }
+        else if (log_entry->samples != NULL) {
             for (i=0; i<log_entry->samples_count; i++) {
                 if (log_entry->samples[i].type == ambit_log_sample_type_periodic) {
                     if (log_entry->samples[i].u.periodic.values != NULL) {
@@ -309,8 +1029,16 @@ void libambit_log_entry_free(ambit_log_entry_t *log_entry)
                     }
                 }
             }
+        }
+        if (log_entry->samples != NULL) {
             free(log_entry->samples);
         }
+        if (log_entry->columns != NULL) {
+            free(log_entry->columns);
+        }
+        if (log_entry->order != NULL) {
+            free(log_entry->order);
+        }
         if (log_entry->header.activity_name) {
             free(log_entry->header.activity_name);
         }
@@ -318,6 +1046,283 @@ void libambit_log_entry_free(ambit_log_entry_t *log_entry)
     }
 }
 
+static int log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_select_cb select_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref)
+{
+    int ret = -1;
+
+    select_adapter_t adapter;
+
+    if (object->driver != NULL && object->driver->log_read != NULL) {
+        // Lets the driver continue a read interrupted by a lost connection
+        if (object->cache_entry != NULL) {
+            object->log_resume = &object->cache_entry->log_resume;
+        }
+        if (select_cb == NULL) {
+            ret = object->driver->log_read(object, skip_cb, sample_cb, push_cb, progress_cb, userref);
+        }
+        else if (object->driver->log_read_batch != NULL) {
+            ret = object->driver->log_read_batch(object, select_cb, push_cb, progress_cb, userref);
+        }
+        else {
+            // Headers are only known one at a time, select each on its own
+            adapter.select_cb = select_cb;
+            adapter.push_cb = push_cb;
+            adapter.progress_cb = progress_cb;
+            adapter.userref = userref;
+            ret = object->driver->log_read(object, select_adapter_skip_cb, NULL,
+                                           push_cb != NULL ? select_adapter_push_cb : NULL,
+                                           progress_cb != NULL ? select_adapter_progress_cb : NULL,
+                                           &adapter);
+        }
+        object->log_resume = NULL;
+
+        // Remember how far we got, for later connections of the same device
+        if (ret >= 0 && object->sync_cursor_valid && object->cache_entry != NULL) {
+            object->cache_entry->sync_cursor_valid = true;
+            object->cache_entry->sync_cursor = object->sync_cursor;
+        }
+    }
+    else {
+        LOG_WARNING("Driver does not support log_read");
+    }
+
+    return ret;
+}
+
+static int select_adapter_skip_cb(void *userref, ambit_log_header_t *log_header)
+{
+    select_adapter_t *adapter = (select_adapter_t *)userref;
+    bool read = false;
+
+    adapter->select_cb(adapter->userref, log_header, 1, &read);
+
+    return read ? 1 : 0;
+}
+
+static void select_adapter_push_cb(void *userref, ambit_log_entry_t *log_entry)
+{
+    select_adapter_t *adapter = (select_adapter_t *)userref;
+
+    adapter->push_cb(adapter->userref, log_entry);
+}
+
+static void select_adapter_progress_cb(void *userref, uint16_t log_count, uint16_t log_current, uint8_t progress_percent)
+{
+    select_adapter_t *adapter = (select_adapter_t *)userref;
+
+    adapter->progress_cb(adapter->userref, log_count, log_current, progress_percent);
+}
+
+/**
+ * Get the cache entry of a device, creating it if needed. Entries held by
+ * an object are never replaced.
+ * \return Entry to release with device_cache_release(), or NULL if all
+ *         entries are held
+ */
+static device_cache_entry_t *device_cache_acquire(const ambit_device_info_t *device)
+{
+    device_cache_entry_t *entry = NULL;
+    size_t slot;
+    int i;
+
+    if (device->serial == NULL) {
+        return NULL;
+    }
+
+    // Objects of different devices may be used from separate threads
+    pthread_mutex_lock(&device_cache_mutex);
+
+    for (i=0; i<LIBAMBIT_DEVICE_CACHE_ENTRIES; i++) {
+        if (device_cache[i].serial[0] != 0 &&
+            strncmp(device_cache[i].serial, device->serial, LIBAMBIT_SERIAL_LENGTH) == 0 &&
+            memcmp(device_cache[i].fw_version, device->fw_version, 4) == 0) {
+            entry = &device_cache[i];
+            break;
+        }
+    }
+
+    // Replace oldest entry not held by an object
+    for (i=0; entry == NULL && i<LIBAMBIT_DEVICE_CACHE_ENTRIES; i++) {
+        slot = (device_cache_next + i) % LIBAMBIT_DEVICE_CACHE_ENTRIES;
+        if (device_cache[slot].refs == 0) {
+            entry = &device_cache[slot];
+            device_cache_next = (slot + 1) % LIBAMBIT_DEVICE_CACHE_ENTRIES;
+            libambit_pmem20_orbit_hashes_clear(&entry->orbit_hashes);
+            libambit_pmem20_log_resume_clear(&entry->log_resume);
+            memset(entry, 0, sizeof(*entry));
+            strncpy(entry->serial, device->serial, LIBAMBIT_SERIAL_LENGTH);
+            memcpy(entry->fw_version, device->fw_version, 4);
+        }
+    }
+
+    if (entry != NULL) {
+        entry->refs++;
+    }
+    else {
+        LOG_WARNING("Device cache full, not caching device info");
+    }
+
+    pthread_mutex_unlock(&device_cache_mutex);
+
+    return entry;
+}
+
+static void device_cache_release(device_cache_entry_t *entry)
+{
+    if (entry != NULL) {
+        pthread_mutex_lock(&device_cache_mutex);
+        entry->refs--;
+        pthread_mutex_unlock(&device_cache_mutex);
+    }
+}
+
+/**
+ * Free a list of enumeration cache entries. Does not lock, the caller
+ * either holds device_cache_mutex or owns the list
+ */
+static void enumeration_cache_free(enumeration_cache_entry_t *entries)
+{
+    enumeration_cache_entry_t *entry;
+
+    while (entries != NULL) {
+        entry = entries;
+        entries = entry->next;
+        libambit_free_enumeration(entry->device);
+        free(entry->hid_serial);
+        free(entry);
+    }
+}
+
+static ambit_device_info_t * enumerate(bool use_cache)
+{
+    ambit_device_info_t *devices = NULL, *tmp;
+    enumeration_cache_entry_t *seen = NULL, *entry, **entryptr;
+    char *hid_serial;
+    unsigned int generation = 0;
+
+    struct hid_device_info *devs = hid_enumerate(0, 0);
+    struct hid_device_info *current;
+
+    if (!devs) {
+      LOG_WARNING("HID: no USB HID devices found");
+      if (use_cache) {
+          libambit_enumerate_invalidate();
+      }
+      return NULL;
+    }
+
+    // Clocks are queried without holding the lock, an invalidation in the
+    // meantime then discards what was seen
+    if (use_cache) {
+        pthread_mutex_lock(&device_cache_mutex);
+        generation = enumeration_cache_generation;
+        pthread_mutex_unlock(&device_cache_mutex);
+    }
+
+    current = devs;
+    while (current) {
+        tmp = NULL;
+
+        if (use_cache && current->path != NULL && libambit_device_support_known(current->vendor_id, current->product_id)) {
+            hid_serial = utf8wcsconv(current->serial_number);
+
+            // Look for a cached entry of the same device at the same path,
+            // devices without a HID serial are only known by path
+            pthread_mutex_lock(&device_cache_mutex);
+            for (entryptr = &enumeration_cache; *entryptr != NULL; entryptr = &(*entryptr)->next) {
+                if (strcmp((*entryptr)->device->path, current->path) == 0 &&
+                    (((*entryptr)->hid_serial == NULL && hid_serial == NULL) ||
+                     ((*entryptr)->hid_serial != NULL && hid_serial != NULL &&
+                      strcmp((*entryptr)->hid_serial, hid_serial) == 0))) {
+                    break;
+                }
+            }
+
+            if ((entry = *entryptr) != NULL) {
+                *entryptr = entry->next;
+            }
+            pthread_mutex_unlock(&device_cache_mutex);
+
+            if (entry != NULL) {
+                LOG_INFO("HID  : %s: using cached device info", current->path);
+                tmp = ambit_device_info_copy(entry->device);
+                free(hid_serial);
+            }
+            else if ((tmp = ambit_device_info_new(current)) != NULL &&
+                     tmp->access_status == 0 &&
+                     (entry = calloc(1, sizeof(enumeration_cache_entry_t))) != NULL) {
+                entry->hid_serial = hid_serial;
+                if ((entry->device = ambit_device_info_copy(tmp)) == NULL) {
+                    free(entry->hid_serial);
+                    free(entry);
+                    entry = NULL;
+                }
+            }
+            else {
+                free(hid_serial);
+            }
+
+            // Keep entries of devices still present
+            if (entry != NULL) {
+                entry->next = seen;
+                seen = entry;
+            }
+        }
+        else {
+            tmp = ambit_device_info_new(current);
+        }
+
+        if (tmp) {
+            tmp->next = devices;
+            devices = tmp;
+        }
+        current = current->next;
+    }
+    hid_free_enumeration(devs);
+
+    if (use_cache) {
+        // Anything left in cache was not seen this time
+        pthread_mutex_lock(&device_cache_mutex);
+        enumeration_cache_free(enumeration_cache);
+        if (generation == enumeration_cache_generation) {
+            enumeration_cache = seen;
+        }
+        else {
+            enumeration_cache = NULL;
+            enumeration_cache_free(seen);
+        }
+        pthread_mutex_unlock(&device_cache_mutex);
+    }
+
+    return devices;
+}
+
+static ambit_device_info_t * ambit_device_info_copy(const ambit_device_info_t *device)
+{
+    ambit_device_info_t *copy;
+
+    if ((copy = calloc(1, sizeof(*copy))) == NULL) {
+        return NULL;
+    }
+
+    memcpy(copy, device, sizeof(*copy));
+    copy->name = (device->name != NULL ? strdup(device->name) : NULL);
+    copy->model = (device->model != NULL ? strdup(device->model) : NULL);
+    copy->serial = (device->serial != NULL ? strdup(device->serial) : NULL);
+    copy->path = strdup(device->path);
+    copy->next = NULL;
+
+    if ((device->name != NULL && copy->name == NULL) ||
+        (device->model != NULL && copy->model == NULL) ||
+        (device->serial != NULL && copy->serial == NULL) ||
+        copy->path == NULL) {
+        libambit_free_enumeration(copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
 static int device_info_get(ambit_object_t *object, ambit_device_info_t *info)
 {
     uint8_t *reply_data = NULL;
@@ -437,6 +1442,7 @@ static ambit_device_info_t * ambit_device_info_new(const struct hid_device_info
          */
         char *serial = device->serial;
         ambit_object_t obj;
+        memset(&obj, 0, sizeof(obj));
         obj.handle = hid;
         obj.sequence_no = 0;
         if (0 == device_info_get(&obj, device)) {
@@ -509,3 +1515,70 @@ static ambit_device_info_t * ambit_device_info_new(const struct hid_device_info
 
     return device;
 }
+
+static int sample_presentation_rank(const ambit_log_sample_t *sample)
+{
+    switch (sample->type) {
+      case ambit_log_sample_type_lapinfo:
+        if (sample->u.lapinfo.event_type == 0x1e || sample->u.lapinfo.event_type == 0x1f) {
+            // Start/stop
+            return 0;
+        }
+        return 3;
+      case ambit_log_sample_type_gps_base:
+      case ambit_log_sample_type_gps_small:
+      case ambit_log_sample_type_gps_tiny:
+        return 1;
+      case ambit_log_sample_type_periodic:
+        return 2;
+      default:
+        return 3;
+    }
+}
+
+static int compare_sample_presentation(const void *userref, uint32_t a, uint32_t b)
+{
+    const ambit_log_sample_t *samples = userref;
+
+    if (samples[a].time != samples[b].time) {
+        return (samples[a].time < samples[b].time ? -1 : 1);
+    }
+
+    return sample_presentation_rank(&samples[a]) - sample_presentation_rank(&samples[b]);
+}
+
+static bool sample_has_columns(const ambit_log_sample_t *sample)
+{
+    return (sample->type == ambit_log_sample_type_periodic ||
+            sample->type == ambit_log_sample_type_gps_base ||
+            sample->type == ambit_log_sample_type_gps_small ||
+            sample->type == ambit_log_sample_type_gps_tiny);
+}
+
+static bool sample_track_point(const ambit_log_sample_t *sample, int32_t *latitude, int32_t *longitude, uint32_t *ehpe)
+{
+    switch (sample->type) {
+    case ambit_log_sample_type_gps_base:
+        *latitude = sample->u.gps_base.latitude;
+        *longitude = sample->u.gps_base.longitude;
+        *ehpe = sample->u.gps_base.ehpe;
+        return true;
+    case ambit_log_sample_type_gps_small:
+        *latitude = sample->u.gps_small.latitude;
+        *longitude = sample->u.gps_small.longitude;
+        *ehpe = sample->u.gps_small.ehpe;
+        return true;
+    case ambit_log_sample_type_gps_tiny:
+        *latitude = sample->u.gps_tiny.latitude;
+        *longitude = sample->u.gps_tiny.longitude;
+        *ehpe = sample->u.gps_tiny.ehpe;
+        return true;
+    case ambit_log_sample_type_position:
+        *latitude = sample->u.position.latitude;
+        *longitude = sample->u.position.longitude;
+        *ehpe = 0;
+        return true;
+    default:
+        return false;
+    }
+}
@@ -367,12 +367,72 @@ typedef struct ambit_log_header_s {
     uint8_t  unknown6[24];
 } ambit_log_header_t;
 
+typedef struct libambit_arena_s libambit_arena_t;
+
+typedef enum ambit_log_column_e {
+    ambit_log_column_hr       = 0x01,
+    ambit_log_column_altitude = 0x02,
+    ambit_log_column_position = 0x04,   /* latitude and longitude */
+    ambit_log_column_speed    = 0x08,
+    ambit_log_column_cadence  = 0x10,
+    ambit_log_column_distance = 0x20
+} ambit_log_column_t;
+
+/* Columnar view of the periodic and GPS samples of a log entry, one row
+ * per sample. Values are only set where the corresponding
+ * ambit_log_column_t bit in valid is set. */
+typedef struct ambit_log_columns_s {
+    uint32_t count;                 /* number of rows */
+    uint32_t *sample_index;         /* index into log entry samples */
+    uint32_t *time;                 /* msec */
+    uint32_t *distance;             /* meter */
+    int32_t  *latitude;             /* degree, scale: 0.0000001 */
+    int32_t  *longitude;            /* degree, scale: 0.0000001 */
+    int16_t  *altitude;             /* meters */
+    uint16_t *speed;                /* m/s scale: 0.01 */
+    uint8_t  *hr;                   /* bpm */
+    uint8_t  *cadence;              /* rpm */
+    uint8_t  *valid;                /* ambit_log_column_t bits */
+} ambit_log_columns_t;
+
 typedef struct ambit_log_entry_s {
     ambit_log_header_t header;
     uint32_t samples_count;
     ambit_log_sample_t *samples;
+    libambit_arena_t *arena;        /* owns sample data if set, see libambit_log_entry_alloc() */
+    ambit_log_columns_t *columns;   /* see libambit_log_entry_columns() */
+    uint32_t *order;                /* see libambit_log_entry_order() */
 } ambit_log_entry_t;
 
+/* Compact, read only copy of the samples of a log entry, see
+ * libambit_log_sample_pack_new() */
+typedef struct ambit_log_sample_pack_s ambit_log_sample_pack_t;
+
+#define LIBAMBIT_SAMPLE_PACK_MAX_VALUES 255   /* periodic values per sample */
+
+typedef struct ambit_log_sync_cursor_s {
+    ambit_date_time_t date_time;    /* time of newest synced entry */
+    uint32_t address;               /* device memory address of that entry */
+} ambit_log_sync_cursor_t;
+
+#define LIBAMBIT_STATS_LATENCY_BUCKETS 16
+
+typedef struct ambit_command_stats_s {
+    uint16_t command;               /* protocol command, 0xffff for all commands without a slot of their own */
+    uint32_t calls;                 /* commands sent */
+    uint32_t failures;              /* failed writes, reads or sequence mismatches */
+    uint32_t retries;               /* commands resent after a failure */
+    uint32_t replies;               /* replies received */
+    uint32_t packets_out;
+    uint32_t packets_in;
+    uint64_t bytes_out;             /* payload bytes */
+    uint64_t bytes_in;              /* payload bytes */
+    uint64_t latency_total;         /* us waited for replies */
+    uint32_t latency_max;           /* us */
+    uint32_t latency_histogram[LIBAMBIT_STATS_LATENCY_BUCKETS]; /* bucket n counts replies
+                                       faster than 250 << n us, the last one all slower */
+} ambit_command_stats_t;
+
 /** \brief Create a list of all known Ambit clocks on the system
  *
  *  The list may include clocks that are not supported or cannot be
@@ -380,6 +440,32 @@ typedef struct ambit_log_entry_s {
  */
 ambit_device_info_t * libambit_enumerate(void);
 
+/** \brief Same as libambit_enumerate(), but reuses device info of
+ *  clocks seen before
+ *
+ *  Device info of accessible clocks is cached per HID path and serial,
+ *  so clocks that are still connected are not opened and queried again.
+ *  Clocks that have disappeared are dropped from the cache, and clocks
+ *  at new paths are queried, so hotplug events need no invalidation.
+ *  Use libambit_enumerate_invalidate_path() for a clock that needs to
+ *  be queried again, e.g. after an error.
+ *  The returned list is released with libambit_free_enumeration().
+ */
+ambit_device_info_t * libambit_enumerate_cached(void);
+
+/** \brief Drop all device info cached by libambit_enumerate_cached()
+ *
+ *  Every clock is opened and queried again by the next
+ *  libambit_enumerate_cached(), so this should only be used while no
+ *  clock is open.
+ */
+void libambit_enumerate_invalidate(void);
+
+/** \brief Drop device info cached by libambit_enumerate_cached() for
+ *  one HID path, so that only that clock is queried again
+ */
+void libambit_enumerate_invalidate_path(const char *path);
+
 /** \brief Release resources acquired by libambit_enumerate()
  */
 void libambit_free_enumeration(ambit_device_info_t *devices);
@@ -450,6 +536,17 @@ int libambit_personal_settings_get(ambit_object_t *object, ambit_personal_settin
  */
 int libambit_gps_orbit_header_read(ambit_object_t *object, uint8_t data[8]);
 
+/**
+ * Get the header that the device reports once the given GPS orbit data
+ * has been written, to compare with libambit_gps_orbit_header_read
+ * without a write.
+ * \param data Orbit data as written by libambit_gps_orbit_write
+ * \param datalen Length of data
+ * \param header Header data, same byte order as the one read
+ * \return 0 on success, -1 if data is too short
+ */
+int libambit_gps_orbit_data_header(const uint8_t *data, size_t datalen, uint8_t header[8]);
+
 /**
  * Write GPS orbit data
  * \param object Object to get settings from
@@ -468,6 +565,17 @@ int libambit_gps_orbit_write(ambit_object_t *object, uint8_t *data, size_t datal
  */
 typedef int (*ambit_log_skip_cb)(void *userref, ambit_log_header_t *log_header);
 
+/**
+ * Callback function for choosing which log entries to read out, given the
+ * headers of all entries on the device at once
+ * \param userref User reference
+ * \param log_headers Headers of log entries, only valid during the call
+ * \param count Number of headers
+ * \param read Set read[i] to true for each entry that should be read out,
+ * all entries are false on entry
+ */
+typedef void (*ambit_log_select_cb)(void *userref, ambit_log_header_t *log_headers, size_t count, bool *read);
+
 /**
  * Callback function to push log entry to calling application
  * \param object Object reference
@@ -476,6 +584,14 @@ typedef int (*ambit_log_skip_cb)(void *userref, ambit_log_header_t *log_header);
  */
 typedef void (*ambit_log_push_cb)(void *userref, ambit_log_entry_t *log_entry);
 
+/**
+ * Callback function for samples of a log entry being read
+ * \param object Object reference
+ * \param log_header Header of log entry the sample belongs to
+ * \param sample Sample, only valid during the call
+ */
+typedef void (*ambit_log_sample_cb)(void *userref, ambit_log_header_t *log_header, ambit_log_sample_t *sample);
+
 /**
  * Callback function to notify about progress
  * \param object Object reference
@@ -497,6 +613,328 @@ typedef void (*ambit_log_progress_cb)(void *userref, uint16_t log_count, uint16_
  */
 int libambit_log_read(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
 
+/**
+ * Read log of all excercises from device like libambit_log_read(), but
+ * let the application choose entries from the full list of headers before
+ * any entry is read. Devices that only provide headers one by one during
+ * the read (Ambit and Ambit2) call select_cb once per header instead, see
+ * libambit_log_read_batch_native().
+ * \param object Object reference
+ * \param select_cb Callback choosing the entries to read
+ * \param push_cb Callback to use for pushing read out entry to caller.
+ * \return Number of entries read, or -1 on error
+ * \note Caller is responsible of freeing log entries with
+ * libambit_log_entry_free()
+ */
+int libambit_log_read_batch(ambit_object_t *object, ambit_log_select_cb select_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+
+/**
+ * Check if libambit_log_read_batch() passes all headers to select_cb at
+ * once, before any device command of the log read. Otherwise select_cb is
+ * called in the middle of the header walk, and must not use the device.
+ * \param object Object reference
+ * \return true if the device lists all headers at once
+ */
+bool libambit_log_read_batch_native(ambit_object_t *object);
+
+/**
+ * Read log of all excercises from device like libambit_log_read(), but
+ * pass samples on as they are parsed instead of collecting them in the
+ * log entry. Samples are ordered and corrected within a window of a few
+ * hundred samples, so samples early in a log may lack corrections (UTC
+ * time, altitude offset) that depend on much later samples.
+ * \param object Object reference
+ * \param skip_cb Callback to be used to check if a specific entry should read
+ * or skipped. Use NULL to get all entries.
+ * \param sample_cb Callback to pass samples to
+ * \param push_cb Callback to use for pushing read out entry to caller, after
+ * all its samples. The entry only holds the header, samples_count is 0.
+ * \return Number of entries read, or -1 on error
+ * \note Caller is responsible of freeing log entries with
+ * libambit_log_entry_free()
+ */
+int libambit_log_read_stream(ambit_object_t *object, ambit_log_skip_cb skip_cb, ambit_log_sample_cb sample_cb, ambit_log_push_cb push_cb, ambit_log_progress_cb progress_cb, void *userref);
+
+/**
+ * Measure log read throughput with the given chunk size. The current
+ * log read state and chunk size is left untouched.
+ * \param object Object reference
+ * \param chunk_size Chunk size to use for reads
+ * \param length Number of bytes to read
+ * \param bytes_per_second Measured throughput
+ * \return 0 on success, else -1
+ */
+int libambit_log_read_benchmark(ambit_object_t *object, uint16_t chunk_size, uint32_t length, uint32_t *bytes_per_second);
+
+/**
+ * Limit memory used for log data read from the device. Log data is read
+ * in chunks, and the least recently used chunks are dropped when the
+ * limit is reached. A few chunks are always kept, regardless of limit.
+ * \param object Object reference
+ * \param cache_size Max number of bytes to keep (default 256 kB)
+ * \return 0 on success, else -1
+ */
+int libambit_log_cache_size_set(ambit_object_t *object, uint32_t cache_size);
+
+/**
+ * Pipeline log reads. Up to depth log read requests are sent before their
+ * replies are read.
+ * \param object Object reference
+ * \param depth Pipeline depth, 0 or 1 to disable (default)
+ * \return 0 on success, else -1
+ */
+int libambit_log_pipeline_set(ambit_object_t *object, uint8_t depth);
+
+/**
+ * Decode log entries in a separate thread, while the next entry is read
+ * from the device, with up to depth read but not yet decoded entries
+ * queued. Only supported by Ambit3 devices, and not used for streaming
+ * reads.
+ * \note push_cb is then called from the decoding thread (in log order,
+ * one at a time), while select_cb, skip_cb and progress_cb are still
+ * called from the thread reading the logs. The read only returns once
+ * all entries are pushed.
+ * \param object Object reference
+ * \param depth Queue depth, 0 to decode in the reading thread (default)
+ * \return 0 on success, else -1
+ */
+int libambit_log_decode_thread_set(ambit_object_t *object, uint8_t depth);
+
+/**
+ * Set chunk size for subsequent log reads, e.g. one found earlier by
+ * libambit_log_chunk_size_tune() and stored by the caller. Remembered
+ * like a tuned one for later objects of the same device.
+ * \param object Object reference
+ * \param chunk_size Chunk size to use for reads
+ * \return 0 on success, else -1
+ */
+int libambit_log_chunk_size_set(ambit_object_t *object, uint16_t chunk_size);
+
+/**
+ * Probe a set of log read chunk sizes and use the fastest working one for
+ * subsequent log reads. The result is remembered per serial and firmware
+ * version, and applied directly to later objects of the same device.
+ * \param object Object reference
+ * \return Selected chunk size, or -1 on error (default is kept)
+ */
+int libambit_log_chunk_size_tune(ambit_object_t *object);
+
+/**
+ * Set cursor to last synced log entry. Later log reads with a skip
+ * callback on devices that support it start from the cursor instead of
+ * walking all headers, as long as the entry at the cursor still matches.
+ * The cursor is never used unless set here, and never by reads without a
+ * skip callback, which read all entries.
+ * Reads move the cursor past entries that were skipped or read and
+ * handed to the push callback, up to the first entry that failed. A
+ * caller that fails to keep a pushed entry should set NULL here before
+ * the next read.
+ * libambit remembers the cursor of each device after a successful
+ * libambit_log_read(), get it with libambit_log_sync_cursor_get() to set
+ * it on a later connection, or save it between runs.
+ * \param object Object reference
+ * \param cursor Cursor to use, or NULL to force a full walk
+ */
+void libambit_log_sync_cursor_set(ambit_object_t *object, const ambit_log_sync_cursor_t *cursor);
+
+/**
+ * Only read log entries the device has not marked as synchronized.
+ * Entries marked as synchronized are skipped without consulting skip_cb,
+ * and the log walk ends as soon as all unsynchronized entries reported by
+ * the device have been seen. Only supported by Ambit3 devices, other
+ * devices read logs as before.
+ * \note Entries are marked by Moveslink when it syncs them, libambit
+ * never marks them. The headers of all entries are still received, as
+ * there is no known way to request only a range of them.
+ * \param object Object reference
+ * \param unsynced_only true to only read unsynchronized entries
+ */
+void libambit_log_read_unsynced_only(ambit_object_t *object, bool unsynced_only);
+
+/**
+ * Get protocol statistics, one entry per command used since the object was
+ * created or the statistics were last reset. Collection is always on.
+ * \param object Object reference
+ * \param stats Array to fill in, may be NULL if count is 0
+ * \param count Number of entries that fit in stats
+ * \return Number of commands with statistics (may be larger than count),
+ *         or -1 on error
+ */
+int libambit_stats_get(ambit_object_t *object, ambit_command_stats_t *stats, size_t count);
+
+/**
+ * Clear all protocol statistics
+ * \param object Object reference
+ */
+void libambit_stats_reset(ambit_object_t *object);
+
+/**
+ * Keep the USB packets sent and received in a ring in memory, for trouble
+ * shooting without a debug build. Recording costs a copy of each packet
+ * and takes no locks, so it may stay on during normal syncs.
+ * Not to be called while another thread uses the object.
+ * \param object Object reference
+ * \param packet_count Packets kept, the oldest are overwritten when the
+ *        ring is full. 0 stops tracing and frees the ring
+ * \return 0 on success, else -1
+ */
+int libambit_trace_enable(ambit_object_t *object, size_t packet_count);
+
+/**
+ * Write the traced packets to a pcap file in Linux usbmon format, which
+ * the Ambit wireshark dissector reads. May be called from any thread
+ * while packets are still being recorded
+ * \param object Object reference
+ * \param path File to write
+ * \return Number of packets written, or -1 on error
+ */
+int libambit_trace_write_pcap(ambit_object_t *object, const char *path);
+
+/**
+ * Get cursor to newest log entry seen by last log read
+ * \param object Object reference
+ * \param cursor Cursor to fill in
+ * \return 0 on success, -1 if no cursor is known
+ */
+int libambit_log_sync_cursor_get(ambit_object_t *object, ambit_log_sync_cursor_t *cursor);
+
+/**
+ * Allocate zeroed memory for sample data (periodic values, satellites,
+ * unknown data) of a log entry. The memory is released together with the
+ * entry by libambit_log_entry_free().
+ * \note All sample data of an entry must be allocated either by this
+ * function or individually by malloc(), not mixed.
+ * \param log_entry Log entry the memory belongs to
+ * \param size Number of bytes
+ * \return Pointer to memory, or NULL on error
+ */
+void *libambit_log_entry_alloc(ambit_log_entry_t *log_entry, size_t size);
+
+/**
+ * Get columnar view of the samples of a log entry. The view is built on
+ * first call and kept with the entry until libambit_log_entry_free(), so
+ * samples must not be changed after calling this. May be called from
+ * several threads for the same entry.
+ * \param log_entry Log entry
+ * \return Columns, or NULL on error
+ */
+const ambit_log_columns_t *libambit_log_entry_columns(ambit_log_entry_t *log_entry);
+
+/**
+ * Make a complete copy of a log entry
+ * \param log_entry Log entry to copy
+ * \return Copy, to be freed with libambit_log_entry_free(), or NULL on error
+ */
+ambit_log_entry_t *libambit_log_entry_copy(const ambit_log_entry_t *log_entry);
+
+/**
+ * Get the order in which samples of a log entry should be presented.
+ * Samples are ordered by time, and samples with equal time are ordered as
+ * start/stop lap events first, then GPS samples, then periodic samples and
+ * then any others. Otherwise the relative order is kept.
+ * \param log_entry Log entry
+ * \param order Array of log_entry->samples_count elements, filled with
+ * sample indices
+ * \return 0 on success, else -1
+ */
+int libambit_log_entry_sample_order(const ambit_log_entry_t *log_entry, uint32_t *order);
+
+/**
+ * Get the presentation order of the samples of a log entry, as filled in
+ * by libambit_log_entry_sample_order(). The order is computed on first
+ * call and kept with the entry until libambit_log_entry_free(), so
+ * samples must not be changed after calling this. May be called from
+ * several threads for the same entry.
+ * \param log_entry Log entry
+ * \return Array of log_entry->samples_count sample indices, or NULL on
+ * error or if there are no samples
+ */
+const uint32_t *libambit_log_entry_order(ambit_log_entry_t *log_entry);
+
+/**
+ * Simplify the GPS track of a log entry with the Douglas-Peucker
+ * algorithm. GPS and position samples are taken in presentation order and
+ * a point is dropped if it is within tolerance of the simplified track, or
+ * within its own horizontal position error if that is larger. The first
+ * and last points are always kept. Samples are not changed.
+ * \param log_entry Log entry
+ * \param tolerance Allowed deviation in meters
+ * \param sample_index Array of log_entry->samples_count elements, filled
+ * with indices of the kept samples in presentation order
+ * \return Number of kept samples, or -1 on error
+ */
+int libambit_log_entry_track_simplify(ambit_log_entry_t *log_entry, double tolerance, uint32_t *sample_index);
+
+/**
+ * Make a compact copy of the samples of a log entry. Each sample is kept
+ * as a variable size record with only the data of its type, so that the
+ * log entry samples can be released while the samples are still needed.
+ * \param log_entry Log entry
+ * \return Sample pack, to be freed with libambit_log_sample_pack_free(),
+ * or NULL on error
+ */
+ambit_log_sample_pack_t *libambit_log_sample_pack_new(const ambit_log_entry_t *log_entry);
+
+/**
+ * Get number of samples in a sample pack
+ * \param pack Sample pack
+ * \return Number of samples
+ */
+uint32_t libambit_log_sample_pack_count(const ambit_log_sample_pack_t *pack);
+
+/**
+ * Get memory used by a sample pack
+ * \param pack Sample pack
+ * \return Number of bytes
+ */
+size_t libambit_log_sample_pack_size(const ambit_log_sample_pack_t *pack);
+
+/**
+ * Get type of a sample in a sample pack
+ * \param pack Sample pack
+ * \param index Sample index
+ * \return Sample type, ambit_log_sample_type_unknown if out of range
+ */
+ambit_log_sample_type_t libambit_log_sample_pack_type(const ambit_log_sample_pack_t *pack, uint32_t index);
+
+/**
+ * Get time of a sample in a sample pack
+ * \param pack Sample pack
+ * \param index Sample index
+ * \return Time from zero in ms, 0 if out of range
+ */
+uint32_t libambit_log_sample_pack_time(const ambit_log_sample_pack_t *pack, uint32_t index);
+
+/**
+ * Get one value of a periodic sample in a sample pack
+ * \param pack Sample pack
+ * \param index Sample index
+ * \param type Periodic value type
+ * \param value Value to be filled
+ * \return 0 on success, -1 if the sample is not periodic or has no value
+ * of the type
+ */
+int libambit_log_sample_pack_periodic_value(const ambit_log_sample_pack_t *pack, uint32_t index, ambit_log_sample_periodic_type_t type, ambit_log_sample_periodic_value_t *value);
+
+/**
+ * Get a sample of a sample pack as an ambit_log_sample_t. GPS satellites
+ * and unknown data point into the pack and periodic values into
+ * \a values, so the sample is only valid while both are.
+ * \param pack Sample pack
+ * \param index Sample index
+ * \param sample Sample to be filled
+ * \param values Array of LIBAMBIT_SAMPLE_PACK_MAX_VALUES elements for
+ * periodic values, may be NULL if the sample is known not to be periodic
+ * \return 0 on success, else -1
+ */
+int libambit_log_sample_pack_get(const ambit_log_sample_pack_t *pack, uint32_t index, ambit_log_sample_t *sample, ambit_log_sample_periodic_value_t *values);
+
+/**
+ * Free sample pack
+ * \param pack Sample pack to free
+ */
+void libambit_log_sample_pack_free(ambit_log_sample_pack_t *pack);
+
 /**
  * Free log entry allocated by libambit_log_read
  * \param log_entry Log entry to free
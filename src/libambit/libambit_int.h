@@ -26,11 +26,29 @@
 #include "hidapi/hidapi.h"
 #include "libambit.h"
 
+#define LIBAMBIT_STATS_SLOTS 32                     // Last slot collects any overflow
+
 struct ambit_object_s {
     hid_device *handle;
     uint16_t sequence_no;
     ambit_device_info_t device_info;
 
+    ambit_command_stats_t stats[LIBAMBIT_STATS_SLOTS]; // Per command, see libambit_stats_get()
+    size_t stats_count;
+    struct libambit_trace_s *trace;                 // Packet ring, see libambit_trace_enable()
+
+    bool sync_cursor_valid;
+    bool sync_cursor_set;                           // Only used by log reads if set by the caller,
+                                                    // see libambit_log_sync_cursor_set()
+    ambit_log_sync_cursor_t sync_cursor;
+    bool log_unsynced_only;                         // See libambit_log_read_unsynced_only()
+    struct libambit_pmem20_orbit_hashes_s *orbit_hashes; // Last written GPS orbit, set during
+                                                    // libambit_gps_orbit_write()
+    struct libambit_pmem20_log_resume_s *log_resume; // Log data kept between connections,
+                                                    // set during libambit_log_read()
+    struct device_cache_entry_s *cache_entry;       // Held from libambit_new() to libambit_close(),
+                                                    // NULL if the device cache is full
+
     struct ambit_device_driver_s *driver;
     struct ambit_device_driver_data_s *driver_data; // Driver specific struct,
                                                     // should be defined
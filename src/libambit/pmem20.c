@@ -20,14 +20,18 @@
  *
  */
 #include "pmem20.h"
+#include "libambit_int.h"
+#include "arena.h"
 #include "protocol.h"
 #include "sha256.h"
 #include "utils.h"
+#include "bench.h"
 #include "debug.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 /*
  * Local definitions
@@ -35,6 +39,19 @@
 #define PMEM20_LOG_WRAP_START_OFFSET      0x00000012
 #define PMEM20_LOG_WRAP_BUFFER_MARGIN     0x00010000 /* Max theoretical size of sample */
 #define PMEM20_LOG_HEADER_MIN_LEN                512 /* Header actually longer, but not interesting*/
+#define PMEM20_LOG_CACHE_SIZE_DEFAULT     0x00040000 /* Bytes of log chunks kept in memory */
+#define PMEM20_LOG_CACHE_MIN_SLOTS        (PMEM20_LOG_PIPELINE_DEPTH_MAX + 1)
+#define PMEM20_LOG_CHUNK_NONE             0xffffffff
+
+#define PMEM20_LOG_PIPELINE_DEPTH_DEFAULT          1 /* Outstanding log read requests */
+#define PMEM20_LOG_PIPELINE_DEPTH_MAX             16
+#define PMEM20_LOG_READAHEAD_CHUNKS                4 /* Chunks read ahead of sequential entry reads */
+#define PMEM20_LOG_READ_RETRIES_DEFAULT            3 /* Resends of a failed log chunk read */
+#define PMEM20_LOG_READ_RETRY_DELAY              100 /* ms before first resend, doubled for each */
+
+#define PMEM20_LOG_STREAM_WINDOW                 256 /* Samples held back for fix-ups when streaming */
+
+#define PMEM20_LOG_RESUME_WINDOW              600000 /* ms that read log data is kept after a failure */
 
 #define PMEM20_GPS_ORBIT_START            0x000704e0
 
@@ -44,21 +61,127 @@ typedef struct __attribute__((__packed__)) periodic_sample_spec_s {
     uint16_t length;
 } periodic_sample_spec_t;
 
+typedef struct periodic_plan_entry_s {
+    uint8_t type;                                   // Periodic value type, 0 if unknown
+    uint8_t width;                                  // Bytes to read, 0 if unknown
+    uint16_t offset;
+} periodic_plan_entry_t;
+
+typedef struct periodic_plan_s {
+    uint16_t count;
+    uint16_t allocated;
+    periodic_plan_entry_t *entries;
+} periodic_plan_t;
+
+typedef struct utc_clock_s {
+    int64_t base_msec;                              // UTC base as msec since epoch
+    bool day_valid;
+    int64_t day;                                    // Day of cached date
+    ambit_date_time_t date;                         // Cached date, time fields unused
+} utc_clock_t;
+
+typedef struct sample_stream_s {
+    ambit_log_entry_t *log_entry;
+    ambit_log_sample_cb sample_cb;
+    void *userref;
+    ambit_log_sample_t sample;                      // Sample being parsed
+    int32_t time_compensator;
+    ambit_log_sample_t window[PMEM20_LOG_STREAM_WINDOW]; // Held samples, ordered by time
+    size_t window_start;
+    size_t window_count;
+    bool have_periodic;
+    uint32_t last_periodic_time;
+    bool have_utc;
+    utc_clock_t utc_clock;
+    bool have_altisource;
+    int16_t altitude_offset;
+    int16_t pressure_offset;
+    uint32_t last_base_lat, last_base_long;
+    uint32_t last_small_lat, last_small_long;
+    uint32_t last_ehpe;
+} sample_stream_t;
+
+typedef struct log_chunk_request_s {
+    uint32_t address;
+    uint32_t length;
+    uint8_t *buffer;
+    uint16_t sequence;
+} log_chunk_request_t;
+
 /*
  * Static functions
  */
-static int parse_sample(uint8_t *buf, size_t offset, uint8_t **spec, ambit_log_entry_t *log_entry, size_t *sample_count, int32_t *time_compensators);
+static int parse_sample(uint8_t *buf, size_t offset, periodic_plan_t *plan, ambit_log_entry_t *log_entry, size_t *sample_count, int32_t *time_compensators);
+static int plan_compile(periodic_plan_t *plan, const uint8_t *spec, size_t spec_len);
+static void plan_free(periodic_plan_t *plan);
 static void correct_samples(ambit_log_entry_t *log_entry, int32_t *time_compensators);
-static int read_upto(libambit_pmem20_t *object, uint32_t address, uint32_t length);
-static int read_log_chunk(libambit_pmem20_t *object, uint32_t address, uint32_t length, uint8_t *buffer);
+static int compare_sample_time(const void *userref, uint32_t a, uint32_t b);
+static sample_stream_t *stream_new(ambit_log_entry_t *log_entry, ambit_log_sample_cb sample_cb, void *userref);
+static int stream_sample(sample_stream_t *stream, uint8_t *buf, size_t offset, periodic_plan_t *plan);
+static void stream_emit(sample_stream_t *stream);
+static void stream_free(sample_stream_t *stream, bool flush);
+static void free_sample_data(ambit_log_sample_t *sample);
+static void *sample_data_alloc(ambit_log_entry_t *log_entry, size_t size);
+static ambit_log_entry_t *log_read_entry(libambit_pmem20_t *object, ambit_log_sample_cb sample_cb, void *userref);
+static ambit_log_entry_t *log_read_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length, ambit_log_sample_cb sample_cb, void *userref);
+static uint8_t *log_fetch_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length);
+static ambit_log_entry_t *log_decode_entry(uint8_t *buffer, uint32_t length, ambit_log_sample_cb sample_cb, void *userref);
+static uint8_t *log_data(libambit_pmem20_t *object, size_t offset, size_t length);
+static size_t readahead_count(libambit_pmem20_t *object, uint32_t first, size_t count);
+static int load_chunks(libambit_pmem20_t *object, uint32_t first, size_t count);
+static size_t evict_slot(libambit_pmem20_t *object);
+static int read_log_chunks(libambit_pmem20_t *object, log_chunk_request_t *requests, size_t count);
+static size_t read_log_chunks_pass(libambit_pmem20_t *object, log_chunk_request_t *requests, size_t count, bool *done);
+static void log_resume_save(libambit_pmem20_t *object);
+static bool log_resume_restore(libambit_pmem20_t *object);
+static void log_cache_flush(libambit_pmem20_t *object);
+static int send_log_chunk_request(libambit_pmem20_t *object, log_chunk_request_t *request);
 static int write_data_chunk(ambit_object_t *object, uint32_t address, size_t buffer_count, const uint8_t **buffers, const size_t *buffer_sizes);
-static void add_time(ambit_date_time_t *intime, int32_t offset, ambit_date_time_t *outtime);
+static int write_orbit_chunk(ambit_object_t *object, uint32_t address, size_t buffer_count, const uint8_t **buffers, const size_t *buffer_sizes, sha256_ctx *total_ctx, uint8_t *hash, const uint8_t *old_hash);
 static int is_leap(unsigned int y);
+static void utc_clock_init(utc_clock_t *clock, ambit_date_time_t *utc_time, uint32_t time);
+static void utc_clock_get(utc_clock_t *clock, uint32_t time, ambit_date_time_t *outtime);
 static void to_timeval(ambit_date_time_t *ambit_time, struct timeval *timeval);
 
 /*
  * Static variables
  */
+// Number of bytes to read for each periodic value type
+static const uint8_t periodic_value_width[] = {
+    [ambit_log_sample_periodic_type_latitude] = 4,
+    [ambit_log_sample_periodic_type_longitude] = 4,
+    [ambit_log_sample_periodic_type_distance] = 4,
+    [ambit_log_sample_periodic_type_speed] = 2,
+    [ambit_log_sample_periodic_type_hr] = 1,
+    [ambit_log_sample_periodic_type_time] = 4,
+    [ambit_log_sample_periodic_type_gpsspeed] = 2,
+    [ambit_log_sample_periodic_type_wristaccspeed] = 2,
+    [ambit_log_sample_periodic_type_bikepodspeed] = 2,
+    [ambit_log_sample_periodic_type_ehpe] = 4,
+    [ambit_log_sample_periodic_type_evpe] = 4,
+    [ambit_log_sample_periodic_type_altitude] = 2,
+    [ambit_log_sample_periodic_type_abspressure] = 2,
+    [ambit_log_sample_periodic_type_energy] = 2,
+    [ambit_log_sample_periodic_type_temperature] = 2,
+    [ambit_log_sample_periodic_type_charge] = 1,
+    [ambit_log_sample_periodic_type_gpsaltitude] = 4,
+    [ambit_log_sample_periodic_type_gpsheading] = 2,
+    [ambit_log_sample_periodic_type_gpshdop] = 1,
+    [ambit_log_sample_periodic_type_gpsvdop] = 1,
+    [ambit_log_sample_periodic_type_wristcadence] = 2,
+    [ambit_log_sample_periodic_type_snr] = 16,
+    [ambit_log_sample_periodic_type_noofsatellites] = 1,
+    [ambit_log_sample_periodic_type_sealevelpressure] = 2,
+    [ambit_log_sample_periodic_type_verticalspeed] = 2,
+    [ambit_log_sample_periodic_type_cadence] = 1,
+    [ambit_log_sample_periodic_type_bikepower] = 2,
+    [ambit_log_sample_periodic_type_swimingstrokecnt] = 4,
+    [ambit_log_sample_periodic_type_ruleoutput1] = 4,
+    [ambit_log_sample_periodic_type_ruleoutput2] = 4,
+    [ambit_log_sample_periodic_type_ruleoutput3] = 4,
+    [ambit_log_sample_periodic_type_ruleoutput4] = 4,
+    [ambit_log_sample_periodic_type_ruleoutput5] = 4
+};
 
 
 
@@ -69,46 +192,169 @@ int libambit_pmem20_init(libambit_pmem20_t *object, ambit_object_t *ambit_object
 {
     object->ambit_object = ambit_object;
     object->chunk_size = chunk_size;
+    object->write_chunk_size = chunk_size;
+    object->pipeline_depth = PMEM20_LOG_PIPELINE_DEPTH_DEFAULT;
+    object->cache_size = PMEM20_LOG_CACHE_SIZE_DEFAULT;
+    object->read_retries = PMEM20_LOG_READ_RETRIES_DEFAULT;
+
+    return 0;
+}
+
+int libambit_pmem20_set_pipeline_depth(libambit_pmem20_t *object, uint8_t depth)
+{
+    if (depth < 1 || depth > PMEM20_LOG_PIPELINE_DEPTH_MAX) {
+        LOG_WARNING("Invalid pipeline depth %d (1-%d)", depth, PMEM20_LOG_PIPELINE_DEPTH_MAX);
+        return -1;
+    }
+
+    object->pipeline_depth = depth;
+
+    return 0;
+}
+
+int libambit_pmem20_set_chunk_size(libambit_pmem20_t *object, uint16_t chunk_size)
+{
+    if (chunk_size == 0) {
+        return -1;
+    }
+
+    if (chunk_size != object->chunk_size) {
+        // Read chunks are tracked per chunk, so any read data is invalid
+        libambit_pmem20_log_deinit(object);
+        object->chunk_size = chunk_size;
+    }
 
     return 0;
 }
 
+int libambit_pmem20_set_cache_size(libambit_pmem20_t *object, uint32_t cache_size)
+{
+    if (cache_size != object->cache_size) {
+        // Cache is sized on log init, so start over
+        libambit_pmem20_log_deinit(object);
+        object->cache_size = cache_size;
+    }
+
+    return 0;
+}
+
+int libambit_pmem20_log_read_benchmark(libambit_pmem20_t *object, uint32_t mem_start, uint32_t mem_size, uint16_t chunk_size, uint32_t length, uint32_t *elapsed)
+{
+    int ret = 0;
+    libambit_pmem20_t probe;
+    uint8_t *buffer;
+    log_chunk_request_t requests[PMEM20_LOG_PIPELINE_DEPTH_MAX];
+    size_t request_count;
+    uint32_t buffer_read = 0;
+    uint64_t start_time;
+
+    if (chunk_size == 0 || length > mem_size) {
+        return -1;
+    }
+
+    if ((buffer = malloc(length)) == NULL) {
+        return -1;
+    }
+
+    // Use a separate object, so that current log state is left untouched.
+    // Failing chunk sizes should fail fast, so no retries
+    memset(&probe, 0, sizeof(probe));
+    probe.ambit_object = object->ambit_object;
+    probe.chunk_size = chunk_size;
+    probe.pipeline_depth = object->pipeline_depth;
+    probe.log.mem_start = mem_start;
+    probe.log.mem_size = mem_size;
+
+    LOG_INFO("Benchmarking log read, chunk_size=%d, length=%d", chunk_size, length);
+
+    start_time = libambit_monotonic_time_us();
+    while (ret == 0 && buffer_read < length) {
+        request_count = 0;
+        while (buffer_read < length && request_count < PMEM20_LOG_PIPELINE_DEPTH_MAX) {
+            requests[request_count].address = mem_start + buffer_read;
+            requests[request_count].length = (length - buffer_read > chunk_size ? chunk_size : length - buffer_read);
+            requests[request_count].buffer = buffer + buffer_read;
+            buffer_read += requests[request_count].length;
+            request_count++;
+        }
+
+        ret = read_log_chunks(&probe, requests, request_count);
+    }
+
+    if (elapsed != NULL) {
+        *elapsed = libambit_monotonic_time_us() - start_time;
+    }
+
+    free(buffer);
+
+    return ret;
+}
+
 int libambit_pmem20_log_init(libambit_pmem20_t *object, uint32_t mem_start, uint32_t mem_size)
 {
     int ret = -1;
     size_t offset;
+    size_t chunk_count, i;
+    uint8_t *data;
+    bool resumed;
+    uint32_t resumed_last_entry, resumed_next_free_address;
 
-    // Allocate buffer for complete memory
-    if (object->log.buffer != NULL) {
-        free(object->log.buffer);
-    }
-    if (object->log.chunks_read != NULL) {
-        free(object->log.chunks_read);
-    }
-    memset(&object->log, 0, sizeof(object->log));
+    // Only keep a limited number of chunks in memory, the log area is
+    // usually a lot larger than what we need to read
+    libambit_pmem20_log_deinit(object);
 
     // Set memory structure
     object->log.mem_start = mem_start;
     object->log.mem_size = mem_size;
 
-    object->log.buffer = malloc(object->log.mem_size + PMEM20_LOG_WRAP_BUFFER_MARGIN);
-    object->log.chunks_read = malloc((object->log.mem_size/object->chunk_size)+1);
+    chunk_count = (object->log.mem_size/object->chunk_size)+1;
+    object->log.slot_count = object->cache_size/object->chunk_size;
+    if (object->log.slot_count < PMEM20_LOG_CACHE_MIN_SLOTS) {
+        object->log.slot_count = PMEM20_LOG_CACHE_MIN_SLOTS;
+    }
+    if (object->log.slot_count > chunk_count) {
+        object->log.slot_count = chunk_count;
+    }
+    if (object->log.slot_count > UINT16_MAX - 1) {
+        object->log.slot_count = UINT16_MAX - 1;
+    }
+
+    object->log.buffer = malloc(PMEM20_LOG_WRAP_BUFFER_MARGIN + 2);
+    object->log.chunk_slots = calloc(chunk_count, sizeof(uint16_t));
+    object->log.slots = malloc(object->log.slot_count*sizeof(libambit_pmem20_cache_slot_t));
+    object->log.slot_data = malloc(object->log.slot_count*object->chunk_size);
+
+    if (object->log.buffer != NULL && object->log.chunk_slots != NULL &&
+        object->log.slots != NULL && object->log.slot_data != NULL) {
+        // Set all slots to unused
+        for (i=0; i<object->log.slot_count; i++) {
+            object->log.slots[i].chunk = PMEM20_LOG_CHUNK_NONE;
+            object->log.slots[i].last_use = 0;
+        }
 
-    if (object->log.buffer != NULL && object->log.chunks_read != NULL) {
-        // Set all chunks to NOT read
-        memset(object->log.chunks_read, 0, (object->log.mem_size/object->chunk_size)+1);
+        // Pick up data read before an earlier connection failed
+        resumed = log_resume_restore(object);
+        resumed_last_entry = object->log.last_entry;
+        resumed_next_free_address = object->log.next_free_address;
 
         // Read initial log header
         LOG_INFO("Reading first log data chunk");
-        ret = read_log_chunk(object, object->log.mem_start, object->chunk_size, object->log.buffer);
+        data = log_data(object, 0, 16);
 
-        if (ret == 0) {
+        if (data != NULL) {
             // Parse PMEM header
             offset = 0;
-            object->log.last_entry = read32inc(object->log.buffer, &offset);
-            object->log.first_entry = read32inc(object->log.buffer, &offset);
-            object->log.entries = read32inc(object->log.buffer, &offset);
-            object->log.next_free_address = read32inc(object->log.buffer, &offset);
+            object->log.last_entry = read32inc(data, &offset);
+            object->log.first_entry = read32inc(data, &offset);
+            object->log.entries = read32inc(data, &offset);
+            object->log.next_free_address = read32inc(data, &offset);
+
+            // Resumed data is only valid if no log has been written since
+            if (resumed && (object->log.last_entry != resumed_last_entry ||
+                            object->log.next_free_address != resumed_next_free_address)) {
+                LOG_INFO("Log changed since last connection, discarding resumed data");
+                log_cache_flush(object);
+            }
             object->log.current.current = object->log.mem_start;
             object->log.current.next = object->log.first_entry;
             object->log.current.prev = object->log.mem_start;
@@ -117,6 +363,7 @@ int libambit_pmem20_log_init(libambit_pmem20_t *object, uint32_t mem_start, uint
 
             // Set initialized
             object->log.initialized = true;
+            ret = 0;
         }
         else {
             LOG_WARNING("Failed to read first data chunk");
@@ -126,24 +373,59 @@ int libambit_pmem20_log_init(libambit_pmem20_t *object, uint32_t mem_start, uint
     return ret;
 }
 
-int libambit_pmem20_deinit(libambit_pmem20_t *object)
+int libambit_pmem20_log_deinit(libambit_pmem20_t *object)
 {
     if (object->log.buffer != NULL) {
         free(object->log.buffer);
     }
-    if (object->log.chunks_read != NULL) {
-        free(object->log.chunks_read);
+    if (object->log.chunk_slots != NULL) {
+        free(object->log.chunk_slots);
+    }
+    if (object->log.slots != NULL) {
+        free(object->log.slots);
+    }
+    if (object->log.slot_data != NULL) {
+        free(object->log.slot_data);
+    }
+    if (object->log.partial.buffer != NULL) {
+        free(object->log.partial.buffer);
     }
     memset(&object->log, 0, sizeof(object->log));
 
     return 0;
 }
 
+int libambit_pmem20_deinit(libambit_pmem20_t *object)
+{
+    return libambit_pmem20_log_deinit(object);
+}
+
+int libambit_pmem20_log_seek(libambit_pmem20_t *object, uint32_t address)
+{
+    if (!object->log.initialized) {
+        LOG_ERROR("Trying to seek log without initialization");
+        return -1;
+    }
+
+    if (address < object->log.mem_start || address + PMEM20_LOG_HEADER_MIN_LEN > object->log.mem_start + object->log.mem_size) {
+        LOG_WARNING("Log seek address %08x out of range", address);
+        return -1;
+    }
+
+    // Make next call to libambit_pmem20_log_next_header read entry at address
+    object->log.current.current = object->log.mem_start;
+    object->log.current.next = address;
+    object->log.current.prev = object->log.mem_start;
+
+    return 0;
+}
+
 int libambit_pmem20_log_next_header(libambit_pmem20_t *object, ambit_log_header_t *log_header)
 {
     int ret = -1;
-    size_t buffer_offset;
+    size_t buffer_offset, offset;
     uint16_t tmp_len;
+    uint8_t *data = NULL;
 
     LOG_INFO("Reading header of next log entry");
 
@@ -158,18 +440,24 @@ int libambit_pmem20_log_next_header(libambit_pmem20_t *object, ambit_log_header_
         return 0;
     }
 
-    if (read_upto(object, object->log.current.next, PMEM20_LOG_HEADER_MIN_LEN) == 0) {
-        buffer_offset = (object->log.current.next - object->log.mem_start);
+    buffer_offset = (object->log.current.next - object->log.mem_start);
+    if (object->log.current.next >= object->log.mem_start && buffer_offset < object->log.mem_size) {
+        data = log_data(object, buffer_offset, PMEM20_LOG_HEADER_MIN_LEN);
+    }
+    if (data != NULL) {
         // First check that header seems to be correctly present
-        if (strncmp((char*)object->log.buffer + buffer_offset, "PMEM", 4) == 0) {
+        if (strncmp((char*)data, "PMEM", 4) == 0) {
             object->log.current.current = object->log.current.next;
-            buffer_offset += 4;
-            object->log.current.next = read32inc(object->log.buffer, &buffer_offset);
-            object->log.current.prev = read32inc(object->log.buffer, &buffer_offset);
-            tmp_len = read16inc(object->log.buffer, &buffer_offset);
-            buffer_offset += tmp_len;
-            tmp_len = read16inc(object->log.buffer, &buffer_offset);
-            if (libambit_pmem20_log_parse_header(object->log.buffer + buffer_offset, tmp_len, log_header) == 0) {
+            offset = 4;
+            object->log.current.next = read32inc(data, &offset);
+            object->log.current.prev = read32inc(data, &offset);
+            tmp_len = read16inc(data, &offset);
+            offset += tmp_len;
+            tmp_len = read16inc(data, &offset);
+            if (offset + tmp_len > PMEM20_LOG_HEADER_MIN_LEN) {
+                data = log_data(object, buffer_offset, offset + tmp_len);
+            }
+            if (data != NULL && libambit_pmem20_log_parse_header(data + offset, tmp_len, log_header) == 0) {
                 LOG_INFO("Log entry header parsed");
                 ret = 1;
             }
@@ -195,212 +483,32 @@ int libambit_pmem20_log_next_header(libambit_pmem20_t *object, ambit_log_header_
 
 ambit_log_entry_t *libambit_pmem20_log_read_entry(libambit_pmem20_t *object)
 {
-    // Note! We assume that the caller has called libambit_pmem20_log_next_header just before
-    uint8_t *periodic_sample_spec;
-    uint16_t tmp_len, sample_len;
-    size_t buffer_offset, sample_count = 0;
-    ambit_log_entry_t *log_entry;
-    int32_t *time_compensators;
-
-    if (!object->log.initialized) {
-        LOG_ERROR("Trying to get log entry without initialization");
-        return NULL;
-    }
-
-    // Allocate log entry
-    if ((log_entry = calloc(1, sizeof(ambit_log_entry_t))) == NULL) {
-        object->log.initialized = false;
-        return NULL;
-    }
-    log_entry->header.activity_name = NULL;
-
-    LOG_INFO("Reading log entry from address=%08x", object->log.current.current);
-
-    buffer_offset = (object->log.current.current - object->log.mem_start);
-    buffer_offset += 12;
-    // Read samples content definition
-    tmp_len = read16inc(object->log.buffer, &buffer_offset);
-    periodic_sample_spec = object->log.buffer + buffer_offset;
-    buffer_offset += tmp_len;
-    // Parse header
-    tmp_len = read16inc(object->log.buffer, &buffer_offset);
-    if (libambit_pmem20_log_parse_header(object->log.buffer + buffer_offset, tmp_len, &log_entry->header) != 0) {
-        LOG_ERROR("Failed to parse log entry header correctly");
-        if (log_entry->header.activity_name) {
-            free(log_entry->header.activity_name);
-        }
-        free(log_entry);
-        object->log.initialized = false;
-        return NULL;
-    }
-    buffer_offset += tmp_len;
-    // Now that we know number of samples, allocate space for them!
-    if ((log_entry->samples = calloc(log_entry->header.samples_count, sizeof(ambit_log_sample_t))) == NULL) {
-        if (log_entry->header.activity_name) {
-            free(log_entry->header.activity_name);
-        }
-        free(log_entry);
-        object->log.initialized = false;
-        return NULL;
-    }
-    log_entry->samples_count = log_entry->header.samples_count;
-    if ((time_compensators = calloc(log_entry->header.samples_count, sizeof(int32_t))) == NULL) {
-        free(log_entry->samples);
-        if (log_entry->header.activity_name) {
-            free(log_entry->header.activity_name);
-        }
-        free(log_entry);
-        object->log.initialized = false;
-        return NULL;
-    }
-
-    LOG_INFO("Log entry got %d samples, reading", log_entry->samples_count);
-
-    // OK, so we are at start of samples, get them all!
-    while (sample_count < log_entry->samples_count) {
-        /* NOTE! The double reads below seems a bit unoptimized,
-           but if we need optimization, we should optimize read_upto
-           instead...
-           To ease the pain on wraparound we simply duplicate the sample
-           to the end of the buffer. */
-
-        // First check for log area wrap
-        if (buffer_offset >= object->log.mem_size - 1) {
-            read_upto(object, object->log.mem_start + PMEM20_LOG_WRAP_START_OFFSET, 2);
-            sample_len = read16(object->log.buffer, PMEM20_LOG_WRAP_START_OFFSET);
-        }
-        else if (buffer_offset == object->log.mem_size - 2) {
-            read_upto(object, object->log.mem_start + PMEM20_LOG_WRAP_START_OFFSET, 1);
-            sample_len = object->log.buffer[buffer_offset] | (object->log.buffer[PMEM20_LOG_WRAP_START_OFFSET] << 8);
-        }
-        else {
-            read_upto(object, object->log.mem_start + buffer_offset, 2);
-            sample_len = read16(object->log.buffer, buffer_offset);
-        }
-
-        // Read all data
-        if (buffer_offset + 2 < (object->log.mem_size-1)) {
-            read_upto(object, object->log.mem_start + buffer_offset + 2, sample_len);
-        }
-        if (buffer_offset + 2 + sample_len > object->log.mem_size) {
-            read_upto(object, object->log.mem_start + PMEM20_LOG_WRAP_START_OFFSET, (buffer_offset + 2 + sample_len) - object->log.mem_size);
-            memcpy(object->log.buffer + object->log.mem_size, object->log.buffer + PMEM20_LOG_WRAP_START_OFFSET, (buffer_offset + 2 + sample_len) - object->log.mem_size);
-        }
-
-        parse_sample(object->log.buffer, buffer_offset, &periodic_sample_spec, log_entry, &sample_count, time_compensators);
-        buffer_offset += 2 + sample_len;
-        // Wrap
-        if (buffer_offset >= object->log.mem_size) {
-            buffer_offset = PMEM20_LOG_WRAP_START_OFFSET + (buffer_offset - object->log.mem_size);
-        }
-    }
-
-    correct_samples(log_entry, time_compensators);
-
-    free(time_compensators);
+    return log_read_entry(object, NULL, NULL);
+}
 
-    return log_entry;
+ambit_log_entry_t *libambit_pmem20_log_read_entry_stream(libambit_pmem20_t *object, ambit_log_sample_cb sample_cb, void *userref)
+{
+    return log_read_entry(object, sample_cb, userref);
 }
 
 ambit_log_entry_t *libambit_pmem20_log_read_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length)
 {
-    uint8_t *buffer;
-    uint8_t *periodic_sample_spec;
-    uint32_t next_address;
-    uint32_t buffer_read = 0, read_length;
-    uint16_t tmp_len, sample_len;
-    size_t buffer_offset, sample_count = 0;
-    ambit_log_entry_t *log_entry;
-    int32_t *time_compensators;
-
-    // Allocate log entry
-    if ((log_entry = calloc(1, sizeof(ambit_log_entry_t))) == NULL) {
-        object->log.initialized = false;
-        return NULL;
-    }
-
-    // Allocate temporary log buffer
-    if ((buffer = calloc(1, length)) == NULL) {
-        object->log.initialized = false;
-        free(log_entry);
-        return NULL;
-    }
-
-    LOG_INFO("Reading log entry from address=%08x", address);
-    log_entry->header.activity_name = NULL;
-
-    // Handle wrap in "the middle" of the log
-    next_address = address;
-    while (buffer_read < length) {
-        if (next_address >= object->log.mem_start + object->log.mem_size) {
-            next_address = object->log.mem_start + PMEM20_LOG_WRAP_START_OFFSET;
-        }
-        if (length - buffer_read >= object->chunk_size) {
-            read_length = object->chunk_size;
-        }
-        else {
-            read_length = length - buffer_read;
-        }
-        if (next_address + read_length > object->log.mem_start + object->log.mem_size) {
-            read_length = object->log.mem_start + object->log.mem_size - next_address;
-        }
-
-        read_log_chunk(object, next_address, read_length, buffer + buffer_read);
-
-        next_address += read_length;
-        buffer_read += read_length;
-    }
-
-    buffer_offset = 12;
-    // Read samples content definition
-    tmp_len = read16inc(buffer, &buffer_offset);
-    periodic_sample_spec = buffer + buffer_offset;
-    buffer_offset += tmp_len;
-    // Parse header
-    tmp_len = read16inc(buffer, &buffer_offset);
-    if (libambit_pmem20_log_parse_header(buffer + buffer_offset, tmp_len, &log_entry->header) != 0) {
-        LOG_ERROR("Failed to parse log entry header correctly");
-        if (log_entry->header.activity_name) {
-            free(log_entry->header.activity_name);
-        }
-        free(log_entry);
-        object->log.initialized = false;
-        return NULL;
-    }
-    buffer_offset += tmp_len;
-    // Now that we know number of samples, allocate space for them!
-    if ((log_entry->samples = calloc(log_entry->header.samples_count, sizeof(ambit_log_sample_t))) == NULL) {
-        if (log_entry->header.activity_name) {
-            free(log_entry->header.activity_name);
-        }
-        free(log_entry);
-        object->log.initialized = false;
-        return NULL;
-    }
-    log_entry->samples_count = log_entry->header.samples_count;
-    if ((time_compensators = calloc(log_entry->header.samples_count, sizeof(int32_t))) == NULL) {
-        free(log_entry->samples);
-        if (log_entry->header.activity_name) {
-            free(log_entry->header.activity_name);
-        }
-        free(log_entry);
-        object->log.initialized = false;
-        return NULL;
-    }
-
-    LOG_INFO("Log entry got %d samples, reading", log_entry->samples_count);
-
-    // OK, so we are at start of samples, get them all!
-    while (sample_count < log_entry->samples_count) {
-        sample_len = read16(buffer, buffer_offset);
+    return log_read_entry_address(object, address, length, NULL, NULL);
+}
 
-        parse_sample(buffer, buffer_offset, &periodic_sample_spec, log_entry, &sample_count, time_compensators);
-        buffer_offset += 2 + sample_len;
-    }
+ambit_log_entry_t *libambit_pmem20_log_read_entry_address_stream(libambit_pmem20_t *object, uint32_t address, uint32_t length, ambit_log_sample_cb sample_cb, void *userref)
+{
+    return log_read_entry_address(object, address, length, sample_cb, userref);
+}
 
-    correct_samples(log_entry, time_compensators);
+uint8_t *libambit_pmem20_log_fetch_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length)
+{
+    return log_fetch_entry_address(object, address, length);
+}
 
-    return log_entry;
+ambit_log_entry_t *libambit_pmem20_log_decode_entry(uint8_t *buffer, uint32_t length)
+{
+    return log_decode_entry(buffer, length, NULL, NULL);
 }
 
 int libambit_pmem20_log_parse_header(uint8_t *data, size_t datalen, ambit_log_header_t *log_header)
@@ -486,9 +594,12 @@ int libambit_pmem20_log_parse_header(uint8_t *data, size_t datalen, ambit_log_he
     return 0;
 }
 
-int libambit_pmem20_gps_orbit_write(libambit_pmem20_t *object, const uint8_t *data, size_t datalen, bool include_sha256_hash)
+int libambit_pmem20_gps_orbit_write(libambit_pmem20_t *object, const uint8_t *data, size_t datalen, bool include_sha256_hash, libambit_pmem20_orbit_hashes_t *hashes)
 {
     int i, ret = -1;
+    uint8_t (*new_hashes)[32] = NULL;
+    uint8_t (*old_hashes)[32] = NULL;
+    size_t chunk_count, chunk = 0, chunks_written = 0;
     const uint8_t *bufptrs[2];
     size_t bufsizes[2];
     uint8_t *tailbuf;
@@ -504,31 +615,49 @@ int libambit_pmem20_gps_orbit_write(libambit_pmem20_t *object, const uint8_t *da
     bufptrs[0] = startheader;
     bufsizes[0] = 4;
     bufptrs[1] = data;
-    bufsizes[1] = object->chunk_size - 4; // We assume that data is
-                                          // always > chunk_size
+    bufsizes[1] = object->write_chunk_size - 4; // We assume that data is
+                                                // always > chunk_size
+
+    // Chunks that are known to be on the device since last write are
+    // skipped, if the layout is the same
+    chunk_count = 1 + (datalen - bufsizes[1] + object->write_chunk_size - 1) / object->write_chunk_size;
+    if (hashes != NULL) {
+        if (hashes->count == chunk_count && hashes->chunk_size == object->write_chunk_size) {
+            old_hashes = hashes->hashes;
+        }
+        new_hashes = malloc(chunk_count*sizeof(*new_hashes));
+    }
+
+    // Data hash is calculated as chunks are written
+    if (include_sha256_hash) {
+        sha256_init(&ctx);
+    }
 
     // Write first chunk (including length)
-    ret = write_data_chunk(object->ambit_object, address, 2, bufptrs, bufsizes);
+    ret = write_orbit_chunk(object->ambit_object, address, 2, bufptrs, bufsizes, include_sha256_hash ? &ctx : NULL, new_hashes != NULL ? new_hashes[chunk] : NULL, old_hashes != NULL && new_hashes != NULL ? old_hashes[chunk] : NULL);
+    chunks_written += (ret > 0 ? 1 : 0);
+    chunk++;
     offset += bufsizes[1];
-    address += object->chunk_size;
+    address += object->write_chunk_size;
 
     // Write rest of the chunks
-    while (ret == 0 && offset < datalen) {
+    while (ret >= 0 && offset < datalen) {
         bufptrs[0] = data + offset;
-        bufsizes[0] = (datalen - offset > object->chunk_size ? object->chunk_size : datalen - offset);
+        bufsizes[0] = (datalen - offset > object->write_chunk_size ? object->write_chunk_size : datalen - offset);
 
-        ret = write_data_chunk(object->ambit_object, address, 1, bufptrs, bufsizes);
+        ret = write_orbit_chunk(object->ambit_object, address, 1, bufptrs, bufsizes, include_sha256_hash ? &ctx : NULL, new_hashes != NULL ? new_hashes[chunk] : NULL, old_hashes != NULL && new_hashes != NULL ? old_hashes[chunk] : NULL);
+        chunks_written += (ret > 0 ? 1 : 0);
+        chunk++;
         offset += bufsizes[0];
         address += bufsizes[0];
     }
+    ret = (ret >= 0 ? 0 : -1);
+    LOG_INFO("Wrote %zu of %zu GPS orbit chunks", chunks_written, chunk_count);
 
     // Write tail length (or what is really!?)
     if (ret == 0) {
         // Handle hash (if wanted)
         if (include_sha256_hash) {
-            sha256_init(&ctx);
-            sha256_update(&ctx, startheader, sizeof(startheader));
-            sha256_update(&ctx, data, datalen);
             sha256_final(&ctx, hash);
             tail_datalen += 64;
         }
@@ -543,174 +672,509 @@ int libambit_pmem20_gps_orbit_write(libambit_pmem20_t *object, const uint8_t *da
             ret = libambit_protocol_command(object->ambit_object, ambit_command_data_tail_len, tailbuf, tail_datalen, NULL, NULL, 0);
             free(tailbuf);
         }
+        else {
+            ret = -1;
+        }
+    }
+
+    if (hashes != NULL) {
+        // Device content is unknown after a failed write
+        libambit_pmem20_orbit_hashes_clear(hashes);
+        if (ret == 0 && new_hashes != NULL) {
+            hashes->hashes = new_hashes;
+            hashes->count = chunk_count;
+            hashes->chunk_size = object->write_chunk_size;
+            new_hashes = NULL;
+        }
     }
+    free(new_hashes);
 
     return ret;
 }
 
-/**
- * Parse the given sample
- * \return number of samples added (1 or 0)
- */
-static int parse_sample(uint8_t *buf, size_t offset, uint8_t **spec, ambit_log_entry_t *log_entry, size_t *sample_count, int32_t *time_compensators)
+void libambit_pmem20_orbit_hashes_clear(libambit_pmem20_orbit_hashes_t *hashes)
 {
-    int ret = 0;
-    size_t int_offset = offset;
-    uint16_t sample_len = read16inc(buf, &int_offset);
-    uint8_t  sample_type = read8inc(buf, &int_offset);
-    uint8_t  episodic_type;
-    uint16_t spec_count, spec_type, spec_offset;
-    periodic_sample_spec_t *spec_entry;
-    int i;
+    free(hashes->hashes);
+    memset(hashes, 0, sizeof(libambit_pmem20_orbit_hashes_t));
+}
 
-    switch (sample_type) {
+void libambit_pmem20_log_resume_clear(libambit_pmem20_log_resume_t *resume)
+{
+    free(resume->chunk_slots);
+    free(resume->slots);
+    free(resume->slot_data);
+    free(resume->partial.buffer);
+    memset(resume, 0, sizeof(libambit_pmem20_log_resume_t));
+}
+
+static ambit_log_entry_t *log_read_entry(libambit_pmem20_t *object, ambit_log_sample_cb sample_cb, void *userref)
+{
+    // Note! We assume that the caller has called libambit_pmem20_log_next_header just before
+    uint8_t *data;
+    periodic_plan_t plan = { 0, 0, NULL };
+    uint16_t spec_len, tmp_len, sample_len;
+    size_t offset, buffer_offset, sample_count = 0;
+    uint8_t sample_len_low;
+    ambit_log_entry_t *log_entry;
+    int32_t *time_compensators = NULL;
+    sample_stream_t *stream = NULL;
+    int added;
+    uint32_t entry_end;
+
+    if (!object->log.initialized) {
+        LOG_ERROR("Trying to get log entry without initialization");
+        return NULL;
+    }
+
+    // Allocate log entry
+    if ((log_entry = calloc(1, sizeof(ambit_log_entry_t))) == NULL) {
+        object->log.initialized = false;
+        return NULL;
+    }
+    log_entry->header.activity_name = NULL;
+
+    LOG_INFO("Reading log entry from address=%08x", object->log.current.current);
+
+    buffer_offset = (object->log.current.current - object->log.mem_start);
+    if ((data = log_data(object, buffer_offset, PMEM20_LOG_HEADER_MIN_LEN)) == NULL) {
+        free(log_entry);
+        object->log.initialized = false;
+        return NULL;
+    }
+    offset = 12;
+    // Read samples content definition
+    spec_len = read16inc(data, &offset);
+    offset += spec_len;
+    // Parse header
+    tmp_len = read16inc(data, &offset);
+    if (offset + tmp_len > PMEM20_LOG_HEADER_MIN_LEN &&
+        (data = log_data(object, buffer_offset, offset + tmp_len)) == NULL) {
+        free(log_entry);
+        object->log.initialized = false;
+        return NULL;
+    }
+    // Data is only valid until next read, so decode the samples content
+    // definition right away
+    if (plan_compile(&plan, data + 14, spec_len) != 0) {
+        free(log_entry);
+        object->log.initialized = false;
+        return NULL;
+    }
+    if (libambit_pmem20_log_parse_header(data + offset, tmp_len, &log_entry->header) != 0) {
+        LOG_ERROR("Failed to parse log entry header correctly");
+        if (log_entry->header.activity_name) {
+            free(log_entry->header.activity_name);
+        }
+        free(log_entry);
+        plan_free(&plan);
+        object->log.initialized = false;
+        return NULL;
+    }
+    buffer_offset += offset + tmp_len;
+    if (buffer_offset >= object->log.mem_size) {
+        buffer_offset = PMEM20_LOG_WRAP_START_OFFSET + (buffer_offset - object->log.mem_size);
+    }
+    if (sample_cb != NULL) {
+        // Samples are passed on as they are parsed, no need to keep them
+        if ((stream = stream_new(log_entry, sample_cb, userref)) == NULL) {
+            if (log_entry->header.activity_name) {
+                free(log_entry->header.activity_name);
+            }
+            free(log_entry);
+            plan_free(&plan);
+            object->log.initialized = false;
+            return NULL;
+        }
+    }
+    // Now that we know number of samples, allocate space for them!
+    else if ((log_entry->samples = calloc(log_entry->header.samples_count, sizeof(ambit_log_sample_t))) == NULL) {
+        if (log_entry->header.activity_name) {
+            free(log_entry->header.activity_name);
+        }
+        free(log_entry);
+        plan_free(&plan);
+        object->log.initialized = false;
+        return NULL;
+    }
+    else {
+        log_entry->samples_count = log_entry->header.samples_count;
+        // Sample data goes into one arena, if possible
+        log_entry->arena = libambit_arena_new(LIBAMBIT_ARENA_BLOCK_SIZE);
+        if ((time_compensators = calloc(log_entry->header.samples_count, sizeof(int32_t))) == NULL) {
+            libambit_log_entry_free(log_entry);
+            plan_free(&plan);
+            object->log.initialized = false;
+            return NULL;
+        }
+    }
+
+    LOG_INFO("Log entry got %d samples, reading", log_entry->header.samples_count);
+
+    // Samples are read in order up to the start of the next entry, or up
+    // to the first free address for the newest one
+    entry_end = (object->log.current.next != object->log.current.current ? object->log.current.next : object->log.next_free_address);
+    if (entry_end > object->log.mem_start && entry_end <= object->log.mem_start + object->log.mem_size) {
+        object->log.readahead_end = entry_end - object->log.mem_start;
+    }
+
+    // OK, so we are at start of samples, get them all!
+    while (sample_count < log_entry->header.samples_count) {
+        /* To ease the pain on wraparound log_data() duplicates the sample
+           into one continuous buffer, as if the log area continued at
+           PMEM20_LOG_WRAP_START_OFFSET. */
+
+        // First check for log area wrap
+        data = NULL;
+        if (buffer_offset >= object->log.mem_size - 1) {
+            if ((data = log_data(object, PMEM20_LOG_WRAP_START_OFFSET, 2)) != NULL) {
+                sample_len = read16(data, 0);
+            }
+        }
+        else if (buffer_offset == object->log.mem_size - 2) {
+            if ((data = log_data(object, buffer_offset, 1)) != NULL) {
+                sample_len_low = data[0];
+                if ((data = log_data(object, PMEM20_LOG_WRAP_START_OFFSET, 1)) != NULL) {
+                    sample_len = sample_len_low | (data[0] << 8);
+                }
+            }
+        }
+        else if ((data = log_data(object, buffer_offset, 2)) != NULL) {
+            sample_len = read16(data, 0);
+        }
+
+        // Read all data, a sample that updates the periodic sample
+        // specifier fails the entry if it can't be used
+        added = 0;
+        if (data != NULL && (data = log_data(object, buffer_offset, 2 + sample_len)) != NULL) {
+            if (stream != NULL) {
+                added = stream_sample(stream, data, 0, &plan);
+            }
+            else {
+                BENCH_TIMER_START(bench_start);
+                added = parse_sample(data, 0, &plan, log_entry, &sample_count, time_compensators);
+                BENCH_TIMER_STOP(libambit_bench_parse_sample_ns, bench_start);
+            }
+        }
+        if (data == NULL || added < 0) {
+            LOG_WARNING("Failed to read log samples");
+            object->log.readahead_end = 0;
+            if (stream != NULL) {
+                stream_free(stream, false);
+            }
+            free(time_compensators);
+            plan_free(&plan);
+            libambit_log_entry_free(log_entry);
+            object->log.initialized = false;
+            return NULL;
+        }
+
+        if (stream != NULL) {
+            sample_count += added;
+        }
+        buffer_offset += 2 + sample_len;
+        // Wrap
+        if (buffer_offset >= object->log.mem_size) {
+            buffer_offset = PMEM20_LOG_WRAP_START_OFFSET + (buffer_offset - object->log.mem_size);
+        }
+    }
+    object->log.readahead_end = 0;
+
+    if (stream != NULL) {
+        stream_free(stream, true);
+    }
+    else {
+        BENCH_TIMER_START(bench_start);
+        correct_samples(log_entry, time_compensators);
+        BENCH_TIMER_STOP(libambit_bench_correct_samples_ns, bench_start);
+    }
+
+    free(time_compensators);
+    plan_free(&plan);
+
+    return log_entry;
+}
+
+static ambit_log_entry_t *log_read_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length, ambit_log_sample_cb sample_cb, void *userref)
+{
+    uint8_t *buffer;
+    ambit_log_entry_t *log_entry;
+
+    if ((buffer = log_fetch_entry_address(object, address, length)) == NULL) {
+        return NULL;
+    }
+
+    if ((log_entry = log_decode_entry(buffer, length, sample_cb, userref)) == NULL) {
+        object->log.initialized = false;
+    }
+    free(buffer);
+
+    return log_entry;
+}
+
+/**
+ * Read raw log entry data
+ * \return Buffer of length bytes (to be freed by caller), or NULL on error
+ */
+static uint8_t *log_fetch_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length)
+{
+    uint8_t *buffer;
+    uint32_t next_address;
+    uint32_t buffer_read = 0, read_length, fetched = 0, batch_start;
+    log_chunk_request_t requests[PMEM20_LOG_PIPELINE_DEPTH_MAX];
+    size_t request_count;
+
+    if (!object->log.initialized) {
+        LOG_ERROR("Trying to fetch log entry without initialization");
+        return NULL;
+    }
+
+    if (object->log.partial.buffer != NULL &&
+        object->log.partial.address == address && object->log.partial.length == length) {
+        // Continue where an earlier connection failed
+        LOG_INFO("Resuming log entry at address=%08x, %d of %d bytes already read", address, object->log.partial.fetched, length);
+        buffer = object->log.partial.buffer;
+        fetched = object->log.partial.fetched;
+        object->log.partial.buffer = NULL;
+    }
+    else {
+        free(object->log.partial.buffer);
+        object->log.partial.buffer = NULL;
+
+        // Allocate temporary log buffer
+        if ((buffer = calloc(1, length)) == NULL) {
+            object->log.initialized = false;
+            return NULL;
+        }
+    }
+
+    LOG_INFO("Reading log entry from address=%08x", address);
+
+    // Handle wrap in "the middle" of the log
+    next_address = address;
+    while (buffer_read < length) {
+        request_count = 0;
+        batch_start = buffer_read;
+        while (buffer_read < length && request_count < PMEM20_LOG_PIPELINE_DEPTH_MAX) {
+            if (next_address >= object->log.mem_start + object->log.mem_size) {
+                next_address = object->log.mem_start + PMEM20_LOG_WRAP_START_OFFSET;
+            }
+            if (length - buffer_read >= object->chunk_size) {
+                read_length = object->chunk_size;
+            }
+            else {
+                read_length = length - buffer_read;
+            }
+            if (next_address + read_length > object->log.mem_start + object->log.mem_size) {
+                read_length = object->log.mem_start + object->log.mem_size - next_address;
+            }
+
+            // Requests are always split the same way, so resumed data
+            // ends on a request boundary
+            if (buffer_read < fetched) {
+                batch_start = buffer_read + read_length;
+            }
+            else {
+                requests[request_count].address = next_address;
+                requests[request_count].length = read_length;
+                requests[request_count].buffer = buffer + buffer_read;
+                request_count++;
+            }
+
+            next_address += read_length;
+            buffer_read += read_length;
+        }
+
+        if (request_count > 0 && read_log_chunks(object, requests, request_count) != 0) {
+            LOG_WARNING("Failed to read log entry data");
+            object->log.partial.address = address;
+            object->log.partial.length = length;
+            object->log.partial.fetched = batch_start;
+            object->log.partial.buffer = buffer;
+            log_resume_save(object);
+            object->log.initialized = false;
+            return NULL;
+        }
+    }
+
+    return buffer;
+}
+
+/**
+ * Decode raw log entry data. Does not touch any device state, so it is
+ * safe to run in parallel with reads from the device.
+ * \return Log entry, or NULL on error
+ */
+static ambit_log_entry_t *log_decode_entry(uint8_t *buffer, uint32_t length, ambit_log_sample_cb sample_cb, void *userref)
+{
+    uint8_t *periodic_sample_spec;
+    uint16_t spec_len;
+    periodic_plan_t plan = { 0, 0, NULL };
+    uint16_t tmp_len, sample_len;
+    size_t buffer_offset, sample_count = 0;
+    ambit_log_entry_t *log_entry;
+    int32_t *time_compensators = NULL;
+    sample_stream_t *stream = NULL;
+    int added;
+
+    // Allocate log entry
+    if ((log_entry = calloc(1, sizeof(ambit_log_entry_t))) == NULL) {
+        return NULL;
+    }
+
+    log_entry->header.activity_name = NULL;
+
+    if (length < 16) {
+        LOG_ERROR("Log entry too short");
+        free(log_entry);
+        return NULL;
+    }
+
+    buffer_offset = 12;
+    // Read samples content definition
+    spec_len = read16inc(buffer, &buffer_offset);
+    periodic_sample_spec = buffer + buffer_offset;
+    buffer_offset += spec_len;
+    if (buffer_offset + 2 > length) {
+        LOG_ERROR("Log entry sample definition passes end of entry");
+        free(log_entry);
+        return NULL;
+    }
+    // Parse header
+    tmp_len = read16inc(buffer, &buffer_offset);
+    if (buffer_offset + tmp_len > length ||
+        libambit_pmem20_log_parse_header(buffer + buffer_offset, tmp_len, &log_entry->header) != 0) {
+        LOG_ERROR("Failed to parse log entry header correctly");
+        if (log_entry->header.activity_name) {
+            free(log_entry->header.activity_name);
+        }
+        free(log_entry);
+        return NULL;
+    }
+    buffer_offset += tmp_len;
+    if (sample_cb != NULL) {
+        // Samples are passed on as they are parsed, no need to keep them
+        if ((stream = stream_new(log_entry, sample_cb, userref)) == NULL) {
+            if (log_entry->header.activity_name) {
+                free(log_entry->header.activity_name);
+            }
+            free(log_entry);
+            return NULL;
+        }
+    }
+    // Now that we know number of samples, allocate space for them!
+    else if ((log_entry->samples = calloc(log_entry->header.samples_count, sizeof(ambit_log_sample_t))) == NULL) {
+        if (log_entry->header.activity_name) {
+            free(log_entry->header.activity_name);
+        }
+        free(log_entry);
+        return NULL;
+    }
+    else {
+        log_entry->samples_count = log_entry->header.samples_count;
+        // Sample data goes into one arena, if possible
+        log_entry->arena = libambit_arena_new(LIBAMBIT_ARENA_BLOCK_SIZE);
+        if ((time_compensators = calloc(log_entry->header.samples_count, sizeof(int32_t))) == NULL) {
+            libambit_log_entry_free(log_entry);
+            return NULL;
+        }
+    }
+
+    LOG_INFO("Log entry got %d samples, reading", log_entry->header.samples_count);
+
+    added = plan_compile(&plan, periodic_sample_spec, spec_len);
+
+    // OK, so we are at start of samples, get them all!
+    while (added >= 0 && sample_count < log_entry->header.samples_count && buffer_offset + 2 <= length) {
+        sample_len = read16(buffer, buffer_offset);
+        if (buffer_offset + 2 + sample_len > length) {
+            LOG_WARNING("Log sample passes end of log entry");
+            break;
+        }
+
+        if (stream != NULL) {
+            if ((added = stream_sample(stream, buffer, buffer_offset, &plan)) > 0) {
+                sample_count += added;
+            }
+        }
+        else {
+            BENCH_TIMER_START(bench_start);
+            added = parse_sample(buffer, buffer_offset, &plan, log_entry, &sample_count, time_compensators);
+            BENCH_TIMER_STOP(libambit_bench_parse_sample_ns, bench_start);
+        }
+        buffer_offset += 2 + sample_len;
+    }
+
+    // A periodic sample specifier that can't be used fails the entry
+    if (added < 0) {
+        LOG_ERROR("Failed to compile periodic sample specifier");
+        if (stream != NULL) {
+            stream_free(stream, false);
+        }
+        free(time_compensators);
+        plan_free(&plan);
+        libambit_log_entry_free(log_entry);
+        return NULL;
+    }
+
+    if (stream != NULL) {
+        stream_free(stream, true);
+    }
+    else {
+        BENCH_TIMER_START(bench_start);
+        correct_samples(log_entry, time_compensators);
+        BENCH_TIMER_STOP(libambit_bench_correct_samples_ns, bench_start);
+    }
+
+    free(time_compensators);
+    plan_free(&plan);
+
+    return log_entry;
+}
+
+/**
+ * Parse the given sample
+ * \return number of samples added (1 or 0), -1 if a periodic sample
+ * specifier could not be compiled
+ */
+static int parse_sample(uint8_t *buf, size_t offset, periodic_plan_t *plan, ambit_log_entry_t *log_entry, size_t *sample_count, int32_t *time_compensators)
+{
+    int ret = 0;
+    size_t int_offset = offset;
+    uint16_t sample_len = read16inc(buf, &int_offset);
+    uint8_t  sample_type = read8inc(buf, &int_offset);
+    uint8_t  episodic_type;
+    ambit_log_sample_periodic_value_t *values;
+    periodic_plan_entry_t *plan_entry;
+    int i;
+
+    switch (sample_type) {
       case 0:   /* periodic sample specifier */
         // Update specifier on input
-        *spec = buf + offset + 2;
+        if (plan_compile(plan, buf + offset + 2, sample_len) != 0) {
+            ret = -1;
+        }
         break;
       case 2:   /* periodic sample */
         log_entry->samples[*sample_count].type = ambit_log_sample_type_periodic;
         log_entry->samples[*sample_count].time = read32(buf, offset + sample_len - 2);
-        
-        // Loop through specifier and set corresponding fields
-        spec_count = read16(*spec, 1);
-        log_entry->samples[*sample_count].u.periodic.value_count = spec_count;
-        log_entry->samples[*sample_count].u.periodic.values = calloc(spec_count, sizeof(ambit_log_sample_periodic_value_t));
-        for (i=0, spec_entry = (periodic_sample_spec_t*)(*spec + 3); i<spec_count; i++, spec_entry++) {
-            spec_type = le16toh(spec_entry->type);
-            spec_offset = le16toh(spec_entry->offset);
-            switch(spec_type) {
-              case ambit_log_sample_periodic_type_latitude:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_latitude;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.latitude = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_longitude:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_longitude;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.longitude = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_distance:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_distance;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.distance = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_speed:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_speed;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.speed = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_hr:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_hr;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.hr = read8(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_time:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_time;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.time = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_gpsspeed:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_gpsspeed;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.gpsspeed = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_wristaccspeed:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_wristaccspeed;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.wristaccspeed = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_bikepodspeed:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_bikepodspeed;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.bikepodspeed = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_ehpe:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_ehpe;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.ehpe = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_evpe:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_evpe;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.evpe = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_altitude:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_altitude;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.altitude = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_abspressure:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_abspressure;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.abspressure = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_energy:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_energy;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.energy = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_temperature:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_temperature;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.temperature = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_charge:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_charge;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.charge = read8(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_gpsaltitude:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_gpsaltitude;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.gpsaltitude = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_gpsheading:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_gpsheading;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.gpsheading = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_gpshdop:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_gpshdop;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.gpshdop = read8(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_gpsvdop:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_gpsvdop;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.gpsvdop = read8(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_wristcadence:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_wristcadence;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.wristcadence = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_snr:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_snr;
-                memcpy(log_entry->samples[*sample_count].u.periodic.values[i].u.snr, buf + int_offset + spec_offset, 16);
-                break;
-              case ambit_log_sample_periodic_type_noofsatellites:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_noofsatellites;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.noofsatellites = read8(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_sealevelpressure:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_sealevelpressure;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.sealevelpressure = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_verticalspeed:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_verticalspeed;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.verticalspeed = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_cadence:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_cadence;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.cadence = read8(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_bikepower:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_bikepower;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.bikepower = read16(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_swimingstrokecnt:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_swimingstrokecnt;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.swimingstrokecnt = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_ruleoutput1:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_ruleoutput1;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.ruleoutput1 = read32(buf, int_offset + spec_offset);
-                break;
-              case ambit_log_sample_periodic_type_ruleoutput2:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_ruleoutput2;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.ruleoutput2 = read32(buf, int_offset + spec_offset);
+
+        // Set fields as decoded from specifier
+        log_entry->samples[*sample_count].u.periodic.value_count = plan->count;
+        values = log_entry->samples[*sample_count].u.periodic.values = sample_data_alloc(log_entry, plan->count*sizeof(ambit_log_sample_periodic_value_t));
+        for (i=0, plan_entry = plan->entries; i<plan->count; i++, plan_entry++) {
+            values[i].type = plan_entry->type;
+            switch (plan_entry->width) {
+              case 1:
+                values[i].u.hr = read8(buf, int_offset + plan_entry->offset);
                 break;
-              case ambit_log_sample_periodic_type_ruleoutput3:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_ruleoutput3;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.ruleoutput3 = read32(buf, int_offset + spec_offset);
+              case 2:
+                values[i].u.speed = read16(buf, int_offset + plan_entry->offset);
                 break;
-              case ambit_log_sample_periodic_type_ruleoutput4:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_ruleoutput4;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.ruleoutput4 = read32(buf, int_offset + spec_offset);
+              case 4:
+                values[i].u.distance = read32(buf, int_offset + plan_entry->offset);
                 break;
-              case ambit_log_sample_periodic_type_ruleoutput5:
-                log_entry->samples[*sample_count].u.periodic.values[i].type = ambit_log_sample_periodic_type_ruleoutput5;
-                log_entry->samples[*sample_count].u.periodic.values[i].u.ruleoutput5 = read32(buf, int_offset + spec_offset);
+              case 16:
+                memcpy(values[i].u.snr, buf + int_offset + plan_entry->offset, 16);
                 break;
             }
         }
@@ -778,7 +1242,7 @@ static int parse_sample(uint8_t *buf, size_t offset, uint8_t **spec, ambit_log_e
             log_entry->samples[*sample_count].u.gps_base.ehpe = read32inc(buf, &int_offset);
             log_entry->samples[*sample_count].u.gps_base.noofsatellites = read8inc(buf, &int_offset);
             log_entry->samples[*sample_count].u.gps_base.hdop = read8inc(buf, &int_offset);
-            log_entry->samples[*sample_count].u.gps_base.satellites = calloc((sample_len - 40)/4, sizeof(ambit_log_gps_satellite_t));
+            log_entry->samples[*sample_count].u.gps_base.satellites = sample_data_alloc(log_entry, ((sample_len - 40)/4)*sizeof(ambit_log_gps_satellite_t));
             for (i=0; i<(sample_len - 40)/4; i++) {
                 log_entry->samples[*sample_count].u.gps_base.satellites[i].sv = read8inc(buf, &int_offset);
                 log_entry->samples[*sample_count].u.gps_base.satellites[i].state = read8inc(buf, &int_offset);
@@ -856,173 +1320,822 @@ static int parse_sample(uint8_t *buf, size_t offset, uint8_t **spec, ambit_log_e
             LOG_WARNING("Found unknown episodic sample type (0x%02x)", episodic_type);
             log_entry->samples[*sample_count].type = ambit_log_sample_type_unknown;
             log_entry->samples[*sample_count].u.unknown.datalen = sample_len;
-            log_entry->samples[*sample_count].u.unknown.data = malloc(sample_len);
+            log_entry->samples[*sample_count].u.unknown.data = sample_data_alloc(log_entry, sample_len);
             memcpy(log_entry->samples[*sample_count].u.unknown.data, buf + offset + 2, sample_len);
             break;
         }
-        ret = 1;
-        break;
-      default:
-        LOG_WARNING("Found unknown sample type (0x%02x)", sample_type);
-        log_entry->samples[*sample_count].type = ambit_log_sample_type_unknown;
-        log_entry->samples[*sample_count].u.unknown.datalen = sample_len;
-        log_entry->samples[*sample_count].u.unknown.data = malloc(sample_len);
-        memcpy(log_entry->samples[*sample_count].u.unknown.data, buf + offset + 2, sample_len);
-        ret = 1;
-        break;
+        ret = 1;
+        break;
+      default:
+        LOG_WARNING("Found unknown sample type (0x%02x)", sample_type);
+        log_entry->samples[*sample_count].type = ambit_log_sample_type_unknown;
+        log_entry->samples[*sample_count].u.unknown.datalen = sample_len;
+        log_entry->samples[*sample_count].u.unknown.data = sample_data_alloc(log_entry, sample_len);
+        memcpy(log_entry->samples[*sample_count].u.unknown.data, buf + offset + 2, sample_len);
+        ret = 1;
+        break;
+    }
+
+    *sample_count += ret;
+
+    return ret;
+}
+
+static void correct_samples(ambit_log_entry_t *log_entry, int32_t *time_compensators)
+{
+    size_t sample_count, i;
+    ambit_log_sample_t *last_periodic = NULL, *utcsource = NULL, *altisource = NULL;
+    utc_clock_t utc_clock;
+    uint32_t altisource_index = 0;
+    uint32_t last_base_lat = 0, last_base_long = 0;
+    uint32_t last_small_lat = 0, last_small_long = 0;
+    uint32_t last_ehpe = 0;
+    ambit_log_sample_t tmpsample;
+    uint32_t *order, next;
+
+    for (sample_count = 0; sample_count < log_entry->header.samples_count; sample_count++) {
+        // Calculate times
+        if (log_entry->samples[sample_count].type == ambit_log_sample_type_periodic) {
+            last_periodic = &log_entry->samples[sample_count];
+        }
+        else if (last_periodic != NULL) {
+            log_entry->samples[sample_count].time += last_periodic->time;
+        }
+        else {
+            log_entry->samples[sample_count].time = 0;
+        }
+        // Correct with time_compensators
+        if (time_compensators[sample_count] < 0 && log_entry->samples[sample_count].time < (0 - time_compensators[sample_count])) {
+            // Avoid negative times, never set to less than 0
+            log_entry->samples[sample_count].time = 0;
+        }
+        else {
+            log_entry->samples[sample_count].time += time_compensators[sample_count];
+        }
+
+        if (utcsource == NULL && log_entry->samples[sample_count].type == ambit_log_sample_type_gps_base) {
+            utcsource = &log_entry->samples[sample_count];
+            // Calculate UTC base time
+            utc_clock_init(&utc_clock, &utcsource->u.gps_base.utc_base_time, utcsource->time);
+        }
+
+        // Calculate positions
+        if (log_entry->samples[sample_count].type == ambit_log_sample_type_gps_base) {
+            last_base_lat = log_entry->samples[sample_count].u.gps_base.latitude;
+            last_base_long = log_entry->samples[sample_count].u.gps_base.longitude;
+            last_small_lat = log_entry->samples[sample_count].u.gps_base.latitude;
+            last_small_long = log_entry->samples[sample_count].u.gps_base.longitude;
+            last_ehpe = log_entry->samples[sample_count].u.gps_base.ehpe;
+        }
+        else if (log_entry->samples[sample_count].type == ambit_log_sample_type_gps_small) {
+            log_entry->samples[sample_count].u.gps_small.latitude = last_base_lat + log_entry->samples[sample_count].u.gps_small.latitude*10;
+            log_entry->samples[sample_count].u.gps_small.longitude = last_base_long + log_entry->samples[sample_count].u.gps_small.longitude*10;
+            last_small_lat = log_entry->samples[sample_count].u.gps_small.latitude;
+            last_small_long = log_entry->samples[sample_count].u.gps_small.longitude;
+            last_ehpe = log_entry->samples[sample_count].u.gps_small.ehpe;
+        }
+        else if (log_entry->samples[sample_count].type == ambit_log_sample_type_gps_tiny) {
+            log_entry->samples[sample_count].u.gps_tiny.latitude = last_small_lat + log_entry->samples[sample_count].u.gps_tiny.latitude*10;
+            log_entry->samples[sample_count].u.gps_tiny.longitude = last_small_long + log_entry->samples[sample_count].u.gps_tiny.longitude*10;
+            log_entry->samples[sample_count].u.gps_tiny.ehpe = (last_ehpe > 700 ? 700 : last_ehpe);
+            last_small_lat = log_entry->samples[sample_count].u.gps_tiny.latitude;
+            last_small_long = log_entry->samples[sample_count].u.gps_tiny.longitude;
+        }
+
+        if (altisource == NULL && log_entry->samples[sample_count].type == ambit_log_sample_type_altitude_source) {
+            altisource = &log_entry->samples[sample_count];
+            altisource_index = sample_count;
+        }
+    }
+
+    // Loop through samples again and correct times etc
+    for (sample_count = 0; sample_count < log_entry->header.samples_count; sample_count++) {
+        // Set UTC times (if UTC source found)
+        if (utcsource != NULL) {
+            utc_clock_get(&utc_clock, log_entry->samples[sample_count].time, &log_entry->samples[sample_count].utc_time);
+        }
+        // Correct altitude based on altitude offset in altitude source
+        if (altisource != NULL && log_entry->samples[sample_count].type == ambit_log_sample_type_periodic && sample_count < altisource_index) {
+            for (i=0; i<log_entry->samples[sample_count].u.periodic.value_count; i++) {
+                if (log_entry->samples[sample_count].u.periodic.values[i].type == ambit_log_sample_periodic_type_sealevelpressure) {
+                    log_entry->samples[sample_count].u.periodic.values[i].u.sealevelpressure += altisource->u.altitude_source.pressure_offset;
+                }
+                if (log_entry->samples[sample_count].u.periodic.values[i].type == ambit_log_sample_periodic_type_altitude) {
+                    log_entry->samples[sample_count].u.periodic.values[i].u.altitude += altisource->u.altitude_source.altitude_offset;
+                }
+            }
+        }
+    }
+
+    // Rearrange samples in respect to time values
+    for (sample_count = 1; sample_count < log_entry->header.samples_count; sample_count++) {
+        // Look for bad sorted samples
+        if (log_entry->samples[sample_count].time < log_entry->samples[sample_count-1].time) {
+            break;
+        }
+    }
+    if (sample_count >= log_entry->header.samples_count) {
+        return;
+    }
+
+    if ((order = malloc(log_entry->header.samples_count*sizeof(uint32_t))) == NULL) {
+        LOG_ERROR("Failed to allocate sample order, samples left unsorted");
+        return;
+    }
+    for (i = 0; i < log_entry->header.samples_count; i++) {
+        order[i] = i;
+    }
+    if (libambit_stable_order(order, log_entry->header.samples_count, compare_sample_time, log_entry->samples) != 0) {
+        LOG_ERROR("Failed to sort samples, samples left unsorted");
+        free(order);
+        return;
+    }
+
+    // Apply permutation in place, one cycle at a time, so that each sample
+    // is moved once
+    for (i = 0; i < log_entry->header.samples_count; i++) {
+        if (order[i] != i) {
+            memcpy(&tmpsample, &log_entry->samples[i], sizeof(ambit_log_sample_t));
+            sample_count = i;
+            while (order[sample_count] != i) {
+                next = order[sample_count];
+                memcpy(&log_entry->samples[sample_count], &log_entry->samples[next], sizeof(ambit_log_sample_t));
+                order[sample_count] = sample_count;
+                sample_count = next;
+            }
+            memcpy(&log_entry->samples[sample_count], &tmpsample, sizeof(ambit_log_sample_t));
+            order[sample_count] = sample_count;
+        }
+    }
+    free(order);
+}
+
+static int compare_sample_time(const void *userref, uint32_t a, uint32_t b)
+{
+    const ambit_log_sample_t *samples = userref;
+
+    if (samples[a].time < samples[b].time) {
+        return -1;
+    }
+    return (samples[a].time > samples[b].time ? 1 : 0);
+}
+
+static sample_stream_t *stream_new(ambit_log_entry_t *log_entry, ambit_log_sample_cb sample_cb, void *userref)
+{
+    sample_stream_t *stream;
+
+    if ((stream = calloc(1, sizeof(sample_stream_t))) != NULL) {
+        stream->log_entry = log_entry;
+        stream->sample_cb = sample_cb;
+        stream->userref = userref;
+    }
+
+    return stream;
+}
+
+/**
+ * Parse the given sample, and do the same corrections as correct_samples()
+ * as far as they are known by now. The sample is then held back in a
+ * window until it is passed on, so that samples can be put in time order
+ * and corrected with data from later samples.
+ * \return number of samples added (1 or 0), -1 if a periodic sample
+ * specifier could not be compiled
+ */
+static int stream_sample(sample_stream_t *stream, uint8_t *buf, size_t offset, periodic_plan_t *plan)
+{
+    ambit_log_entry_t *log_entry = stream->log_entry;
+    ambit_log_sample_t *sample = &stream->sample;
+    ambit_log_sample_t *held;
+    size_t sample_count = 0, pos, i, j;
+    int ret;
+
+    memset(sample, 0, sizeof(ambit_log_sample_t));
+    stream->time_compensator = 0;
+
+    // Let parse_sample fill in our single sample
+    log_entry->samples = sample;
+    BENCH_TIMER_START(bench_start);
+    ret = parse_sample(buf, offset, plan, log_entry, &sample_count, &stream->time_compensator);
+    BENCH_TIMER_STOP(libambit_bench_parse_sample_ns, bench_start);
+    log_entry->samples = NULL;
+
+    if (ret < 0) {
+        return -1;
+    }
+    if (sample_count == 0) {
+        return 0;
+    }
+
+    // Calculate times
+    if (sample->type == ambit_log_sample_type_periodic) {
+        stream->have_periodic = true;
+    }
+    else if (stream->have_periodic) {
+        sample->time += stream->last_periodic_time;
+    }
+    else {
+        sample->time = 0;
+    }
+    // Correct with time compensator
+    if (stream->time_compensator < 0 && sample->time < (0 - stream->time_compensator)) {
+        // Avoid negative times, never set to less than 0
+        sample->time = 0;
+    }
+    else {
+        sample->time += stream->time_compensator;
+    }
+    if (sample->type == ambit_log_sample_type_periodic) {
+        stream->last_periodic_time = sample->time;
+    }
+
+    if (!stream->have_utc && sample->type == ambit_log_sample_type_gps_base) {
+        // Calculate UTC base time
+        stream->have_utc = true;
+        utc_clock_init(&stream->utc_clock, &sample->u.gps_base.utc_base_time, sample->time);
+    }
+
+    // Calculate positions
+    if (sample->type == ambit_log_sample_type_gps_base) {
+        stream->last_base_lat = sample->u.gps_base.latitude;
+        stream->last_base_long = sample->u.gps_base.longitude;
+        stream->last_small_lat = sample->u.gps_base.latitude;
+        stream->last_small_long = sample->u.gps_base.longitude;
+        stream->last_ehpe = sample->u.gps_base.ehpe;
+    }
+    else if (sample->type == ambit_log_sample_type_gps_small) {
+        sample->u.gps_small.latitude = stream->last_base_lat + sample->u.gps_small.latitude*10;
+        sample->u.gps_small.longitude = stream->last_base_long + sample->u.gps_small.longitude*10;
+        stream->last_small_lat = sample->u.gps_small.latitude;
+        stream->last_small_long = sample->u.gps_small.longitude;
+        stream->last_ehpe = sample->u.gps_small.ehpe;
+    }
+    else if (sample->type == ambit_log_sample_type_gps_tiny) {
+        sample->u.gps_tiny.latitude = stream->last_small_lat + sample->u.gps_tiny.latitude*10;
+        sample->u.gps_tiny.longitude = stream->last_small_long + sample->u.gps_tiny.longitude*10;
+        sample->u.gps_tiny.ehpe = (stream->last_ehpe > 700 ? 700 : stream->last_ehpe);
+        stream->last_small_lat = sample->u.gps_tiny.latitude;
+        stream->last_small_long = sample->u.gps_tiny.longitude;
+    }
+
+    // Correct altitude of held samples based on altitude offset in altitude
+    // source. Samples already passed on can not be corrected.
+    if (!stream->have_altisource && sample->type == ambit_log_sample_type_altitude_source) {
+        stream->have_altisource = true;
+        stream->altitude_offset = sample->u.altitude_source.altitude_offset;
+        stream->pressure_offset = sample->u.altitude_source.pressure_offset;
+        for (i=0; i<stream->window_count; i++) {
+            held = &stream->window[(stream->window_start + i) % PMEM20_LOG_STREAM_WINDOW];
+            if (held->type == ambit_log_sample_type_periodic) {
+                for (j=0; j<held->u.periodic.value_count; j++) {
+                    if (held->u.periodic.values[j].type == ambit_log_sample_periodic_type_sealevelpressure) {
+                        held->u.periodic.values[j].u.sealevelpressure += stream->pressure_offset;
+                    }
+                    if (held->u.periodic.values[j].type == ambit_log_sample_periodic_type_altitude) {
+                        held->u.periodic.values[j].u.altitude += stream->altitude_offset;
+                    }
+                }
+            }
+        }
+    }
+
+    if (stream->window_count == PMEM20_LOG_STREAM_WINDOW) {
+        stream_emit(stream);
+    }
+
+    // Put sample after held samples with lower or equal time
+    for (pos = stream->window_count; pos > 0; pos--) {
+        if (stream->window[(stream->window_start + pos - 1) % PMEM20_LOG_STREAM_WINDOW].time <= sample->time) {
+            break;
+        }
+    }
+    for (i = stream->window_count; i > pos; i--) {
+        stream->window[(stream->window_start + i) % PMEM20_LOG_STREAM_WINDOW] = stream->window[(stream->window_start + i - 1) % PMEM20_LOG_STREAM_WINDOW];
+    }
+    stream->window[(stream->window_start + pos) % PMEM20_LOG_STREAM_WINDOW] = *sample;
+    stream->window_count++;
+
+    return 1;
+}
+
+static void stream_emit(sample_stream_t *stream)
+{
+    ambit_log_sample_t *sample = &stream->window[stream->window_start];
+
+    // Set UTC time (if UTC source found)
+    if (stream->have_utc) {
+        utc_clock_get(&stream->utc_clock, sample->time, &sample->utc_time);
+    }
+
+    stream->sample_cb(stream->userref, &stream->log_entry->header, sample);
+    free_sample_data(sample);
+
+    stream->window_start = (stream->window_start + 1) % PMEM20_LOG_STREAM_WINDOW;
+    stream->window_count--;
+}
+
+static void stream_free(sample_stream_t *stream, bool flush)
+{
+    while (stream->window_count > 0) {
+        if (flush) {
+            stream_emit(stream);
+        }
+        else {
+            free_sample_data(&stream->window[stream->window_start]);
+            stream->window_start = (stream->window_start + 1) % PMEM20_LOG_STREAM_WINDOW;
+            stream->window_count--;
+        }
     }
 
-    *sample_count += ret;
+    free(stream);
+}
 
-    return ret;
+static void free_sample_data(ambit_log_sample_t *sample)
+{
+    if (sample->type == ambit_log_sample_type_periodic && sample->u.periodic.values != NULL) {
+        free(sample->u.periodic.values);
+    }
+    if (sample->type == ambit_log_sample_type_gps_base && sample->u.gps_base.satellites != NULL) {
+        free(sample->u.gps_base.satellites);
+    }
+    if (sample->type == ambit_log_sample_type_unknown && sample->u.unknown.data != NULL) {
+        free(sample->u.unknown.data);
+    }
 }
 
-static void correct_samples(ambit_log_entry_t *log_entry, int32_t *time_compensators)
+static void *sample_data_alloc(ambit_log_entry_t *log_entry, size_t size)
 {
-    size_t sample_count, i;
-    ambit_log_sample_t *last_periodic = NULL, *utcsource = NULL, *altisource = NULL;
-    ambit_date_time_t utcbase;
-    uint32_t altisource_index = 0;
-    uint32_t last_base_lat = 0, last_base_long = 0;
-    uint32_t last_small_lat = 0, last_small_long = 0;
-    uint32_t last_ehpe = 0;
-    ambit_log_sample_t tmpsample;
+    if (log_entry->arena != NULL) {
+        return libambit_arena_alloc(log_entry->arena, size);
+    }
 
-    for (sample_count = 0; sample_count < log_entry->header.samples_count; sample_count++) {
-        // Calculate times
-        if (log_entry->samples[sample_count].type == ambit_log_sample_type_periodic) {
-            last_periodic = &log_entry->samples[sample_count];
+    return calloc(1, size);
+}
+
+/**
+ * Decode periodic sample specifier into a plan, which is then used for all
+ * following periodic samples
+ * \param spec Specifier, starting with the sample type
+ * \param spec_len Length of specifier
+ * \return 0 on success, else -1
+ */
+static int plan_compile(periodic_plan_t *plan, const uint8_t *spec, size_t spec_len)
+{
+    periodic_plan_entry_t *entries;
+    const periodic_sample_spec_t *spec_entry;
+    uint16_t count, spec_type, i;
+
+    plan->count = 0;
+
+    if (spec_len < 3) {
+        return 0;
+    }
+
+    count = read16(spec, 1);
+    if (count > (spec_len - 3) / sizeof(periodic_sample_spec_t)) {
+        LOG_WARNING("Periodic sample specifier truncated");
+        count = (spec_len - 3) / sizeof(periodic_sample_spec_t);
+    }
+
+    if (count > plan->allocated) {
+        if ((entries = realloc(plan->entries, count*sizeof(periodic_plan_entry_t))) == NULL) {
+            return -1;
         }
-        else if (last_periodic != NULL) {
-            log_entry->samples[sample_count].time += last_periodic->time;
+        plan->entries = entries;
+        plan->allocated = count;
+    }
+
+    for (i=0, spec_entry = (const periodic_sample_spec_t*)(spec + 3); i<count; i++, spec_entry++) {
+        spec_type = le16toh(spec_entry->type);
+        if (spec_type < sizeof(periodic_value_width) && periodic_value_width[spec_type] != 0) {
+            plan->entries[i].type = spec_type;
+            plan->entries[i].width = periodic_value_width[spec_type];
         }
         else {
-            log_entry->samples[sample_count].time = 0;
+            plan->entries[i].type = 0;
+            plan->entries[i].width = 0;
         }
-        // Correct with time_compensators
-        if (time_compensators[sample_count] < 0 && log_entry->samples[sample_count].time < (0 - time_compensators[sample_count])) {
-            // Avoid negative times, never set to less than 0
-            log_entry->samples[sample_count].time = 0;
+        plan->entries[i].offset = le16toh(spec_entry->offset);
+    }
+    plan->count = count;
+
+    return 0;
+}
+
+static void plan_free(periodic_plan_t *plan)
+{
+    if (plan->entries != NULL) {
+        free(plan->entries);
+    }
+    plan->entries = NULL;
+    plan->count = 0;
+    plan->allocated = 0;
+}
+
+/**
+ * Get log data, reading chunks not already in memory from the device.
+ * Data past the end of the log area continues at
+ * PMEM20_LOG_WRAP_START_OFFSET, just like the device writes it.
+ * \param offset Offset from start of log area
+ * \param length Number of bytes needed
+ * \return Pointer to continuous data, valid until next call, or NULL on error
+ */
+static uint8_t *log_data(libambit_pmem20_t *object, size_t offset, size_t length)
+{
+    uint32_t chunk;
+    size_t chunk_offset, count, copied = 0, part, end, i;
+
+    if (object->log.chunk_slots == NULL ||
+        offset >= object->log.mem_size || length == 0 || length > PMEM20_LOG_WRAP_BUFFER_MARGIN + 2) {
+        return NULL;
+    }
+
+    // Common case, all data in one chunk
+    chunk = offset / object->chunk_size;
+    chunk_offset = offset % object->chunk_size;
+    if (chunk_offset + length <= object->chunk_size && offset + length <= object->log.mem_size) {
+        if (load_chunks(object, chunk, readahead_count(object, chunk, 1)) != 0) {
+            return NULL;
         }
-        else {
-            log_entry->samples[sample_count].time += time_compensators[sample_count];
+        object->log.last_chunk = chunk;
+        return object->log.slot_data + (object->log.chunk_slots[chunk]-1)*object->chunk_size + chunk_offset;
+    }
+
+    // Otherwise put the parts together
+    while (copied < length) {
+        if (offset >= object->log.mem_size) {
+            offset = PMEM20_LOG_WRAP_START_OFFSET + (offset - object->log.mem_size);
+        }
+        end = offset + (length - copied);
+        if (end > object->log.mem_size) {
+            end = object->log.mem_size;
+        }
+        chunk = offset / object->chunk_size;
+        count = (end - 1) / object->chunk_size - chunk + 1;
+        if (count > PMEM20_LOG_PIPELINE_DEPTH_MAX) {
+            count = PMEM20_LOG_PIPELINE_DEPTH_MAX;
         }
 
-        if (utcsource == NULL && log_entry->samples[sample_count].type == ambit_log_sample_type_gps_base) {
-            utcsource = &log_entry->samples[sample_count];
-            // Calculate UTC base time
-            add_time(&utcsource->u.gps_base.utc_base_time, 0-utcsource->time, &utcbase);
+        if (load_chunks(object, chunk, readahead_count(object, chunk, count)) != 0) {
+            return NULL;
         }
+        object->log.last_chunk = chunk + count - 1;
 
-        // Calculate positions
-        if (log_entry->samples[sample_count].type == ambit_log_sample_type_gps_base) {
-            last_base_lat = log_entry->samples[sample_count].u.gps_base.latitude;
-            last_base_long = log_entry->samples[sample_count].u.gps_base.longitude;
-            last_small_lat = log_entry->samples[sample_count].u.gps_base.latitude;
-            last_small_long = log_entry->samples[sample_count].u.gps_base.longitude;
-            last_ehpe = log_entry->samples[sample_count].u.gps_base.ehpe;
+        for (i=0; i<count; i++) {
+            chunk_offset = offset - (chunk + i)*object->chunk_size;
+            part = object->chunk_size - chunk_offset;
+            if (offset + part > end) {
+                part = end - offset;
+            }
+            memcpy(object->log.buffer + copied, object->log.slot_data + (object->log.chunk_slots[chunk + i]-1)*object->chunk_size + chunk_offset, part);
+            copied += part;
+            offset += part;
         }
-        else if (log_entry->samples[sample_count].type == ambit_log_sample_type_gps_small) {
-            log_entry->samples[sample_count].u.gps_small.latitude = last_base_lat + log_entry->samples[sample_count].u.gps_small.latitude*10;
-            log_entry->samples[sample_count].u.gps_small.longitude = last_base_long + log_entry->samples[sample_count].u.gps_small.longitude*10;
-            last_small_lat = log_entry->samples[sample_count].u.gps_small.latitude;
-            last_small_long = log_entry->samples[sample_count].u.gps_small.longitude;
-            last_ehpe = log_entry->samples[sample_count].u.gps_small.ehpe;
+    }
+
+    return object->log.buffer;
+}
+
+/**
+ * Number of chunks to load for an access, including read-ahead. Only
+ * sequential accesses inside an entry read by log_read_entry() read ahead,
+ * and never past the end of the entry or the log area.
+ * \param first First chunk needed
+ * \param count Number of chunks needed
+ * \return Number of chunks to load, starting at first
+ */
+static size_t readahead_count(libambit_pmem20_t *object, uint32_t first, size_t count)
+{
+    uint32_t last_chunk;
+    size_t i;
+    bool missing = false;
+
+    if (object->log.readahead_end == 0 ||
+        (first != object->log.last_chunk && first != object->log.last_chunk + 1)) {
+        return count;
+    }
+
+    for (i=0; !missing && i<count; i++) {
+        missing = (object->log.chunk_slots[first + i] == 0);
+    }
+    if (!missing) {
+        return count;
+    }
+
+    // Entries wrapping around the log area end before the current position
+    if (object->log.readahead_end > first*object->chunk_size) {
+        last_chunk = (object->log.readahead_end - 1)/object->chunk_size;
+    }
+    else {
+        last_chunk = (object->log.mem_size - 1)/object->chunk_size;
+    }
+
+    count += PMEM20_LOG_READAHEAD_CHUNKS;
+    if (count > PMEM20_LOG_PIPELINE_DEPTH_MAX) {
+        count = PMEM20_LOG_PIPELINE_DEPTH_MAX;
+    }
+    if (first + count > last_chunk + 1) {
+        count = last_chunk + 1 - first;
+    }
+
+    return count;
+}
+
+static int load_chunks(libambit_pmem20_t *object, uint32_t first, size_t count)
+{
+    log_chunk_request_t requests[PMEM20_LOG_PIPELINE_DEPTH_MAX];
+    size_t request_slots[PMEM20_LOG_PIPELINE_DEPTH_MAX];
+    size_t request_count = 0;
+    size_t slot, i;
+
+    for (i=0; i<count; i++) {
+        if (object->log.chunk_slots[first + i] != 0) {
+            // Already read, mark as recently used so that it is not
+            // evicted in favour of the missing ones
+            object->log.slots[object->log.chunk_slots[first + i]-1].last_use = ++object->log.use_count;
         }
-        else if (log_entry->samples[sample_count].type == ambit_log_sample_type_gps_tiny) {
-            log_entry->samples[sample_count].u.gps_tiny.latitude = last_small_lat + log_entry->samples[sample_count].u.gps_tiny.latitude*10;
-            log_entry->samples[sample_count].u.gps_tiny.longitude = last_small_long + log_entry->samples[sample_count].u.gps_tiny.longitude*10;
-            log_entry->samples[sample_count].u.gps_tiny.ehpe = (last_ehpe > 700 ? 700 : last_ehpe);
-            last_small_lat = log_entry->samples[sample_count].u.gps_tiny.latitude;
-            last_small_long = log_entry->samples[sample_count].u.gps_tiny.longitude;
+        else {
+            slot = evict_slot(object);
+            object->log.slots[slot].chunk = first + i;
+            object->log.slots[slot].last_use = ++object->log.use_count;
+            requests[request_count].address = object->log.mem_start + (first + i)*object->chunk_size;
+            requests[request_count].length = object->chunk_size;
+            requests[request_count].buffer = object->log.slot_data + slot*object->chunk_size;
+            request_slots[request_count] = slot;
+            request_count++;
         }
+    }
 
-        if (altisource == NULL && log_entry->samples[sample_count].type == ambit_log_sample_type_altitude_source) {
-            altisource = &log_entry->samples[sample_count];
-            altisource_index = sample_count;
+    if (request_count > 0 && read_log_chunks(object, requests, request_count) != 0) {
+        for (i=0; i<request_count; i++) {
+            object->log.slots[request_slots[i]].chunk = PMEM20_LOG_CHUNK_NONE;
+            object->log.slots[request_slots[i]].last_use = 0;
         }
+        log_resume_save(object);
+        return -1;
     }
 
-    // Loop through samples again and correct times etc
-    for (sample_count = 0; sample_count < log_entry->header.samples_count; sample_count++) {
-        // Set UTC times (if UTC source found)
-        if (utcsource != NULL) {
-            add_time(&utcbase, log_entry->samples[sample_count].time, &log_entry->samples[sample_count].utc_time);
-        }
-        // Correct altitude based on altitude offset in altitude source
-        if (altisource != NULL && log_entry->samples[sample_count].type == ambit_log_sample_type_periodic && sample_count < altisource_index) {
-            for (i=0; i<log_entry->samples[sample_count].u.periodic.value_count; i++) {
-                if (log_entry->samples[sample_count].u.periodic.values[i].type == ambit_log_sample_periodic_type_sealevelpressure) {
-                    log_entry->samples[sample_count].u.periodic.values[i].u.sealevelpressure += altisource->u.altitude_source.pressure_offset;
-                }
-                if (log_entry->samples[sample_count].u.periodic.values[i].type == ambit_log_sample_periodic_type_altitude) {
-                    log_entry->samples[sample_count].u.periodic.values[i].u.altitude += altisource->u.altitude_source.altitude_offset;
-                }
-            }
+    for (i=0; i<request_count; i++) {
+        object->log.chunk_slots[object->log.slots[request_slots[i]].chunk] = request_slots[i] + 1;
+    }
+
+    return 0;
+}
+
+static size_t evict_slot(libambit_pmem20_t *object)
+{
+    size_t slot = 0, i;
+
+    // Least recently used, unused slots first
+    for (i=1; i<object->log.slot_count; i++) {
+        if (object->log.slots[i].last_use < object->log.slots[slot].last_use) {
+            slot = i;
         }
     }
 
-    // Rearrange samples in respect to time values
-    for (sample_count = 1; sample_count < log_entry->header.samples_count; sample_count++) {
-        // Look for bad sorted samples
-        if (log_entry->samples[sample_count].time < log_entry->samples[sample_count-1].time) {
-            // Find out new position of sample
-            for (i = sample_count - 1; i > 0; i--) {
-                if (log_entry->samples[sample_count].time >= log_entry->samples[i-1].time) {
-                    break;
-                }
-            }
-            memcpy(&tmpsample, &log_entry->samples[sample_count], sizeof(ambit_log_sample_t));
-            memmove(&log_entry->samples[i+1], &log_entry->samples[i], sizeof(ambit_log_sample_t)*(sample_count-i));
-            memcpy(&log_entry->samples[i], &tmpsample, sizeof(ambit_log_sample_t));
+    if (object->log.slots[slot].chunk != PMEM20_LOG_CHUNK_NONE) {
+        object->log.chunk_slots[object->log.slots[slot].chunk] = 0;
+        object->log.slots[slot].chunk = PMEM20_LOG_CHUNK_NONE;
+    }
+
+    return slot;
+}
+
+/**
+ * Hand read log data over to the resume store of the device, so that a
+ * later connection can continue without reading it again. The log cache
+ * is left unusable until the next libambit_pmem20_log_init()
+ */
+static void log_resume_save(libambit_pmem20_t *object)
+{
+    libambit_pmem20_log_resume_t *resume;
+    bool have_data = (object->log.partial.buffer != NULL);
+    size_t i;
+
+    if (object->ambit_object == NULL || (resume = object->ambit_object->log_resume) == NULL) {
+        return;
+    }
+
+    for (i=0; !have_data && i<object->log.slot_count; i++) {
+        have_data = (object->log.slots[i].chunk != PMEM20_LOG_CHUNK_NONE);
+    }
+    if (!have_data) {
+        return;
+    }
+
+    libambit_pmem20_log_resume_clear(resume);
+    resume->saved_at = libambit_monotonic_time_us()/1000;
+    resume->mem_start = object->log.mem_start;
+    resume->mem_size = object->log.mem_size;
+    resume->chunk_size = object->chunk_size;
+    resume->last_entry = object->log.last_entry;
+    resume->next_free_address = object->log.next_free_address;
+    resume->chunk_slots = object->log.chunk_slots;
+    resume->slots = object->log.slots;
+    resume->slot_data = object->log.slot_data;
+    resume->slot_count = object->log.slot_count;
+    resume->use_count = object->log.use_count;
+    resume->partial.address = object->log.partial.address;
+    resume->partial.length = object->log.partial.length;
+    resume->partial.fetched = object->log.partial.fetched;
+    resume->partial.buffer = object->log.partial.buffer;
+
+    object->log.chunk_slots = NULL;
+    object->log.slots = NULL;
+    object->log.slot_data = NULL;
+    object->log.partial.buffer = NULL;
+
+    LOG_INFO("Saved read log data for resume");
+}
+
+/**
+ * Take over log data saved by log_resume_save(), if it is recent and
+ * matches the current memory layout. The first chunk is dropped, so that
+ * the PMEM header is always read from the device
+ * \return true if data was taken over
+ */
+static bool log_resume_restore(libambit_pmem20_t *object)
+{
+    libambit_pmem20_log_resume_t *resume;
+    size_t slot;
+
+    if (object->ambit_object == NULL || (resume = object->ambit_object->log_resume) == NULL ||
+        resume->saved_at == 0) {
+        return false;
+    }
+
+    if (libambit_monotonic_time_us()/1000 - resume->saved_at > PMEM20_LOG_RESUME_WINDOW ||
+        resume->mem_start != object->log.mem_start || resume->mem_size != object->log.mem_size ||
+        resume->chunk_size != object->chunk_size || resume->slot_count != object->log.slot_count) {
+        LOG_INFO("Saved log data expired or of other layout, discarding");
+        libambit_pmem20_log_resume_clear(resume);
+        return false;
+    }
+
+    free(object->log.chunk_slots);
+    free(object->log.slots);
+    free(object->log.slot_data);
+    object->log.chunk_slots = resume->chunk_slots;
+    object->log.slots = resume->slots;
+    object->log.slot_data = resume->slot_data;
+    object->log.use_count = resume->use_count;
+    object->log.partial.address = resume->partial.address;
+    object->log.partial.length = resume->partial.length;
+    object->log.partial.fetched = resume->partial.fetched;
+    object->log.partial.buffer = resume->partial.buffer;
+    object->log.last_entry = resume->last_entry;
+    object->log.next_free_address = resume->next_free_address;
+
+    // Ownership has moved to the log cache
+    memset(resume, 0, sizeof(libambit_pmem20_log_resume_t));
+
+    if (object->log.chunk_slots[0] != 0) {
+        slot = object->log.chunk_slots[0] - 1;
+        object->log.slots[slot].chunk = PMEM20_LOG_CHUNK_NONE;
+        object->log.slots[slot].last_use = 0;
+        object->log.chunk_slots[0] = 0;
+    }
+
+    LOG_INFO("Resuming with log data read by earlier connection");
+
+    return true;
+}
+
+/**
+ * Drop all cached log data
+ */
+static void log_cache_flush(libambit_pmem20_t *object)
+{
+    size_t i;
+
+    for (i=0; i<object->log.slot_count; i++) {
+        if (object->log.slots[i].chunk != PMEM20_LOG_CHUNK_NONE) {
+            object->log.chunk_slots[object->log.slots[i].chunk] = 0;
+            object->log.slots[i].chunk = PMEM20_LOG_CHUNK_NONE;
+            object->log.slots[i].last_use = 0;
         }
     }
+
+    free(object->log.partial.buffer);
+    object->log.partial.buffer = NULL;
 }
 
-static int read_upto(libambit_pmem20_t *object, uint32_t address, uint32_t length)
+static int read_log_chunks(libambit_pmem20_t *object, log_chunk_request_t *requests, size_t count)
 {
-    uint32_t start_address = address - ((address - object->log.mem_start) % object->chunk_size);
+    bool done[PMEM20_LOG_PIPELINE_DEPTH_MAX];
+    size_t remaining = count, i;
+    unsigned int attempt;
+
+    memset(done, 0, sizeof(done));
 
-    while (start_address < address + length) {
-        if (object->log.chunks_read[(start_address - object->log.mem_start)/object->chunk_size] == 0) {
-            if (read_log_chunk(object, start_address, object->chunk_size, object->log.buffer + (start_address - object->log.mem_start)) != 0) {
-                return -1;
+    remaining -= read_log_chunks_pass(object, requests, count, done);
+
+    // Only resend the requests that did not get a complete reply
+    for (attempt=0; remaining > 0 && attempt < object->read_retries; attempt++) {
+        LOG_WARNING("Retrying %d of %d log chunk reads (retry %d of %d)", (int)remaining, (int)count, attempt + 1, object->read_retries);
+        usleep((PMEM20_LOG_READ_RETRY_DELAY << attempt)*1000);
+        for (i=0; i<count; i++) {
+            if (!done[i]) {
+                libambit_protocol_retry_count(object->ambit_object, ambit_command_log_read);
             }
-            object->log.chunks_read[(start_address - object->log.mem_start)/object->chunk_size] = 1;
         }
-        start_address += object->chunk_size;
+        remaining -= read_log_chunks_pass(object, requests, count, done);
     }
 
-    return 0;
+    return remaining == 0 ? 0 : -1;
 }
 
-static int read_log_chunk(libambit_pmem20_t *object, uint32_t address, uint32_t length, uint8_t *buffer)
+/**
+ * Send all requests not marked as done, and read their replies
+ * \param done Per request, set when the reply has been stored
+ * \return Number of requests completed by this pass
+ */
+static size_t read_log_chunks_pass(libambit_pmem20_t *object, log_chunk_request_t *requests, size_t count, bool *done)
 {
-    int ret = -1;
+    int ret = 0;
+    size_t next = 0, outstanding = 0, completed = 0;
+    size_t index;
 
-    uint8_t *reply = NULL;
+    // Replies are stored directly in the request buffers, skipping the
+    // address and length fields
+    libambit_protocol_reply_buffer_t replies[PMEM20_LOG_PIPELINE_DEPTH_MAX];
+    size_t reply_requests[PMEM20_LOG_PIPELINE_DEPTH_MAX];
     size_t replylen = 0;
 
-    uint8_t send_data[8];
-    uint32_t *_address = (uint32_t*)&send_data[0];
-    uint32_t *_length = (uint32_t*)&send_data[4];
+    while (ret == 0 && (next < count || outstanding > 0)) {
+        // Keep up to pipeline_depth requests in flight
+        while (next < count && outstanding < object->pipeline_depth) {
+            if (done[next]) {
+                next++;
+                continue;
+            }
+            if (send_log_chunk_request(object, &requests[next]) != 0) {
+                ret = -1;
+                break;
+            }
+            replies[outstanding].sequence = requests[next].sequence;
+            replies[outstanding].buffer = requests[next].buffer;
+            replies[outstanding].size = requests[next].length;
+            replies[outstanding].skip = 8;
+            reply_requests[outstanding] = next;
+            next++;
+            outstanding++;
+        }
 
-    if ((address + object->chunk_size) > (object->log.mem_start + object->log.mem_size)) {
-        length = object->log.mem_start + object->log.mem_size - address;
+        if (ret != 0 || outstanding == 0) {
+            break;
+        }
+
+        // Match reply to one of the outstanding requests
+        if (libambit_protocol_command_receive_into(object->ambit_object, replies, outstanding, &index, &replylen) != 0) {
+            LOG_WARNING("Failed to read log chunk reply");
+            ret = -1;
+            break;
+        }
+
+        if (replylen == requests[reply_requests[index]].length + 8) {
+            done[reply_requests[index]] = true;
+            completed++;
+        }
+        else {
+            LOG_WARNING("Log chunk reply of unexpected length %d", (int)replylen);
+            ret = -1;
+        }
+
+        outstanding--;
+        replies[index] = replies[outstanding];
+        reply_requests[index] = reply_requests[outstanding];
+    }
+
+    // Collect replies to requests still in flight, so that they are not
+    // mistaken for replies to later commands. Complete ones need no resend
+    while (outstanding > 0 &&
+           libambit_protocol_command_receive_into(object->ambit_object, replies, outstanding, &index, &replylen) == 0) {
+        if (replylen == requests[reply_requests[index]].length + 8) {
+            done[reply_requests[index]] = true;
+            completed++;
+        }
+        outstanding--;
+        replies[index] = replies[outstanding];
+        reply_requests[index] = reply_requests[outstanding];
     }
 
-    *_address = htole32(address);
-    *_length = htole32(length);
+    return completed;
+}
+
+static int send_log_chunk_request(libambit_pmem20_t *object, log_chunk_request_t *request)
+{
+    uint8_t send_data[8];
+    uint32_t *_address = (uint32_t*)&send_data[0];
+    uint32_t *_length = (uint32_t*)&send_data[4];
 
-    if (libambit_protocol_command(object->ambit_object, ambit_command_log_read, send_data, sizeof(send_data), &reply, &replylen, 0) == 0 &&
-        replylen == length + 8) {
-        memcpy(buffer, reply + 8, length);
-        ret = 0;
+    if ((request->address + request->length) > (object->log.mem_start + object->log.mem_size)) {
+        request->length = object->log.mem_start + object->log.mem_size - request->address;
     }
 
-    libambit_protocol_free(reply);
+    *_address = htole32(request->address);
+    *_length = htole32(request->length);
 
-    return ret;
+    return libambit_protocol_command_send(object->ambit_object, ambit_command_log_read, send_data, sizeof(send_data), 0, &request->sequence);
 }
 
 static int write_data_chunk(ambit_object_t *object, uint32_t address, size_t buffer_count, const uint8_t **buffers, const size_t *buffer_sizes)
@@ -1065,37 +2178,86 @@ static int write_data_chunk(ambit_object_t *object, uint32_t address, size_t buf
     return ret;
 }
 
-static void add_time(ambit_date_time_t *intime, int32_t offset, ambit_date_time_t *outtime)
+/**
+ * Write data chunk, unless it has the same hash as the chunk previously
+ * written at the same place
+ * \param total_ctx Hash of all data, updated with chunk if not NULL
+ * \param hash Filled with hash of chunk, if not NULL
+ * \param old_hash Hash of previously written chunk, or NULL if unknown
+ * \return 1 if written, 0 if skipped, -1 on error
+ */
+static int write_orbit_chunk(ambit_object_t *object, uint32_t address, size_t buffer_count, const uint8_t **buffers, const size_t *buffer_sizes, sha256_ctx *total_ctx, uint8_t *hash, const uint8_t *old_hash)
 {
-    struct timeval timeval;
-    struct tm *tm;
-
-    to_timeval(intime, &timeval);
+    sha256_ctx ctx;
+    size_t i;
 
-    if (offset >= 0) {
-        timeval.tv_sec += offset / 1000;
-        timeval.tv_usec += (offset % 1000)*1000;
+    if (total_ctx != NULL) {
+        for (i=0; i<buffer_count; i++) {
+            sha256_update(total_ctx, buffers[i], buffer_sizes[i]);
+        }
     }
-    else {
-        timeval.tv_sec += offset / 1000;
-        timeval.tv_usec -= (abs(offset) % 1000)*1000;
+
+    if (hash != NULL) {
+        sha256_init(&ctx);
+        for (i=0; i<buffer_count; i++) {
+            sha256_update(&ctx, buffers[i], buffer_sizes[i]);
+        }
+        sha256_final(&ctx, hash);
+
+        if (old_hash != NULL && memcmp(hash, old_hash, 32) == 0) {
+            return 0;
+        }
     }
-    if (timeval.tv_usec >= 1000000) {
-        timeval.tv_sec++;
-        timeval.tv_usec -= 1000000;
+
+    return (write_data_chunk(object, address, buffer_count, buffers, buffer_sizes) == 0 ? 1 : -1);
+}
+
+/**
+ * Setup clock for converting sample times to UTC
+ * \param utc_time UTC time at sample time \a time
+ * \param time Sample time
+ */
+static void utc_clock_init(utc_clock_t *clock, ambit_date_time_t *utc_time, uint32_t time)
+{
+    struct timeval timeval;
+
+    to_timeval(utc_time, &timeval);
+    clock->base_msec = (int64_t)timeval.tv_sec*1000 + timeval.tv_usec/1000 - (int32_t)time;
+    clock->day_valid = false;
+}
+
+/**
+ * Get UTC time for sample time. The calendar is only consulted when the
+ * day changes, the time of day is derived from the msec offset.
+ */
+static void utc_clock_get(utc_clock_t *clock, uint32_t time, ambit_date_time_t *outtime)
+{
+    int64_t msec = clock->base_msec + (int32_t)time;
+    int64_t day = msec / 86400000;
+    time_t day_start;
+    struct tm tm_buf, *tm;
+
+    if (msec % 86400000 < 0) {
+        day--;
     }
-    if(timeval.tv_usec < 0) {
-        timeval.tv_sec--;
-        timeval.tv_usec += 1000000;
+
+    if (!clock->day_valid || day != clock->day) {
+        day_start = (time_t)(day*86400);
+        tm = gmtime_r(&day_start, &tm_buf);
+        clock->date.day = tm->tm_mday;
+        clock->date.month = tm->tm_mon;
+        clock->date.year = tm->tm_year;
+        clock->day = day;
+        clock->day_valid = true;
     }
 
-    tm = gmtime(&timeval.tv_sec);
-    outtime->msec = tm->tm_sec * 1000 + (timeval.tv_usec / 1000);
-    outtime->minute = tm->tm_min;
-    outtime->hour = tm->tm_hour;
-    outtime->day = tm->tm_mday;
-    outtime->month = tm->tm_mon;
-    outtime->year = tm->tm_year;
+    msec -= day*86400000;
+    outtime->year = clock->date.year;
+    outtime->month = clock->date.month;
+    outtime->day = clock->date.day;
+    outtime->hour = msec / 3600000;
+    outtime->minute = (msec / 60000) % 60;
+    outtime->msec = msec % 60000;
 }
 
 static int is_leap(unsigned int y) {
@@ -26,8 +26,44 @@
 #include <stdint.h>
 #include "libambit.h"
 
-typedef struct libambit_pmem20_s {
+typedef struct libambit_pmem20_cache_slot_s {
+    uint32_t chunk;                                 // Cached chunk index
+    uint32_t last_use;
+} libambit_pmem20_cache_slot_t;
+
+typedef struct libambit_pmem20_orbit_hashes_s {
+    uint8_t header[8];                              // Orbit header of written data, as read from device
+    uint16_t chunk_size;                            // Write chunk size used
+    size_t count;                                   // Number of chunks, 0 = unknown
+    uint8_t (*hashes)[32];                          // SHA256 of each written chunk
+} libambit_pmem20_orbit_hashes_t;
+
+typedef struct libambit_pmem20_log_resume_s {
+    uint64_t saved_at;                              // Monotonic ms, 0 = nothing saved
+    uint32_t mem_start;
+    uint32_t mem_size;
     uint16_t chunk_size;
+    uint32_t last_entry;                            // PMEM header when saved
+    uint32_t next_free_address;
+    uint16_t *chunk_slots;                          // Chunk cache, as in libambit_pmem20_t
+    libambit_pmem20_cache_slot_t *slots;
+    uint8_t *slot_data;
+    size_t slot_count;
+    uint32_t use_count;
+    struct {
+        uint32_t address;
+        uint32_t length;
+        uint32_t fetched;
+        uint8_t *buffer;
+    } partial;
+} libambit_pmem20_log_resume_t;
+
+typedef struct libambit_pmem20_s {
+    uint16_t chunk_size;                            // Log read chunk size
+    uint16_t write_chunk_size;                      // Data write chunk size
+    uint8_t pipeline_depth;
+    uint32_t cache_size;                            // Max bytes of cached log chunks
+    uint8_t read_retries;                           // Resends of failed log chunk reads
     struct {
         bool initialized;
         uint32_t mem_start;
@@ -41,20 +77,43 @@ typedef struct libambit_pmem20_s {
             uint32_t next;
             uint32_t prev;
         } current;
-        uint8_t *buffer;
-        uint8_t *chunks_read;
+        uint8_t *buffer;                            // Data spanning several chunks
+        uint16_t *chunk_slots;                      // Cache slot + 1 per chunk, 0 = not read
+        libambit_pmem20_cache_slot_t *slots;
+        uint8_t *slot_data;
+        size_t slot_count;
+        uint32_t use_count;
+        uint32_t last_chunk;                        // Last chunk accessed
+        uint32_t readahead_end;                     // Offset where read-ahead stops, 0 = off
+        struct {
+            uint32_t address;
+            uint32_t length;
+            uint32_t fetched;                       // Leading bytes already read
+            uint8_t *buffer;
+        } partial;                                  // Entry fetch interrupted by a read error
     } log;
     ambit_object_t *ambit_object;
 } libambit_pmem20_t;
 
 int libambit_pmem20_init(libambit_pmem20_t *object, ambit_object_t *ambit_object, uint16_t chunk_size);
 int libambit_pmem20_deinit(libambit_pmem20_t *object);
+int libambit_pmem20_set_pipeline_depth(libambit_pmem20_t *object, uint8_t depth);
+int libambit_pmem20_set_chunk_size(libambit_pmem20_t *object, uint16_t chunk_size);
+int libambit_pmem20_set_cache_size(libambit_pmem20_t *object, uint32_t cache_size);
+int libambit_pmem20_log_read_benchmark(libambit_pmem20_t *object, uint32_t mem_start, uint32_t mem_size, uint16_t chunk_size, uint32_t length, uint32_t *elapsed);
 int libambit_pmem20_log_init(libambit_pmem20_t *object, uint32_t mem_start, uint32_t mem_size);
 int libambit_pmem20_log_deinit(libambit_pmem20_t *object);
+int libambit_pmem20_log_seek(libambit_pmem20_t *object, uint32_t address);
 int libambit_pmem20_log_next_header(libambit_pmem20_t *object, ambit_log_header_t *log_header);
 ambit_log_entry_t *libambit_pmem20_log_read_entry(libambit_pmem20_t *object);
 ambit_log_entry_t *libambit_pmem20_log_read_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length);
+ambit_log_entry_t *libambit_pmem20_log_read_entry_stream(libambit_pmem20_t *object, ambit_log_sample_cb sample_cb, void *userref);
+ambit_log_entry_t *libambit_pmem20_log_read_entry_address_stream(libambit_pmem20_t *object, uint32_t address, uint32_t length, ambit_log_sample_cb sample_cb, void *userref);
+uint8_t *libambit_pmem20_log_fetch_entry_address(libambit_pmem20_t *object, uint32_t address, uint32_t length);
+ambit_log_entry_t *libambit_pmem20_log_decode_entry(uint8_t *buffer, uint32_t length);
 int libambit_pmem20_log_parse_header(uint8_t *data, size_t datalen, ambit_log_header_t *log_header);
-int libambit_pmem20_gps_orbit_write(libambit_pmem20_t *object, const uint8_t *data, size_t datalen, bool include_sha256_hash);
+int libambit_pmem20_gps_orbit_write(libambit_pmem20_t *object, const uint8_t *data, size_t datalen, bool include_sha256_hash, libambit_pmem20_orbit_hashes_t *hashes);
+void libambit_pmem20_orbit_hashes_clear(libambit_pmem20_orbit_hashes_t *hashes);
+void libambit_pmem20_log_resume_clear(libambit_pmem20_log_resume_t *resume);
 
 #endif /* __PMEM20_H__ */
@@ -22,6 +22,9 @@
 #include "protocol.h"
 #include "libambit_int.h"
 #include "crc16.h"
+#include "utils.h"
+#include "bench.h"
+#include "debug.h"
 
 #include "hidapi/hidapi.h"
 
@@ -30,13 +33,12 @@
 #include <math.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 
 /*
  * Local definitions
  */
 #define READ_TIMEOUT       20000 // ms
-#define READ_POLL_INTERVAL 100  // ms
-#define READ_POLL_RETRY    (READ_TIMEOUT / READ_POLL_INTERVAL)
 
 typedef struct __attribute__((__packed__)) ambit_msg_header_s {
     uint8_t UId;
@@ -52,32 +54,148 @@ typedef struct __attribute__((__packed__)) ambit_msg_header_s {
     uint32_t payload_len;
 } ambit_msg_header_t;
 
+// Trace records are filled in place, seq is the record number plus one
+// once complete, 0 while being written
+typedef struct trace_record_s {
+    uint64_t seq;
+    int64_t  time_sec;
+    int32_t  time_usec;
+    uint8_t  direction;                             // 0 = to device, 1 = from device
+    uint8_t  data[64];
+} trace_record_t;
+
+struct libambit_trace_s {
+    size_t size;                                    // Records in ring
+    uint64_t next;                                  // Number of next record
+    trace_record_t records[];
+};
+
+// Linux usbmon packet header, as used by the pcap link type
+// LINKTYPE_USB_LINUX_MMAPPED
+typedef struct __attribute__((__packed__)) usbmon_header_s {
+    uint64_t id;
+    uint8_t  type;                                  // 'S'ubmit or 'C'omplete
+    uint8_t  xfer_type;                             // 1 = interrupt
+    uint8_t  epnum;                                 // 0x80 set for IN
+    uint8_t  devnum;
+    uint16_t busnum;
+    int8_t   flag_setup;
+    int8_t   flag_data;                             // 0 = data present
+    int64_t  ts_sec;
+    int32_t  ts_usec;
+    int32_t  status;
+    uint32_t length;
+    uint32_t len_cap;
+    uint8_t  setup[8];
+    int32_t  interval;
+    int32_t  start_frame;
+    uint32_t xfer_flags;
+    uint32_t ndesc;
+} usbmon_header_t;
+
+#define PCAP_LINKTYPE_USB_LINUX_MMAPPED 220
+
+typedef void (*reply_target_cb)(void *ref, uint16_t sequence, size_t replylen, uint8_t **target, size_t *skip);
+
+typedef struct reply_buffers_ref_s {
+    libambit_protocol_reply_buffer_t *buffers;
+    size_t count;
+    size_t index;
+} reply_buffers_ref_t;
+
 /*
  * Static functions
  */
 /**
- * Write packet to bus. The data buffer should include space for headers
- * which is automatically filled in.
+ * Write finalized packets to bus, in one go if supported by the backend
+ * \param object Connection object
+ * \param data Data buffer to write (64 byte per packet)
+ * \param packet_count Number of packets in buffer
+ * \return 0 if all packets were written, else -1
+ */
+static int protocol_write_packets(ambit_object_t *object, uint8_t *data, int packet_count);
+
+/**
+ * Read packet from bus. Blocks until a packet arrives or the deadline
+ * has passed.
  * \param object Connection object
  * \param data Data buffer to write (64 byte)
+ * \param deadline Monotonic time (in ms) when to give up waiting
  * \return 0 on success, else -1
  */
-static int protocol_write_packet(ambit_object_t *object, uint8_t *data);
+static int protocol_read_packet(ambit_object_t *object, uint8_t *data, uint64_t deadline);
 
 /**
- * Read packet from bus.
+ * Read a complete reply from bus.
  * \param object Connection object
- * \param data Data buffer to write (64 byte)
+ * \param target_cb Called when the first packet is read, to get the
+ *                  buffer where the reply should be stored, and how many
+ *                  leading reply bytes to skip. If no buffer is given, the
+ *                  reply is read but discarded
+ * \param ref Reference passed to target_cb
+ * \param sequence Set to the sequence number of the reply
+ * \param replylen Set to the full length of the reply
  * \return 0 on success, else -1
  */
-static int protocol_read_packet(ambit_object_t *object, uint8_t *data);
+static int protocol_receive(ambit_object_t *object, reply_target_cb target_cb, void *ref, uint16_t *sequence, size_t *replylen);
+
+/**
+ * Copy part of reply into target buffer, skipping leading bytes
+ * \param target Target buffer, NULL to discard
+ * \param skip Number of leading reply bytes not stored in target
+ * \param offset Offset of data in reply
+ * \param data Part data
+ * \param datalen Length of part data
+ */
+static void copy_reply_part(uint8_t *target, size_t skip, size_t offset, uint8_t *data, size_t datalen);
+
+/**
+ * Reply target callback that allocates a new buffer for the reply
+ */
+static void malloc_reply_target(void *ref, uint16_t sequence, size_t replylen, uint8_t **target, size_t *skip);
+
+/**
+ * Reply target callback that selects a caller supplied buffer by sequence
+ */
+static void buffer_reply_target(void *ref, uint16_t sequence, size_t replylen, uint8_t **target, size_t *skip);
+
+/**
+ * Finalize packet. Copy payload data into packet, add lengths and
+ * calculate checksums in a single pass over the payload
+ * \param data Packet buffer
+ * \param header_len Length of message header fields already in packet
+ *                   after the packet header (12 for first packet, else 0)
+ * \param payload Payload data to copy
+ * \param payload_len Length of payload data
+ */
+static void finalize_packet(uint8_t *data, uint8_t header_len, const uint8_t *payload, uint8_t payload_len);
+
+/**
+ * Add packet to trace, if tracing is on
+ * \param object Connection object
+ * \param direction 0 if sent to device, 1 if received
+ * \param data Packet (64 byte)
+ */
+static void trace_packet(ambit_object_t *object, uint8_t direction, const uint8_t *data);
+
+/**
+ * Get statistics slot of command, allocating one if needed. When all slots
+ * are taken, the last one collects all remaining commands
+ * \param object Connection object
+ * \param command Protocol command
+ * \return Statistics slot
+ */
+static ambit_command_stats_t *command_stats(ambit_object_t *object, uint16_t command);
 
 /**
- * Finalize packet. Add lengths and calculate checksums
- * \param data Data buffer
- * \param payload_len Length of payload
+ * Add reply to statistics of command
+ * \param object Connection object
+ * \param command Protocol command of reply
+ * \param packets Number of packets in reply
+ * \param bytes Reply payload length
+ * \param wait_time Time waited for first packet (in us)
  */
-static void finalize_packet(uint8_t *data, uint8_t payload_len);
+static void command_stats_reply(ambit_object_t *object, uint16_t command, uint16_t packets, size_t bytes, uint64_t wait_time);
 
 /*
  * Static variables
@@ -88,21 +206,69 @@ static void finalize_packet(uint8_t *data, uint8_t payload_len);
  */
 int libambit_protocol_command(ambit_object_t *object, uint16_t command, uint8_t *data, size_t datalen, uint8_t **reply_data, size_t *replylen, uint8_t legacy_format)
 {
-    int ret = 0;
-    uint8_t buf[64];
+    int ret = -1;
+    uint16_t sequence, reply_sequence;
+    BENCH_TIMER_START(bench_start);
+
+    // Send failures are already counted by libambit_protocol_command_send()
+    if (libambit_protocol_command_send(object, command, data, datalen, legacy_format, &sequence) == 0) {
+        if (libambit_protocol_command_receive(object, &reply_sequence, reply_data, replylen) == 0) {
+            if (reply_sequence == sequence) {
+                ret = 0;
+            }
+            else if (reply_data != NULL) {
+                libambit_protocol_free(*reply_data);
+                *reply_data = NULL;
+            }
+        }
+        if (ret != 0) {
+            command_stats(object, command)->failures++;
+        }
+    }
+
+    BENCH_TIMER_STOP(libambit_bench_protocol_command_ns, bench_start);
+
+    return ret;
+}
+
+int libambit_protocol_command_send(ambit_object_t *object, uint16_t command, uint8_t *data, size_t datalen, uint8_t legacy_format, uint16_t *sequence)
+{
+    int ret;
+    uint8_t single_buf[64];
+    uint8_t *train = single_buf, *buf;
     int packet_count = 1;
-    ambit_msg_header_t *msg = (ambit_msg_header_t *)buf;
+    ambit_msg_header_t *msg;
     uint8_t packet_payload_len;
     int i;
-    uint32_t dataoffset = 0, reply_data_len;
-    uint16_t msg_parts;
+    uint32_t dataoffset = 0;
+    ambit_command_stats_t *stats;
+
+    BENCH_COUNT(libambit_bench_commands, 1);
+    BENCH_COUNT(libambit_bench_bytes_sent, datalen);
 
     // Calculate number of packets
     if (datalen > 42) {
         packet_count = 2 + (datalen - 42)/54;
     }
 
+    // Build complete packet train up front
+    if (packet_count > 1) {
+        if ((train = malloc(packet_count*64)) == NULL) {
+            stats = command_stats(object, command);
+            stats->calls++;
+            stats->failures++;
+            return -1;
+        }
+    }
+    memset(train, 0, packet_count*64);
+
+    if (sequence != NULL) {
+        *sequence = object->sequence_no;
+    }
+
     // Create first packet
+    buf = train;
+    msg = (ambit_msg_header_t *)buf;
     msg->MP = 0x5d;
     msg->parts_seq = htole16(packet_count);
     msg->command = htobe16(command);
@@ -111,52 +277,228 @@ int libambit_protocol_command(ambit_object_t *object, uint16_t command, uint8_t
     msg->sequence = htole16(object->sequence_no);
     msg->payload_len = htole32(datalen);
     packet_payload_len = fmin(42, datalen);
-    memcpy(&buf[20], &data[dataoffset], packet_payload_len);
-    finalize_packet(buf, packet_payload_len + 12);
-    protocol_write_packet(object, buf);
+    finalize_packet(buf, 12, &data[dataoffset], packet_payload_len);
 
     datalen -= packet_payload_len;
     dataoffset += packet_payload_len;
 
-    // Send additional packets
+    // Create additional packets
     for(i=1; i<packet_count; i++) {
+        buf = &train[i*64];
+        msg = (ambit_msg_header_t *)buf;
         msg->MP = 0x5e;
         msg->parts_seq = htole16(i);
         packet_payload_len = fmin(54, datalen);
-        memcpy(&buf[8], &data[dataoffset], packet_payload_len);
-        finalize_packet(buf, packet_payload_len);
-        protocol_write_packet(object, buf);
+        finalize_packet(buf, 0, &data[dataoffset], packet_payload_len);
 
         datalen -= packet_payload_len;
         dataoffset += packet_payload_len;
     }
 
+    ret = protocol_write_packets(object, train, packet_count);
+
+    stats = command_stats(object, command);
+    stats->calls++;
+    stats->packets_out += packet_count;
+    stats->bytes_out += dataoffset;
+    if (ret != 0) {
+        stats->failures++;
+    }
+
+    if (train != single_buf) {
+        free(train);
+    }
+
+    // Increment sequence number for next run
+    object->sequence_no++;
+
+    return ret;
+}
+
+int libambit_protocol_command_receive(ambit_object_t *object, uint16_t *sequence, uint8_t **reply_data, size_t *replylen)
+{
+    int ret;
+    uint8_t *target = NULL;
+    size_t len = 0;
+
+    ret = protocol_receive(object, malloc_reply_target, &target, sequence, &len);
+
+    if (reply_data != NULL && replylen != NULL) {
+        *reply_data = target;
+        *replylen = len;
+    }
+    else {
+        free(target);
+    }
+
+    return ret;
+}
+
+int libambit_protocol_command_receive_into(ambit_object_t *object, libambit_protocol_reply_buffer_t *buffers, size_t buffer_count, size_t *index, size_t *replylen)
+{
+    reply_buffers_ref_t ref;
+    uint16_t sequence;
+
+    ref.buffers = buffers;
+    ref.count = buffer_count;
+    ref.index = buffer_count;
+
+    if (protocol_receive(object, buffer_reply_target, &ref, &sequence, replylen) != 0 ||
+        ref.index == buffer_count) {
+        return -1;
+    }
+
+    if (index != NULL) {
+        *index = ref.index;
+    }
+
+    return 0;
+}
+
+void libambit_protocol_retry_count(ambit_object_t *object, uint16_t command)
+{
+    command_stats(object, command)->retries++;
+}
+
+void libambit_protocol_free(uint8_t *data)
+{
+    if (data != NULL) {
+        free(data);
+    }
+}
+
+int libambit_trace_enable(ambit_object_t *object, size_t packet_count)
+{
+    struct libambit_trace_s *trace = NULL;
+
+    if (object == NULL) {
+        return -1;
+    }
+
+    if (packet_count > 0) {
+        if ((trace = calloc(1, sizeof(*trace) + packet_count*sizeof(trace_record_t))) == NULL) {
+            return -1;
+        }
+        trace->size = packet_count;
+    }
+
+    free(object->trace);
+    object->trace = trace;
+
+    return 0;
+}
+
+int libambit_trace_write_pcap(ambit_object_t *object, const char *path)
+{
+    struct libambit_trace_s *trace;
+    trace_record_t record;
+    usbmon_header_t header;
+    uint32_t pcap_header[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, PCAP_LINKTYPE_USB_LINUX_MMAPPED };
+    uint32_t record_header[4];
+    uint64_t first, last, i;
+    FILE *file;
+    int written = 0;
+
+    if (object == NULL || (trace = object->trace) == NULL || (file = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+
+    fwrite(pcap_header, sizeof(pcap_header), 1, file);
+
+    // Only the records in the ring at this moment, any that are
+    // overwritten or half written while copying are left out
+    last = __atomic_load_n(&trace->next, __ATOMIC_ACQUIRE);
+    first = (last > trace->size ? last - trace->size : 0);
+    for (i=first; i<last; i++) {
+        trace_record_t *slot = &trace->records[i % trace->size];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i+1) {
+            continue;
+        }
+        memcpy(&record, slot, sizeof(record));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != i+1) {
+            continue;
+        }
+
+        memset(&header, 0, sizeof(header));
+        header.id = i;
+        header.type = (record.direction ? 'C' : 'S');
+        header.xfer_type = 1;
+        header.epnum = (record.direction ? 0x81 : 0x01);
+        header.devnum = 1;
+        header.busnum = 1;
+        header.flag_setup = '-';
+        header.ts_sec = record.time_sec;
+        header.ts_usec = record.time_usec;
+        header.length = sizeof(record.data);
+        header.len_cap = sizeof(record.data);
+
+        record_header[0] = (uint32_t)record.time_sec;
+        record_header[1] = (uint32_t)record.time_usec;
+        record_header[2] = sizeof(header) + sizeof(record.data);
+        record_header[3] = sizeof(header) + sizeof(record.data);
+        fwrite(record_header, sizeof(record_header), 1, file);
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(record.data, sizeof(record.data), 1, file);
+        written++;
+    }
+
+    if (fclose(file) != 0) {
+        return -1;
+    }
+
+    return written;
+}
+
+static int protocol_receive(ambit_object_t *object, reply_target_cb target_cb, void *ref, uint16_t *sequence, size_t *replylen)
+{
+    int ret = 0;
+    uint8_t buf[64];
+    ambit_msg_header_t *msg = (ambit_msg_header_t *)buf;
+    int i;
+    uint8_t *target = NULL;
+    size_t skip = 0;
+    uint32_t reply_data_len, part_offset;
+    uint16_t msg_parts, reply_command = 0;
+    uint64_t start_time, wait_time = 0, deadline;
+
+    // All parts of the reply should arrive within the same deadline
+    start_time = libambit_monotonic_time_us();
+    deadline = start_time/1000 + READ_TIMEOUT;
+
     // Retrieve reply packets
-    if (protocol_read_packet(object, buf) == 0 &&
-        msg->MP == 0x5d && le16toh(msg->sequence) == object->sequence_no) {
+    if (protocol_read_packet(object, buf, deadline) == 0 && msg->MP == 0x5d) {
+        wait_time = libambit_monotonic_time_us() - start_time;
+
         reply_data_len = le32toh(msg->payload_len);
-        dataoffset = 0;
-        packet_payload_len = fmin(42, reply_data_len);
-        if (reply_data != NULL && replylen != NULL) {
+        if (sequence != NULL) {
+            *sequence = le16toh(msg->sequence);
+        }
+        if (replylen != NULL) {
             *replylen = reply_data_len;
-            *reply_data = malloc(reply_data_len);
-            memcpy(&(*reply_data)[dataoffset], &buf[20], packet_payload_len);
         }
-        dataoffset += packet_payload_len;
-        reply_data_len -= packet_payload_len;
+
+        // Let caller decide where to put the reply. Even if there is no
+        // target, the remaining parts are read to keep the stream in sync
+        target_cb(ref, le16toh(msg->sequence), reply_data_len, &target, &skip);
+        copy_reply_part(target, skip, 0, &buf[20], fmin(42, reply_data_len));
 
         msg_parts = le16toh(msg->parts_seq);
+        reply_command = be16toh(msg->command);
 
-        for (i=2; ret == 0 && i<=msg_parts; i++) {
-            if (protocol_read_packet(object, buf) == 0 && msg->MP == 0x5e && le16toh(msg->parts_seq) < msg_parts) {
-                packet_payload_len = fmin(54, reply_data_len);
-                if (reply_data != NULL) {
-                    memcpy(&(*reply_data)[42+(le16toh(msg->parts_seq)-1)*54], &buf[8], packet_payload_len);
-                }
-                dataoffset += packet_payload_len;
-                reply_data_len -= packet_payload_len;
+        for (i=2; i<=msg_parts; i++) {
+            if (protocol_read_packet(object, buf, deadline) != 0 || msg->MP != 0x5e) {
+                // Rest of reply lost
+                ret = -1;
+                break;
+            }
+            if (le16toh(msg->parts_seq) < msg_parts &&
+                (part_offset = 42+(le16toh(msg->parts_seq)-1)*54) < reply_data_len) {
+                copy_reply_part(target, skip, part_offset, &buf[8], fmin(54, reply_data_len - part_offset));
             }
             else {
+                // Keep reading, so that the next reply starts in sync
                 ret = -1;
             }
         }
@@ -165,50 +507,170 @@ int libambit_protocol_command(ambit_object_t *object, uint16_t command, uint8_t
         ret = -1;
     }
 
-    // Increment sequence number for next run
-    object->sequence_no++;
+    if (ret == 0) {
+        BENCH_COUNT(libambit_bench_bytes_received, reply_data_len);
+        command_stats_reply(object, reply_command, msg_parts, reply_data_len, wait_time);
+    }
 
     return ret;
 }
 
-void libambit_protocol_free(uint8_t *data)
+static void copy_reply_part(uint8_t *target, size_t skip, size_t offset, uint8_t *data, size_t datalen)
 {
-    if (data != NULL) {
-        free(data);
+    if (target == NULL || offset + datalen <= skip) {
+        return;
+    }
+
+    if (offset < skip) {
+        data += skip - offset;
+        datalen -= skip - offset;
+        offset = skip;
     }
+
+    memcpy(target + (offset - skip), data, datalen);
 }
 
-static int protocol_write_packet(ambit_object_t *object, uint8_t *data)
+static void malloc_reply_target(void *ref, uint16_t sequence, size_t replylen, uint8_t **target, size_t *skip)
 {
-    hid_write(object->handle, data, 64);
+    uint8_t **reply_data = (uint8_t **)ref;
 
-    return 0;
+    *reply_data = malloc(replylen);
+    *target = *reply_data;
+    *skip = 0;
 }
 
-static int protocol_read_packet(ambit_object_t *object, uint8_t *data)
+static void buffer_reply_target(void *ref, uint16_t sequence, size_t replylen, uint8_t **target, size_t *skip)
 {
-    int i, res = -1;
-    for (i=0; i<READ_POLL_RETRY; i++) {
-        res = hid_read(object->handle, data, 64);
-        if (res != 0) {
+    reply_buffers_ref_t *buffers_ref = (reply_buffers_ref_t *)ref;
+    size_t i;
+
+    for (i=0; i<buffers_ref->count; i++) {
+        if (buffers_ref->buffers[i].sequence == sequence) {
+            // Only accept replies that fit in the supplied buffer
+            if (replylen <= buffers_ref->buffers[i].skip + buffers_ref->buffers[i].size) {
+                buffers_ref->index = i;
+                *target = buffers_ref->buffers[i].buffer;
+                *skip = buffers_ref->buffers[i].skip;
+            }
             break;
         }
-        usleep(READ_POLL_INTERVAL * 1000);
+    }
+}
+
+static int protocol_write_packets(ambit_object_t *object, uint8_t *data, int packet_count)
+{
+    int res = hid_write_train(object->handle, data, 64, packet_count);
+    int i;
+
+    for (i=0; i<res; i++) {
+        trace_packet(object, 0, &data[i*64]);
+    }
+
+    if (res != packet_count) {
+        LOG_WARNING("Short write, %d of %d packets written", res, packet_count);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int protocol_read_packet(ambit_object_t *object, uint8_t *data, uint64_t deadline)
+{
+    int res = -1;
+    uint64_t now;
+
+    do {
+        now = libambit_monotonic_time_us()/1000;
+        res = hid_read_timeout(object->handle, data, 64, now < deadline ? deadline - now : 0);
+    } while (res == 0 && now < deadline);
+
+    if (res > 0) {
+        trace_packet(object, 1, data);
     }
 
     return (res > 0 ? 0 : -1);
 }
 
-static void finalize_packet(uint8_t *data, uint8_t payload_len)
+static void trace_packet(ambit_object_t *object, uint8_t direction, const uint8_t *data)
+{
+    struct libambit_trace_s *trace = object->trace;
+    trace_record_t *record;
+    struct timespec ts;
+    uint64_t seq;
+
+    if (trace == NULL) {
+        return;
+    }
+
+    // Claim the next slot, readers skip it until seq is set again
+    seq = __atomic_fetch_add(&trace->next, 1, __ATOMIC_RELAXED);
+    record = &trace->records[seq % trace->size];
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record->time_sec = ts.tv_sec;
+    record->time_usec = ts.tv_nsec/1000;
+    record->direction = direction;
+    memcpy(record->data, data, sizeof(record->data));
+
+    __atomic_store_n(&record->seq, seq+1, __ATOMIC_RELEASE);
+}
+
+static void finalize_packet(uint8_t *data, uint8_t header_len, const uint8_t *payload, uint8_t payload_len)
 {
     ambit_msg_header_t *msg = (ambit_msg_header_t *)data;
     uint16_t *payload_crc, tmpcrc;
 
     msg->UId = 0x3f;
-    msg->UL = payload_len + 8;
-    msg->ML = payload_len;
+    msg->UL = header_len + payload_len + 8;
+    msg->ML = header_len + payload_len;
     tmpcrc = crc16_ccitt_false(&data[2], 4);
     msg->checksum = htole16(tmpcrc);
+    tmpcrc = crc16_ccitt_false_init(&data[8], header_len, tmpcrc);
     payload_crc = (uint16_t *)&data[msg->UL];
-    *payload_crc = htole16(crc16_ccitt_false_init(&data[8], payload_len, tmpcrc));
+    *payload_crc = htole16(crc16_ccitt_false_copy(&data[8 + header_len], payload, payload_len, tmpcrc));
+}
+
+static ambit_command_stats_t *command_stats(ambit_object_t *object, uint16_t command)
+{
+    size_t i;
+
+    for (i=0; i<object->stats_count; i++) {
+        if (object->stats[i].command == command) {
+            return &object->stats[i];
+        }
+    }
+
+    if (object->stats_count == LIBAMBIT_STATS_SLOTS) {
+        // Overflow slot, see below
+        return &object->stats[LIBAMBIT_STATS_SLOTS-1];
+    }
+
+    if (object->stats_count == LIBAMBIT_STATS_SLOTS-1) {
+        command = 0xffff;
+    }
+    memset(&object->stats[object->stats_count], 0, sizeof(ambit_command_stats_t));
+    object->stats[object->stats_count].command = command;
+
+    return &object->stats[object->stats_count++];
+}
+
+static void command_stats_reply(ambit_object_t *object, uint16_t command, uint16_t packets, size_t bytes, uint64_t wait_time)
+{
+    ambit_command_stats_t *stats = command_stats(object, command);
+    size_t bucket = 0;
+
+    stats->replies++;
+    stats->packets_in += packets;
+    stats->bytes_in += bytes;
+    stats->latency_total += wait_time;
+    if (wait_time > stats->latency_max) {
+        stats->latency_max = wait_time;
+    }
+
+    while (bucket < LIBAMBIT_STATS_LATENCY_BUCKETS-1 && wait_time >= (250ULL << bucket)) {
+        bucket++;
+    }
+    stats->latency_histogram[bucket]++;
 }
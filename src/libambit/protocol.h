@@ -53,11 +53,51 @@ enum ambit_commands_e {
     ambit_command_ambit3_log_synced     = 0x1201
 };
 
+typedef struct libambit_protocol_reply_buffer_s {
+    uint16_t sequence;                              // Sequence number of command
+    uint8_t *buffer;                                // Where to store reply
+    size_t size;                                    // Size of buffer
+    size_t skip;                                    // Leading reply bytes to not store
+} libambit_protocol_reply_buffer_t;
+
 /**
  * Write command to device
  * \param legacy_format 0=normal, 1=legacy, 2=version 2
  */
 int libambit_protocol_command(ambit_object_t *object, uint16_t command, uint8_t *data, size_t datalen, uint8_t **reply_data, size_t *replylen, uint8_t legacy_format);
+
+/**
+ * Write command to device without waiting for the reply. Several commands
+ * can be outstanding at once, replies are matched by sequence number.
+ * \param legacy_format 0=normal, 1=legacy, 2=version 2
+ * \param sequence Set to the sequence number used for the command
+ * \return 0 on success, else -1
+ */
+int libambit_protocol_command_send(ambit_object_t *object, uint16_t command, uint8_t *data, size_t datalen, uint8_t legacy_format, uint16_t *sequence);
+
+/**
+ * Read next complete reply from device
+ * \param sequence Set to the sequence number carried by the reply
+ * \return 0 on success, else -1
+ */
+int libambit_protocol_command_receive(ambit_object_t *object, uint16_t *sequence, uint8_t **reply_data, size_t *replylen);
+
+/**
+ * Read next complete reply from device directly into one of the caller
+ * supplied buffers, selected by sequence number. No memory is allocated.
+ * \param buffers Candidate buffers
+ * \param buffer_count Number of buffers
+ * \param index Set to index of buffer that got the reply
+ * \param replylen Set to full length of reply (including skipped bytes)
+ * \return 0 on success, -1 on failure or if no buffer matched the reply
+ */
+int libambit_protocol_command_receive_into(ambit_object_t *object, libambit_protocol_reply_buffer_t *buffers, size_t buffer_count, size_t *index, size_t *replylen);
+
+/**
+ * Count a resent command in the protocol statistics
+ * \param command Command that is sent again
+ */
+void libambit_protocol_retry_count(ambit_object_t *object, uint16_t command);
 void libambit_protocol_free(uint8_t *data);
 
 #endif /* __PROTOCOL_H__ */
@@ -0,0 +1,413 @@
+/*
+ * (C) Copyright 2014 Emil Ljungdahl
+ *
+ * This file is part of libambit.
+ *
+ * libambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "libambit.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Local definitions
+ */
+#define RECORD_FLAG_UTC_TIME          0x01
+#define RECORD_HEADER_SIZE            7    /* type, flags, time */
+#define PERIODIC_VALUE_MAX_SIZE       sizeof(((ambit_log_sample_periodic_value_t*)0)->u)
+#define GPS_BASE_FIXED_SIZE           (offsetof(ambit_log_sample_t, u.gps_base.satellites) - offsetof(ambit_log_sample_t, u))
+
+/* Samples are packed as records, one per sample, found through
+ * an offset index. A record is the sample type (16 bits), flags and time,
+ * the UTC time if set, and then only the union member of that type, with
+ * pointed to data inline. Multibyte fields are in host byte order and
+ * unaligned. */
+struct ambit_log_sample_pack_s {
+    uint32_t count;
+    size_t size;                    /* bytes of data */
+    uint32_t *offset;               /* record offsets into data, count + 1 */
+    uint8_t *data;
+};
+
+/*
+ * Static functions
+ */
+static size_t record_size(const ambit_log_sample_t *sample);
+static void record_write(const ambit_log_sample_t *sample, uint8_t *data);
+static size_t payload_fixed_size(ambit_log_sample_type_t type);
+static size_t periodic_value_size(ambit_log_sample_periodic_type_t type);
+static const uint8_t *record_payload(const ambit_log_sample_pack_t *pack, uint32_t index);
+
+/*
+ * Public functions
+ */
+ambit_log_sample_pack_t *libambit_log_sample_pack_new(const ambit_log_entry_t *log_entry)
+{
+    ambit_log_sample_pack_t *pack;
+    size_t size = 0;
+    uint32_t i;
+
+    if (log_entry == NULL || (log_entry->samples_count > 0 && log_entry->samples == NULL)) {
+        return NULL;
+    }
+
+    for (i=0; i<log_entry->samples_count; i++) {
+        size += record_size(&log_entry->samples[i]);
+    }
+    if (size > UINT32_MAX) {
+        return NULL;
+    }
+
+    // Pack, index and data in one block
+    pack = malloc(sizeof(ambit_log_sample_pack_t) + (log_entry->samples_count + 1)*sizeof(uint32_t) + size);
+    if (pack == NULL) {
+        return NULL;
+    }
+    pack->count = log_entry->samples_count;
+    pack->size = size;
+    pack->offset = (uint32_t*)(pack + 1);
+    pack->data = (uint8_t*)(pack->offset + pack->count + 1);
+
+    for (i=0, size=0; i<log_entry->samples_count; i++) {
+        pack->offset[i] = size;
+        record_write(&log_entry->samples[i], pack->data + size);
+        size += record_size(&log_entry->samples[i]);
+    }
+    pack->offset[pack->count] = size;
+
+    return pack;
+}
+
+uint32_t libambit_log_sample_pack_count(const ambit_log_sample_pack_t *pack)
+{
+    return pack != NULL ? pack->count : 0;
+}
+
+size_t libambit_log_sample_pack_size(const ambit_log_sample_pack_t *pack)
+{
+    if (pack == NULL) {
+        return 0;
+    }
+
+    return sizeof(ambit_log_sample_pack_t) + (pack->count + 1)*sizeof(uint32_t) + pack->size;
+}
+
+ambit_log_sample_type_t libambit_log_sample_pack_type(const ambit_log_sample_pack_t *pack, uint32_t index)
+{
+    uint16_t type;
+
+    if (pack == NULL || index >= pack->count) {
+        return ambit_log_sample_type_unknown;
+    }
+    memcpy(&type, pack->data + pack->offset[index], sizeof(type));
+
+    return (ambit_log_sample_type_t)type;
+}
+
+uint32_t libambit_log_sample_pack_time(const ambit_log_sample_pack_t *pack, uint32_t index)
+{
+    uint32_t time;
+
+    if (pack == NULL || index >= pack->count) {
+        return 0;
+    }
+    memcpy(&time, pack->data + pack->offset[index] + 3, sizeof(time));
+
+    return time;
+}
+
+int libambit_log_sample_pack_periodic_value(const ambit_log_sample_pack_t *pack, uint32_t index, ambit_log_sample_periodic_type_t type, ambit_log_sample_periodic_value_t *value)
+{
+    const uint8_t *ptr;
+    uint8_t value_count, value_type, i;
+    size_t size;
+
+    if (pack == NULL || value == NULL || libambit_log_sample_pack_type(pack, index) != ambit_log_sample_type_periodic) {
+        return -1;
+    }
+
+    ptr = record_payload(pack, index);
+    value_count = *ptr++;
+    for (i=0; i<value_count; i++) {
+        value_type = *ptr++;
+        size = periodic_value_size(value_type);
+        if (value_type == type) {
+            memset(value, 0, sizeof(ambit_log_sample_periodic_value_t));
+            value->type = type;
+            memcpy(&value->u, ptr, size);
+            return 0;
+        }
+        ptr += size;
+    }
+
+    return -1;
+}
+
+int libambit_log_sample_pack_get(const ambit_log_sample_pack_t *pack, uint32_t index, ambit_log_sample_t *sample, ambit_log_sample_periodic_value_t *values)
+{
+    const uint8_t *record, *ptr;
+    uint8_t flags, i;
+    uint16_t type;
+    size_t size;
+
+    if (pack == NULL || sample == NULL || index >= pack->count) {
+        return -1;
+    }
+
+    record = pack->data + pack->offset[index];
+    memset(sample, 0, sizeof(ambit_log_sample_t));
+    memcpy(&type, record, sizeof(type));
+    flags = record[2];
+    memcpy(&sample->time, record + 3, sizeof(sample->time));
+    sample->type = (ambit_log_sample_type_t)type;
+    ptr = record_payload(pack, index);
+    if (flags & RECORD_FLAG_UTC_TIME) {
+        memcpy(&sample->utc_time, record + RECORD_HEADER_SIZE, sizeof(ambit_date_time_t));
+    }
+
+    switch (sample->type) {
+    case ambit_log_sample_type_periodic:
+        if (values == NULL) {
+            return -1;
+        }
+        sample->u.periodic.value_count = *ptr++;
+        sample->u.periodic.values = values;
+        for (i=0; i<sample->u.periodic.value_count; i++) {
+            memset(&values[i], 0, sizeof(ambit_log_sample_periodic_value_t));
+            values[i].type = *ptr++;
+            size = periodic_value_size(values[i].type);
+            memcpy(&values[i].u, ptr, size);
+            ptr += size;
+        }
+        break;
+    case ambit_log_sample_type_ibi:
+        sample->u.ibi.ibi_count = *ptr++;
+        memcpy(sample->u.ibi.ibi, ptr, sample->u.ibi.ibi_count*sizeof(uint16_t));
+        break;
+    case ambit_log_sample_type_gps_base:
+        memcpy(&sample->u.gps_base, ptr, GPS_BASE_FIXED_SIZE);
+        ptr += GPS_BASE_FIXED_SIZE;
+        if (sample->u.gps_base.satellites_count > 0) {
+            // Satellites only have byte members and are used in place
+            sample->u.gps_base.satellites = (ambit_log_gps_satellite_t*)ptr;
+        }
+        break;
+    case ambit_log_sample_type_unknown:
+        memcpy(&sample->u.unknown.datalen, ptr, sizeof(sample->u.unknown.datalen));
+        if (sample->u.unknown.datalen > 0) {
+            sample->u.unknown.data = (uint8_t*)ptr + sizeof(sample->u.unknown.datalen);
+        }
+        break;
+    default:
+        memcpy(&sample->u, ptr, payload_fixed_size(sample->type));
+        break;
+    }
+
+    return 0;
+}
+
+void libambit_log_sample_pack_free(ambit_log_sample_pack_t *pack)
+{
+    free(pack);
+}
+
+/*
+ * Static functions implementation
+ */
+static size_t record_size(const ambit_log_sample_t *sample)
+{
+    size_t size = RECORD_HEADER_SIZE;
+    uint8_t i;
+
+    if (sample->utc_time.year != 0) {
+        size += sizeof(ambit_date_time_t);
+    }
+
+    switch (sample->type) {
+    case ambit_log_sample_type_periodic:
+        size += 1;
+        for (i=0; i<sample->u.periodic.value_count; i++) {
+            size += 1 + periodic_value_size(sample->u.periodic.values[i].type);
+        }
+        break;
+    case ambit_log_sample_type_ibi:
+        size += 1 + sample->u.ibi.ibi_count*sizeof(uint16_t);
+        break;
+    case ambit_log_sample_type_gps_base:
+        size += GPS_BASE_FIXED_SIZE + sample->u.gps_base.satellites_count*sizeof(ambit_log_gps_satellite_t);
+        break;
+    case ambit_log_sample_type_unknown:
+        size += sizeof(sample->u.unknown.datalen) + sample->u.unknown.datalen;
+        break;
+    default:
+        size += payload_fixed_size(sample->type);
+        break;
+    }
+
+    return size;
+}
+
+static void record_write(const ambit_log_sample_t *sample, uint8_t *data)
+{
+    uint16_t type = sample->type;
+    uint8_t *ptr = data + RECORD_HEADER_SIZE;
+    uint8_t i;
+    size_t size;
+
+    memcpy(data, &type, sizeof(type));
+    data[2] = 0;
+    memcpy(data + 3, &sample->time, sizeof(sample->time));
+    if (sample->utc_time.year != 0) {
+        data[2] |= RECORD_FLAG_UTC_TIME;
+        memcpy(ptr, &sample->utc_time, sizeof(ambit_date_time_t));
+        ptr += sizeof(ambit_date_time_t);
+    }
+
+    switch (sample->type) {
+    case ambit_log_sample_type_periodic:
+        *ptr++ = sample->u.periodic.value_count;
+        for (i=0; i<sample->u.periodic.value_count; i++) {
+            *ptr++ = sample->u.periodic.values[i].type;
+            size = periodic_value_size(sample->u.periodic.values[i].type);
+            memcpy(ptr, &sample->u.periodic.values[i].u, size);
+            ptr += size;
+        }
+        break;
+    case ambit_log_sample_type_ibi:
+        *ptr++ = sample->u.ibi.ibi_count;
+        memcpy(ptr, sample->u.ibi.ibi, sample->u.ibi.ibi_count*sizeof(uint16_t));
+        break;
+    case ambit_log_sample_type_gps_base:
+        memcpy(ptr, &sample->u.gps_base, GPS_BASE_FIXED_SIZE);
+        ptr += GPS_BASE_FIXED_SIZE;
+        if (sample->u.gps_base.satellites_count > 0) {
+            memcpy(ptr, sample->u.gps_base.satellites, sample->u.gps_base.satellites_count*sizeof(ambit_log_gps_satellite_t));
+        }
+        break;
+    case ambit_log_sample_type_unknown:
+        memcpy(ptr, &sample->u.unknown.datalen, sizeof(sample->u.unknown.datalen));
+        if (sample->u.unknown.datalen > 0) {
+            memcpy(ptr + sizeof(sample->u.unknown.datalen), sample->u.unknown.data, sample->u.unknown.datalen);
+        }
+        break;
+    default:
+        memcpy(ptr, &sample->u, payload_fixed_size(sample->type));
+        break;
+    }
+}
+
+/**
+ * Size of the union member of samples of a type without pointed to data
+ */
+static size_t payload_fixed_size(ambit_log_sample_type_t type)
+{
+    const ambit_log_sample_t *sample = NULL;
+
+    switch (type) {
+    case ambit_log_sample_type_logpause:
+    case ambit_log_sample_type_logrestart:
+    case ambit_log_sample_type_swimming_stroke:
+        return 0;
+    case ambit_log_sample_type_ttff:
+        return sizeof(sample->u.ttff);
+    case ambit_log_sample_type_distance_source:
+        return sizeof(sample->u.distance_source);
+    case ambit_log_sample_type_lapinfo:
+        return sizeof(sample->u.lapinfo);
+    case ambit_log_sample_type_altitude_source:
+        return sizeof(sample->u.altitude_source);
+    case ambit_log_sample_type_gps_small:
+        return sizeof(sample->u.gps_small);
+    case ambit_log_sample_type_gps_tiny:
+        return sizeof(sample->u.gps_tiny);
+    case ambit_log_sample_type_time:
+        return sizeof(sample->u.time);
+    case ambit_log_sample_type_swimming_turn:
+        return sizeof(sample->u.swimming_turn);
+    case ambit_log_sample_type_activity:
+        return sizeof(sample->u.activity);
+    case ambit_log_sample_type_cadence_source:
+        return sizeof(sample->u.cadence_source);
+    case ambit_log_sample_type_position:
+        return sizeof(sample->u.position);
+    case ambit_log_sample_type_fwinfo:
+        return sizeof(sample->u.fwinfo);
+    default:
+        // Types not known here are kept whole
+        return sizeof(sample->u);
+    }
+}
+
+/**
+ * Size of the periodic value union member of a type
+ */
+static size_t periodic_value_size(ambit_log_sample_periodic_type_t type)
+{
+    switch (type) {
+    case ambit_log_sample_periodic_type_hr:
+    case ambit_log_sample_periodic_type_charge:
+    case ambit_log_sample_periodic_type_gpshdop:
+    case ambit_log_sample_periodic_type_gpsvdop:
+    case ambit_log_sample_periodic_type_noofsatellites:
+    case ambit_log_sample_periodic_type_cadence:
+        return 1;
+    case ambit_log_sample_periodic_type_speed:
+    case ambit_log_sample_periodic_type_gpsspeed:
+    case ambit_log_sample_periodic_type_wristaccspeed:
+    case ambit_log_sample_periodic_type_bikepodspeed:
+    case ambit_log_sample_periodic_type_altitude:
+    case ambit_log_sample_periodic_type_abspressure:
+    case ambit_log_sample_periodic_type_energy:
+    case ambit_log_sample_periodic_type_temperature:
+    case ambit_log_sample_periodic_type_gpsheading:
+    case ambit_log_sample_periodic_type_wristcadence:
+    case ambit_log_sample_periodic_type_sealevelpressure:
+    case ambit_log_sample_periodic_type_verticalspeed:
+    case ambit_log_sample_periodic_type_bikepower:
+        return 2;
+    case ambit_log_sample_periodic_type_latitude:
+    case ambit_log_sample_periodic_type_longitude:
+    case ambit_log_sample_periodic_type_distance:
+    case ambit_log_sample_periodic_type_time:
+    case ambit_log_sample_periodic_type_ehpe:
+    case ambit_log_sample_periodic_type_evpe:
+    case ambit_log_sample_periodic_type_gpsaltitude:
+    case ambit_log_sample_periodic_type_swimingstrokecnt:
+    case ambit_log_sample_periodic_type_ruleoutput1:
+    case ambit_log_sample_periodic_type_ruleoutput2:
+    case ambit_log_sample_periodic_type_ruleoutput3:
+    case ambit_log_sample_periodic_type_ruleoutput4:
+    case ambit_log_sample_periodic_type_ruleoutput5:
+        return 4;
+    default:
+        // snr and types not known here are kept whole
+        return PERIODIC_VALUE_MAX_SIZE;
+    }
+}
+
+static const uint8_t *record_payload(const ambit_log_sample_pack_t *pack, uint32_t index)
+{
+    const uint8_t *record = pack->data + pack->offset[index];
+
+    if (record[2] & RECORD_FLAG_UTC_TIME) {
+        return record + RECORD_HEADER_SIZE + sizeof(ambit_date_time_t);
+    }
+
+    return record + RECORD_HEADER_SIZE;
+}
@@ -23,6 +23,19 @@
 
 #include "sha256.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86_SHA 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define SHA256_ARMV8_CRYPTO 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 /*
  * Local definitions
  */
@@ -36,10 +49,19 @@
 #define SIG1(x)       (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
 
 
+typedef void (*transform_blocks_fn)(uint32_t *state, const uint8_t *data, size_t blocks);
+
 /*
  * Static functions
  */
-static void sha256_transform(sha256_ctx *ctx, const uint8_t *data);
+static void select_transform(void);
+static void transform_blocks_c(uint32_t *state, const uint8_t *data, size_t blocks);
+#ifdef SHA256_X86_SHA
+static void transform_blocks_x86_sha(uint32_t *state, const uint8_t *data, size_t blocks);
+#endif
+#ifdef SHA256_ARMV8_CRYPTO
+static void transform_blocks_armv8(uint32_t *state, const uint8_t *data, size_t blocks);
+#endif
 
 /*
  * Static variables
@@ -66,6 +88,9 @@ static const uint32_t k[SHA256_BLOCK_SIZE] = {
     0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
 };
 
+// Block transform for this CPU, selected on first use
+static transform_blocks_fn transform_blocks = NULL;
+
 /*
  * Public functions
  */
@@ -81,6 +106,11 @@ void sha256(const uint8_t *data, size_t len, uint8_t *hash)
 void sha256_init(sha256_ctx *ctx)
 {
     size_t i;
+
+    if (transform_blocks == NULL) {
+        select_transform();
+    }
+
     ctx->datalen = 0;
     ctx->bitlen = 0;
     for (i=0; i<8; i++) {
@@ -90,16 +120,38 @@ void sha256_init(sha256_ctx *ctx)
 
 void sha256_update(sha256_ctx *ctx, const uint8_t *data, size_t len)
 {
-    size_t i;
+    size_t fill, blocks;
 
-    for (i=0; i<len; i++) {
-        ctx->data[ctx->datalen++] = data[i];
+    // Complete partially filled block first
+    if (ctx->datalen > 0) {
+        fill = SHA256_BLOCK_SIZE - ctx->datalen;
+        if (fill > len) {
+            fill = len;
+        }
+        memcpy(ctx->data + ctx->datalen, data, fill);
+        ctx->datalen += fill;
+        data += fill;
+        len -= fill;
         if (ctx->datalen == SHA256_BLOCK_SIZE) {
-            sha256_transform(ctx, ctx->data);
+            transform_blocks(ctx->h, ctx->data, 1);
             ctx->bitlen += 512;
             ctx->datalen = 0;
         }
     }
+
+    // Whole blocks are hashed directly from input
+    if (len >= SHA256_BLOCK_SIZE) {
+        blocks = len / SHA256_BLOCK_SIZE;
+        transform_blocks(ctx->h, data, blocks);
+        ctx->bitlen += 512*(uint64_t)blocks;
+        data += blocks*SHA256_BLOCK_SIZE;
+        len -= blocks*SHA256_BLOCK_SIZE;
+    }
+
+    if (len > 0) {
+        memcpy(ctx->data, data, len);
+        ctx->datalen = len;
+    }
 }
 
 void sha256_final(sha256_ctx *ctx, uint8_t *hash)
@@ -122,7 +174,7 @@ void sha256_final(sha256_ctx *ctx, uint8_t *hash)
         while (i < 64) {
             ctx->data[i++] = 0x00;
         }
-        sha256_transform(ctx, ctx->data);
+        transform_blocks(ctx->h, ctx->data, 1);
         memset(ctx->data, 0, 56);
     }
 
@@ -131,7 +183,7 @@ void sha256_final(sha256_ctx *ctx, uint8_t *hash)
     for (i=0; i<8; i++) {
         ctx->data[63-i] = ctx->bitlen >> (8*i);
     }
-    sha256_transform(ctx, ctx->data);
+    transform_blocks(ctx->h, ctx->data, 1);
 
     // Get hash (stored as 8 (4-byte) words)
     for (i=0; i<8; i++) {
@@ -142,35 +194,150 @@ void sha256_final(sha256_ctx *ctx, uint8_t *hash)
     }
 }
 
-static void sha256_transform(sha256_ctx *ctx, const uint8_t *data)
+static void select_transform(void)
+{
+#ifdef SHA256_X86_SHA
+    unsigned int eax, ebx, ecx, edx;
+#endif
+
+#ifdef SHA256_X86_SHA
+    // SHA extensions, plus SSSE3 and SSE4.1 for the shuffles
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+        __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 29))) {
+        transform_blocks = transform_blocks_x86_sha;
+        return;
+    }
+#endif
+#ifdef SHA256_ARMV8_CRYPTO
+    if (getauxval(AT_HWCAP) & HWCAP_SHA2) {
+        transform_blocks = transform_blocks_armv8;
+        return;
+    }
+#endif
+
+    transform_blocks = transform_blocks_c;
+}
+
+static void transform_blocks_c(uint32_t *state, const uint8_t *data, size_t blocks)
 {
     size_t i;
     uint32_t m[64];
     uint32_t th[8];
     uint32_t t1, t2;
 
-    for (i=0; i<16; i++) {
-        m[i] = (data[(i<<2)] << 24) | (data[(i<<2)+1] << 16) | (data[(i<<2)+2] << 8) | (data[(i<<2)+3]);
-    }
-    for (i=16; i<64; i++) {
-        m[i] = SIG1(m[i-2]) + m[i-7] + SIG0(m[i-15]) + m[i-16];
-    }
-    for (i=0; i<8; i++) {
-        th[i] = ctx->h[i];
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        for (i=0; i<16; i++) {
+            m[i] = (data[(i<<2)] << 24) | (data[(i<<2)+1] << 16) | (data[(i<<2)+2] << 8) | (data[(i<<2)+3]);
+        }
+        for (i=16; i<64; i++) {
+            m[i] = SIG1(m[i-2]) + m[i-7] + SIG0(m[i-15]) + m[i-16];
+        }
+        for (i=0; i<8; i++) {
+            th[i] = state[i];
+        }
+        for (i=0; i<64; i++) {
+            t1 = th[7] + EP1(th[4]) + CH(th[4], th[5], th[6]) + k[i] + m[i];
+            t2 = EP0(th[0]) + MAJ(th[0], th[1], th[2]);
+            th[7] = th[6];
+            th[6] = th[5];
+            th[5] = th[4];
+            th[4] = th[3] + t1;
+            th[3] = th[2];
+            th[2] = th[1];
+            th[1] = th[0];
+            th[0] = t1 + t2;
+        }
+        for (i=0; i<8; i++) {
+            state[i] += th[i];
+        }
     }
-    for (i=0; i<64; i++) {
-        t1 = th[7] + EP1(th[4]) + CH(th[4], th[5], th[6]) + k[i] + m[i];
-        t2 = EP0(th[0]) + MAJ(th[0], th[1], th[2]);
-        th[7] = th[6];
-        th[6] = th[5];
-        th[5] = th[4];
-        th[4] = th[3] + t1;
-        th[3] = th[2];
-        th[2] = th[1];
-        th[1] = th[0];
-        th[0] = t1 + t2;
+}
+
+#ifdef SHA256_X86_SHA
+__attribute__((target("sha,sse4.1")))
+static void transform_blocks_x86_sha(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+    __m128i w[4];
+    int j;
+
+    // Reorder state to the ABEF/CDGH layout used by the instructions
+    tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        abef_save = state0;
+        cdgh_save = state1;
+
+        // 16 groups of 4 rounds, message schedule kept in w[group % 4]
+        for (j=0; j<16; j++) {
+            if (j < 4) {
+                w[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16*j)), mask);
+            }
+            else {
+                w[j&3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[j&3], w[(j+1)&3]),
+                                                            _mm_alignr_epi8(w[(j+3)&3], w[(j+2)&3], 4)),
+                                              w[(j+3)&3]);
+            }
+            msg = _mm_add_epi32(w[j&3], _mm_loadu_si128((const __m128i*)&k[4*j]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
     }
-    for (i=0; i<8; i++) {
-        ctx->h[i] += th[i];
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+#endif
+
+#ifdef SHA256_ARMV8_CRYPTO
+__attribute__((target("arch=armv8-a+crypto")))
+static void transform_blocks_armv8(uint32_t *state, const uint8_t *data, size_t blocks)
+{
+    uint32x4_t state0, state1, abcd_save, efgh_save, msg, tmp;
+    uint32x4_t w[4];
+    int j;
+
+    state0 = vld1q_u32(&state[0]);
+    state1 = vld1q_u32(&state[4]);
+
+    for (; blocks > 0; blocks--, data += SHA256_BLOCK_SIZE) {
+        abcd_save = state0;
+        efgh_save = state1;
+
+        for (j=0; j<4; j++) {
+            w[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16*j)));
+        }
+
+        // 16 groups of 4 rounds, message schedule kept in w[group % 4]
+        for (j=0; j<16; j++) {
+            msg = vaddq_u32(w[j&3], vld1q_u32(&k[4*j]));
+            if (j < 12) {
+                w[j&3] = vsha256su1q_u32(vsha256su0q_u32(w[j&3], w[(j+1)&3]), w[(j+2)&3], w[(j+3)&3]);
+            }
+            tmp = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, tmp, msg);
+        }
+
+        state0 = vaddq_u32(state0, abcd_save);
+        state1 = vaddq_u32(state1, efgh_save);
     }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
 }
+#endif
@@ -20,6 +20,7 @@
  *
  */
 #include "utils.h"
+#include "bench.h"
 #include "debug.h"
 
 #include <ctype.h>
@@ -31,6 +32,10 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef LIBAMBIT_BENCH
+uint64_t libambit_bench_counters[libambit_bench_counter_count];
+#endif
+
 static int date_get_num(const char **pp, int n_min, int n_max, int len_max)
 {
     int i, val, c;
@@ -203,3 +208,69 @@ char * utf8wcsconv(const wchar_t *src)
 
     return utf8memconv((char *)src, len, "WCHAR_T");
 }
+
+uint64_t libambit_monotonic_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+int libambit_stable_order(uint32_t *order, size_t count, int (*compare)(const void *userref, uint32_t a, uint32_t b), const void *userref)
+{
+    uint32_t *tmp, *src, *dst, *swap;
+    size_t width, left, mid, right, i, j, k;
+
+    // Most inputs are already in order, avoid the buffer if so
+    for (i = 1; i < count; i++) {
+        if (compare(userref, order[i-1], order[i]) > 0) {
+            break;
+        }
+    }
+    if (i >= count) {
+        return 0;
+    }
+
+    if ((tmp = malloc(count*sizeof(uint32_t))) == NULL) {
+        return -1;
+    }
+
+    // Bottom-up merge sort, taking from the left run on ties keeps it stable
+    src = order;
+    dst = tmp;
+    for (width = 1; width < count; width *= 2) {
+        for (left = 0; left < count; left += 2*width) {
+            mid = (left + width < count ? left + width : count);
+            right = (left + 2*width < count ? left + 2*width : count);
+            i = left;
+            j = mid;
+            k = left;
+            while (i < mid && j < right) {
+                if (compare(userref, src[j], src[i]) < 0) {
+                    dst[k++] = src[j++];
+                }
+                else {
+                    dst[k++] = src[i++];
+                }
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < right) {
+                dst[k++] = src[j++];
+            }
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != order) {
+        memcpy(order, src, count*sizeof(uint32_t));
+    }
+    free(tmp);
+
+    return 0;
+}
@@ -57,6 +57,23 @@ char * utf8memconv(const char *src, size_t n, const char *encoding);
  */
 char * utf8wcsconv(const wchar_t *src);
 
+/**
+ * Get current time from a monotonic clock, for measuring durations
+ * \return Time in microseconds
+ */
+uint64_t libambit_monotonic_time_us(void);
+
+/**
+ * Stable sort of an index array, used to order items that are too large
+ * to move around while sorting
+ * \param order Indices to sort, typically 0..count-1 on input
+ * \param count Number of indices
+ * \param compare Compare items a and b, return <0, 0 or >0
+ * \param userref Passed to compare
+ * \return 0 on success, -1 on allocation failure (order is then untouched)
+ */
+int libambit_stable_order(uint32_t *order, size_t count, int (*compare)(const void *userref, uint32_t a, uint32_t b), const void *userref);
+
 // static helpers
 static inline uint8_t read8(const uint8_t *buf, size_t offset)
 {
@@ -0,0 +1,214 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logchartdata.h"
+
+#include <QIODevice>
+#include <QtAlgorithms>
+
+// Levels are merged until the top one is about as coarse as a chart
+// would ever be drawn
+#define CHART_TOP_LEVEL_SIZE    64
+
+static bool bucketTimeLessThan(const LogChartData::Bucket &a, const LogChartData::Bucket &b)
+{
+    return a.time < b.time;
+}
+
+LogChartData::LogChartData() :
+    endTime(0)
+{
+}
+
+bool LogChartData::build(ambit_log_entry_t *logEntry)
+{
+    const ambit_log_columns_t *columns = libambit_log_entry_columns(logEntry);
+    Bucket bucket;
+    uint32_t i;
+    int series;
+
+    if (columns == NULL) {
+        return false;
+    }
+
+    endTime = 0;
+    for (series=0; series<SeriesCount; series++) {
+        levels[series].clear();
+        levels[series].append(QVector<Bucket>());
+    }
+
+    for (i=0; i<columns->count; i++) {
+        bucket.time = columns->time[i];
+        endTime = qMax(endTime, bucket.time);
+
+        if (columns->valid[i] & ambit_log_column_hr) {
+            bucket.min = bucket.max = columns->hr[i];
+            levels[HeartRate][0].append(bucket);
+        }
+        if (columns->valid[i] & ambit_log_column_altitude) {
+            bucket.min = bucket.max = columns->altitude[i];
+            levels[Altitude][0].append(bucket);
+        }
+        if (columns->valid[i] & ambit_log_column_speed) {
+            bucket.min = bucket.max = columns->speed[i]*0.036;
+            levels[Speed][0].append(bucket);
+        }
+    }
+
+    for (series=0; series<SeriesCount; series++) {
+        buildLevels((Series)series);
+    }
+
+    return true;
+}
+
+quint32 LogChartData::duration() const
+{
+    return endTime;
+}
+
+bool LogChartData::isEmpty(Series series) const
+{
+    return levels[series].isEmpty() || levels[series].first().isEmpty();
+}
+
+bool LogChartData::range(Series series, float *min, float *max) const
+{
+    if (isEmpty(series)) {
+        return false;
+    }
+
+    // The top level covers the whole log in a few buckets
+    const QVector<Bucket> &top = levels[series].last();
+    *min = top.first().min;
+    *max = top.first().max;
+    foreach (const Bucket &bucket, top) {
+        *min = qMin(*min, bucket.min);
+        *max = qMax(*max, bucket.max);
+    }
+
+    return true;
+}
+
+QVector<LogChartData::Bucket> LogChartData::buckets(Series series, quint32 from, quint32 to, int maxBuckets) const
+{
+    QVector<Bucket> result;
+    Bucket fromKey, toKey;
+    int level;
+
+    if (isEmpty(series)) {
+        return result;
+    }
+
+    fromKey.time = from;
+    toKey.time = to;
+
+    for (level=0; level<levels[series].count(); level++) {
+        const QVector<Bucket> &buckets = levels[series][level];
+        QVector<Bucket>::const_iterator first = qLowerBound(buckets.constBegin(), buckets.constEnd(), fromKey, bucketTimeLessThan);
+        QVector<Bucket>::const_iterator last = qUpperBound(buckets.constBegin(), buckets.constEnd(), toKey, bucketTimeLessThan);
+
+        if (last - first <= maxBuckets || level == levels[series].count() - 1) {
+            if (first != buckets.constBegin()) {
+                --first;
+            }
+            if (last != buckets.constEnd()) {
+                ++last;
+            }
+            result.reserve(last - first);
+            for (; first != last; ++first) {
+                result.append(*first);
+            }
+            break;
+        }
+    }
+
+    return result;
+}
+
+bool LogChartData::read(QDataStream &stream)
+{
+    quint32 seriesCount, levelCount, bucketCount, i, j, k;
+
+    stream >> endTime >> seriesCount;
+    if (stream.status() != QDataStream::Ok || seriesCount != SeriesCount) {
+        return false;
+    }
+
+    for (i=0; i<seriesCount; i++) {
+        levels[i].clear();
+        stream >> levelCount;
+        for (j=0; j<levelCount && stream.status() == QDataStream::Ok; j++) {
+            QVector<Bucket> buckets;
+            stream >> bucketCount;
+            if (stream.status() != QDataStream::Ok ||
+                (stream.device() != NULL && bucketCount > stream.device()->bytesAvailable()/12) ||
+                (j > 0 && bucketCount > (quint32)levels[i].last().count())) {
+                return false;
+            }
+            buckets.resize(bucketCount);
+            for (k=0; k<bucketCount; k++) {
+                stream >> buckets[k].time >> buckets[k].min >> buckets[k].max;
+            }
+            levels[i].append(buckets);
+        }
+    }
+
+    return stream.status() == QDataStream::Ok;
+}
+
+void LogChartData::write(QDataStream &stream) const
+{
+    int i, j, k;
+
+    stream << endTime << (quint32)SeriesCount;
+    for (i=0; i<SeriesCount; i++) {
+        stream << (quint32)levels[i].count();
+        for (j=0; j<levels[i].count(); j++) {
+            const QVector<Bucket> &buckets = levels[i][j];
+            stream << (quint32)buckets.count();
+            for (k=0; k<buckets.count(); k++) {
+                stream << buckets[k].time << buckets[k].min << buckets[k].max;
+            }
+        }
+    }
+}
+
+void LogChartData::buildLevels(Series series)
+{
+    int i;
+
+    while (levels[series].last().count() > CHART_TOP_LEVEL_SIZE) {
+        const QVector<Bucket> below = levels[series].last();
+        QVector<Bucket> merged;
+
+        merged.reserve((below.count() + 1)/2);
+        for (i=0; i<below.count(); i+=2) {
+            Bucket bucket = below[i];
+            if (i+1 < below.count()) {
+                bucket.min = qMin(bucket.min, below[i+1].min);
+                bucket.max = qMax(bucket.max, below[i+1].max);
+            }
+            merged.append(bucket);
+        }
+        levels[series].append(merged);
+    }
+}
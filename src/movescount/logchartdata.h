@@ -0,0 +1,95 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGCHARTDATA_H
+#define LOGCHARTDATA_H
+
+#include <QDataStream>
+#include <QVector>
+#include <libambit.h>
+
+/**
+ * Level of detail pyramid of the chart series of a log. Level 0 has one
+ * bucket per sample, each further level merges two neighbouring buckets
+ * of the level below, so any time range can be drawn from about as many
+ * buckets as there are pixels, whatever the sample count
+ */
+class LogChartData
+{
+public:
+    enum Series {
+        HeartRate,                  /* bpm */
+        Altitude,                   /* m */
+        Speed,                      /* km/h */
+        SeriesCount
+    };
+
+    class Bucket
+    {
+    public:
+        quint32 time;               /* ms, first sample of the bucket */
+        float min;
+        float max;
+    };
+
+    LogChartData();
+
+    /**
+     * Build the pyramid from the samples of a log entry
+     * \param logEntry Log entry with samples
+     * \return true on success
+     */
+    bool build(ambit_log_entry_t *logEntry);
+
+    /**
+     * \return Time of the last sample in ms
+     */
+    quint32 duration() const;
+
+    /**
+     * \return true if the log has no samples of series
+     */
+    bool isEmpty(Series series) const;
+
+    /**
+     * Get the value range of a series over the whole log
+     * \return false if the series is empty
+     */
+    bool range(Series series, float *min, float *max) const;
+
+    /**
+     * Get the buckets of a series between two times, from the finest level
+     * that has at most maxBuckets buckets in that range. The buckets just
+     * outside the range are included so that lines reach the edges
+     */
+    QVector<Bucket> buckets(Series series, quint32 from, quint32 to, int maxBuckets) const;
+
+    bool read(QDataStream &stream);
+    void write(QDataStream &stream) const;
+
+private:
+    void buildLevels(Series series);
+
+    QVector<QVector<Bucket> > levels[SeriesCount];
+    quint32 endTime;
+};
+
+#endif // LOGCHARTDATA_H
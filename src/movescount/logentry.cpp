@@ -23,77 +23,108 @@
 
 LogEntry::LogEntry() :
     personalSettings(NULL),
-    logEntry(NULL)
+    logEntry(NULL),
+    refs(new QAtomicInt(1))
 {
 }
 
-LogEntry::LogEntry(const LogEntry &other)
+LogEntry::LogEntry(const LogEntry &other) :
+    device(other.device),
+    time(other.time),
+    movescountId(other.movescountId),
+    deviceInfo(other.deviceInfo),
+    personalSettings(other.personalSettings),
+    logEntry(other.logEntry),
+    refs(other.refs)
 {
-    u_int32_t i;
-
-    device = other.device;
-    time = other.time;
-    movescountId = other.movescountId;
-    deviceInfo = other.deviceInfo;
-
-    if (other.personalSettings != NULL) {
-        personalSettings = (ambit_personal_settings_t*)malloc(sizeof(ambit_personal_settings_t));
-        memcpy(personalSettings, other.personalSettings, sizeof(ambit_personal_settings_t));
+    // Copying only shares the settings and samples
+    if (refs != NULL) {
+        refs->ref();
     }
     else {
-        personalSettings = NULL;
+        // Copy of a moved from entry
+        refs = new QAtomicInt(1);
     }
+}
 
-    if (other.logEntry != NULL) {
-        logEntry = (ambit_log_entry_t*)malloc(sizeof(ambit_log_entry_t));
-        memcpy(logEntry, other.logEntry, sizeof(ambit_log_entry_t));
-        if (other.logEntry->header.activity_name) {
-            logEntry->header.activity_name = strdup(other.logEntry->header.activity_name);
-        }
-        if (other.logEntry->samples != NULL) {
-            logEntry->samples = (ambit_log_sample_t*)malloc(sizeof(ambit_log_sample_t)*other.logEntry->samples_count);
-            memcpy(logEntry->samples, other.logEntry->samples, sizeof(ambit_log_sample_t)*other.logEntry->samples_count);
-            for (i=0; i<other.logEntry->samples_count; i++) {
-                if (other.logEntry->samples[i].type == ambit_log_sample_type_periodic) {
-                    if (other.logEntry->samples[i].u.periodic.values != NULL) {
-                        logEntry->samples[i].u.periodic.values = (ambit_log_sample_periodic_value_t*)malloc(sizeof(ambit_log_sample_periodic_value_t)*other.logEntry->samples[i].u.periodic.value_count);
-                        memcpy(logEntry->samples[i].u.periodic.values, other.logEntry->samples[i].u.periodic.values, sizeof(ambit_log_sample_periodic_value_t)*other.logEntry->samples[i].u.periodic.value_count);
-                    }
-                }
-                if (other.logEntry->samples[i].type == ambit_log_sample_type_gps_base) {
-                    if (other.logEntry->samples[i].u.gps_base.satellites != NULL) {
-                        logEntry->samples[i].u.gps_base.satellites = (ambit_log_gps_satellite_t*)malloc(sizeof(ambit_log_gps_satellite_t)*logEntry->samples[i].u.gps_base.satellites_count);
-                        memcpy(logEntry->samples[i].u.gps_base.satellites, other.logEntry->samples[i].u.gps_base.satellites, sizeof(ambit_log_gps_satellite_t)*logEntry->samples[i].u.gps_base.satellites_count);
-                    }
-                }
-                if (other.logEntry->samples[i].type == ambit_log_sample_type_unknown) {
-                    if (other.logEntry->samples[i].u.unknown.datalen > 0 && other.logEntry->samples[i].u.unknown.data != NULL) {
-                        logEntry->samples[i].u.unknown.data = (uint8_t*)malloc(other.logEntry->samples[i].u.unknown.datalen);
-                        memcpy(logEntry->samples[i].u.unknown.data, other.logEntry->samples[i].u.unknown.data, other.logEntry->samples[i].u.unknown.datalen);
-                    }
-                }
-            }
-        }
-    }
+#ifdef Q_COMPILER_RVALUE_REFS
+LogEntry::LogEntry(LogEntry &&other) :
+    personalSettings(NULL),
+    logEntry(NULL),
+    refs(NULL)
+{
+    swap(other);
 }
+#endif
 
 LogEntry& LogEntry::operator=(const LogEntry &rhs)
 {
     LogEntry tmp(rhs);
 
-    std::swap(device, tmp.device);
-    std::swap(time, tmp.time);
-    std::swap(movescountId, tmp.movescountId);
-    std::swap(deviceInfo, tmp.deviceInfo);
-    std::swap(personalSettings, tmp.personalSettings);
-    std::swap(logEntry, tmp.logEntry);
+    swap(tmp);
+
+    return *this;
+}
+
+#ifdef Q_COMPILER_RVALUE_REFS
+LogEntry& LogEntry::operator=(LogEntry &&rhs)
+{
+    swap(rhs);
 
     return *this;
 }
+#endif
+
+void LogEntry::swap(LogEntry &other)
+{
+    std::swap(device, other.device);
+    std::swap(time, other.time);
+    std::swap(movescountId, other.movescountId);
+    std::swap(deviceInfo, other.deviceInfo);
+    std::swap(personalSettings, other.personalSettings);
+    std::swap(logEntry, other.logEntry);
+    std::swap(refs, other.refs);
+}
+
+void LogEntry::detach()
+{
+    ambit_personal_settings_t *settings = personalSettings;
+    ambit_log_entry_t *entry = logEntry;
+
+    if (refs == NULL) {
+        // Pointers set on a moved from entry are its own
+        refs = new QAtomicInt(1);
+        return;
+    }
+    if (*refs == 1) {
+        return;
+    }
+
+    if (settings != NULL) {
+        personalSettings = (ambit_personal_settings_t*)malloc(sizeof(ambit_personal_settings_t));
+        memcpy(personalSettings, settings, sizeof(ambit_personal_settings_t));
+    }
+    if (entry != NULL) {
+        logEntry = libambit_log_entry_copy(entry);
+    }
+
+    refs->deref();
+    refs = new QAtomicInt(1);
+}
 
 LogEntry::~LogEntry()
 {
-    u_int32_t i;
+    if (refs != NULL) {
+        if (refs->deref()) {
+            // Still used by a copy
+            refs = NULL;
+            personalSettings = NULL;
+            logEntry = NULL;
+            return;
+        }
+        delete refs;
+        refs = NULL;
+    }
 
     if (personalSettings != NULL) {
         free(personalSettings);
@@ -101,27 +132,7 @@ LogEntry::~LogEntry()
     }
 
     if (logEntry != NULL) {
-        if (logEntry->samples != NULL) {
-            for (i=0; i<logEntry->samples_count; i++) {
-                if (logEntry->samples[i].type == ambit_log_sample_type_periodic) {
-                    if (logEntry->samples[i].u.periodic.values != NULL) {
-                        free(logEntry->samples[i].u.periodic.values);
-                    }
-                }
-                if (logEntry->samples[i].type == ambit_log_sample_type_gps_base) {
-                    if (logEntry->samples[i].u.gps_base.satellites != NULL) {
-                        free(logEntry->samples[i].u.gps_base.satellites);
-                    }
-                }
-                if (logEntry->samples[i].type == ambit_log_sample_type_unknown) {
-                    if (logEntry->samples[i].u.unknown.data != NULL) {
-                        free(logEntry->samples[i].u.unknown.data);
-                    }
-                }
-            }
-            free(logEntry->samples);
-        }
-        free(logEntry);
+        libambit_log_entry_free(logEntry);
     }
 
     logEntry = NULL;
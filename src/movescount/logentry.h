@@ -23,18 +23,36 @@
 #define LOGENTRY_H
 
 #include <QDateTime>
+#include <QAtomicInt>
 #include <libambit.h>
 
 #include "deviceinfo.h"
 
+/*
+ * Copies share personalSettings and logEntry, which are freed with the
+ * last copy. Call detach() before changing either in place, or before
+ * replacing the pointers of an entry that may have been copied.
+ */
 class LogEntry
 {
 public:
     explicit LogEntry();
     LogEntry(const LogEntry &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    LogEntry(LogEntry &&other);
+#endif
     ~LogEntry();
 
     LogEntry& operator=(const LogEntry &rhs);
+#ifdef Q_COMPILER_RVALUE_REFS
+    LogEntry& operator=(LogEntry &&rhs);
+#endif
+    void swap(LogEntry &other);
+    /**
+     * Give this entry its own personal settings and log entry if they
+     * are shared with a copy
+     */
+    void detach();
 
     bool isUploaded();
 
@@ -44,6 +62,9 @@ public:
     DeviceInfo deviceInfo;
     ambit_personal_settings_t *personalSettings;
     ambit_log_entry_t *logEntry;
+
+private:
+    QAtomicInt *refs;       /* entries sharing the pointers, NULL once moved from */
 signals:
     
 public slots:
@@ -0,0 +1,309 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logexport.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+/*
+ * Days from 1970-01-01 to a date of the proleptic Gregorian calendar,
+ * without the QDateTime conversions for every sample
+ */
+static qint64 daysFromCivil(int year, int month, int day)
+{
+    int era, yearOfEra, dayOfYear, dayOfEra;
+
+    year -= (month <= 2 ? 1 : 0);
+    era = (year >= 0 ? year : year - 399) / 400;
+    yearOfEra = year - era*400;
+    dayOfYear = (153*(month + (month > 2 ? -3 : 9)) + 2)/5 + day - 1;
+    dayOfEra = yearOfEra*365 + yearOfEra/4 - yearOfEra/100 + dayOfYear;
+
+    return (qint64)era*146097 + dayOfEra - 719468;
+}
+
+LogExportBuffer::LogExportBuffer(QIODevice *target, int size) :
+    target(target), size(size), ok(true)
+{
+    buffer.reserve(size + 256);
+    open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+LogExportBuffer::~LogExportBuffer()
+{
+    flushBuffer();
+}
+
+bool LogExportBuffer::isSequential() const
+{
+    return true;
+}
+
+void LogExportBuffer::append(const char *data, int len)
+{
+    buffer.append(data, len);
+    if (buffer.size() >= size) {
+        flushBuffer();
+    }
+}
+
+void LogExportBuffer::append(const char *string)
+{
+    append(string, qstrlen(string));
+}
+
+void LogExportBuffer::append(const QByteArray &data)
+{
+    append(data.constData(), data.size());
+}
+
+void LogExportBuffer::print(const char *format, ...)
+{
+    char text[256];
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    if (len > 0) {
+        append(text, qMin(len, (int)sizeof(text) - 1));
+    }
+}
+
+void LogExportBuffer::appendEscaped(const char *string)
+{
+    const char *start = string;
+
+    if (string == NULL) {
+        return;
+    }
+
+    // Runs without special characters are appended in one go
+    for (; *string != '\0'; string++) {
+        const char *entity = NULL;
+
+        switch (*string) {
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '&':
+            entity = "&amp;";
+            break;
+        default:
+            continue;
+        }
+
+        buffer.append(start, string - start);
+        buffer.append(entity);
+        start = string + 1;
+    }
+    append(start, string - start);
+}
+
+bool LogExportBuffer::flushBuffer()
+{
+    if (buffer.size() > 0) {
+        if (target->write(buffer) != buffer.size()) {
+            ok = false;
+        }
+        buffer.clear();
+    }
+
+    return ok;
+}
+
+bool LogExportBuffer::isOk() const
+{
+    return ok;
+}
+
+qint64 LogExportBuffer::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+
+    return -1;
+}
+
+qint64 LogExportBuffer::writeData(const char *data, qint64 len)
+{
+    append(data, (int)len);
+
+    return len;
+}
+
+LogExportState::LogExportState() :
+    hasUTCTime(false), utcTime(0),
+    hasHeartRate(false), heartRate(0), hasAltitude(false), altitude(0),
+    hasDistance(false), distance(0), hasSpeed(false), speed(0),
+    hasCadence(false), cadence(0), hasPosition(false), latitude(0), longitude(0),
+    positionChanged(false), latitudePending(false), longitudePending(false)
+{
+    utcTimeText[0] = '\0';
+}
+
+void LogExportState::update(const ambit_log_sample_t *sample)
+{
+    const ambit_date_time_t *utc = &sample->utc_time;
+    int i;
+
+    // Formatted once here rather than by every writer
+    hasUTCTime = (utc->year != 0);
+    if (hasUTCTime) {
+        utcTime = ((daysFromCivil(utc->year, utc->month, utc->day)*24 + utc->hour)*60 + utc->minute)*60000 + utc->msec;
+        snprintf(utcTimeText, sizeof(utcTimeText), "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ",
+                 utc->year, utc->month, utc->day, utc->hour, utc->minute, utc->msec/1000, utc->msec%1000);
+    }
+
+    positionChanged = false;
+
+    switch (sample->type) {
+    case ambit_log_sample_type_periodic:
+        for (i=0; i<sample->u.periodic.value_count; i++) {
+            const ambit_log_sample_periodic_value_t *value = &sample->u.periodic.values[i];
+
+            switch (value->type) {
+            case ambit_log_sample_periodic_type_hr:
+                if (value->u.hr != 0xff) {
+                    hasHeartRate = true;
+                    heartRate = value->u.hr;
+                }
+                break;
+            case ambit_log_sample_periodic_type_altitude:
+                hasAltitude = true;
+                altitude = value->u.altitude;
+                break;
+            case ambit_log_sample_periodic_type_distance:
+                hasDistance = true;
+                distance = value->u.distance;
+                break;
+            case ambit_log_sample_periodic_type_speed:
+                if (value->u.speed != 0xffff) {
+                    hasSpeed = true;
+                    speed = value->u.speed;
+                }
+                break;
+            case ambit_log_sample_periodic_type_cadence:
+                if (value->u.cadence != 0xff) {
+                    hasCadence = true;
+                    cadence = value->u.cadence;
+                }
+                break;
+            case ambit_log_sample_periodic_type_latitude:
+                latitude = value->u.latitude;
+                latitudePending = true;
+                break;
+            case ambit_log_sample_periodic_type_longitude:
+                longitude = value->u.longitude;
+                longitudePending = true;
+                break;
+            default:
+                break;
+            }
+        }
+        if (latitudePending && longitudePending) {
+            latitudePending = longitudePending = false;
+            hasPosition = positionChanged = true;
+        }
+        break;
+    case ambit_log_sample_type_gps_base:
+        latitude = sample->u.gps_base.latitude;
+        longitude = sample->u.gps_base.longitude;
+        hasPosition = positionChanged = true;
+        break;
+    case ambit_log_sample_type_gps_small:
+        latitude = sample->u.gps_small.latitude;
+        longitude = sample->u.gps_small.longitude;
+        hasPosition = positionChanged = true;
+        break;
+    case ambit_log_sample_type_gps_tiny:
+        latitude = sample->u.gps_tiny.latitude;
+        longitude = sample->u.gps_tiny.longitude;
+        hasPosition = positionChanged = true;
+        break;
+    case ambit_log_sample_type_position:
+        latitude = sample->u.position.latitude;
+        longitude = sample->u.position.longitude;
+        hasPosition = positionChanged = true;
+        break;
+    default:
+        break;
+    }
+}
+
+LogExport::LogExport()
+{
+}
+
+LogExport::~LogExport()
+{
+    qDeleteAll(writers);
+}
+
+void LogExport::addWriter(LogExportWriter *writer)
+{
+    writers.append(writer);
+}
+
+bool LogExport::run(LogEntry *logEntry)
+{
+    LogExportState state;
+    const uint32_t *order;
+    ambit_log_sample_t *sample;
+    bool ret = true;
+    int i, j;
+
+    if (logEntry == NULL || logEntry->logEntry == NULL) {
+        return false;
+    }
+
+    for (j=0; j<writers.count(); j++) {
+        ret = writers[j]->begin(logEntry) && ret;
+    }
+
+    // Computed once and kept with the log entry for the other exporters
+    order = libambit_log_entry_order(logEntry->logEntry);
+    if (order == NULL && logEntry->logEntry->samples_count > 0) {
+        // The writers still get to end and clean up
+        ret = false;
+    }
+    else if (order != NULL) {
+        for (i=0; i<(int)logEntry->logEntry->samples_count; i++) {
+            sample = &logEntry->logEntry->samples[order[i]];
+            state.update(sample);
+            for (j=0; j<writers.count(); j++) {
+                ret = writers[j]->sample(sample, state) && ret;
+            }
+        }
+    }
+
+    for (j=0; j<writers.count(); j++) {
+        ret = writers[j]->end() && ret;
+    }
+
+    return ret;
+}
@@ -0,0 +1,161 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGEXPORT_H
+#define LOGEXPORT_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <libambit.h>
+
+#include "logentry.h"
+
+/**
+ * Collects the small writes of a format writer and passes them on to the
+ * target device in large blocks. Text writers also get printf style
+ * formatting and XML escaping, which are the bulk of their work
+ */
+class LogExportBuffer : public QIODevice
+{
+public:
+    /**
+     * \param target Device written to, must be open for writing
+     * \param size Bytes collected before they are written to target
+     */
+    explicit LogExportBuffer(QIODevice *target, int size = 65536);
+    ~LogExportBuffer();
+
+    bool isSequential() const;
+
+    void append(const char *data, int len);
+    void append(const char *string);
+    void append(const QByteArray &data);
+    /**
+     * Append a printf formatted string of at most 255 characters
+     */
+    void print(const char *format, ...);
+    /**
+     * Append a string with <, > and & replaced by their XML entities
+     */
+    void appendEscaped(const char *string);
+
+    /**
+     * Write what is collected to the target
+     * \return false if the target failed any write so far
+     */
+    bool flushBuffer();
+    bool isOk() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    QIODevice *target;
+    QByteArray buffer;
+    int size;
+    bool ok;
+};
+
+/**
+ * Values carried from sample to sample, updated by the engine once for
+ * all writers. Periodic samples only hold the values that changed
+ */
+class LogExportState
+{
+public:
+    LogExportState();
+
+    /**
+     * Fold a sample into the state
+     */
+    void update(const ambit_log_sample_t *sample);
+
+    bool hasUTCTime;            /* of the current sample */
+    qint64 utcTime;             /* ms since 1970-01-01 UTC */
+    char utcTimeText[25];       /* yyyy-MM-ddThh:mm:ss.zzzZ */
+
+    bool hasHeartRate;
+    quint8 heartRate;           /* bpm */
+    bool hasAltitude;
+    qint16 altitude;            /* m */
+    bool hasDistance;
+    quint32 distance;           /* m */
+    bool hasSpeed;
+    quint16 speed;              /* m/s scale: 0.01 */
+    bool hasCadence;
+    quint8 cadence;             /* rpm */
+    bool hasPosition;
+    qint32 latitude;            /* degree, scale: 0.0000001 */
+    qint32 longitude;           /* degree, scale: 0.0000001 */
+    bool positionChanged;       /* by the current sample */
+
+private:
+    bool latitudePending;       /* periodic values come one by one */
+    bool longitudePending;
+};
+
+/**
+ * Format writer fed by LogExport. All calls get the same log entry, the
+ * writer may keep pointers into it until end()
+ */
+class LogExportWriter
+{
+public:
+    virtual ~LogExportWriter() {}
+
+    /**
+     * \return false on failure, the remaining calls are still made
+     */
+    virtual bool begin(LogEntry *logEntry) = 0;
+    virtual bool sample(ambit_log_sample_t *sample, const LogExportState &state) = 0;
+    virtual bool end() = 0;
+};
+
+/**
+ * Writes a log entry in any number of formats from a single pass over
+ * its samples in time order
+ */
+class LogExport
+{
+public:
+    LogExport();
+    ~LogExport();
+
+    /**
+     * Add a format writer
+     * \param writer Writer, owned by the export from now on
+     */
+    void addWriter(LogExportWriter *writer);
+
+    /**
+     * Feed a log entry to all writers
+     * \param logEntry Log entry with samples
+     * \return true if all writers succeeded
+     */
+    bool run(LogEntry *logEntry);
+
+private:
+    QList<LogExportWriter*> writers;
+};
+
+#endif // LOGEXPORT_H
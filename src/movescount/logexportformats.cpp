@@ -0,0 +1,449 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logexportformats.h"
+
+// Seconds from 1970-01-01 to the FIT epoch 1989-12-31 00:00 UTC
+#define FIT_EPOCH_OFFSET        631065600
+#define FIT_PROTOCOL_VERSION    0x10
+#define FIT_PROFILE_VERSION     2093
+#define FIT_MANUFACTURER_SUUNTO 23
+
+// Global message numbers
+#define FIT_MESG_FILE_ID        0
+#define FIT_MESG_SESSION        18
+#define FIT_MESG_LAP            19
+#define FIT_MESG_RECORD         20
+#define FIT_MESG_ACTIVITY       34
+
+// Base types
+#define FIT_ENUM                0x00
+#define FIT_UINT8               0x02
+#define FIT_UINT16              0x84
+#define FIT_SINT32              0x85
+#define FIT_UINT32              0x86
+#define FIT_UINT32Z             0x8c
+
+// Local message types, each defined once per file
+enum fit_local_e {
+    fit_local_file_id = 0,
+    fit_local_record,
+    fit_local_lap,
+    fit_local_session,
+    fit_local_activity
+};
+
+typedef struct fit_field_s {
+    quint8 number;
+    quint8 size;
+    quint8 baseType;
+} fit_field_t;
+
+static const fit_field_t fitFileIdFields[] = {
+    { 0, 1, FIT_ENUM },         /* type */
+    { 1, 2, FIT_UINT16 },       /* manufacturer */
+    { 2, 2, FIT_UINT16 },       /* product */
+    { 3, 4, FIT_UINT32Z },      /* serial_number */
+    { 4, 4, FIT_UINT32 }        /* time_created */
+};
+
+static const fit_field_t fitRecordFields[] = {
+    { 253, 4, FIT_UINT32 },     /* timestamp */
+    { 0, 4, FIT_SINT32 },       /* position_lat, semicircles */
+    { 1, 4, FIT_SINT32 },       /* position_long, semicircles */
+    { 2, 2, FIT_UINT16 },       /* altitude, m scale: 0.2 offset: -500 */
+    { 3, 1, FIT_UINT8 },        /* heart_rate, bpm */
+    { 4, 1, FIT_UINT8 },        /* cadence, rpm */
+    { 5, 4, FIT_UINT32 },       /* distance, m scale: 0.01 */
+    { 6, 2, FIT_UINT16 }        /* speed, m/s scale: 0.001 */
+};
+
+// Shared by the lap and the session, the session adds the sport
+static const fit_field_t fitLapFields[] = {
+    { 253, 4, FIT_UINT32 },     /* timestamp */
+    { 0, 1, FIT_ENUM },         /* event */
+    { 1, 1, FIT_ENUM },         /* event_type */
+    { 2, 4, FIT_UINT32 },       /* start_time */
+    { 7, 4, FIT_UINT32 },       /* total_elapsed_time, s scale: 0.001 */
+    { 8, 4, FIT_UINT32 },       /* total_timer_time, s scale: 0.001 */
+    { 9, 4, FIT_UINT32 },       /* total_distance, m scale: 0.01 */
+    { 5, 1, FIT_ENUM }          /* sport, session only */
+};
+
+static const fit_field_t fitActivityFields[] = {
+    { 253, 4, FIT_UINT32 },     /* timestamp */
+    { 0, 4, FIT_UINT32 },       /* total_timer_time, s scale: 0.001 */
+    { 1, 2, FIT_UINT16 },       /* num_sessions */
+    { 2, 1, FIT_ENUM },         /* type */
+    { 3, 1, FIT_ENUM },         /* event */
+    { 4, 1, FIT_ENUM }          /* event_type */
+};
+
+#define FIT_FIELD_COUNT(fields) ((int)(sizeof(fields)/sizeof(fields[0])))
+
+static void fitPut8(QByteArray &data, quint8 value)
+{
+    data.append((char)value);
+}
+
+static void fitPut16(QByteArray &data, quint16 value)
+{
+    data.append((char)(value & 0xff));
+    data.append((char)(value >> 8));
+}
+
+static void fitPut32(QByteArray &data, quint32 value)
+{
+    fitPut16(data, value & 0xffff);
+    fitPut16(data, value >> 16);
+}
+
+static void fitDefine(QByteArray &data, quint8 local, quint16 global, const fit_field_t *fields, int count)
+{
+    int i;
+
+    fitPut8(data, 0x40 | local);
+    fitPut8(data, 0);           /* reserved */
+    fitPut8(data, 0);           /* little endian */
+    fitPut16(data, global);
+    fitPut8(data, count);
+    for (i=0; i<count; i++) {
+        fitPut8(data, fields[i].number);
+        fitPut8(data, fields[i].size);
+        fitPut8(data, fields[i].baseType);
+    }
+}
+
+static quint16 fitCRC(quint16 crc, const QByteArray &data)
+{
+    static const quint16 table[16] = {
+        0x0000, 0xcc01, 0xd801, 0x1400, 0xf001, 0x3c00, 0x2800, 0xe401,
+        0xa001, 0x6c00, 0x7800, 0xb401, 0x5000, 0x9c01, 0x8801, 0x4400
+    };
+    quint16 tmp;
+    int i;
+
+    for (i=0; i<data.size(); i++) {
+        quint8 byte = data[i];
+
+        tmp = table[crc & 0xf];
+        crc = (crc >> 4) & 0x0fff;
+        crc = crc ^ tmp ^ table[byte & 0xf];
+        tmp = table[crc & 0xf];
+        crc = (crc >> 4) & 0x0fff;
+        crc = crc ^ tmp ^ table[(byte >> 4) & 0xf];
+    }
+
+    return crc;
+}
+
+static qint32 fitSemicircles(qint32 degrees)
+{
+    // Degrees scale 0.0000001 to 2^31 per 180 degrees
+    return (qint32)qRound64(degrees*(2147483648.0/1800000000.0));
+}
+
+LogExportGPX::LogExportGPX(QIODevice *device, double tolerance) :
+    output(device), tolerance(tolerance), samples(NULL)
+{
+}
+
+bool LogExportGPX::begin(LogEntry *logEntry)
+{
+    QVector<uint32_t> index;
+    int count, i;
+
+    samples = logEntry->logEntry->samples;
+    keep.clear();
+    if (tolerance > 0 && logEntry->logEntry->samples_count > 0) {
+        index.resize(logEntry->logEntry->samples_count);
+        count = libambit_log_entry_track_simplify(logEntry->logEntry, tolerance, index.data());
+        if (count < 0) {
+            return false;
+        }
+        keep.fill(false, logEntry->logEntry->samples_count);
+        for (i=0; i<count; i++) {
+            keep[index[i]] = true;
+        }
+    }
+
+    output.append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<gpx version=\"1.1\" creator=\"Openambit\" xmlns=\"http://www.topografix.com/GPX/1/1\" "
+                  "xmlns:gpxtpx=\"http://www.garmin.com/xmlschemas/TrackPointExtension/v1\">\n"
+                  "<trk>\n<name>");
+    output.appendEscaped(logEntry->logEntry->header.activity_name);
+    output.append("</name>\n<trkseg>\n");
+
+    return true;
+}
+
+bool LogExportGPX::sample(ambit_log_sample_t *sample, const LogExportState &state)
+{
+    if (!state.positionChanged || !state.hasUTCTime) {
+        return true;
+    }
+    // Positions from periodic samples are not part of the simplified track
+    // and always written
+    if (!keep.isEmpty() && sample->type != ambit_log_sample_type_periodic && !keep[sample - samples]) {
+        return true;
+    }
+
+    output.print("<trkpt lat=\"%.7f\" lon=\"%.7f\">", state.latitude/10000000.0, state.longitude/10000000.0);
+    if (state.hasAltitude) {
+        output.print("<ele>%d</ele>", state.altitude);
+    }
+    output.append("<time>");
+    output.append(state.utcTimeText);
+    output.append("</time>");
+    if (state.hasHeartRate) {
+        output.print("<extensions><gpxtpx:TrackPointExtension><gpxtpx:hr>%u</gpxtpx:hr></gpxtpx:TrackPointExtension></extensions>", state.heartRate);
+    }
+    output.append("</trkpt>\n");
+
+    return true;
+}
+
+bool LogExportGPX::end()
+{
+    output.append("</trkseg>\n</trk>\n</gpx>\n");
+
+    return output.flushBuffer();
+}
+
+LogExportTCX::LogExportTCX(QIODevice *device) :
+    output(device), logEntry(NULL), started(false)
+{
+}
+
+bool LogExportTCX::begin(LogEntry *logEntry)
+{
+    this->logEntry = logEntry;
+    started = false;
+
+    output.append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<TrainingCenterDatabase xmlns=\"http://www.garmin.com/xmlschemas/TrainingCenterDatabase/v2\">\n"
+                  "<Activities>\n");
+
+    return true;
+}
+
+bool LogExportTCX::sample(ambit_log_sample_t *sample, const LogExportState &state)
+{
+    ambit_log_header_t *header = &logEntry->logEntry->header;
+
+    if (sample->type != ambit_log_sample_type_periodic || !state.hasUTCTime) {
+        return true;
+    }
+
+    // Samples before the first with a UTC time can't be placed
+    if (!started) {
+        started = true;
+        output.append("<Activity Sport=\"Other\">\n<Id>");
+        output.append(state.utcTimeText);
+        output.append("</Id>\n<Lap StartTime=\"");
+        output.append(state.utcTimeText);
+        output.append("\">\n");
+        output.print("<TotalTimeSeconds>%.1f</TotalTimeSeconds>\n", header->duration/1000.0);
+        output.print("<DistanceMeters>%u</DistanceMeters>\n", header->distance);
+        output.print("<Calories>%u</Calories>\n", header->energy_consumption);
+        if (header->heartrate_avg > 0) {
+            output.print("<AverageHeartRateBpm><Value>%u</Value></AverageHeartRateBpm>\n", header->heartrate_avg);
+            output.print("<MaximumHeartRateBpm><Value>%u</Value></MaximumHeartRateBpm>\n", header->heartrate_max);
+        }
+        output.append("<Intensity>Active</Intensity>\n<TriggerMethod>Manual</TriggerMethod>\n<Track>\n");
+    }
+
+    output.append("<Trackpoint><Time>");
+    output.append(state.utcTimeText);
+    output.append("</Time>");
+    if (state.hasPosition) {
+        output.print("<Position><LatitudeDegrees>%.7f</LatitudeDegrees><LongitudeDegrees>%.7f</LongitudeDegrees></Position>",
+                     state.latitude/10000000.0, state.longitude/10000000.0);
+    }
+    if (state.hasAltitude) {
+        output.print("<AltitudeMeters>%d</AltitudeMeters>", state.altitude);
+    }
+    if (state.hasDistance) {
+        output.print("<DistanceMeters>%u</DistanceMeters>", state.distance);
+    }
+    if (state.hasHeartRate) {
+        output.print("<HeartRateBpm><Value>%u</Value></HeartRateBpm>", state.heartRate);
+    }
+    if (state.hasCadence) {
+        output.print("<Cadence>%u</Cadence>", state.cadence);
+    }
+    output.append("</Trackpoint>\n");
+
+    return true;
+}
+
+bool LogExportTCX::end()
+{
+    if (started) {
+        output.append("</Track>\n</Lap>\n</Activity>\n");
+    }
+    output.append("</Activities>\n</TrainingCenterDatabase>\n");
+
+    return output.flushBuffer();
+}
+
+LogExportFIT::LogExportFIT(QIODevice *device) :
+    output(device), logEntry(NULL), startTime(0), lastTime(0)
+{
+}
+
+bool LogExportFIT::begin(LogEntry *logEntry)
+{
+    this->logEntry = logEntry;
+    startTime = lastTime = 0;
+
+    records.clear();
+    records.reserve(logEntry->logEntry->samples_count*16);
+    fitDefine(records, fit_local_record, FIT_MESG_RECORD, fitRecordFields, FIT_FIELD_COUNT(fitRecordFields));
+
+    return true;
+}
+
+bool LogExportFIT::sample(ambit_log_sample_t *sample, const LogExportState &state)
+{
+    quint32 time;
+
+    if ((sample->type != ambit_log_sample_type_periodic && !state.positionChanged) || !state.hasUTCTime) {
+        return true;
+    }
+
+    time = (quint32)(state.utcTime/1000 - FIT_EPOCH_OFFSET);
+    if (startTime == 0) {
+        startTime = time;
+    }
+    lastTime = time;
+
+    // Values not known yet are written as the invalid value of their type
+    fitPut8(records, fit_local_record);
+    fitPut32(records, time);
+    fitPut32(records, state.hasPosition ? fitSemicircles(state.latitude) : 0x7fffffff);
+    fitPut32(records, state.hasPosition ? fitSemicircles(state.longitude) : 0x7fffffff);
+    fitPut16(records, state.hasAltitude ? (quint16)((state.altitude + 500)*5) : 0xffff);
+    fitPut8(records, state.hasHeartRate ? state.heartRate : 0xff);
+    fitPut8(records, state.hasCadence ? state.cadence : 0xff);
+    fitPut32(records, state.hasDistance ? state.distance*100 : 0xffffffff);
+    fitPut16(records, state.hasSpeed ? (quint16)qMin(state.speed*10, 0xfffe) : 0xffff);
+
+    return true;
+}
+
+bool LogExportFIT::end()
+{
+    ambit_log_header_t *header = &logEntry->logEntry->header;
+    QByteArray fileHeader, messages;
+    quint16 crc;
+    int field;
+
+    messages.reserve(records.size() + 256);
+
+    fitDefine(messages, fit_local_file_id, FIT_MESG_FILE_ID, fitFileIdFields, FIT_FIELD_COUNT(fitFileIdFields));
+    fitPut8(messages, fit_local_file_id);
+    fitPut8(messages, 4);       /* activity file */
+    fitPut16(messages, FIT_MANUFACTURER_SUUNTO);
+    fitPut16(messages, 0);
+    fitPut32(messages, logEntry->deviceInfo.serial.toUInt());
+    fitPut32(messages, startTime);
+
+    messages.append(records);
+
+    // The lap and the session cover the whole log
+    for (field=FIT_FIELD_COUNT(fitLapFields)-1; field<=FIT_FIELD_COUNT(fitLapFields); field++) {
+        bool session = (field == FIT_FIELD_COUNT(fitLapFields));
+        quint8 local = (session ? fit_local_session : fit_local_lap);
+
+        fitDefine(messages, local, session ? FIT_MESG_SESSION : FIT_MESG_LAP, fitLapFields, field);
+        fitPut8(messages, local);
+        fitPut32(messages, lastTime);
+        fitPut8(messages, session ? 8 : 9); /* event session or lap */
+        fitPut8(messages, 1);   /* stop */
+        fitPut32(messages, startTime);
+        fitPut32(messages, header->duration);
+        fitPut32(messages, header->duration);
+        fitPut32(messages, header->distance*100);
+        if (session) {
+            fitPut8(messages, 0); /* generic sport */
+        }
+    }
+
+    fitDefine(messages, fit_local_activity, FIT_MESG_ACTIVITY, fitActivityFields, FIT_FIELD_COUNT(fitActivityFields));
+    fitPut8(messages, fit_local_activity);
+    fitPut32(messages, lastTime);
+    fitPut32(messages, header->duration);
+    fitPut16(messages, 1);
+    fitPut8(messages, 0);       /* manual */
+    fitPut8(messages, 26);      /* activity */
+    fitPut8(messages, 1);       /* stop */
+
+    fitPut8(fileHeader, 14);
+    fitPut8(fileHeader, FIT_PROTOCOL_VERSION);
+    fitPut16(fileHeader, FIT_PROFILE_VERSION);
+    fitPut32(fileHeader, messages.size());
+    fileHeader.append(".FIT");
+    fitPut16(fileHeader, fitCRC(0, fileHeader));
+
+    // The file CRC covers the header too
+    crc = fitCRC(fitCRC(0, fileHeader), messages);
+    fitPut16(messages, crc);
+
+    output.append(fileHeader);
+    output.append(messages);
+    records.clear();
+
+    return output.flushBuffer();
+}
+
+LogExportMovescountJSON::LogExportMovescountJSON(QIODevice *device) :
+    output(device), logEntry(NULL)
+{
+}
+
+bool LogExportMovescountJSON::begin(LogEntry *logEntry)
+{
+    this->logEntry = logEntry;
+
+    return true;
+}
+
+bool LogExportMovescountJSON::sample(ambit_log_sample_t *sample, const LogExportState &state)
+{
+    Q_UNUSED(sample);
+    Q_UNUSED(state);
+
+    return true;
+}
+
+bool LogExportMovescountJSON::end()
+{
+    QByteArray data;
+
+    // Uses the sample order already computed by the engine
+    if (json.generateLogData(logEntry, data) != 0) {
+        return false;
+    }
+    output.append(data);
+
+    return output.flushBuffer();
+}
@@ -0,0 +1,113 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGEXPORTFORMATS_H
+#define LOGEXPORTFORMATS_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QVector>
+
+#include "logexport.h"
+#include "movescountjson.h"
+
+/**
+ * GPX 1.1 track with a point per position fix, heart rate in the Garmin
+ * track point extension. With a tolerance in meters, GPS fixes are
+ * dropped where the track is simplified, see
+ * libambit_log_entry_track_simplify().
+ */
+class LogExportGPX : public LogExportWriter
+{
+public:
+    explicit LogExportGPX(QIODevice *device, double tolerance = 0);
+
+    bool begin(LogEntry *logEntry);
+    bool sample(ambit_log_sample_t *sample, const LogExportState &state);
+    bool end();
+
+private:
+    LogExportBuffer output;
+    double tolerance;
+    ambit_log_sample_t *samples;
+    QVector<bool> keep;         /* per sample, empty if not simplified */
+};
+
+/**
+ * TCX activity of a single lap with a track point per periodic sample
+ */
+class LogExportTCX : public LogExportWriter
+{
+public:
+    explicit LogExportTCX(QIODevice *device);
+
+    bool begin(LogEntry *logEntry);
+    bool sample(ambit_log_sample_t *sample, const LogExportState &state);
+    bool end();
+
+private:
+    LogExportBuffer output;
+    LogEntry *logEntry;
+    bool started;               /* activity is opened at the first UTC time */
+};
+
+/**
+ * FIT activity file with a record per periodic sample or position fix,
+ * closed by a lap, a session and an activity message. The header holds
+ * the data size, so the messages are collected until end()
+ */
+class LogExportFIT : public LogExportWriter
+{
+public:
+    explicit LogExportFIT(QIODevice *device);
+
+    bool begin(LogEntry *logEntry);
+    bool sample(ambit_log_sample_t *sample, const LogExportState &state);
+    bool end();
+
+private:
+    LogExportBuffer output;
+    LogEntry *logEntry;
+    QByteArray records;
+    quint32 startTime;          /* FIT time, s since 1989-12-31 UTC, 0 until known */
+    quint32 lastTime;
+};
+
+/**
+ * Movescount JSON upload document. Its sample lists are compressed per
+ * content, so the document is generated from the whole entry in end()
+ */
+class LogExportMovescountJSON : public LogExportWriter
+{
+public:
+    explicit LogExportMovescountJSON(QIODevice *device);
+
+    bool begin(LogEntry *logEntry);
+    bool sample(ambit_log_sample_t *sample, const LogExportState &state);
+    bool end();
+
+private:
+    LogExportBuffer output;
+    LogEntry *logEntry;
+    MovesCountJSON json;
+};
+
+#endif // LOGEXPORTFORMATS_H
@@ -0,0 +1,135 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logrollup.h"
+
+LogRollup::Totals::Totals() :
+    count(0), duration(0), distance(0), ascent(0), descent(0)
+{
+}
+
+void LogRollup::Totals::add(const Totals &other)
+{
+    count += other.count;
+    duration += other.duration;
+    distance += other.distance;
+    ascent += other.ascent;
+    descent += other.descent;
+}
+
+void LogRollup::Totals::subtract(const Totals &other)
+{
+    count -= other.count;
+    duration -= other.duration;
+    distance -= other.distance;
+    ascent -= other.ascent;
+    descent -= other.descent;
+}
+
+LogRollup::Key::Key(QDate start, QString device, quint8 activityType) :
+    start(start), device(device), activityType(activityType)
+{
+}
+
+bool LogRollup::Key::operator<(const Key &other) const
+{
+    // Period first, so that a range of periods is a range of keys
+    if (start != other.start) {
+        return start < other.start;
+    }
+    if (device != other.device) {
+        return device < other.device;
+    }
+    return activityType < other.activityType;
+}
+
+void LogRollup::add(QString device, QDateTime time, quint8 activityType, const Totals &totals)
+{
+    int period;
+
+    for (period=0; period<PeriodCount; period++) {
+        buckets[period][Key(periodStart((Period)period, time.date()), device, activityType)].add(totals);
+    }
+}
+
+void LogRollup::remove(QString device, QDateTime time, quint8 activityType, const Totals &totals)
+{
+    QMap<Key, Totals>::iterator it;
+    int period;
+
+    for (period=0; period<PeriodCount; period++) {
+        it = buckets[period].find(Key(periodStart((Period)period, time.date()), device, activityType));
+        if (it == buckets[period].end()) {
+            continue;
+        }
+        it->subtract(totals);
+        if (it->count == 0) {
+            buckets[period].erase(it);
+        }
+    }
+}
+
+void LogRollup::clear()
+{
+    int period;
+
+    for (period=0; period<PeriodCount; period++) {
+        buckets[period].clear();
+    }
+}
+
+QList<LogRollup::Bucket> LogRollup::query(Period period, QDate from, QDate to, QString device, int activityType) const
+{
+    QList<Bucket> result;
+
+    if (period < 0 || period >= PeriodCount || !from.isValid() || !to.isValid()) {
+        return result;
+    }
+    from = periodStart(period, from);
+
+    QMap<Key, Totals>::const_iterator it;
+    for (it = buckets[period].lowerBound(Key(from, "", 0)); it != buckets[period].constEnd() && it.key().start <= to; ++it) {
+        if ((device != "" && it.key().device != device) ||
+            (activityType >= 0 && it.key().activityType != activityType)) {
+            continue;
+        }
+        if (result.isEmpty() || result.last().start != it.key().start) {
+            Bucket bucket;
+            bucket.start = it.key().start;
+            result.append(bucket);
+        }
+        result.last().totals.add(it.value());
+    }
+
+    return result;
+}
+
+QDate LogRollup::periodStart(Period period, QDate date)
+{
+    switch (period) {
+    case Week:
+        return date.addDays(1 - date.dayOfWeek());
+    case Month:
+        return QDate(date.year(), date.month(), 1);
+    default:
+        return date;
+    }
+}
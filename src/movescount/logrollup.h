@@ -0,0 +1,98 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGROLLUP_H
+#define LOGROLLUP_H
+
+#include <QDate>
+#include <QDateTime>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+/**
+ * Totals of stored logs per day, week and month, by device and activity
+ * type. Kept up to date with the log index as logs are added and
+ * removed, so history views never read the logs
+ */
+class LogRollup
+{
+public:
+    enum Period {
+        Day = 0,
+        Week,                       /* starting on Monday */
+        Month,
+        PeriodCount
+    };
+
+    class Totals
+    {
+    public:
+        Totals();
+
+        void add(const Totals &other);
+        void subtract(const Totals &other);
+
+        quint32 count;              /* number of logs */
+        quint64 duration;           /* ms */
+        quint64 distance;           /* m */
+        quint64 ascent;             /* m */
+        quint64 descent;            /* m */
+    };
+
+    class Bucket
+    {
+    public:
+        QDate start;                /* first day of the period */
+        Totals totals;
+    };
+
+    void add(QString device, QDateTime time, quint8 activityType, const Totals &totals);
+    void remove(QString device, QDateTime time, quint8 activityType, const Totals &totals);
+    void clear();
+
+    /**
+     * Sum the totals of the periods from the one containing from to the
+     * one containing to
+     * \param device Device serial, "" for all devices
+     * \param activityType Activity type, -1 for all
+     * \return Periods with logs, oldest first
+     */
+    QList<Bucket> query(Period period, QDate from, QDate to, QString device = "", int activityType = -1) const;
+
+    static QDate periodStart(Period period, QDate date);
+
+private:
+    class Key
+    {
+    public:
+        Key(QDate start, QString device, quint8 activityType);
+        bool operator<(const Key &other) const;
+
+        QDate start;
+        QString device;
+        quint8 activityType;
+    };
+
+    QMap<Key, Totals> buckets[PeriodCount];
+};
+
+#endif // LOGROLLUP_H
@@ -0,0 +1,239 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logstatistics.h"
+
+#include <QIODevice>
+
+#define SPLIT_DISTANCE          1000    /* m */
+
+// Altitude is smoothed with an exponential average, weight 1/4 for the
+// new sample, and only changes of more than the hysteresis count as
+// climbing, so that barometer noise doesn't add up to hundreds of metres
+#define ALTITUDE_SMOOTHING      4
+#define ALTITUDE_HYSTERESIS     2.0f    /* m */
+
+// Sums of the lap being built
+typedef struct lap_sums_s {
+    quint32 startTime;
+    quint32 startDistance;
+    quint64 heartRateSum;
+    quint32 heartRateCount;
+    quint8 heartRateMax;
+    float ascent;
+    float descent;
+} lap_sums_t;
+
+static bool isLapMark(const ambit_log_sample_t *sample)
+{
+    return sample->type == ambit_log_sample_type_lapinfo &&
+           (sample->u.lapinfo.event_type == 0x00 || sample->u.lapinfo.event_type == 0x01);
+}
+
+static LogStatistics::Lap closeLap(lap_sums_t *sums, quint32 time, quint32 distance)
+{
+    LogStatistics::Lap lap;
+
+    lap.duration = time - sums->startTime;
+    lap.distance = distance - sums->startDistance;
+    lap.heartRateAvg = sums->heartRateCount > 0 ? (quint8)(sums->heartRateSum/sums->heartRateCount) : 0;
+    lap.heartRateMax = sums->heartRateMax;
+    lap.speedAvg = lap.duration > 0 ? (quint16)qMin((quint64)0xffff, (quint64)lap.distance*100000/lap.duration) : 0;
+    lap.ascent = (quint32)sums->ascent;
+    lap.descent = (quint32)sums->descent;
+
+    sums->startTime = time;
+    sums->startDistance = distance;
+    sums->heartRateSum = 0;
+    sums->heartRateCount = 0;
+    sums->heartRateMax = 0;
+    sums->ascent = sums->descent = 0;
+
+    return lap;
+}
+
+LogStatistics::LogStatistics() :
+    valid(false), zoneMaxHeartRate(0), ascent(0), descent(0)
+{
+    for (int i=0; i<HeartRateZoneCount; i++) {
+        heartRateZones[i] = 0;
+    }
+}
+
+bool LogStatistics::build(ambit_log_entry_t *logEntry, quint8 maxHeartRate)
+{
+    const ambit_log_columns_t *columns = libambit_log_entry_columns(logEntry);
+    QVector<uint32_t> lapMarks;
+    lap_sums_t sums = { 0, 0, 0, 0, 0, 0, 0 };
+    quint32 zoneLimits[HeartRateZoneCount];
+    quint32 distance = 0, prevTime = 0, nextSplit = SPLIT_DISTANCE, splitTime = 0;
+    quint8 heartRate = 0;
+    float smoothed = 0, reference = 0, totalAscent = 0, totalDescent = 0;
+    bool hasAltitude = false;
+    uint32_t i;
+    int zone, mark = 0;
+
+    if (columns == NULL) {
+        return false;
+    }
+
+    *this = LogStatistics();
+
+    zoneMaxHeartRate = (maxHeartRate > 0 ? maxHeartRate : logEntry->header.heartrate_max);
+    for (zone=0; zone<HeartRateZoneCount; zone++) {
+        zoneLimits[zone] = zoneMaxHeartRate*(5 + zone);   /* bpm scale: 0.1 */
+    }
+
+    // Lap marks are rare, only their positions in the samples are needed
+    // to split the rows
+    for (i=0; i<logEntry->samples_count; i++) {
+        if (isLapMark(&logEntry->samples[i])) {
+            lapMarks.append(i);
+        }
+    }
+
+    for (i=0; i<columns->count; i++) {
+        quint32 time = columns->time[i];
+        quint8 flags = columns->valid[i];
+
+        while (mark < lapMarks.count() && lapMarks[mark] < columns->sample_index[i]) {
+            laps.append(closeLap(&sums, logEntry->samples[lapMarks[mark]].time, distance));
+            mark++;
+        }
+
+        // The last known HR holds until the next HR value
+        if (heartRate > 0 && zoneMaxHeartRate > 0 && time > prevTime) {
+            for (zone=HeartRateZoneCount-1; zone>=0 && (quint32)heartRate*10 < zoneLimits[zone]; zone--) {
+            }
+            if (zone >= 0) {
+                heartRateZones[zone] += time - prevTime;
+            }
+        }
+        prevTime = time;
+
+        if (flags & ambit_log_column_hr) {
+            heartRate = columns->hr[i];
+            sums.heartRateSum += heartRate;
+            sums.heartRateCount++;
+            sums.heartRateMax = qMax(sums.heartRateMax, heartRate);
+        }
+
+        if (flags & ambit_log_column_distance) {
+            distance = columns->distance[i];
+            while (distance >= nextSplit) {
+                splits.append(time - splitTime);
+                splitTime = time;
+                nextSplit += SPLIT_DISTANCE;
+            }
+        }
+
+        if (flags & ambit_log_column_altitude) {
+            if (!hasAltitude) {
+                hasAltitude = true;
+                smoothed = reference = columns->altitude[i];
+            }
+            smoothed += (columns->altitude[i] - smoothed)/ALTITUDE_SMOOTHING;
+            if (smoothed - reference > ALTITUDE_HYSTERESIS) {
+                sums.ascent += smoothed - reference;
+                totalAscent += smoothed - reference;
+                reference = smoothed;
+            }
+            else if (reference - smoothed > ALTITUDE_HYSTERESIS) {
+                sums.descent += reference - smoothed;
+                totalDescent += reference - smoothed;
+                reference = smoothed;
+            }
+        }
+    }
+
+    laps.append(closeLap(&sums, prevTime, distance));
+    ascent = (quint32)totalAscent;
+    descent = (quint32)totalDescent;
+    valid = true;
+
+    return true;
+}
+
+bool LogStatistics::isValid() const
+{
+    return valid;
+}
+
+bool LogStatistics::read(QDataStream &stream)
+{
+    quint32 count, i;
+    int zone;
+
+    *this = LogStatistics();
+
+    stream >> valid >> zoneMaxHeartRate;
+    for (zone=0; zone<HeartRateZoneCount; zone++) {
+        stream >> heartRateZones[zone];
+    }
+    stream >> ascent >> descent;
+
+    stream >> count;
+    if (stream.status() != QDataStream::Ok ||
+        (stream.device() != NULL && count > stream.device()->bytesAvailable()/4)) {
+        return false;
+    }
+    splits.resize(count);
+    for (i=0; i<count; i++) {
+        stream >> splits[i];
+    }
+
+    stream >> count;
+    if (stream.status() != QDataStream::Ok ||
+        (stream.device() != NULL && count > stream.device()->bytesAvailable()/20)) {
+        return false;
+    }
+    laps.resize(count);
+    for (i=0; i<count; i++) {
+        Lap &lap = laps[i];
+        stream >> lap.duration >> lap.distance >> lap.heartRateAvg >> lap.heartRateMax
+               >> lap.speedAvg >> lap.ascent >> lap.descent;
+    }
+
+    return stream.status() == QDataStream::Ok;
+}
+
+void LogStatistics::write(QDataStream &stream) const
+{
+    int i;
+
+    stream << valid << zoneMaxHeartRate;
+    for (i=0; i<HeartRateZoneCount; i++) {
+        stream << heartRateZones[i];
+    }
+    stream << ascent << descent;
+
+    stream << (quint32)splits.count();
+    for (i=0; i<splits.count(); i++) {
+        stream << splits[i];
+    }
+
+    stream << (quint32)laps.count();
+    for (i=0; i<laps.count(); i++) {
+        const Lap &lap = laps[i];
+        stream << lap.duration << lap.distance << lap.heartRateAvg << lap.heartRateMax
+               << lap.speedAvg << lap.ascent << lap.descent;
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGSTATISTICS_H
+#define LOGSTATISTICS_H
+
+#include <QDataStream>
+#include <QVector>
+#include <libambit.h>
+
+/**
+ * Values derived from the samples of a log that the device doesn't put
+ * in the header. Computed once when a log is stored and kept in the log
+ * index, so views never scan the samples for them
+ */
+class LogStatistics
+{
+public:
+    enum {
+        HeartRateZoneCount = 5      /* 50-60, 60-70, 70-80, 80-90, 90- % of max HR */
+    };
+
+    class Lap
+    {
+    public:
+        quint32 duration;           /* ms */
+        quint32 distance;           /* m */
+        quint8 heartRateAvg;        /* bpm, 0 without HR */
+        quint8 heartRateMax;        /* bpm */
+        quint16 speedAvg;           /* m/s scale: 0.01 */
+        quint32 ascent;             /* m */
+        quint32 descent;            /* m */
+    };
+
+    LogStatistics();
+
+    /**
+     * Compute the statistics in a single pass over the column view of
+     * a log entry
+     * \param logEntry Log entry with samples
+     * \param maxHeartRate Max HR of the user the zones are relative to,
+     * 0 to use the max HR of the log
+     * \return true on success
+     */
+    bool build(ambit_log_entry_t *logEntry, quint8 maxHeartRate = 0);
+
+    /**
+     * \return true if built from samples, false if empty or only read
+     * from a header
+     */
+    bool isValid() const;
+
+    bool read(QDataStream &stream);
+    void write(QDataStream &stream) const;
+
+    bool valid;
+    quint8 zoneMaxHeartRate;        /* bpm the zones are relative to */
+    quint32 heartRateZones[HeartRateZoneCount];     /* ms in each zone */
+    QVector<quint32> splits;        /* ms per full km */
+    QVector<Lap> laps;              /* one lap for logs without lap marks */
+    quint32 ascent;                 /* m, of the smoothed altitude */
+    quint32 descent;                /* m */
+};
+
+#endif // LOGSTATISTICS_H
@@ -25,9 +25,36 @@
 #include <QStringList>
 #include <QDir>
 #include <QRegExp>
+#include <QTemporaryFile>
+#include <QMutexLocker>
+#include <QMap>
+#include <QSet>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QVector>
+#include <QRunnable>
+#include <QWaitCondition>
+#include <QPair>
 
 #include <QDebug>
 
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define XML_PERIODIC_VALUES_MAX 64
+
+#define INDEX_FILENAME  "logstore.index"
+#define INDEX_MAGIC     0x4f41494e      /* "OAIN" */
+#define INDEX_VERSION   3
+
+#define METADATA_MAGIC      0x4f414d44  /* "OAMD" */
+#define METADATA_VERSION    1
+
+#define CHART_MAGIC         0x4f414348  /* "OACH" */
+#define CHART_VERSION       1
+
 typedef struct sample_type_names_s {
     ambit_log_sample_type_t id;
     QString XMLName;
@@ -122,6 +149,237 @@ static sample_swimming_style_name_t sampleSwimmingStyleNames[] = {
     { 0, "" }
 };
 
+typedef struct sample_periodic_name_s {
+    ambit_log_sample_periodic_type_t type;
+    const char *XMLName;
+} sample_periodic_name_t;
+
+static sample_periodic_name_t samplePeriodicNames[] = {
+    { ambit_log_sample_periodic_type_latitude, "Latitude" },
+    { ambit_log_sample_periodic_type_longitude, "Longitude" },
+    { ambit_log_sample_periodic_type_distance, "Distance" },
+    { ambit_log_sample_periodic_type_speed, "Speed" },
+    { ambit_log_sample_periodic_type_hr, "HR" },
+    { ambit_log_sample_periodic_type_time, "Time" },
+    { ambit_log_sample_periodic_type_gpsspeed, "GPSSpeed" },
+    { ambit_log_sample_periodic_type_wristaccspeed, "WristAccSpeed" },
+    { ambit_log_sample_periodic_type_bikepodspeed, "BikePodSpeed" },
+    { ambit_log_sample_periodic_type_ehpe, "EHPE" },
+    { ambit_log_sample_periodic_type_evpe, "EVPE" },
+    { ambit_log_sample_periodic_type_altitude, "Altitude" },
+    { ambit_log_sample_periodic_type_abspressure, "AbsPressure" },
+    { ambit_log_sample_periodic_type_energy, "EnergyConsumption" },
+    { ambit_log_sample_periodic_type_temperature, "Temperature" },
+    { ambit_log_sample_periodic_type_charge, "BatteryCharge" },
+    { ambit_log_sample_periodic_type_gpsaltitude, "GPSAltitude" },
+    { ambit_log_sample_periodic_type_gpsheading, "GPSHeading" },
+    { ambit_log_sample_periodic_type_gpshdop, "GpsHDOP" },
+    { ambit_log_sample_periodic_type_gpsvdop, "GpsVDOP" },
+    { ambit_log_sample_periodic_type_wristcadence, "WristCadence" },
+    { ambit_log_sample_periodic_type_snr, "SNR" },
+    { ambit_log_sample_periodic_type_noofsatellites, "NumberOfSatellites" },
+    { ambit_log_sample_periodic_type_sealevelpressure, "SeaLevelPressure" },
+    { ambit_log_sample_periodic_type_verticalspeed, "VerticalSpeed" },
+    { ambit_log_sample_periodic_type_cadence, "Cadence" },
+    { ambit_log_sample_periodic_type_bikepower, "BikePower" },
+    { ambit_log_sample_periodic_type_swimingstrokecnt, "SwimmingStrokeCount" },
+    { ambit_log_sample_periodic_type_ruleoutput1, "RuleOutput1" },
+    { ambit_log_sample_periodic_type_ruleoutput2, "RuleOutput2" },
+    { ambit_log_sample_periodic_type_ruleoutput3, "RuleOutput3" },
+    { ambit_log_sample_periodic_type_ruleoutput4, "RuleOutput4" },
+    { ambit_log_sample_periodic_type_ruleoutput5, "RuleOutput5" },
+    { (ambit_log_sample_periodic_type_t)0, NULL }
+};
+
+/*
+ * Lookup of element names without converting them to QString. The table
+ * is grown until every name has a slot of its own, so that a lookup is
+ * one hash and one compare.
+ */
+class XMLElementTable
+{
+public:
+    template <typename T> explicit XMLElementTable(const T *table)
+    {
+        int count;
+
+        for (count = 0; table[count].XMLName != NULL; count++) {
+            names.append(QString::fromLatin1(table[count].XMLName));
+        }
+
+        mask = 15;
+        while (mask < 4*count - 1) {
+            mask = mask*2 + 1;
+        }
+        while (!build() && mask < 0xffff) {
+            mask = mask*2 + 1;
+        }
+    }
+
+    int find(const QStringRef &name) const
+    {
+        uint slot = hash(name.unicode(), name.size()) & mask;
+
+        // Only probes further if no perfect size was found
+        while (buckets[slot] >= 0) {
+            if (name == names[buckets[slot]]) {
+                return buckets[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+
+        return -1;
+    }
+
+private:
+    static uint hash(const QChar *s, int len)
+    {
+        uint h = len;
+
+        while (len-- > 0) {
+            h = h*31 + (s++)->unicode();
+        }
+
+        return h;
+    }
+
+    bool build()
+    {
+        bool perfect = true;
+
+        buckets.fill(-1, mask + 1);
+        for (int i=0; i<names.count(); i++) {
+            uint slot = hash(names[i].unicode(), names[i].length()) & mask;
+            if (buckets[slot] >= 0) {
+                perfect = false;
+            }
+            while (buckets[slot] >= 0) {
+                slot = (slot + 1) & mask;
+            }
+            buckets[slot] = i;
+        }
+
+        return perfect;
+    }
+
+    QStringList names;
+    QVector<int> buckets;
+    int mask;
+};
+
+/* Integer from element or attribute text, 0 if there is none */
+static qint64 parseInt(const QStringRef &text)
+{
+    const QChar *c = text.unicode();
+    int len = text.size(), i = 0;
+    bool negative = false;
+    qint64 value = 0;
+
+    while (i < len && c[i].isSpace()) {
+        i++;
+    }
+    if (i < len && (c[i] == QLatin1Char('-') || c[i] == QLatin1Char('+'))) {
+        negative = c[i] == QLatin1Char('-');
+        i++;
+    }
+    for (; i < len && c[i].unicode() >= '0' && c[i].unicode() <= '9'; i++) {
+        value = value*10 + (c[i].unicode() - '0');
+    }
+
+    return negative ? -value : value;
+}
+
+static int parseDigits(const QChar *c, int count)
+{
+    int value = 0;
+
+    while (count-- > 0) {
+        if (c->unicode() < '0' || c->unicode() > '9') {
+            return -1;
+        }
+        value = value*10 + ((c++)->unicode() - '0');
+    }
+
+    return value;
+}
+
+/* "yyyy-MM-ddThh:mm:ss" with optional ".zzz" and "Z", as written by XMLWriter */
+static bool parseDateTime(const QStringRef &text, ambit_date_time_t *date_time)
+{
+    const QChar *c = text.unicode();
+    int len = text.size(), year, month, day, hour, minute, second, msec = 0, digits, i;
+
+    if (len < 19 || c[4] != QLatin1Char('-') || c[7] != QLatin1Char('-') || c[10] != QLatin1Char('T') ||
+        c[13] != QLatin1Char(':') || c[16] != QLatin1Char(':')) {
+        return false;
+    }
+    if ((year = parseDigits(&c[0], 4)) < 0 || (month = parseDigits(&c[5], 2)) < 0 || (day = parseDigits(&c[8], 2)) < 0 ||
+        (hour = parseDigits(&c[11], 2)) < 0 || (minute = parseDigits(&c[14], 2)) < 0 || (second = parseDigits(&c[17], 2)) < 0) {
+        return false;
+    }
+
+    i = 19;
+    if (i < len && c[i] == QLatin1Char('.')) {
+        for (i++, digits = 0; i < len && digits < 3 && c[i].unicode() >= '0' && c[i].unicode() <= '9'; i++, digits++) {
+            msec = msec*10 + (c[i].unicode() - '0');
+        }
+        if (digits == 0) {
+            return false;
+        }
+        for (; digits < 3; digits++) {
+            msec *= 10;
+        }
+    }
+    if (i < len && c[i] == QLatin1Char('Z')) {
+        i++;
+    }
+    if (i != len) {
+        return false;
+    }
+
+    date_time->year = year;
+    date_time->month = month;
+    date_time->day = day;
+    date_time->hour = hour;
+    date_time->minute = minute;
+    date_time->msec = second*1000 + msec;
+
+    return true;
+}
+
+/*
+ * Move a written temporary file in place of path. The data is synced
+ * before the rename and the directory after it, so that a crash leaves
+ * either the old or the new file, complete. The temporary file is
+ * removed if anything fails.
+ */
+static bool replaceFile(QTemporaryFile &tmpfile, QString path, bool written)
+{
+    int dirfd;
+
+    written = written && tmpfile.flush() && ::fsync(tmpfile.handle()) == 0;
+    tmpfile.close();
+
+    if (!written || ::rename(QFile::encodeName(tmpfile.fileName()).constData(), QFile::encodeName(path).constData()) != 0) {
+        QFile::remove(tmpfile.fileName());
+        return false;
+    }
+
+    if ((dirfd = ::open(QFile::encodeName(QFileInfo(path).absolutePath()).constData(), O_RDONLY)) >= 0) {
+        ::fsync(dirfd);
+        ::close(dirfd);
+    }
+
+    return true;
+}
+
+QMutex LogStore::indexMutex(QMutex::Recursive);
+QMutex LogStore::migrateMutex(QMutex::Recursive);
+QMap<QString, LogStore::IndexEntry> LogStore::index;
+bool LogStore::indexLoaded = false;
+bool LogStore::indexDirty = false;
+LogRollup LogStore::rollups;
+
 LogStore::LogStore(QObject *parent) :
     QObject(parent)
 {
@@ -133,24 +391,66 @@ LogEntry *LogStore::store(const DeviceInfo& deviceInfo, ambit_personal_settings_
     QDateTime dateTime(QDate(logEntry->header.date_time.year, logEntry->header.date_time.month, logEntry->header.date_time.day),
                        QTime(logEntry->header.date_time.hour, logEntry->header.date_time.minute, logEntry->header.date_time.msec/1000));
 
-    return storeInternal(deviceInfo.serial, dateTime, deviceInfo, personalSettings, logEntry);
+    LogEntry *retEntry;
+
+    if (!storeInternal(logEntryPath(deviceInfo.serial, dateTime), dateTime, deviceInfo, personalSettings, logEntry)) {
+        return NULL;
+    }
+
+    // Built from what was just written, the returned entry takes over
+    // the samples instead of reading them back
+    retEntry = new LogEntry();
+    retEntry->device = deviceInfo.serial;
+    retEntry->time = dateTime;
+    retEntry->movescountId = "";
+    retEntry->deviceInfo = deviceInfo;
+    if (personalSettings != NULL) {
+        retEntry->personalSettings = (ambit_personal_settings_t*)malloc(sizeof(ambit_personal_settings_t));
+        memcpy(retEntry->personalSettings, personalSettings, sizeof(ambit_personal_settings_t));
+    }
+    retEntry->logEntry = logEntry;
+
+    return retEntry;
 }
 
 LogEntry *LogStore::store(LogEntry *entry)
 {
-    return storeInternal(entry->device, entry->time, entry->deviceInfo, entry->personalSettings, entry->logEntry, entry->movescountId);
+    if (!storeInternal(logEntryPath(entry->device, entry->time), entry->time, entry->deviceInfo, entry->personalSettings, entry->logEntry, entry->movescountId)) {
+        return NULL;
+    }
+
+    return new LogEntry(*entry);
 }
 
 void LogStore::storeMovescountId(QString device, QDateTime time, QString movescountId)
 {
-    LogEntry *entry, *retEntry;
+    QString path = logEntryPath(device, time);
+    Metadata metadata;
 
-    if ((entry = read(device, time)) != NULL) {
-        entry->movescountId = movescountId;
+    // Read-modify-write of the metadata, don't interleave with another update
+    QMutexLocker locker(&updateMutex);
 
-        retEntry = store(entry);
-        delete retEntry;
-        delete entry;
+    if (!QFile::exists(path) && !QFile::exists(xmlLogEntryPath(path))) {
+        return;
+    }
+
+    // The log itself is never rewritten, only its small metadata file
+    readMetadata(path, &metadata);
+    metadata.movescountId = movescountId;
+    metadata.uploaded = movescountId.isEmpty() ? QDateTime() : QDateTime::currentDateTime();
+    metadata.modified = QDateTime::currentDateTime();
+    if (!writeMetadata(path, metadata)) {
+        return;
+    }
+
+    QMutexLocker indexLocker(&indexMutex);
+    loadIndex();
+    QMap<QString, IndexEntry>::iterator indexed = index.find(QFileInfo(path).completeBaseName());
+    if (indexed != index.end()) {
+        indexed->dirEntry.movescountId = movescountId;
+        indexed->metaModified = QFileInfo(metadataPath(path)).lastModified();
+        indexDirty = true;
+        saveIndex();
     }
 }
 
@@ -158,8 +458,9 @@ bool LogStore::logExists(QString device, ambit_log_header_t *logHeader)
 {
     QDateTime dateTime(QDate(logHeader->date_time.year, logHeader->date_time.month, logHeader->date_time.day),
                        QTime(logHeader->date_time.hour, logHeader->date_time.minute, logHeader->date_time.msec/1000));
+    QString path = logEntryPath(device, dateTime);
 
-    return QFile::exists(logEntryPath(device, dateTime));
+    return QFile::exists(path) || QFile::exists(xmlLogEntryPath(path));
 }
 
 LogEntry *LogStore::read(QString device, QDateTime time)
@@ -177,80 +478,798 @@ LogEntry *LogStore::read(QString filename)
     return readInternal(storagePath + "/" + filename);
 }
 
+LogEntry *LogStore::readHeader(LogDirEntry dirEntry)
+{
+    return readInternal(storagePath + "/" + dirEntry.filename, true);
+}
+
+LogEntry *LogStore::readHeader(QString filename)
+{
+    return readInternal(storagePath + "/" + filename, true);
+}
+
+LogChartData *LogStore::readChartData(LogDirEntry dirEntry)
+{
+    return readChartData(dirEntry.filename);
+}
+
+LogChartData *LogStore::readChartData(QString filename)
+{
+    QString path = storagePath + "/" + filename;
+    LogChartData *chartData = new LogChartData();
+    LogEntry *entry;
+
+    if (readChartCache(path, chartData)) {
+        return chartData;
+    }
+
+    entry = readInternal(path);
+    if (entry == NULL || !chartData->build(entry->logEntry)) {
+        delete entry;
+        delete chartData;
+        return NULL;
+    }
+    delete entry;
+
+    // XML logs are migrated by the read, cache for the binary file
+    if (path.endsWith(".log") && QFile::exists(path.left(path.length() - 4) + ".bin")) {
+        path = path.left(path.length() - 4) + ".bin";
+    }
+    writeChartCache(path, *chartData);
+
+    return chartData;
+}
+
+bool LogStore::readSamples(LogEntry *entry)
+{
+    LogEntry *fullEntry;
+
+    if (entry->logEntry != NULL && entry->logEntry->samples != NULL) {
+        return true;
+    }
+
+    if ((fullEntry = read(entry->device, entry->time)) == NULL) {
+        return false;
+    }
+
+    entry->detach();
+    std::swap(entry->logEntry, fullEntry->logEntry);
+    delete fullEntry;
+
+    return true;
+}
+
+LogEntry *LogStore::readRange(QString device, QDateTime time, quint32 from, quint32 to)
+{
+    QString path = logEntryPath(device, time);
+    LogEntry *entry;
+
+    if (from > to) {
+        return NULL;
+    }
+
+    // XML logs have no blocks, migrate by a full read first
+    if (!QFile::exists(path) && QFile::exists(xmlLogEntryPath(path))) {
+        if ((entry = readInternal(path)) == NULL) {
+            return NULL;
+        }
+        delete entry;
+    }
+
+    return readBinary(path, false, from, to);
+}
+
+class LogStore::ReadQueue
+{
+public:
+    QMutex mutex;
+    QWaitCondition done;
+    QList<QPair<int, LogEntry*> > results;
+};
+
+class LogStore::ReadTask : public QRunnable
+{
+public:
+    ReadTask(LogStore *logStore, ReadQueue *queue, int index, QString path, bool headerOnly) :
+        logStore(logStore), queue(queue), index(index), path(path), headerOnly(headerOnly)
+    {
+    }
+
+    void run()
+    {
+        LogEntry *entry = logStore->readInternal(path, headerOnly);
+
+        QMutexLocker locker(&queue->mutex);
+        queue->results.append(qMakePair(index, entry));
+        queue->done.wakeOne();
+    }
+
+private:
+    LogStore *logStore;
+    ReadQueue *queue;
+    int index;
+    QString path;
+    bool headerOnly;
+};
+
+static bool readManyCallback(void *ref, int index, LogStore::LogDirEntry dirEntry, LogEntry *entry)
+{
+    QList<LogEntry*> *entries = static_cast<QList<LogEntry*>*>(ref);
+
+    Q_UNUSED(dirEntry);
+    (*entries)[index] = entry;
+
+    return true;
+}
+
+QList<LogEntry*> LogStore::readMany(QList<LogDirEntry> dirEntries, bool headerOnly)
+{
+    QList<LogEntry*> entries;
+
+    for (int i=0; i<dirEntries.count(); i++) {
+        entries.append(NULL);
+    }
+    forEach(dirEntries, &readManyCallback, &entries, headerOnly);
+
+    return entries;
+}
+
+bool LogStore::forEach(QList<LogDirEntry> dirEntries, ReadCallback callback, void *ref, bool headerOnly)
+{
+    ReadQueue queue;
+    QPair<int, LogEntry*> result;
+    int limit = 2*readPool.maxThreadCount();
+    int next = 0, running = 0;
+    bool cont = true;
+
+    QMutexLocker locker(&queue.mutex);
+    while (running > 0 || (cont && next < dirEntries.count())) {
+        // Only a few logs ahead of the callback, so that read entries
+        // don't pile up when the callback is the slower part
+        while (cont && next < dirEntries.count() && running < limit) {
+            readPool.start(new ReadTask(this, &queue, next, storagePath + "/" + dirEntries[next].filename, headerOnly));
+            next++;
+            running++;
+        }
+
+        while (queue.results.isEmpty()) {
+            queue.done.wait(&queue.mutex);
+        }
+        result = queue.results.takeFirst();
+        running--;
+
+        if (!cont) {
+            // Stopped, only waiting for the tasks still running
+            delete result.second;
+            continue;
+        }
+
+        locker.unlock();
+        cont = callback(ref, result.first, dirEntries[result.first], result.second);
+        locker.relock();
+    }
+
+    return cont;
+}
+
 QList<LogStore::LogDirEntry> LogStore::dir(QString device)
 {
     QList<LogDirEntry> dirList;
-    QRegExp rx("log_([0-9a-zA-Z]+)_([0-9]{4})_([0-9]{2})_([0-9]{2})_([0-9]{2})_([0-9]{2})_([0-9]{2}).log");
+    QMap<QString, QFileInfo> files, metadataFiles;
+    QStringList stale;
+    QSet<QString> failed;
+    QRegExp rx("log_([0-9a-zA-Z]+)_([0-9]{4})_([0-9]{2})_([0-9]{2})_([0-9]{2})_([0-9]{2})_([0-9]{2})\\.(bin|log)");
 
     QStringList nameFilter;
-    if (device == "") {
-        nameFilter.append("log_*.log");
+    nameFilter.append("log_*.bin");
+    nameFilter.append("log_*.log");
+    nameFilter.append("log_*.meta");
+
+    QDir directory(storagePath);
+    QFileInfoList matches = directory.entryInfoList(nameFilter, QDir::Files, QDir::Name);
+    foreach (QFileInfo match, matches) {
+        if (match.suffix() == "meta") {
+            metadataFiles.insert(match.completeBaseName(), match);
+        }
+        else if (rx.exactMatch(match.fileName())) {
+            // Logs not yet migrated only have the XML file, prefer the
+            // binary one where both exist
+            if (rx.cap(8) == "bin" || !files.contains(match.completeBaseName())) {
+                files.insert(match.completeBaseName(), match);
+            }
+        }
     }
-    else {
-        nameFilter.append("log_" + device + "_*.log");
+
+    // The index is only locked while it is looked at or updated, logs
+    // that are new or changed since they were indexed are read without
+    // holding any lock
+    QMap<QString, QFileInfo>::const_iterator it;
+    QMutexLocker locker(&indexMutex);
+    loadIndex();
+
+    // Forget logs that have been removed
+    foreach (QString key, index.keys()) {
+        if (!files.contains(key)) {
+            rollupEntry(index.value(key), false);
+            index.remove(key);
+            indexDirty = true;
+        }
     }
 
-    QDir directory(storagePath);
-    QStringList matches = directory.entryList(nameFilter, QDir::Files, QDir::Name);
-    foreach (QString match, matches) {
-        if (rx.indexIn(match) >= 0) {
-            LogDirEntry dirEntry;
-            dirEntry.filename = rx.cap(0);
-            dirEntry.device = rx.cap(1);
-            dirEntry.time = QDateTime(QDate(rx.cap(2).toInt(), rx.cap(3).toInt(), rx.cap(4).toInt()),
-                                      QTime(rx.cap(5).toInt(), rx.cap(6).toInt(), rx.cap(7).toInt()));
-            dirList.append(dirEntry);
+    for (it = files.constBegin(); it != files.constEnd(); ++it) {
+        QMap<QString, IndexEntry>::const_iterator indexed = index.constFind(it.key());
+        if (indexed == index.constEnd() ||
+            indexed->dirEntry.filename != it->fileName() ||
+            indexed->size != it->size() ||
+            indexed->modified != it->lastModified() ||
+            indexed->metaModified != metadataFiles.value(it.key()).lastModified()) {
+            stale.append(it->absoluteFilePath());
         }
     }
+    locker.unlock();
+
+    foreach (QString path, stale) {
+        if (!indexFile(path)) {
+            failed.insert(QFileInfo(path).completeBaseName());
+        }
+    }
+
+    locker.relock();
+    for (it = files.constBegin(); it != files.constEnd(); ++it) {
+        QMap<QString, IndexEntry>::const_iterator indexed = index.constFind(it.key());
+        if (failed.contains(it.key()) || indexed == index.constEnd()) {
+            continue;
+        }
+        if (device == "" || indexed->dirEntry.device == device) {
+            dirList.append(indexed->dirEntry);
+        }
+    }
+
+    // Saved once for all the logs indexed
+    if (indexDirty) {
+        saveIndex();
+    }
 
     return dirList;
 }
 
+QList<LogRollup::Bucket> LogStore::rollup(LogRollup::Period period, QDate from, QDate to, QString device, int activityType)
+{
+    // Picks up logs added or removed outside of this store
+    dir();
+
+    QMutexLocker locker(&indexMutex);
+    return rollups.query(period, from, to, device, activityType);
+}
+
+bool LogStore::exportXML(LogEntry *entry, QString path)
+{
+    XMLWriter writer(entry->deviceInfo, entry->time, entry->movescountId, entry->personalSettings, entry->logEntry);
+    QFile logfile(path);
+    bool ret;
+
+    if (!logfile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    ret = writer.write(&logfile);
+    logfile.close();
+
+    return ret;
+}
+
+LogEntry *LogStore::importXML(QString path)
+{
+    LogEntry *entry;
+
+    if ((entry = readXML(path)) != NULL) {
+        if (!storeInternal(logEntryPath(entry->device, entry->time), entry->time, entry->deviceInfo, entry->personalSettings, entry->logEntry, entry->movescountId)) {
+            delete entry;
+            entry = NULL;
+        }
+    }
+
+    return entry;
+}
+
 QString LogStore::logEntryPath(QString device, QDateTime time)
 {
-    return storagePath + "/log_" + device + "_" + time.toString("yyyy_MM_dd_hh_mm_ss") + ".log";
+    return storagePath + "/log_" + device + "_" + time.toString("yyyy_MM_dd_hh_mm_ss") + ".bin";
+}
+
+QString LogStore::xmlLogEntryPath(QString path)
+{
+    return path.left(path.length() - 4) + ".log";
+}
+
+QString LogStore::metadataPath(QString path)
+{
+    return path.left(path.length() - 4) + ".meta";
+}
+
+bool LogStore::readStatistics(QString filename, LogStatistics *statistics)
+{
+    QMutexLocker locker(&indexMutex);
+    loadIndex();
+
+    QMap<QString, IndexEntry>::const_iterator indexed = index.constFind(QFileInfo(filename).completeBaseName());
+    if (indexed == index.constEnd() || !indexed->dirEntry.statistics.isValid()) {
+        return false;
+    }
+    *statistics = indexed->dirEntry.statistics;
+
+    return true;
+}
+
+QString LogStore::chartDataPath(QString path)
+{
+    return path.left(path.length() - 4) + ".chart";
+}
+
+bool LogStore::storeInternal(QString path, QDateTime dateTime, const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry, QString movescountId)
+{
+    BinaryWriter writer(deviceInfo, dateTime, movescountId, personalSettings, logEntry);
+    QFile logfile(path);
+    bool written;
+
+    // Several devices may be synced at the same time, write to a private
+    // temporary file and move it in place so that no one ever sees a
+    // partially written log
+    QTemporaryFile tmpfile(logfile.fileName() + ".XXXXXX");
+    tmpfile.setAutoRemove(false);
+    if (!tmpfile.open()) {
+        return false;
+    }
+    tmpfile.setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+    written = writer.write(&tmpfile);
+    if (!replaceFile(tmpfile, logfile.fileName(), written)) {
+        return false;
+    }
+
+    updateIndex(path, dateTime, deviceInfo, personalSettings, logEntry, movescountId);
+
+#ifdef DEBUG_LOGSTORE_VERIFY
+    verifyStored(path, logEntry);
+#endif
+
+    return true;
+}
+
+#ifdef DEBUG_LOGSTORE_VERIFY
+void LogStore::verifyStored(QString path, ambit_log_entry_t *logEntry)
+{
+    LogEntry *stored = readBinary(path);
+    uint32_t i;
+
+    if (stored == NULL) {
+        qDebug() << "Verify " << path << ": failed to read back";
+        return;
+    }
+
+    if (logEntry != NULL && stored->logEntry != NULL) {
+        if (stored->logEntry->samples_count != logEntry->samples_count) {
+            qDebug() << "Verify " << path << ": " << stored->logEntry->samples_count << " samples read back, " << logEntry->samples_count << " written";
+        }
+        else {
+            for (i=0; i<logEntry->samples_count; i++) {
+                if (stored->logEntry->samples[i].type != logEntry->samples[i].type ||
+                    stored->logEntry->samples[i].time != logEntry->samples[i].time) {
+                    qDebug() << "Verify " << path << ": sample " << i << " differs";
+                    break;
+                }
+            }
+        }
+    }
+    else if (logEntry != stored->logEntry) {
+        qDebug() << "Verify " << path << ": log entry missing";
+    }
+
+    delete stored;
 }
+#endif
 
-LogEntry *LogStore::storeInternal(QString serial, QDateTime dateTime, const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry, QString movescountId)
+LogEntry *LogStore::readInternal(QString path, bool headerOnly)
+{
+    LogEntry *retEntry = NULL, *migratedEntry;
+    QString binaryPath = path, xmlPath;
+
+    if (path.endsWith(".log")) {
+        binaryPath = path.left(path.length() - 4) + ".bin";
+    }
+    xmlPath = xmlLogEntryPath(binaryPath);
+
+    // Only the header pages of the mapped file are touched for headerOnly,
+    // XML logs are always read completely and migrated
+    if (QFile::exists(binaryPath) && (retEntry = readBinary(binaryPath, headerOnly)) != NULL) {
+        return retEntry;
+    }
+
+    QMutexLocker locker(&migrateMutex);
+
+    // Another reader may have migrated the log while waiting for the lock
+    if (QFile::exists(binaryPath) && (retEntry = readBinary(binaryPath, headerOnly)) != NULL) {
+        return retEntry;
+    }
+
+    if (QFile::exists(xmlPath) && (retEntry = readXML(xmlPath)) != NULL) {
+        // Migrate on first read. The XML file is kept, for tools reading
+        // it, the binary one is used from now on
+        if (storeInternal(binaryPath, retEntry->time, retEntry->deviceInfo, retEntry->personalSettings, retEntry->logEntry, retEntry->movescountId) &&
+            (migratedEntry = readBinary(binaryPath)) != NULL) {
+            delete retEntry;
+            retEntry = migratedEntry;
+        }
+        else {
+            qDebug() << "Failed to migrate " << xmlPath << " to binary format";
+        }
+    }
+
+    return retEntry;
+}
+
+LogEntry *LogStore::readBinary(QString path, bool headerOnly, quint32 from, quint32 to)
 {
     LogEntry *retEntry = new LogEntry();
+    QFile logfile(path);
+
+    if (!logfile.open(QIODevice::ReadOnly)) {
+        delete retEntry;
+        return NULL;
+    }
+
+    BinaryReader reader(retEntry);
+    if (!(headerOnly ? reader.read(&logfile, true) : reader.readRange(&logfile, from, to))) {
+        QString error = reader.errorString();
+        qDebug() << "Failed to read " << path << ": " << error;
+        delete retEntry;
+        retEntry = NULL;
+    }
+    else {
+        applyMetadata(path, retEntry);
+    }
+
+    return retEntry;
+}
+
+LogEntry *LogStore::readXML(QString path)
+{
+    LogEntry *retEntry = new LogEntry();
+    QFile logfile(path);
+
+    if (!logfile.open(QIODevice::ReadOnly)) {
+        delete retEntry;
+        return NULL;
+    }
 
-    XMLWriter writer(deviceInfo, dateTime, movescountId, personalSettings, logEntry);
-    QFile logfile(logEntryPath(serial, dateTime));
-    logfile.open(QIODevice::WriteOnly);
-    writer.write(&logfile);
-    logfile.close();
-    logfile.open(QIODevice::ReadOnly);
     XMLReader reader(retEntry);
     if (!reader.read(&logfile)) {
-        if (retEntry->logEntry && retEntry->logEntry->header.activity_name) {
-            free(retEntry->logEntry->header.activity_name);
-        }
+        QString error = reader.errorString();
+        qDebug() << "Failed to read " << path << ": " << error;
         delete retEntry;
         retEntry = NULL;
     }
+    else {
+        applyMetadata(path, retEntry);
+    }
 
     return retEntry;
 }
 
-LogEntry *LogStore::readInternal(QString path)
+
+
+bool LogStore::readMetadata(QString path, Metadata *metadata)
 {
-    LogEntry *retEntry = NULL;
+    quint32 magic, version;
 
-    if (QFile::exists(path)) {
-        retEntry = new LogEntry();
-        QFile logfile(path);
-        logfile.open(QIODevice::ReadOnly);
-        XMLReader reader(retEntry);
-        if (!reader.read(&logfile)) {
-            QString error = reader.errorString();
-            qDebug() << "Failed to read " << path << ": " << error;
-            delete retEntry;
-            retEntry = NULL;
+    QFile metafile(metadataPath(path));
+    if (!metafile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&metafile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> magic >> version;
+    if (magic != METADATA_MAGIC || version != METADATA_VERSION) {
+        qDebug() << "Ignoring metadata of unknown version " << version << " for " << path;
+        return false;
+    }
+    stream >> metadata->movescountId >> metadata->uploaded >> metadata->modified;
+
+    return stream.status() == QDataStream::Ok;
+}
+
+bool LogStore::writeMetadata(QString path, const Metadata &metadata)
+{
+    QString metaPath = metadataPath(path);
+    QTemporaryFile tmpfile(metaPath + ".XXXXXX");
+    bool written;
+
+    tmpfile.setAutoRemove(false);
+    if (!tmpfile.open()) {
+        return false;
+    }
+    tmpfile.setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+
+    QDataStream stream(&tmpfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << (quint32)METADATA_MAGIC << (quint32)METADATA_VERSION
+           << metadata.movescountId << metadata.uploaded << metadata.modified;
+    written = stream.status() == QDataStream::Ok;
+
+    if (!replaceFile(tmpfile, metaPath, written)) {
+        return false;
+    }
+
+    return true;
+}
+
+void LogStore::applyMetadata(QString path, LogEntry *entry)
+{
+    Metadata metadata;
+
+    // Metadata written after the log was stored takes precedence
+    if (readMetadata(path, &metadata)) {
+        entry->movescountId = metadata.movescountId;
+    }
+}
+
+bool LogStore::readChartCache(QString path, LogChartData *chartData)
+{
+    QFileInfo info(path);
+    quint32 magic, version;
+    qint64 size;
+    QDateTime modified;
+
+    QFile chartfile(chartDataPath(path));
+    if (!info.exists() || !chartfile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&chartfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> magic >> version;
+    if (magic != CHART_MAGIC || version != CHART_VERSION) {
+        return false;
+    }
+
+    // Rebuilt when the log was changed since, e.g. by a new import
+    stream >> size >> modified;
+    if (stream.status() != QDataStream::Ok || size != info.size() || modified != info.lastModified()) {
+        return false;
+    }
+
+    return chartData->read(stream);
+}
+
+bool LogStore::writeChartCache(QString path, const LogChartData &chartData)
+{
+    QString chartPath = chartDataPath(path);
+    QTemporaryFile tmpfile(chartPath + ".XXXXXX");
+    QFileInfo info(path);
+    bool written;
+
+    tmpfile.setAutoRemove(false);
+    if (!tmpfile.open()) {
+        return false;
+    }
+    tmpfile.setPermissions(QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+
+    QDataStream stream(&tmpfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << (quint32)CHART_MAGIC << (quint32)CHART_VERSION
+           << info.size() << info.lastModified();
+    chartData.write(stream);
+    written = stream.status() == QDataStream::Ok;
+
+    if (!replaceFile(tmpfile, chartPath, written)) {
+        return false;
+    }
+
+    return true;
+}
+
+void LogStore::loadIndex()
+{
+    quint32 magic, version, count, i;
+
+    if (indexLoaded) {
+        return;
+    }
+    indexLoaded = true;
+
+    QFile indexfile(storagePath + "/" + INDEX_FILENAME);
+    if (!indexfile.open(QIODevice::ReadOnly)) {
+        // Rebuilt from the logs by the next dir()
+        return;
+    }
+
+    QDataStream stream(&indexfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> magic >> version >> count;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        qDebug() << "Ignoring log index of unknown version " << version;
+        return;
+    }
+
+    for (i=0; i<count && stream.status() == QDataStream::Ok; i++) {
+        QString key;
+        IndexEntry entry;
+        stream >> key
+               >> entry.dirEntry.device
+               >> entry.dirEntry.time
+               >> entry.dirEntry.filename
+               >> entry.dirEntry.activityName
+               >> entry.dirEntry.activityType
+               >> entry.dirEntry.duration
+               >> entry.dirEntry.distance
+               >> entry.dirEntry.movescountId;
+        entry.dirEntry.statistics.read(stream);
+        stream >> entry.size
+               >> entry.modified
+               >> entry.metaModified;
+        index.insert(key, entry);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qDebug() << "Log index is truncated, rebuilding";
+        index.clear();
+    }
+
+    // Cheap enough to rebuild from the index alone that it isn't saved
+    QMap<QString, IndexEntry>::const_iterator it;
+    for (it = index.constBegin(); it != index.constEnd(); ++it) {
+        rollupEntry(it.value(), true);
+    }
+}
+
+void LogStore::rollupEntry(const IndexEntry &entry, bool add)
+{
+    LogRollup::Totals totals;
+
+    totals.count = 1;
+    totals.duration = entry.dirEntry.duration;
+    totals.distance = entry.dirEntry.distance;
+    if (entry.dirEntry.statistics.isValid()) {
+        totals.ascent = entry.dirEntry.statistics.ascent;
+        totals.descent = entry.dirEntry.statistics.descent;
+    }
+
+    if (add) {
+        rollups.add(entry.dirEntry.device, entry.dirEntry.time, entry.dirEntry.activityType, totals);
+    }
+    else {
+        rollups.remove(entry.dirEntry.device, entry.dirEntry.time, entry.dirEntry.activityType, totals);
+    }
+}
+
+void LogStore::saveIndex()
+{
+    QString path = storagePath + "/" + INDEX_FILENAME;
+    QTemporaryFile tmpfile(path + ".XXXXXX");
+    bool written;
+
+    tmpfile.setAutoRemove(false);
+    if (!tmpfile.open()) {
+        return;
+    }
+
+    QDataStream stream(&tmpfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << (quint32)INDEX_MAGIC << (quint32)INDEX_VERSION << (quint32)index.count();
+
+    QMap<QString, IndexEntry>::const_iterator it;
+    for (it = index.constBegin(); it != index.constEnd(); ++it) {
+        stream << it.key()
+               << it->dirEntry.device
+               << it->dirEntry.time
+               << it->dirEntry.filename
+               << it->dirEntry.activityName
+               << it->dirEntry.activityType
+               << it->dirEntry.duration
+               << it->dirEntry.distance
+               << it->dirEntry.movescountId;
+        it->dirEntry.statistics.write(stream);
+        stream << it->size
+               << it->modified
+               << it->metaModified;
+    }
+    written = stream.status() == QDataStream::Ok;
+
+    if (!replaceFile(tmpfile, path, written)) {
+        return;
+    }
+
+    indexDirty = false;
+}
+
+void LogStore::updateIndex(QString path, QDateTime dateTime, const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry, QString movescountId, bool save)
+{
+    QFileInfo info(path);
+    IndexEntry entry;
+    Metadata metadata;
+
+    if (readMetadata(path, &metadata)) {
+        movescountId = metadata.movescountId;
+    }
+
+    entry.dirEntry.device = deviceInfo.serial;
+    entry.dirEntry.time = dateTime;
+    entry.dirEntry.filename = info.fileName();
+    entry.dirEntry.activityType = 0;
+    entry.dirEntry.duration = 0;
+    entry.dirEntry.distance = 0;
+    if (logEntry != NULL) {
+        if (logEntry->header.activity_name != NULL) {
+            entry.dirEntry.activityName = QString::fromUtf8(logEntry->header.activity_name);
         }
+        entry.dirEntry.activityType = logEntry->header.activity_type;
+        entry.dirEntry.duration = logEntry->header.duration;
+        entry.dirEntry.distance = logEntry->header.distance;
     }
+    entry.dirEntry.movescountId = movescountId;
+    entry.size = info.size();
+    entry.modified = info.lastModified();
+    entry.metaModified = QFileInfo(metadataPath(path)).lastModified();
 
-    return retEntry;
+    // Computed while the samples are at hand, before taking the lock
+    if (logEntry != NULL && logEntry->samples != NULL) {
+        entry.dirEntry.statistics.build(logEntry, personalSettings != NULL ? personalSettings->max_hr : 0);
+    }
+
+    QMutexLocker locker(&indexMutex);
+    loadIndex();
+    QMap<QString, IndexEntry>::const_iterator indexed = index.constFind(info.completeBaseName());
+    if (!entry.dirEntry.statistics.isValid()) {
+        // A header only update, the samples haven't changed if the log
+        // file hasn't
+        if (indexed != index.constEnd() && indexed->size == entry.size && indexed->modified == entry.modified) {
+            entry.dirEntry.statistics = indexed->dirEntry.statistics;
+        }
+    }
+    // Replaces what the log added before, if it was indexed
+    if (indexed != index.constEnd()) {
+        rollupEntry(indexed.value(), false);
+    }
+    rollupEntry(entry, true);
+    index.insert(info.completeBaseName(), entry);
+    indexDirty = true;
+
+    // dir() saves once when done
+    if (save) {
+        saveIndex();
+    }
+}
+
+bool LogStore::indexFile(QString path)
+{
+    LogEntry *entry;
+
+    if (path.endsWith(".bin")) {
+        // The samples are only read if the statistics are missing or out
+        // of date, metadata changes keep the indexed ones
+        QFileInfo info(path);
+        QMutexLocker locker(&indexMutex);
+        QMap<QString, IndexEntry>::const_iterator indexed = index.constFind(info.completeBaseName());
+        bool headerOnly = (indexed != index.constEnd() &&
+                           indexed->dirEntry.statistics.isValid() &&
+                           indexed->size == info.size() &&
+                           indexed->modified == info.lastModified());
+        locker.unlock();
+
+        entry = readBinary(path, headerOnly);
+    }
+    else {
+        // Indexed as it is, the log is migrated by its first read
+        entry = readXML(path);
+    }
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    updateIndex(path, entry->time, entry->deviceInfo, entry->personalSettings, entry->logEntry, entry->movescountId, false);
+    delete entry;
+
+    return true;
 }
 
 
@@ -792,7 +1811,7 @@ void LogStore::XMLReader::readLogSamples()
     int sampleCount = 0;
     ambit_log_sample_type_t type;
 
-    Q_ASSERT(xml.isStartElement() && xml.name() == "Samples");
+    Q_ASSERT(xml.isStartElement() && xml.name() == QLatin1String("Samples"));
 
     if (logEntry->logEntry->samples == NULL) {
         logEntry->logEntry->samples = (ambit_log_sample_t *)calloc(logEntry->logEntry->header.samples_count, sizeof(ambit_log_sample_t));
@@ -800,32 +1819,28 @@ void LogStore::XMLReader::readLogSamples()
     }
 
     while (xml.readNextStartElement()) {
-        if (xml.name() == "Sample") {
-            QList<ambit_log_sample_periodic_value_t> periodicValues;
+        // Samples were allocated from the header count, ignore any extra
+        if (xml.name() == QLatin1String("Sample") && sampleCount < (int)logEntry->logEntry->samples_count) {
+            ambit_log_sample_periodic_value_t periodicValues[XML_PERIODIC_VALUES_MAX];
+            int periodicCount = 0;
             int ibiCount = 0;
             type = ambit_log_sample_type_unknown;
             while (xml.readNextStartElement()) {
-                if (xml.name() == "Type") {
-                    type = (ambit_log_sample_type_t)xml.attributes().value("id").toString().toUInt();
+                if (xml.name() == QLatin1String("Type")) {
+                    type = (ambit_log_sample_type_t)parseInt(xml.attributes().value(QLatin1String("id")));
                     logEntry->logEntry->samples[sampleCount].type = type;
                     xml.skipCurrentElement();
                 }
-                else if (xml.name() == "UTC") {
-                    QDateTime datetime = QDateTime::fromString(xml.readElementText(), "yyyy-MM-ddThh:mm:ss.zzzZ");
-                    logEntry->logEntry->samples[sampleCount].utc_time.year = datetime.date().year();
-                    logEntry->logEntry->samples[sampleCount].utc_time.month = datetime.date().month();
-                    logEntry->logEntry->samples[sampleCount].utc_time.day = datetime.date().day();
-                    logEntry->logEntry->samples[sampleCount].utc_time.hour = datetime.time().hour();
-                    logEntry->logEntry->samples[sampleCount].utc_time.minute = datetime.time().minute();
-                    logEntry->logEntry->samples[sampleCount].utc_time.msec = datetime.time().second()*1000 + datetime.time().msec();
+                else if (xml.name() == QLatin1String("UTC")) {
+                    readElementDateTime(&logEntry->logEntry->samples[sampleCount].utc_time);
                 }
-                else if (xml.name() == "Time") {
-                    logEntry->logEntry->samples[sampleCount].time = xml.readElementText().toUInt();
+                else if (xml.name() == QLatin1String("Time")) {
+                    logEntry->logEntry->samples[sampleCount].time = readElementInt();
                 }
                 else {
                     switch(type) {
                     case ambit_log_sample_type_periodic:
-                        readPeriodicSample(&periodicValues);
+                        readPeriodicSample(periodicValues, &periodicCount);
                         break;
                     case ambit_log_sample_type_logpause:
                         /* Should not get here! */
@@ -836,8 +1851,8 @@ void LogStore::XMLReader::readLogSamples()
                         xml.skipCurrentElement();
                         break;
                     case ambit_log_sample_type_ibi:
-                        if (xml.name() == "IBI") {
-                            logEntry->logEntry->samples[sampleCount].u.ibi.ibi[ibiCount] = xml.readElementText().toUInt();
+                        if (xml.name() == QLatin1String("IBI")) {
+                            logEntry->logEntry->samples[sampleCount].u.ibi.ibi[ibiCount] = readElementInt();
                             ibiCount++;
                             logEntry->logEntry->samples[sampleCount].u.ibi.ibi_count = ibiCount;
                         }
@@ -847,11 +1862,11 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_ttff:
-                        logEntry->logEntry->samples[sampleCount].u.ttff = xml.readElementText().toUInt();
+                        logEntry->logEntry->samples[sampleCount].u.ttff = readElementInt();
                         break;
                     case ambit_log_sample_type_distance_source:
-                        if (xml.name() == "DistanceSource") {
-                            int distanceId = xml.attributes().value("id").toString().toUInt();
+                        if (xml.name() == QLatin1String("DistanceSource")) {
+                            int distanceId = parseInt(xml.attributes().value(QLatin1String("id")));
                             logEntry->logEntry->samples[sampleCount].u.distance_source = distanceId;
                             xml.skipCurrentElement();
                         }
@@ -861,27 +1876,21 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_lapinfo:
-                        if (xml.name() == "Lap") {
+                        if (xml.name() == QLatin1String("Lap")) {
                             while(xml.readNextStartElement()) {
-                                if (xml.name() == "Type") {
-                                    int lapTypeId = xml.attributes().value("id").toString().toUInt();
+                                if (xml.name() == QLatin1String("Type")) {
+                                    int lapTypeId = parseInt(xml.attributes().value(QLatin1String("id")));
                                     logEntry->logEntry->samples[sampleCount].u.lapinfo.event_type = lapTypeId;
                                     xml.skipCurrentElement();
                                 }
-                                else if (xml.name() == "DateTime") {
-                                    QDateTime datetime = QDateTime::fromString(xml.readElementText(), Qt::ISODate);
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time.year = datetime.date().year();
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time.month = datetime.date().month();
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time.day = datetime.date().day();
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time.hour = datetime.time().hour();
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time.minute = datetime.time().minute();
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time.msec = datetime.time().second()*1000 + datetime.time().msec();
+                                else if (xml.name() == QLatin1String("DateTime")) {
+                                    readElementDateTime(&logEntry->logEntry->samples[sampleCount].u.lapinfo.date_time);
                                 }
-                                else if (xml.name() == "Duration") {
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.duration = xml.readElementText().toUInt();
+                                else if (xml.name() == QLatin1String("Duration")) {
+                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.duration = readElementInt();
                                 }
-                                else if (xml.name() == "Distance") {
-                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.distance = xml.readElementText().toUInt();
+                                else if (xml.name() == QLatin1String("Distance")) {
+                                    logEntry->logEntry->samples[sampleCount].u.lapinfo.distance = readElementInt();
                                 }
                                 else {
                                     /* Should not get here! */
@@ -895,16 +1904,16 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_altitude_source:
-                        if (xml.name() == "AltitudeSource") {
-                            int altitudeSourceId = xml.attributes().value("id").toString().toUInt();
+                        if (xml.name() == QLatin1String("AltitudeSource")) {
+                            int altitudeSourceId = parseInt(xml.attributes().value(QLatin1String("id")));
                             logEntry->logEntry->samples[sampleCount].u.altitude_source.source_type = altitudeSourceId;
                             xml.skipCurrentElement();
                         }
-                        else if (xml.name() == "AltitudeOffset") {
-                            logEntry->logEntry->samples[sampleCount].u.altitude_source.altitude_offset = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("AltitudeOffset")) {
+                            logEntry->logEntry->samples[sampleCount].u.altitude_source.altitude_offset = readElementInt();
                         }
-                        else if (xml.name() == "PressureOffset") {
-                            logEntry->logEntry->samples[sampleCount].u.altitude_source.pressure_offset = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("PressureOffset")) {
+                            logEntry->logEntry->samples[sampleCount].u.altitude_source.pressure_offset = readElementInt();
                         }
                         else {
                             /* Should not get here! */
@@ -912,59 +1921,53 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_gps_base:
-                        if (xml.name() == "NavValid") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.navvalid = xml.readElementText().toUInt();
+                        if (xml.name() == QLatin1String("NavValid")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.navvalid = readElementInt();
                         }
-                        else if (xml.name() == "NavType") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.navtype = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("NavType")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.navtype = readElementInt();
                         }
-                        else if (xml.name() == "UTCReference") {
-                            QDateTime datetime = QDateTime::fromString(xml.readElementText(), "yyyy-MM-ddThh:mm:ss.zzzZ");
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time.year = datetime.date().year();
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time.month = datetime.date().month();
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time.day = datetime.date().day();
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time.hour = datetime.time().hour();
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time.minute = datetime.time().minute();
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time.msec = datetime.time().second()*1000 + datetime.time().msec();
+                        else if (xml.name() == QLatin1String("UTCReference")) {
+                            readElementDateTime(&logEntry->logEntry->samples[sampleCount].u.gps_base.utc_base_time);
                         }
-                        else if (xml.name() == "Latitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.latitude = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("Latitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.latitude = readElementInt();
                         }
-                        else if (xml.name() == "Longitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.longitude = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("Longitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.longitude = readElementInt();
                         }
-                        else if (xml.name() == "GPSAltitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.altitude = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("GPSAltitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.altitude = readElementInt();
                         }
-                        else if (xml.name() == "GPSSpeed") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.speed = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("GPSSpeed")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.speed = readElementInt();
                         }
-                        else if (xml.name() == "GPSHeading") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.heading = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("GPSHeading")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.heading = readElementInt();
                         }
-                        else if (xml.name() == "EHPE") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.ehpe = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("EHPE")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.ehpe = readElementInt();
                         }
-                        else if (xml.name() == "NumberOfSatellites") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.noofsatellites = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("NumberOfSatellites")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.noofsatellites = readElementInt();
                         }
-                        else if (xml.name() == "GpsHDOP") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_base.hdop = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("GpsHDOP")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_base.hdop = readElementInt();
                         }
-                        else if (xml.name() == "Satellites") {
+                        else if (xml.name() == QLatin1String("Satellites")) {
                             QList<ambit_log_gps_satellite_t> satellites;
                             while(xml.readNextStartElement()) {
-                                if (xml.name() == "Satellite") {
+                                if (xml.name() == QLatin1String("Satellite")) {
                                     ambit_log_gps_satellite_t satellite;
                                     while(xml.readNextStartElement()) {
-                                        if (xml.name() == "SV") {
-                                            satellite.sv = xml.readElementText().toUInt();
+                                        if (xml.name() == QLatin1String("SV")) {
+                                            satellite.sv = readElementInt();
                                         }
-                                        else if (xml.name() == "SNR") {
-                                            satellite.snr = xml.readElementText().toUInt();
+                                        else if (xml.name() == QLatin1String("SNR")) {
+                                            satellite.snr = readElementInt();
                                         }
-                                        else if (xml.name() == "State") {
-                                            satellite.state = xml.readElementText().toUInt();
+                                        else if (xml.name() == QLatin1String("State")) {
+                                            satellite.state = readElementInt();
                                         }
                                         else {
                                             /* Should not get here! */
@@ -980,7 +1983,7 @@ void LogStore::XMLReader::readLogSamples()
                             }
                             if (satellites.count() > 0) {
                                 logEntry->logEntry->samples[sampleCount].u.gps_base.satellites_count = satellites.count();
-                                logEntry->logEntry->samples[sampleCount].u.gps_base.satellites = (ambit_log_gps_satellite_t*)calloc(satellites.count(), sizeof(ambit_log_gps_satellite_t));
+                                logEntry->logEntry->samples[sampleCount].u.gps_base.satellites = (ambit_log_gps_satellite_t*)libambit_log_entry_alloc(logEntry->logEntry, satellites.count()*sizeof(ambit_log_gps_satellite_t));
                                 for (int i=0; i<satellites.count(); i++) {
                                     logEntry->logEntry->samples[sampleCount].u.gps_base.satellites[i] = satellites.at(i);
                                 }
@@ -992,17 +1995,17 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_gps_small:
-                        if (xml.name() == "Latitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_small.latitude = xml.readElementText().toInt();
+                        if (xml.name() == QLatin1String("Latitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_small.latitude = readElementInt();
                         }
-                        else if (xml.name() == "Longitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_small.longitude = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("Longitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_small.longitude = readElementInt();
                         }
-                        else if (xml.name() == "EHPE") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_small.ehpe = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("EHPE")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_small.ehpe = readElementInt();
                         }
-                        else if (xml.name() == "NumberOfSatellites") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_small.noofsatellites = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("NumberOfSatellites")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_small.noofsatellites = readElementInt();
                         }
                         else {
                             /* Should not get here! */
@@ -1010,17 +2013,17 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_gps_tiny:
-                        if (xml.name() == "Latitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.latitude = xml.readElementText().toInt();
+                        if (xml.name() == QLatin1String("Latitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.latitude = readElementInt();
                         }
-                        else if (xml.name() == "Longitude") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.longitude = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("Longitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.longitude = readElementInt();
                         }
-                        else if (xml.name() == "EHPE") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.ehpe = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("EHPE")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.ehpe = readElementInt();
                         }
-                        else if (xml.name() == "Unknown") {
-                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.unknown = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("Unknown")) {
+                            logEntry->logEntry->samples[sampleCount].u.gps_tiny.unknown = readElementInt();
                         }
                         else {
                             /* Should not get here! */
@@ -1028,7 +2031,7 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_time:
-                        if (xml.name() == "TimeRef") {
+                        if (xml.name() == QLatin1String("TimeRef")) {
                             QTime timeref = QTime::fromString(xml.readElementText(), Qt::ISODate);
                             logEntry->logEntry->samples[sampleCount].u.time.hour = timeref.hour();
                             logEntry->logEntry->samples[sampleCount].u.time.minute = timeref.minute();
@@ -1040,17 +2043,17 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_swimming_turn:
-                        if (xml.name() == "Distance") {
-                            logEntry->logEntry->samples[sampleCount].u.swimming_turn.distance = xml.readElementText().toInt();
+                        if (xml.name() == QLatin1String("Distance")) {
+                            logEntry->logEntry->samples[sampleCount].u.swimming_turn.distance = readElementInt();
                         }
-                        else if (xml.name() == "Lengths") {
-                            logEntry->logEntry->samples[sampleCount].u.swimming_turn.lengths = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("Lengths")) {
+                            logEntry->logEntry->samples[sampleCount].u.swimming_turn.lengths = readElementInt();
                         }
-                        else if (xml.name() == "Classification") {
+                        else if (xml.name() == QLatin1String("Classification")) {
                             int itemCount = 0;
                             while(xml.readNextStartElement()) {
-                                if (xml.name() == "Item" && itemCount < (int)(sizeof(logEntry->logEntry->samples[sampleCount].u.swimming_turn.classification)/sizeof(logEntry->logEntry->samples[sampleCount].u.swimming_turn.classification[0]))) {
-                                    logEntry->logEntry->samples[sampleCount].u.swimming_turn.classification[itemCount++] = xml.readElementText().toInt();
+                                if (xml.name() == QLatin1String("Item") && itemCount < (int)(sizeof(logEntry->logEntry->samples[sampleCount].u.swimming_turn.classification)/sizeof(logEntry->logEntry->samples[sampleCount].u.swimming_turn.classification[0]))) {
+                                    logEntry->logEntry->samples[sampleCount].u.swimming_turn.classification[itemCount++] = readElementInt();
                                 }
                                 else {
                                     /* Should not get here! */
@@ -1058,8 +2061,8 @@ void LogStore::XMLReader::readLogSamples()
                                 }
                             }
                         }
-                        else if (xml.name() == "Style") {
-                            int styleId = xml.attributes().value("id").toString().toUInt();
+                        else if (xml.name() == QLatin1String("Style")) {
+                            int styleId = parseInt(xml.attributes().value(QLatin1String("id")));
                             logEntry->logEntry->samples[sampleCount].u.swimming_turn.style = styleId;
                             xml.skipCurrentElement();
                         }
@@ -1073,11 +2076,11 @@ void LogStore::XMLReader::readLogSamples()
                         xml.skipCurrentElement();
                         break;
                     case ambit_log_sample_type_activity:
-                        if (xml.name() == "ActivityType") {
-                            logEntry->logEntry->samples[sampleCount].u.activity.activitytype = xml.readElementText().toUInt();
+                        if (xml.name() == QLatin1String("ActivityType")) {
+                            logEntry->logEntry->samples[sampleCount].u.activity.activitytype = readElementInt();
                         }
-                        else if (xml.name() == "CustomModeId") {
-                            logEntry->logEntry->samples[sampleCount].u.activity.custommode = xml.readElementText().toUInt();
+                        else if (xml.name() == QLatin1String("CustomModeId")) {
+                            logEntry->logEntry->samples[sampleCount].u.activity.custommode = readElementInt();
                         }
                         else {
                             /* Should not get here! */
@@ -1085,8 +2088,8 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_cadence_source:
-                        if (xml.name() == "CadenceSource") {
-                            int cadenceId = xml.attributes().value("id").toString().toUInt();
+                        if (xml.name() == QLatin1String("CadenceSource")) {
+                            int cadenceId = parseInt(xml.attributes().value(QLatin1String("id")));
                             logEntry->logEntry->samples[sampleCount].u.cadence_source = cadenceId;
                             xml.skipCurrentElement();
                         }
@@ -1096,11 +2099,11 @@ void LogStore::XMLReader::readLogSamples()
                         }
                         break;
                     case ambit_log_sample_type_position:
-                        if (xml.name() == "Latitude") {
-                            logEntry->logEntry->samples[sampleCount].u.position.latitude = xml.readElementText().toInt();
+                        if (xml.name() == QLatin1String("Latitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.position.latitude = readElementInt();
                         }
-                        else if (xml.name() == "Longitude") {
-                            logEntry->logEntry->samples[sampleCount].u.position.longitude = xml.readElementText().toInt();
+                        else if (xml.name() == QLatin1String("Longitude")) {
+                            logEntry->logEntry->samples[sampleCount].u.position.longitude = readElementInt();
                         }
                         else {
                             /* Should not get here! */
@@ -1111,7 +2114,7 @@ void LogStore::XMLReader::readLogSamples()
                     {
                         QRegExp versionRX("([0-9]+)\\.([0-9]+)\\.([0-9]+)");
 
-                        if (xml.name() == "Version") {
+                        if (xml.name() == QLatin1String("Version")) {
                             if (versionRX.indexIn(xml.readElementText()) >= 0) {
                                 logEntry->logEntry->samples[sampleCount].u.fwinfo.version[0] = versionRX.cap(1).toInt();
                                 logEntry->logEntry->samples[sampleCount].u.fwinfo.version[1] = versionRX.cap(2).toInt();
@@ -1119,14 +2122,8 @@ void LogStore::XMLReader::readLogSamples()
                                 logEntry->logEntry->samples[sampleCount].u.fwinfo.version[3] = (versionRX.cap(3).toInt() >> 8) & 0xff;
                             }
                         }
-                        else if (xml.name() == "BuildDate") {
-                            QDateTime datetime = QDateTime::fromString(xml.readElementText(), Qt::ISODate);
-                            logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date.year = datetime.date().year();
-                            logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date.month = datetime.date().month();
-                            logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date.day = datetime.date().day();
-                            logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date.hour = datetime.time().hour();
-                            logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date.minute = datetime.time().minute();
-                            logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date.msec = datetime.time().second()*1000 + datetime.time().msec();
+                        else if (xml.name() == QLatin1String("BuildDate")) {
+                            readElementDateTime(&logEntry->logEntry->samples[sampleCount].u.fwinfo.build_date);
                         }
                         else {
                             /* Should not get here! */
@@ -1135,11 +2132,11 @@ void LogStore::XMLReader::readLogSamples()
                         break;
                     }
                     case ambit_log_sample_type_unknown:
-                        if (xml.name() == "Data") {
+                        if (xml.name() == QLatin1String("Data")) {
                             QByteArray val = xml.readElementText().toLocal8Bit();
                             const char *c_str = val.data();
                             if (val.length() >= 2) {
-                                logEntry->logEntry->samples[sampleCount].u.unknown.data = (uint8_t*)malloc(val.length()/2);
+                                logEntry->logEntry->samples[sampleCount].u.unknown.data = (uint8_t*)libambit_log_entry_alloc(logEntry->logEntry, val.length()/2);
                                 for (int i=0; i<val.length()/2; i++) {
                                     sscanf(c_str, "%2hhx", &logEntry->logEntry->samples[sampleCount].u.unknown.data[i]);
                                     c_str += 2 * sizeof(char);
@@ -1157,12 +2154,10 @@ void LogStore::XMLReader::readLogSamples()
                     }
                 }
             }
-            if (type == ambit_log_sample_type_periodic && periodicValues.count() > 0) {
-                logEntry->logEntry->samples[sampleCount].u.periodic.value_count = periodicValues.count();
-                logEntry->logEntry->samples[sampleCount].u.periodic.values = (ambit_log_sample_periodic_value_t*)calloc(periodicValues.count(), sizeof(ambit_log_sample_periodic_value_t));
-                for (int i=0; i<periodicValues.count(); i++) {
-                    logEntry->logEntry->samples[sampleCount].u.periodic.values[i] = periodicValues.at(i);
-                }
+            if (type == ambit_log_sample_type_periodic && periodicCount > 0) {
+                logEntry->logEntry->samples[sampleCount].u.periodic.value_count = periodicCount;
+                logEntry->logEntry->samples[sampleCount].u.periodic.values = (ambit_log_sample_periodic_value_t*)libambit_log_entry_alloc(logEntry->logEntry, periodicCount*sizeof(ambit_log_sample_periodic_value_t));
+                memcpy(logEntry->logEntry->samples[sampleCount].u.periodic.values, periodicValues, periodicCount*sizeof(ambit_log_sample_periodic_value_t));
             }
             sampleCount++;
         }
@@ -1172,181 +2167,73 @@ void LogStore::XMLReader::readLogSamples()
     }
 }
 
-void LogStore::XMLReader::readPeriodicSample(QList<ambit_log_sample_periodic_value_t> *valueContent)
-{
-    ambit_log_sample_periodic_value_t value;
-
-    if (xml.name() == "Latitude") {
-        value.type = ambit_log_sample_periodic_type_latitude;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Longitude") {
-        value.type = ambit_log_sample_periodic_type_longitude;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Distance") {
-        value.type = ambit_log_sample_periodic_type_distance;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Speed") {
-        value.type = ambit_log_sample_periodic_type_speed;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "HR") {
-        value.type = ambit_log_sample_periodic_type_hr;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Time") {
-        value.type = ambit_log_sample_periodic_type_time;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "GPSSpeed") {
-        value.type = ambit_log_sample_periodic_type_gpsspeed;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "WristAccSpeed") {
-        value.type = ambit_log_sample_periodic_type_wristaccspeed;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "BikePodSpeed") {
-        value.type = ambit_log_sample_periodic_type_bikepodspeed;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "EHPE") {
-        value.type = ambit_log_sample_periodic_type_ehpe;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "EVPE") {
-        value.type = ambit_log_sample_periodic_type_evpe;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Altitude") {
-        value.type = ambit_log_sample_periodic_type_altitude;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "AbsPressure") {
-        value.type = ambit_log_sample_periodic_type_abspressure;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "EnergyConsumption") {
-        value.type = ambit_log_sample_periodic_type_energy;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Temperature") {
-        value.type = ambit_log_sample_periodic_type_temperature;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "BatteryCharge") {
-        value.type = ambit_log_sample_periodic_type_charge;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "GPSAltitude") {
-        value.type = ambit_log_sample_periodic_type_gpsaltitude;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "GPSHeading") {
-        value.type = ambit_log_sample_periodic_type_gpsheading;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "GpsHDOP") {
-        value.type = ambit_log_sample_periodic_type_gpshdop;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "GpsVDOP") {
-        value.type = ambit_log_sample_periodic_type_gpsvdop;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "WristCadence") {
-        value.type = ambit_log_sample_periodic_type_wristcadence;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "SNR") {
-        value.type = ambit_log_sample_periodic_type_snr;
+void LogStore::XMLReader::readPeriodicSample(ambit_log_sample_periodic_value_t *values, int *count)
+{
+    static const XMLElementTable names(samplePeriodicNames);
+    ambit_log_sample_periodic_value_t *value;
+    int index;
+
+    if ((index = names.find(xml.name())) < 0 || *count >= XML_PERIODIC_VALUES_MAX) {
+        xml.skipCurrentElement();
+        return;
+    }
+
+    value = &values[(*count)++];
+    memset(value, 0, sizeof(ambit_log_sample_periodic_value_t));
+    value->type = samplePeriodicNames[index].type;
+
+    if (value->type == ambit_log_sample_periodic_type_snr) {
         QByteArray val = xml.readElementText().toLocal8Bit();
         const char *c_str = val.data();
         for (int i=0; i<16 && i<val.length()/2; i++) {
-            sscanf(c_str, "%2hhx", &value.u.snr[i]);
+            sscanf(c_str, "%2hhx", &value->u.snr[i]);
             c_str += 2 * sizeof(char);
         }
-        valueContent->append(value);
-    }
-    else if (xml.name() == "NumberOfSatellites") {
-        value.type = ambit_log_sample_periodic_type_noofsatellites;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "SeaLevelPressure") {
-        value.type = ambit_log_sample_periodic_type_sealevelpressure;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "VerticalSpeed") {
-        value.type = ambit_log_sample_periodic_type_verticalspeed;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "Cadence") {
-        value.type = ambit_log_sample_periodic_type_cadence;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "BikePower") {
-        value.type = ambit_log_sample_periodic_type_bikepower;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "SwimmingStrokeCount") {
-        value.type = ambit_log_sample_periodic_type_swimingstrokecnt;
-        value.u.latitude = xml.readElementText().toUInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "RuleOutput1") {
-        value.type = ambit_log_sample_periodic_type_ruleoutput1;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "RuleOutput2") {
-        value.type = ambit_log_sample_periodic_type_ruleoutput2;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "RuleOutput3") {
-        value.type = ambit_log_sample_periodic_type_ruleoutput3;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "RuleOutput4") {
-        value.type = ambit_log_sample_periodic_type_ruleoutput4;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
-    }
-    else if (xml.name() == "RuleOutput5") {
-        value.type = ambit_log_sample_periodic_type_ruleoutput5;
-        value.u.latitude = xml.readElementText().toInt();
-        valueContent->append(value);
     }
     else {
+        // All other values are plain integers of at most 32 bits
+        value->u.latitude = readElementInt();
+    }
+}
+
+qint64 LogStore::XMLReader::readElementInt()
+{
+    qint64 value = 0;
+
+    // Parse straight from the reader's buffer instead of a copy
+    if (xml.readNext() == QXmlStreamReader::Characters) {
+        value = parseInt(xml.text());
+        xml.readNext();
+    }
+    if (!xml.isEndElement()) {
+        xml.skipCurrentElement();
+    }
+
+    return value;
+}
+
+void LogStore::XMLReader::readElementDateTime(ambit_date_time_t *date_time)
+{
+    memset(date_time, 0, sizeof(ambit_date_time_t));
+
+    if (xml.readNext() == QXmlStreamReader::Characters) {
+        if (!parseDateTime(xml.text(), date_time)) {
+            // Not in the format written by XMLWriter, take the slow path
+            QString text = xml.text().toString();
+            QDateTime datetime = QDateTime::fromString(text, "yyyy-MM-ddThh:mm:ss.zzzZ");
+            if (!datetime.isValid()) {
+                datetime = QDateTime::fromString(text, Qt::ISODate);
+            }
+            date_time->year = datetime.date().year();
+            date_time->month = datetime.date().month();
+            date_time->day = datetime.date().day();
+            date_time->hour = datetime.time().hour();
+            date_time->minute = datetime.time().minute();
+            date_time->msec = datetime.time().second()*1000 + datetime.time().msec();
+        }
+        xml.readNext();
+    }
+    if (!xml.isEndElement()) {
         xml.skipCurrentElement();
     }
 }
@@ -25,13 +25,22 @@
 #include <QObject>
 #include <QDateTime>
 #include <QList>
+#include <QMap>
 #include <QIODevice>
+#include <QMutex>
+#include <QThreadPool>
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 #include <libambit.h>
 
 #include "deviceinfo.h"
+#include "logchartdata.h"
 #include "logentry.h"
+#include "logrollup.h"
+#include "logstatistics.h"
+
+class QFile;
+struct binary_sample_s;
 
 class LogStore : public QObject
 {
@@ -43,9 +52,22 @@ public:
         QString device;
         QDateTime time;
         QString filename;
+        QString activityName;
+        quint8 activityType;
+        quint32 duration;           /* ms */
+        quint32 distance;           /* m */
+        QString movescountId;
+        LogStatistics statistics;   /* computed when stored */
     };
 
+    typedef bool (*ReadCallback)(void *ref, int index, LogDirEntry dirEntry, LogEntry *entry);
+
     explicit LogStore(QObject *parent = 0);
+    /**
+     * Store a log read from a device
+     * \return Stored entry, which then owns logEntry, or NULL on error,
+     * in which case logEntry is still owned by the caller
+     */
     LogEntry *store(const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry);
     LogEntry *store(LogEntry *entry);
     void storeMovescountId(QString device, QDateTime time, QString movescountId);
@@ -53,17 +75,127 @@ public:
     LogEntry *read(QString device, QDateTime time);
     LogEntry *read(LogDirEntry dirEntry);
     LogEntry *read(QString filename);
+    /**
+     * Read only the header, device info and settings of a log, for
+     * views that don't need the samples. The log entry of the returned
+     * entry has no samples until passed to readSamples()
+     */
+    LogEntry *readHeader(LogDirEntry dirEntry);
+    LogEntry *readHeader(QString filename);
+    bool readSamples(LogEntry *entry);
+    /**
+     * Read only the samples of a log from time from to time to, in ms
+     * from the start of the log. Only the parts of the log file covering
+     * the range are decompressed. The samples count of the log entry is
+     * that of the range, the header is that of the whole log
+     * \return Entry owned by the caller, or NULL on error
+     */
+    LogEntry *readRange(QString device, QDateTime time, quint32 from, quint32 to);
+    /**
+     * Get the chart pyramid of a log. It is built from the samples on
+     * first use and cached next to the log, later calls don't read the
+     * samples unless the log has changed
+     * \return Chart data owned by the caller, or NULL on error
+     */
+    LogChartData *readChartData(LogDirEntry dirEntry);
+    LogChartData *readChartData(QString filename);
+    /**
+     * Get the statistics of a log from the index, without reading the log
+     * \return false if the log is not indexed or has no statistics
+     */
+    bool readStatistics(QString filename, LogStatistics *statistics);
+    /**
+     * Read several logs in parallel
+     * \return One entry per dirEntries item in the same order, NULL for
+     * logs that could not be read. The caller owns the entries
+     */
+    QList<LogEntry*> readMany(QList<LogDirEntry> dirEntries, bool headerOnly = false);
+    /**
+     * Read several logs in parallel and pass each to callback, on the
+     * calling thread, as soon as it is read. The callback owns the entry,
+     * which is NULL if the log could not be read, and stops the reading
+     * by returning false
+     * \return false if stopped by the callback
+     */
+    bool forEach(QList<LogDirEntry> dirEntries, ReadCallback callback, void *ref, bool headerOnly = false);
     QList<LogDirEntry> dir(QString device = "");
+    /**
+     * Get totals of the stored logs per day, week or month, from rollups
+     * kept with the index, without reading any log
+     * \param device Device serial, "" for all devices
+     * \param activityType Activity type, -1 for all
+     * \return Periods from from to to that have logs, oldest first
+     */
+    QList<LogRollup::Bucket> rollup(LogRollup::Period period, QDate from, QDate to, QString device = "", int activityType = -1);
+    bool exportXML(LogEntry *entry, QString path);
+    LogEntry *importXML(QString path);
 signals:
     
 public slots:
 
 private:
     QString logEntryPath(QString device, QDateTime time);
-    LogEntry *storeInternal(QString serial, QDateTime dateTime, const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry, QString movescountId = "");
-    LogEntry *readInternal(QString path);
+    QString xmlLogEntryPath(QString path);
+    QString metadataPath(QString path);
+    QString chartDataPath(QString path);
+    bool storeInternal(QString path, QDateTime dateTime, const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry, QString movescountId = "");
+    LogEntry *readInternal(QString path, bool headerOnly = false);
+    LogEntry *readBinary(QString path, bool headerOnly = false, quint32 from = 0, quint32 to = 0xffffffff);
+    LogEntry *readXML(QString path);
+#ifdef DEBUG_LOGSTORE_VERIFY
+    void verifyStored(QString path, ambit_log_entry_t *logEntry);
+#endif
+
+    class IndexEntry
+    {
+    public:
+        LogDirEntry dirEntry;
+        qint64 size;
+        QDateTime modified;
+        QDateTime metaModified;     /* null without metadata file */
+    };
+
+    // Mutable data of a stored log, kept apart from the log so that
+    // updates don't rewrite the samples
+    class Metadata
+    {
+    public:
+        QString movescountId;
+        QDateTime uploaded;
+        QDateTime modified;
+    };
+
+    bool readMetadata(QString path, Metadata *metadata);
+    bool writeMetadata(QString path, const Metadata &metadata);
+    void applyMetadata(QString path, LogEntry *entry);
+
+    bool readChartCache(QString path, LogChartData *chartData);
+    bool writeChartCache(QString path, const LogChartData &chartData);
+
+    void loadIndex();
+    void rollupEntry(const IndexEntry &entry, bool add);
+    void saveIndex();
+    void updateIndex(QString path, QDateTime dateTime, const DeviceInfo& deviceInfo, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry, QString movescountId, bool save = true);
+    bool indexFile(QString path);
 
     QString storagePath;
+    QMutex updateMutex;
+
+    class ReadQueue;
+    class ReadTask;
+    QThreadPool readPool;
+
+    // Migration of XML logs by concurrent readers, taken before
+    // indexMutex where both are needed
+    static QMutex migrateMutex;
+
+    // Summary of every stored log, shared by all LogStore objects and
+    // kept on disk next to the logs
+    static QMutex indexMutex;
+    static QMap<QString, IndexEntry> index;
+    static bool indexLoaded;
+    static bool indexDirty;
+    static LogRollup rollups;       /* of the indexed logs, not saved */
 
     class XMLReader
     {
@@ -82,7 +214,9 @@ private:
         void readLog();
         void readLogHeader();
         void readLogSamples();
-        void readPeriodicSample(QList<ambit_log_sample_periodic_value_t> *valueContent);
+        void readPeriodicSample(ambit_log_sample_periodic_value_t *values, int *count);
+        qint64 readElementInt();
+        void readElementDateTime(ambit_date_time_t *date_time);
         QXmlStreamReader xml;
         LogEntry *logEntry;
     };
@@ -107,6 +241,53 @@ private:
         ambit_personal_settings_t *personalSettings;
         ambit_log_entry_t *logEntry;
     };
+
+    class BinaryReader
+    {
+    public:
+        BinaryReader(LogEntry *logEntry);
+        bool read(QFile *file, bool headerOnly = false);
+        /**
+         * Read only the samples from time from to time to, in ms
+         */
+        bool readRange(QFile *file, quint32 from, quint32 to);
+
+        QString errorString() const;
+    private:
+        bool readData(const uchar *data, qint64 size, bool headerOnly);
+        bool readRecords(const binary_sample_s *records, quint32 count);
+        QString string(quint32 offset) const;
+        const uchar *extraData(quint32 offset, quint64 length);
+
+        LogEntry *logEntry;
+        QString error;
+        const char *strings;
+        quint32 stringsSize;
+        const uchar *extra;
+        quint32 extraSize;
+        quint32 rangeFrom;          /* ms, samples outside are skipped */
+        quint32 rangeTo;
+        quint32 samplesCapacity;
+    };
+
+    class BinaryWriter
+    {
+    public:
+        BinaryWriter(const DeviceInfo& deviceInfo, QDateTime time, QString movescountId, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry);
+        bool write(QIODevice *device);
+
+    private:
+        void writeSample(const ambit_log_sample_t *sample, binary_sample_s *record);
+        quint32 addString(QString string);
+
+        DeviceInfo deviceInfo;
+        QDateTime time;
+        QString movescountId;
+        QByteArray extra;
+        QByteArray strings;
+        ambit_personal_settings_t *personalSettings;
+        ambit_log_entry_t *logEntry;
+    };
 };
 
 #endif // LOGSTORE_H
@@ -0,0 +1,744 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logstore.h"
+
+#include <QFile>
+#include <QVector>
+
+#include <stddef.h>
+#include <string.h>
+#include <zlib.h>
+
+/*
+ * Binary log file layout, all integers in host byte order:
+ *
+ *   binary_file_header_t   device info, settings and log header
+ *   binary_sample_t[]      one fixed size record per sample
+ *   extra data             periodic values, GPS satellites and unknown
+ *                          sample data, referenced by offset from samples
+ *   string table           NUL terminated UTF-8 strings, referenced by
+ *                          offset from the header
+ *
+ * With BINARY_FLAG_COMPRESSED (written since version 2) the samples and
+ * extra data are instead split in blocks of at most BINARY_BLOCK_SAMPLES
+ * samples, also closed after BINARY_BLOCK_SECONDS of sample time:
+ *
+ *   binary_file_header_t
+ *   binary_block_t[]       sample range, time range and file offset of
+ *                          each block
+ *   string table
+ *   blocks                 zlib compressed sample records followed by
+ *                          their extra data, offsets relative to the block
+ *
+ * Only one block is held decompressed at a time, and the header and block
+ * table can be read without touching the sample data. The block table is
+ * also the seek index for reading a time range, only blocks overlapping
+ * the range are decompressed.
+ *
+ * The file is memory mapped on read, and records are copied as is into
+ * the log entry. Any change of the layout needs a new version.
+ */
+#define BINARY_MAGIC            "OALOGBIN"
+#define BINARY_VERSION          2
+#define BINARY_BYTE_ORDER       0x01020304
+#define BINARY_NO_STRING        0xffffffff
+#define BINARY_SAMPLE_PAYLOAD   68          /* >= the largest sample union member without pointers */
+#define BINARY_PERIODIC_VALUE   16          /* size of the periodic value union */
+#define BINARY_BLOCK_SAMPLES    1024
+#define BINARY_BLOCK_SECONDS    300
+
+#define BINARY_FLAG_COMPRESSED  0x00000001
+
+#pragma pack(push, 1)
+
+typedef struct binary_log_header_s {
+    ambit_date_time_t date_time;
+    quint32 duration;
+    quint16 ascent;
+    quint16 descent;
+    quint32 ascent_time;
+    quint32 descent_time;
+    quint32 recovery_time;
+    quint16 speed_avg;
+    quint16 speed_max;
+    quint32 speed_max_time;
+    qint16  altitude_max;
+    qint16  altitude_min;
+    quint32 altitude_max_time;
+    quint32 altitude_min_time;
+    quint8  heartrate_avg;
+    quint8  heartrate_max;
+    quint8  heartrate_min;
+    quint32 heartrate_max_time;
+    quint32 heartrate_min_time;
+    quint8  peak_training_effect;
+    quint8  activity_type;
+    quint32 activity_name;              /* string */
+    qint16  temperature_max;
+    qint16  temperature_min;
+    quint32 temperature_max_time;
+    quint32 temperature_min_time;
+    quint32 distance;
+    quint32 samples_count;
+    quint16 energy_consumption;
+    quint32 first_fix_time;
+    quint8  battery_start;
+    quint8  battery_end;
+    quint32 distance_before_calib;
+    quint8  unknown1[5];
+    quint8  unknown2;
+    quint8  cadence_max;
+    quint8  cadence_avg;
+    quint8  unknown3[2];
+    quint16 swimming_pool_lengths;
+    quint32 cadence_max_time;
+    quint32 swimming_pool_length;
+    quint8  unknown5[4];
+    quint8  unknown6[24];
+} binary_log_header_t;
+
+typedef struct binary_file_header_s {
+    char    magic[8];
+    quint32 version;
+    quint32 byte_order;
+    quint32 header_size;
+    quint32 sample_size;
+    quint32 sample_count;
+    quint32 samples_offset;
+    quint32 extra_offset;
+    quint32 extra_size;
+    quint32 strings_offset;
+    quint32 strings_size;
+    ambit_date_time_t time;
+    quint32 device;                     /* string */
+    quint32 movescount_id;              /* string */
+    quint32 info_name;                  /* string */
+    quint32 info_model;                 /* string */
+    quint32 info_serial;                /* string */
+    qint32  info_fw_version[3];
+    qint32  info_hw_version[3];
+    quint8  has_personal_settings;
+    quint8  has_log_entry;
+    ambit_personal_settings_t personal_settings;
+    binary_log_header_t log_header;
+    /* Version 2 */
+    quint32 flags;
+    quint32 block_count;
+    quint32 block_table_offset;
+} binary_file_header_t;
+
+#define BINARY_HEADER_V1_SIZE   offsetof(binary_file_header_t, flags)
+
+typedef struct binary_block_s {
+    quint32 first_sample;
+    quint32 sample_count;
+    quint32 first_time;                 /* sample time of first and last sample */
+    quint32 last_time;
+    quint32 offset;
+    quint32 compressed_size;
+    quint32 records_size;
+    quint32 extra_size;
+} binary_block_t;
+
+typedef struct binary_sample_s {
+    quint16 type;
+    quint32 time;
+    ambit_date_time_t utc_time;
+    quint32 extra_offset;               /* periodic values, satellites or unknown data */
+    quint32 extra_count;
+    quint8  payload[BINARY_SAMPLE_PAYLOAD];
+} binary_sample_t;
+
+typedef struct binary_periodic_value_s {
+    quint16 type;
+    quint8  value[BINARY_PERIODIC_VALUE];
+} binary_periodic_value_t;
+
+#pragma pack(pop)
+
+static ambit_date_time_t toBinaryDateTime(QDateTime dateTime);
+static QDateTime fromBinaryDateTime(ambit_date_time_t date_time);
+static void toBinaryLogHeader(const ambit_log_header_t *header, binary_log_header_t *binary, quint32 activityName);
+static void fromBinaryLogHeader(const binary_log_header_t *binary, ambit_log_header_t *header);
+
+LogStore::BinaryReader::BinaryReader(LogEntry *logEntry) :
+    logEntry(logEntry), rangeFrom(0), rangeTo(0xffffffff), samplesCapacity(0)
+{
+}
+
+bool LogStore::BinaryReader::readRange(QFile *file, quint32 from, quint32 to)
+{
+    rangeFrom = from;
+    rangeTo = to;
+
+    return read(file);
+}
+
+bool LogStore::BinaryReader::read(QFile *file, bool headerOnly)
+{
+    QByteArray buffer;
+    qint64 size = file->size();
+    uchar *mapped = file->map(0, size);
+    const uchar *data = mapped;
+    bool ret;
+
+    if (mapped == NULL) {
+        // Not all file systems can be mapped
+        buffer = file->readAll();
+        data = (const uchar*)buffer.constData();
+        size = buffer.size();
+    }
+
+    ret = readData(data, size, headerOnly);
+
+    if (mapped != NULL) {
+        file->unmap(mapped);
+    }
+
+    return ret;
+}
+
+QString LogStore::BinaryReader::errorString() const
+{
+    return error;
+}
+
+bool LogStore::BinaryReader::readData(const uchar *data, qint64 size, bool headerOnly)
+{
+    binary_file_header_t header;
+    quint32 i;
+
+    if (size < (qint64)BINARY_HEADER_V1_SIZE || memcmp(data, BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        error = QObject::tr("The file is not an openambit binary log.");
+        return false;
+    }
+
+    // Older headers are shorter, the fields they lack stay zero
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, data, qMin((qint64)sizeof(header), size));
+    if (header.version < 1 || header.version > BINARY_VERSION || header.byte_order != BINARY_BYTE_ORDER) {
+        error = QObject::tr("Unsupported openambit binary log version %1.").arg(header.version);
+        return false;
+    }
+    if (header.version == 1) {
+        header.flags = header.block_count = header.block_table_offset = 0;
+    }
+
+    if (header.header_size != (header.version == 1 ? BINARY_HEADER_V1_SIZE : sizeof(binary_file_header_t)) ||
+        header.header_size > (quint64)size || header.sample_size != sizeof(binary_sample_t) ||
+        (quint64)header.strings_offset + header.strings_size > (quint64)size) {
+        error = QObject::tr("The binary log is truncated or corrupt.");
+        return false;
+    }
+    if (header.flags & BINARY_FLAG_COMPRESSED) {
+        if ((quint64)header.block_table_offset + (quint64)header.block_count*sizeof(binary_block_t) > (quint64)size) {
+            error = QObject::tr("The binary log is truncated or corrupt.");
+            return false;
+        }
+    }
+    else if ((quint64)header.samples_offset + (quint64)header.sample_count*header.sample_size > (quint64)size ||
+             (quint64)header.extra_offset + header.extra_size > (quint64)size) {
+        error = QObject::tr("The binary log is truncated or corrupt.");
+        return false;
+    }
+
+    strings = (const char*)data + header.strings_offset;
+    stringsSize = header.strings_size;
+
+    logEntry->device = string(header.device);
+    logEntry->time = fromBinaryDateTime(header.time);
+    logEntry->movescountId = string(header.movescount_id);
+    logEntry->deviceInfo.name = string(header.info_name);
+    logEntry->deviceInfo.model = string(header.info_model);
+    logEntry->deviceInfo.serial = string(header.info_serial);
+    for (i=0; i<3; i++) {
+        logEntry->deviceInfo.fw_version[i] = header.info_fw_version[i];
+        logEntry->deviceInfo.hw_version[i] = header.info_hw_version[i];
+    }
+
+    if (header.has_personal_settings) {
+        if (logEntry->personalSettings == NULL) {
+            logEntry->personalSettings = (ambit_personal_settings_t*)malloc(sizeof(ambit_personal_settings_t));
+        }
+        memcpy(logEntry->personalSettings, &header.personal_settings, sizeof(ambit_personal_settings_t));
+    }
+
+    if (!header.has_log_entry) {
+        return true;
+    }
+
+    if (logEntry->logEntry == NULL) {
+        logEntry->logEntry = (ambit_log_entry_t*)calloc(1, sizeof(ambit_log_entry_t));
+    }
+    fromBinaryLogHeader(&header.log_header, &logEntry->logEntry->header);
+    if (header.log_header.activity_name != BINARY_NO_STRING) {
+        logEntry->logEntry->header.activity_name = strdup(string(header.log_header.activity_name).toUtf8().constData());
+    }
+
+    if (headerOnly || header.sample_count == 0) {
+        return true;
+    }
+
+    // Only blocks overlapping the range are read, room is made for all
+    // their samples and those outside of the range are skipped
+    const binary_block_t *blocks = (const binary_block_t*)(data + header.block_table_offset);
+    quint64 capacity = header.sample_count;
+    if (header.flags & BINARY_FLAG_COMPRESSED) {
+        for (i=0, capacity=0; i<header.block_count; i++) {
+            if (blocks[i].first_time <= rangeTo && blocks[i].last_time >= rangeFrom) {
+                capacity += blocks[i].sample_count;
+            }
+        }
+        capacity = qMin(capacity, (quint64)header.sample_count);
+        if (capacity == 0) {
+            return true;
+        }
+    }
+
+    logEntry->logEntry->samples = (ambit_log_sample_t*)calloc(capacity, sizeof(ambit_log_sample_t));
+    if (logEntry->logEntry->samples == NULL) {
+        error = QObject::tr("Out of memory reading %1 samples.").arg((quint32)capacity);
+        return false;
+    }
+    logEntry->logEntry->samples_count = 0;
+    samplesCapacity = capacity;
+
+    if (!(header.flags & BINARY_FLAG_COMPRESSED)) {
+        extra = data + header.extra_offset;
+        extraSize = header.extra_size;
+        return readRecords((const binary_sample_t*)(data + header.samples_offset), header.sample_count);
+    }
+
+    QByteArray buffer;
+    const binary_block_t *block = blocks;
+    for (i=0; i<header.block_count; i++, block++) {
+        uLongf length = (quint64)block->records_size + block->extra_size;
+
+        if ((quint64)block->offset + block->compressed_size > (quint64)size ||
+            (quint64)block->first_sample + block->sample_count > header.sample_count ||
+            (quint64)block->sample_count*sizeof(binary_sample_t) != block->records_size) {
+            error = QObject::tr("Block %1 of the binary log is corrupt.").arg(i);
+            return false;
+        }
+        if (block->first_time > rangeTo || block->last_time < rangeFrom) {
+            continue;
+        }
+
+        // The buffer is reused, so at most one block is decompressed at a time
+        buffer.resize(length);
+        if (uncompress((Bytef*)buffer.data(), &length, data + block->offset, block->compressed_size) != Z_OK ||
+            length != (uLongf)buffer.size()) {
+            error = QObject::tr("Block %1 of the binary log could not be decompressed.").arg(i);
+            return false;
+        }
+
+        extra = (const uchar*)buffer.constData() + block->records_size;
+        extraSize = block->extra_size;
+        if (!readRecords((const binary_sample_t*)buffer.constData(), block->sample_count)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool LogStore::BinaryReader::readRecords(const binary_sample_s *records, quint32 count)
+{
+    const binary_sample_t *record = records;
+    ambit_log_sample_t *sample;
+    quint32 i, n;
+
+    for (n=0; n<count; n++, record++) {
+        if (record->time < rangeFrom || record->time > rangeTo) {
+            continue;
+        }
+        if (logEntry->logEntry->samples_count >= samplesCapacity) {
+            error = QObject::tr("The binary log has more samples than its header.");
+            return false;
+        }
+        i = logEntry->logEntry->samples_count++;
+        sample = &logEntry->logEntry->samples[i];
+        sample->type = (ambit_log_sample_type_t)record->type;
+        sample->time = record->time;
+        sample->utc_time = record->utc_time;
+        memcpy(&sample->u, record->payload, qMin(sizeof(sample->u), sizeof(record->payload)));
+
+        switch (sample->type) {
+        case ambit_log_sample_type_periodic:
+            sample->u.periodic.value_count = 0;
+            sample->u.periodic.values = NULL;
+            if (record->extra_count > 0) {
+                const binary_periodic_value_t *value = (const binary_periodic_value_t*)extraData(record->extra_offset, (quint64)record->extra_count*sizeof(binary_periodic_value_t));
+                if (value == NULL) {
+                    return false;
+                }
+                sample->u.periodic.values = (ambit_log_sample_periodic_value_t*)libambit_log_entry_alloc(logEntry->logEntry, record->extra_count*sizeof(ambit_log_sample_periodic_value_t));
+                if (sample->u.periodic.values == NULL) {
+                    error = QObject::tr("Out of memory reading sample %1.").arg(i);
+                    return false;
+                }
+                for (quint32 j=0; j<record->extra_count; j++, value++) {
+                    memset(&sample->u.periodic.values[j], 0, sizeof(ambit_log_sample_periodic_value_t));
+                    sample->u.periodic.values[j].type = (ambit_log_sample_periodic_type_t)value->type;
+                    memcpy(&sample->u.periodic.values[j].u, value->value, qMin(sizeof(sample->u.periodic.values[j].u), sizeof(value->value)));
+                }
+                sample->u.periodic.value_count = record->extra_count;
+            }
+            break;
+        case ambit_log_sample_type_gps_base:
+            sample->u.gps_base.satellites_count = 0;
+            sample->u.gps_base.satellites = NULL;
+            if (record->extra_count > 0) {
+                const uchar *satellites = extraData(record->extra_offset, (quint64)record->extra_count*sizeof(ambit_log_gps_satellite_t));
+                if (satellites == NULL) {
+                    return false;
+                }
+                sample->u.gps_base.satellites = (ambit_log_gps_satellite_t*)libambit_log_entry_alloc(logEntry->logEntry, record->extra_count*sizeof(ambit_log_gps_satellite_t));
+                if (sample->u.gps_base.satellites == NULL) {
+                    error = QObject::tr("Out of memory reading sample %1.").arg(i);
+                    return false;
+                }
+                memcpy(sample->u.gps_base.satellites, satellites, record->extra_count*sizeof(ambit_log_gps_satellite_t));
+                sample->u.gps_base.satellites_count = record->extra_count;
+            }
+            break;
+        case ambit_log_sample_type_unknown:
+            sample->u.unknown.datalen = 0;
+            sample->u.unknown.data = NULL;
+            if (record->extra_count > 0) {
+                const uchar *unknown = extraData(record->extra_offset, record->extra_count);
+                if (unknown == NULL) {
+                    return false;
+                }
+                sample->u.unknown.data = (uint8_t*)libambit_log_entry_alloc(logEntry->logEntry, record->extra_count);
+                if (sample->u.unknown.data == NULL) {
+                    error = QObject::tr("Out of memory reading sample %1.").arg(i);
+                    return false;
+                }
+                memcpy(sample->u.unknown.data, unknown, record->extra_count);
+                sample->u.unknown.datalen = record->extra_count;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+QString LogStore::BinaryReader::string(quint32 offset) const
+{
+    if (offset == BINARY_NO_STRING || offset >= stringsSize) {
+        return QString();
+    }
+
+    return QString::fromUtf8(strings + offset, qstrnlen(strings + offset, stringsSize - offset));
+}
+
+const uchar *LogStore::BinaryReader::extraData(quint32 offset, quint64 length)
+{
+    if ((quint64)offset + length > extraSize) {
+        error = QObject::tr("Sample data at offset %1 is outside of the file.").arg(offset);
+        return NULL;
+    }
+
+    return extra + offset;
+}
+
+
+LogStore::BinaryWriter::BinaryWriter(const DeviceInfo& deviceInfo, QDateTime time, QString movescountId, ambit_personal_settings_t *personalSettings, ambit_log_entry_t *logEntry) :
+    deviceInfo(deviceInfo), time(time), movescountId(movescountId), personalSettings(personalSettings), logEntry(logEntry)
+{
+}
+
+bool LogStore::BinaryWriter::write(QIODevice *device)
+{
+    binary_file_header_t header;
+    QVector<binary_block_t> blocks;
+    QByteArray raw, compressed;
+    quint32 i, offset;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.byte_order = BINARY_BYTE_ORDER;
+    header.header_size = sizeof(binary_file_header_t);
+    header.sample_size = sizeof(binary_sample_t);
+    header.flags = BINARY_FLAG_COMPRESSED;
+
+    header.time = toBinaryDateTime(time);
+    header.device = addString(deviceInfo.serial);
+    header.movescount_id = movescountId.isNull() ? BINARY_NO_STRING : addString(movescountId);
+    header.info_name = addString(deviceInfo.name);
+    header.info_model = addString(deviceInfo.model);
+    header.info_serial = addString(deviceInfo.serial);
+    for (i=0; i<3; i++) {
+        header.info_fw_version[i] = deviceInfo.fw_version[i];
+        header.info_hw_version[i] = deviceInfo.hw_version[i];
+    }
+
+    if (personalSettings != NULL) {
+        header.has_personal_settings = 1;
+        memcpy(&header.personal_settings, personalSettings, sizeof(ambit_personal_settings_t));
+    }
+
+    if (logEntry != NULL) {
+        header.has_log_entry = 1;
+        toBinaryLogHeader(&logEntry->header, &header.log_header,
+                          logEntry->header.activity_name != NULL ? addString(QString::fromUtf8(logEntry->header.activity_name)) : BINARY_NO_STRING);
+        header.sample_count = logEntry->samples_count;
+    }
+
+    // Block boundaries only depend on sample times, and all strings come
+    // from the header, so everything but the blocks has a known size
+    // before the samples are encoded
+    for (i=0; i<header.sample_count; i++) {
+        if (blocks.isEmpty() || blocks.last().sample_count == BINARY_BLOCK_SAMPLES ||
+            logEntry->samples[i].time - logEntry->samples[blocks.last().first_sample].time >= BINARY_BLOCK_SECONDS*1000) {
+            binary_block_t block;
+            memset(&block, 0, sizeof(block));
+            block.first_sample = i;
+            blocks.append(block);
+        }
+        blocks.last().sample_count++;
+    }
+    header.block_count = blocks.size();
+    header.block_table_offset = sizeof(binary_file_header_t);
+    header.strings_offset = header.block_table_offset + header.block_count*sizeof(binary_block_t);
+    header.strings_size = strings.size();
+
+    if (device->write((const char*)&header, sizeof(header)) != sizeof(header) ||
+        device->write((const char*)blocks.constData(), blocks.size()*sizeof(binary_block_t)) != (qint64)(blocks.size()*sizeof(binary_block_t)) ||
+        device->write(strings) != strings.size()) {
+        return false;
+    }
+    offset = header.strings_offset + header.strings_size;
+
+    for (i=0; i<header.block_count; i++) {
+        binary_block_t *block = &blocks[i];
+        uLongf length;
+
+        block->first_time = logEntry->samples[block->first_sample].time;
+        block->last_time = logEntry->samples[block->first_sample + block->sample_count - 1].time;
+
+        // Extra data offsets are relative to the block
+        extra.clear();
+        raw.resize(block->sample_count*sizeof(binary_sample_t));
+        for (quint32 j=0; j<block->sample_count; j++) {
+            writeSample(&logEntry->samples[block->first_sample + j], (binary_sample_t*)(raw.data() + j*sizeof(binary_sample_t)));
+        }
+        block->records_size = raw.size();
+        block->extra_size = extra.size();
+        raw.append(extra);
+
+        length = compressBound(raw.size());
+        compressed.resize(length);
+        if (compress((Bytef*)compressed.data(), &length, (const Bytef*)raw.constData(), raw.size()) != Z_OK) {
+            return false;
+        }
+        block->offset = offset;
+        block->compressed_size = length;
+        if (device->write(compressed.constData(), length) != (qint64)length) {
+            return false;
+        }
+        offset += length;
+    }
+
+    // Fill in the block table now that the offsets are known
+    return device->seek(header.block_table_offset) &&
+           device->write((const char*)blocks.constData(), blocks.size()*sizeof(binary_block_t)) == (qint64)(blocks.size()*sizeof(binary_block_t)) &&
+           device->seek(offset);
+}
+
+void LogStore::BinaryWriter::writeSample(const ambit_log_sample_t *sample, binary_sample_s *record)
+{
+    ambit_log_sample_t copy = *sample;
+    quint32 i;
+
+    memset(record, 0, sizeof(binary_sample_t));
+    record->type = sample->type;
+    record->time = sample->time;
+    record->utc_time = sample->utc_time;
+    record->extra_offset = extra.size();
+
+    // Pointers go to the extra data, the payload only keeps plain values
+    switch (sample->type) {
+    case ambit_log_sample_type_periodic:
+        for (i=0; i<sample->u.periodic.value_count; i++) {
+            binary_periodic_value_t value;
+            memset(&value, 0, sizeof(value));
+            value.type = sample->u.periodic.values[i].type;
+            memcpy(value.value, &sample->u.periodic.values[i].u, qMin(sizeof(value.value), sizeof(sample->u.periodic.values[i].u)));
+            extra.append((const char*)&value, sizeof(value));
+        }
+        record->extra_count = sample->u.periodic.value_count;
+        copy.u.periodic.value_count = 0;
+        copy.u.periodic.values = NULL;
+        break;
+    case ambit_log_sample_type_gps_base:
+        if (sample->u.gps_base.satellites != NULL) {
+            extra.append((const char*)sample->u.gps_base.satellites, sample->u.gps_base.satellites_count*sizeof(ambit_log_gps_satellite_t));
+            record->extra_count = sample->u.gps_base.satellites_count;
+        }
+        copy.u.gps_base.satellites_count = 0;
+        copy.u.gps_base.satellites = NULL;
+        break;
+    case ambit_log_sample_type_unknown:
+        if (sample->u.unknown.data != NULL) {
+            extra.append((const char*)sample->u.unknown.data, sample->u.unknown.datalen);
+            record->extra_count = sample->u.unknown.datalen;
+        }
+        copy.u.unknown.datalen = 0;
+        copy.u.unknown.data = NULL;
+        break;
+    default:
+        break;
+    }
+
+    memcpy(record->payload, &copy.u, qMin(sizeof(copy.u), sizeof(record->payload)));
+}
+
+quint32 LogStore::BinaryWriter::addString(QString string)
+{
+    quint32 offset = strings.size();
+
+    strings.append(string.toUtf8());
+    strings.append('\0');
+
+    return offset;
+}
+
+
+static ambit_date_time_t toBinaryDateTime(QDateTime dateTime)
+{
+    ambit_date_time_t date_time;
+
+    date_time.year = dateTime.date().year();
+    date_time.month = dateTime.date().month();
+    date_time.day = dateTime.date().day();
+    date_time.hour = dateTime.time().hour();
+    date_time.minute = dateTime.time().minute();
+    date_time.msec = dateTime.time().second()*1000 + dateTime.time().msec();
+
+    return date_time;
+}
+
+static QDateTime fromBinaryDateTime(ambit_date_time_t date_time)
+{
+    return QDateTime(QDate(date_time.year, date_time.month, date_time.day),
+                     QTime(date_time.hour, date_time.minute, 0).addMSecs(date_time.msec));
+}
+
+static void toBinaryLogHeader(const ambit_log_header_t *header, binary_log_header_t *binary, quint32 activityName)
+{
+    binary->date_time = header->date_time;
+    binary->duration = header->duration;
+    binary->ascent = header->ascent;
+    binary->descent = header->descent;
+    binary->ascent_time = header->ascent_time;
+    binary->descent_time = header->descent_time;
+    binary->recovery_time = header->recovery_time;
+    binary->speed_avg = header->speed_avg;
+    binary->speed_max = header->speed_max;
+    binary->speed_max_time = header->speed_max_time;
+    binary->altitude_max = header->altitude_max;
+    binary->altitude_min = header->altitude_min;
+    binary->altitude_max_time = header->altitude_max_time;
+    binary->altitude_min_time = header->altitude_min_time;
+    binary->heartrate_avg = header->heartrate_avg;
+    binary->heartrate_max = header->heartrate_max;
+    binary->heartrate_min = header->heartrate_min;
+    binary->heartrate_max_time = header->heartrate_max_time;
+    binary->heartrate_min_time = header->heartrate_min_time;
+    binary->peak_training_effect = header->peak_training_effect;
+    binary->activity_type = header->activity_type;
+    binary->activity_name = activityName;
+    binary->temperature_max = header->temperature_max;
+    binary->temperature_min = header->temperature_min;
+    binary->temperature_max_time = header->temperature_max_time;
+    binary->temperature_min_time = header->temperature_min_time;
+    binary->distance = header->distance;
+    binary->samples_count = header->samples_count;
+    binary->energy_consumption = header->energy_consumption;
+    binary->first_fix_time = header->first_fix_time;
+    binary->battery_start = header->battery_start;
+    binary->battery_end = header->battery_end;
+    binary->distance_before_calib = header->distance_before_calib;
+    memcpy(binary->unknown1, header->unknown1, sizeof(binary->unknown1));
+    binary->unknown2 = header->unknown2;
+    binary->cadence_max = header->cadence_max;
+    binary->cadence_avg = header->cadence_avg;
+    memcpy(binary->unknown3, header->unknown3, sizeof(binary->unknown3));
+    binary->swimming_pool_lengths = header->swimming_pool_lengths;
+    binary->cadence_max_time = header->cadence_max_time;
+    binary->swimming_pool_length = header->swimming_pool_length;
+    memcpy(binary->unknown5, header->unknown5, sizeof(binary->unknown5));
+    memcpy(binary->unknown6, header->unknown6, sizeof(binary->unknown6));
+}
+
+static void fromBinaryLogHeader(const binary_log_header_t *binary, ambit_log_header_t *header)
+{
+    header->date_time = binary->date_time;
+    header->duration = binary->duration;
+    header->ascent = binary->ascent;
+    header->descent = binary->descent;
+    header->ascent_time = binary->ascent_time;
+    header->descent_time = binary->descent_time;
+    header->recovery_time = binary->recovery_time;
+    header->speed_avg = binary->speed_avg;
+    header->speed_max = binary->speed_max;
+    header->speed_max_time = binary->speed_max_time;
+    header->altitude_max = binary->altitude_max;
+    header->altitude_min = binary->altitude_min;
+    header->altitude_max_time = binary->altitude_max_time;
+    header->altitude_min_time = binary->altitude_min_time;
+    header->heartrate_avg = binary->heartrate_avg;
+    header->heartrate_max = binary->heartrate_max;
+    header->heartrate_min = binary->heartrate_min;
+    header->heartrate_max_time = binary->heartrate_max_time;
+    header->heartrate_min_time = binary->heartrate_min_time;
+    header->peak_training_effect = binary->peak_training_effect;
+    header->activity_type = binary->activity_type;
+    header->activity_name = NULL;
+    header->temperature_max = binary->temperature_max;
+    header->temperature_min = binary->temperature_min;
+    header->temperature_max_time = binary->temperature_max_time;
+    header->temperature_min_time = binary->temperature_min_time;
+    header->distance = binary->distance;
+    header->samples_count = binary->samples_count;
+    header->energy_consumption = binary->energy_consumption;
+    header->first_fix_time = binary->first_fix_time;
+    header->battery_start = binary->battery_start;
+    header->battery_end = binary->battery_end;
+    header->distance_before_calib = binary->distance_before_calib;
+    memcpy(header->unknown1, binary->unknown1, sizeof(header->unknown1));
+    header->unknown2 = binary->unknown2;
+    header->cadence_max = binary->cadence_max;
+    header->cadence_avg = binary->cadence_avg;
+    memcpy(header->unknown3, binary->unknown3, sizeof(header->unknown3));
+    header->swimming_pool_lengths = binary->swimming_pool_lengths;
+    header->cadence_max_time = binary->cadence_max_time;
+    header->swimming_pool_length = binary->swimming_pool_length;
+    memcpy(header->unknown5, binary->unknown5, sizeof(header->unknown5));
+    memcpy(header->unknown6, binary->unknown6, sizeof(header->unknown6));
+}
@@ -24,11 +24,34 @@
 #include <QEventLoop>
 #include <QMutex>
 #include <QDebug>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QRegExp>
+#include <QTemporaryFile>
+
+#include <stdio.h>
 
 #include "logstore.h"
 
-#define AUTH_CHECK_TIMEOUT 5000 /* ms */
+#define AUTH_CHECK_TIMEOUT 5000 /* ms, first recheck after a failure */
+#define AUTH_RECHECK_MAX_DELAY 600000 /* ms */
+#define AUTH_CHECK_TTL 900 /* s */
+#define FIRMWARE_CHECK_TTL 86400 /* s */
+#define FIRMWARE_CHECK_DELAY 10000 /* ms, the notice is not urgent */
+#define LOG_CHECK_DELAY 60000 /* ms */
 #define GPS_ORBIT_DATA_MIN_SIZE 30000 /* byte */
+#define UPLOAD_PARALLELISM_DEFAULT 2
+#define ORBIT_CACHE_FILENAME "gpsorbit.cache"
+#define ORBIT_CACHE_MAGIC 0x4f524243 /* "ORBC" */
+#define ORBIT_CACHE_VERSION 1
+#define ORBIT_CACHE_MAX_AGE 21600 /* s, unless the server says otherwise */
+#define UPLOAD_QUEUE_FILENAME "uploadqueue"
+#define UPLOAD_QUEUE_MAGIC 0x55504c51 /* "UPLQ" */
+#define UPLOAD_QUEUE_VERSION 1
+#define UPLOAD_RETRY_BASE 60 /* s, doubled for every failed attempt */
+#define UPLOAD_RETRY_MAX_DELAY 86400 /* s */
+#define UPLOAD_RETRY_MAX_ATTEMPTS 12
 
 static MovesCount *m_Instance;
 
@@ -53,6 +76,14 @@ void MovesCount::exit()
 
     exiting = true;
 
+    // Nothing is answered anymore, let waiting callers go
+    orbitMutex.lock();
+    orbitCondition.wakeAll();
+    orbitMutex.unlock();
+    entriesMutex.lock();
+    entriesCondition.wakeAll();
+    entriesMutex.unlock();
+
     mutex.lock();
     if (m_Instance) {
         workerThread.quit();
@@ -120,7 +151,10 @@ int MovesCount::getOrbitalData(u_int8_t **data)
         ret = getOrbitalDataInThread(data);
     }
     else {
-        QMetaObject::invokeMethod(this, "getOrbitalDataInThread", Qt::BlockingQueuedConnection,
+        // The download is waited for here, the worker thread goes on
+        prefetchOrbitalData();
+        waitForOrbitalData();
+        QMetaObject::invokeMethod(this, "copyOrbitalDataInThread", Qt::BlockingQueuedConnection,
                                   Q_RETURN_ARG(int, ret),
                                   Q_ARG(u_int8_t **, data));
     }
@@ -128,6 +162,30 @@ int MovesCount::getOrbitalData(u_int8_t **data)
     return ret;
 }
 
+bool MovesCount::isOrbitalDataCurrent(QByteArray deviceHeader)
+{
+    bool ret = false;
+
+    if (&workerThread == QThread::currentThread()) {
+        ret = isOrbitalDataCurrentInThread(deviceHeader);
+    }
+    else {
+        waitForOrbitalData();
+        QMetaObject::invokeMethod(this, "isOrbitalDataCurrentInThread", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(bool, ret),
+                                  Q_ARG(QByteArray, deviceHeader));
+    }
+
+    return ret;
+}
+
+void MovesCount::prefetchOrbitalData()
+{
+    // Until the worker thread knows whether it has to download
+    setOrbitPending(true);
+    QMetaObject::invokeMethod(this, "prefetchOrbitalDataInThread", Qt::QueuedConnection);
+}
+
 int MovesCount::getPersonalSettings(ambit_personal_settings_t *settings)
 {
     int ret = -1;
@@ -166,6 +224,32 @@ QList<MovesCountLogDirEntry> MovesCount::getMovescountEntries(QDate startTime, Q
     return retList;
 }
 
+QList<MovesCountLogDirEntry> MovesCount::getMovescountEntries(QList<QDate> months)
+{
+    QList<MovesCountLogDirEntry> retList;
+
+    if (&workerThread == QThread::currentThread()) {
+        retList = getMovescountEntriesInThread(months);
+    }
+    else {
+        // The replies are waited for here, the worker thread goes on
+        EntriesRequest request;
+        request.pending = 0;
+        request.done = false;
+        QMetaObject::invokeMethod(this, "requestMovescountEntriesInThread", Qt::QueuedConnection,
+                                  Q_ARG(void *, &request),
+                                  Q_ARG(QList<QDate>, months));
+        entriesMutex.lock();
+        while (!request.done && !exiting) {
+            entriesCondition.wait(&entriesMutex);
+        }
+        retList = request.entries;
+        entriesMutex.unlock();
+    }
+
+    return retList;
+}
+
 void MovesCount::checkAuthorization()
 {
     QMetaObject::invokeMethod(this, "checkAuthorizationInThread", Qt::AutoConnection);
@@ -189,12 +273,57 @@ void MovesCount::writePersonalSettings(ambit_personal_settings_t *settings)
 
 void MovesCount::writeLog(LogEntry *logEntry)
 {
-    if (&workerThread == QThread::currentThread()) {
-        writeLogInThread(logEntry);
+    QString key = uploadKey(logEntry->device, logEntry->time);
+    PendingUpload pending;
+
+    uploadMutex.lock();
+    loadUploadQueue();
+    pending.device = logEntry->device;
+    pending.time = logEntry->time;
+    pending.attempts = 0;
+    pending.nextAttempt = QDateTime::currentDateTime();
+    pendingUploads.insert(key, pending);
+    saveUploadQueue();
+
+    // Copies share the samples, the caller may free its entry at once.
+    // While offline the log is read again once going online
+    if (!offline && !isUploading(key)) {
+        uploadQueue.enqueue(new LogEntry(*logEntry));
     }
-    else {
-        QMetaObject::invokeMethod(this, "writeLogInThread", Qt::BlockingQueuedConnection,
-                                  Q_ARG(LogEntry *, logEntry));
+    uploadMutex.unlock();
+
+    QMetaObject::invokeMethod(this, "startUploads", Qt::QueuedConnection);
+}
+
+void MovesCount::setUploadParallelism(int uploads)
+{
+    uploadMutex.lock();
+    uploadParallelism = qMax(1, uploads);
+    uploadMutex.unlock();
+
+    QMetaObject::invokeMethod(this, "startUploads", Qt::QueuedConnection);
+}
+
+bool MovesCount::isUploadPending(QString device, QDateTime time)
+{
+    bool ret;
+
+    uploadMutex.lock();
+    loadUploadQueue();
+    ret = pendingUploads.contains(uploadKey(device, time));
+    uploadMutex.unlock();
+
+    return ret;
+}
+
+void MovesCount::setOfflineMode(bool offline)
+{
+    uploadMutex.lock();
+    this->offline = offline;
+    uploadMutex.unlock();
+
+    if (!offline) {
+        QMetaObject::invokeMethod(this, "retryUploads", Qt::QueuedConnection);
     }
 }
 
@@ -215,11 +344,10 @@ void MovesCount::firmwareReplyFinished()
         if (firmwareCheckReply->error() == QNetworkReply::NoError) {
             QByteArray data = firmwareCheckReply->readAll();
             if (jsonParser.parseFirmwareVersionReply(data, fw_version) == 0) {
-                if (fw_version[0] > device_info.fw_version[0] ||
-                    (fw_version[0] == device_info.fw_version[0] && (fw_version[1] > device_info.fw_version[1] ||
-                     (fw_version[1] == device_info.fw_version[1] && (fw_version[2] > device_info.fw_version[2]))))) {
-                    emit newerFirmwareExists(QByteArray((const char*)fw_version, 3));
-                }
+                latestFirmware = QByteArray((const char*)fw_version, 3);
+                firmwareCheckedFor = firmwareKey();
+                firmwareChecked = QDateTime::currentDateTime();
+                compareFirmwareVersion(latestFirmware);
             }
         }
 
@@ -228,40 +356,186 @@ void MovesCount::firmwareReplyFinished()
     }
 }
 
-void MovesCount::recheckAuthorization()
+void MovesCount::runServiceChecks()
 {
-    getDeviceSettings();
+    QDateTime now = QDateTime::currentDateTime();
+    QList<int> due;
+
+    foreach (int check, serviceChecksDue.keys()) {
+        if (serviceChecksDue[check] <= now) {
+            due.append(check);
+            serviceChecksDue.remove(check);
+        }
+    }
+
+    foreach (int check, due) {
+        switch (check) {
+        case ServiceCheckAuthorization:
+            startAuthorizationCheck();
+            break;
+        case ServiceCheckFirmware:
+            startFirmwareCheck();
+            break;
+        }
+    }
+
+    restartServiceCheckTimer();
 }
 
 void MovesCount::handleAuthorizationSignal(bool authorized)
+{
+    if (authorized && !logCheckTimer->isActive()) {
+        logCheckTimer->start(LOG_CHECK_DELAY);
+    }
+}
+
+void MovesCount::startLogCheck()
 {
     if (authorized) {
+        // Uploads left from earlier runs first, the checker skips them
+        retryUploads();
         logChecker->run();
     }
 }
 
 int MovesCount::getOrbitalDataInThread(u_int8_t **data)
+{
+    // Joins a prefetch still in flight instead of downloading again
+    prefetchOrbitalDataInThread();
+    waitForOrbitReply();
+
+    return copyOrbitalDataInThread(data);
+}
+
+int MovesCount::copyOrbitalDataInThread(u_int8_t **data)
 {
     int ret = -1;
-    QNetworkReply *reply;
 
-    reply = syncGET("/devices/gpsorbit/binary", "", false);
+    if (!orbitData.isEmpty()) {
+        *data = (u_int8_t*)malloc(orbitData.length());
 
-    if(reply->error() == QNetworkReply::NoError) {
-        QByteArray _data = reply->readAll();
+        memcpy(*data, orbitData.data(), orbitData.length());
 
-        if (_data.length() >= GPS_ORBIT_DATA_MIN_SIZE) {
-            *data = (u_int8_t*)malloc(_data.length());
+        ret = orbitData.length();
+    }
+
+    return ret;
+}
 
-            memcpy(*data, _data.data(), _data.length());
+void MovesCount::prefetchOrbitalDataInThread()
+{
+    loadOrbitCache();
+
+    if (orbitReply != NULL || (!orbitData.isEmpty() && isOrbitCacheFresh())) {
+        setOrbitPending(orbitReply != NULL);
+        return;
+    }
 
-            ret = _data.length();
+    QNetworkRequest req = buildRequest("/devices/gpsorbit/binary", "", false);
+    if (!orbitData.isEmpty()) {
+        // Only download the data if it has changed since last time
+        if (!orbitETag.isEmpty()) {
+            req.setRawHeader("If-None-Match", orbitETag);
+        }
+        if (!orbitLastModified.isEmpty()) {
+            req.setRawHeader("If-Modified-Since", orbitLastModified);
         }
     }
 
-    delete reply;
+    orbitReply = this->manager->get(req);
+    connect(orbitReply, SIGNAL(finished()), this, SLOT(orbitReplyFinished()));
+    setOrbitPending(true);
+}
+
+void MovesCount::setOrbitPending(bool pending)
+{
+    orbitMutex.lock();
+    orbitPending = pending;
+    if (!pending) {
+        orbitCondition.wakeAll();
+    }
+    orbitMutex.unlock();
+}
 
-    return ret;
+void MovesCount::waitForOrbitalData()
+{
+    orbitMutex.lock();
+    while (orbitPending && !exiting) {
+        orbitCondition.wait(&orbitMutex);
+    }
+    orbitMutex.unlock();
+}
+
+/*
+ * Only for calls on the worker thread itself, the others wait in
+ * waitForOrbitalData() instead
+ */
+void MovesCount::waitForOrbitReply()
+{
+    if (orbitReply != NULL) {
+        QEventLoop loop;
+        // orbitReplyFinished is connected first and has run once this quits
+        connect(orbitReply, SIGNAL(finished()), &loop, SLOT(quit()));
+        loop.exec();
+    }
+}
+
+void MovesCount::orbitReplyFinished()
+{
+    QNetworkReply *reply = orbitReply;
+
+    if (reply == NULL) {
+        return;
+    }
+    orbitReply = NULL;
+
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304 && !orbitData.isEmpty()) {
+        orbitFetched = QDateTime::currentDateTime();
+        saveOrbitCache();
+    }
+    else if (reply->error() == QNetworkReply::NoError) {
+        QByteArray _data = reply->readAll();
+
+        if (_data.length() >= GPS_ORBIT_DATA_MIN_SIZE) {
+            QRegExp maxAgeRe("max-age=(\\d+)");
+
+            orbitData = _data;
+            orbitETag = reply->rawHeader("ETag");
+            orbitLastModified = reply->rawHeader("Last-Modified");
+            orbitFetched = QDateTime::currentDateTime();
+            orbitMaxAge = ORBIT_CACHE_MAX_AGE;
+            if (maxAgeRe.indexIn(QString(reply->rawHeader("Cache-Control"))) >= 0) {
+                orbitMaxAge = maxAgeRe.cap(1).toUInt();
+            }
+            saveOrbitCache();
+        }
+        else {
+            orbitData.clear();
+        }
+    }
+    else {
+        orbitData.clear();
+    }
+    setOrbitPending(false);
+
+    reply->deleteLater();
+}
+
+bool MovesCount::isOrbitalDataCurrentInThread(QByteArray deviceHeader)
+{
+    uint8_t header[8];
+
+    loadOrbitCache();
+    waitForOrbitReply();
+
+    if (orbitData.isEmpty() || !isOrbitCacheFresh() || deviceHeader.length() != 8) {
+        return false;
+    }
+    if (libambit_gps_orbit_data_header((const uint8_t*)orbitData.constData(), orbitData.length(), header) != 0) {
+        return false;
+    }
+
+    return memcmp(header, deviceHeader.constData(), 8) == 0;
 }
 
 int MovesCount::getPersonalSettingsInThread(ambit_personal_settings_t *settings)
@@ -300,7 +574,172 @@ QList<MovesCountLogDirEntry> MovesCount::getMovescountEntriesInThread(QDate star
     return retList;
 }
 
+/*
+ * Only for calls on the worker thread itself, the others ask through
+ * requestMovescountEntriesInThread() and wait in their own thread
+ */
+QList<MovesCountLogDirEntry> MovesCount::getMovescountEntriesInThread(QList<QDate> months)
+{
+    QList<QNetworkReply*> replies = requestMonthLists(months);
+
+    // All requests are in flight, wait for each in turn
+    foreach (QNetworkReply *reply, replies) {
+        if (!reply->isFinished()) {
+            QEventLoop loop;
+            connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+            loop.exec();
+        }
+    }
+
+    return parseMonthLists(replies);
+}
+
+void MovesCount::requestMovescountEntriesInThread(void *ref, QList<QDate> months)
+{
+    EntriesRequest *request = static_cast<EntriesRequest*>(ref);
+
+    request->replies = requestMonthLists(months);
+    request->pending = request->replies.count();
+    foreach (QNetworkReply *reply, request->replies) {
+        entriesReplies.insert(reply, request);
+        connect(reply, SIGNAL(finished()), this, SLOT(entriesReplyFinished()));
+    }
+
+    if (request->pending == 0) {
+        finishEntriesRequest(request);
+    }
+}
+
+void MovesCount::entriesReplyFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    EntriesRequest *request = entriesReplies.take(reply);
+
+    if (request != NULL && --request->pending == 0) {
+        finishEntriesRequest(request);
+    }
+}
+
+void MovesCount::finishEntriesRequest(EntriesRequest *request)
+{
+    QList<MovesCountLogDirEntry> entries = parseMonthLists(request->replies);
+
+    // The request belongs to the waiting caller, don't touch it after this
+    entriesMutex.lock();
+    request->entries = entries;
+    request->done = true;
+    entriesCondition.wakeAll();
+    entriesMutex.unlock();
+}
+
+QList<QNetworkReply*> MovesCount::requestMonthLists(QList<QDate> months)
+{
+    QList<QNetworkReply*> replies;
+    QMap<QDate, bool> firsts;
+    QDate first, last;
+
+    foreach (QDate month, months) {
+        firsts.insert(QDate(month.year(), month.month(), 1), true);
+    }
+
+    // Runs of consecutive months are asked for in one request
+    foreach (QDate month, firsts.keys()) {
+        if (first.isValid() && month == last.addDays(1)) {
+            last = month.addMonths(1).addDays(-1);
+            continue;
+        }
+        if (first.isValid()) {
+            replies.append(asyncGET("/moves/private", "startdate=" + first.toString("yyyy-MM-dd") + "&enddate=" + last.toString("yyyy-MM-dd"), true));
+        }
+        first = month;
+        last = month.addMonths(1).addDays(-1);
+    }
+    if (first.isValid()) {
+        replies.append(asyncGET("/moves/private", "startdate=" + first.toString("yyyy-MM-dd") + "&enddate=" + last.toString("yyyy-MM-dd"), true));
+    }
+
+    return replies;
+}
+
+QList<MovesCountLogDirEntry> MovesCount::parseMonthLists(QList<QNetworkReply*> replies)
+{
+    QList<MovesCountLogDirEntry> retList, monthList;
+
+    foreach (QNetworkReply *reply, replies) {
+        if (checkReplyAuthorization(reply)) {
+            QByteArray _data = reply->readAll();
+
+            monthList.clear();
+            if (jsonParser.parseLogDirReply(_data, monthList) == 0) {
+                retList.append(monthList);
+            }
+        }
+        reply->deleteLater();
+    }
+
+    return retList;
+}
+
 void MovesCount::checkAuthorizationInThread()
+{
+    QDateTime now = QDateTime::currentDateTime();
+
+    if (authorized && authValidatedFor == username + ":" + userkey &&
+        authValidated.isValid() && authValidated <= now && authValidated.secsTo(now) < AUTH_CHECK_TTL) {
+        return;
+    }
+
+    scheduleServiceCheck(ServiceCheckAuthorization, 0);
+}
+
+void MovesCount::checkLatestFirmwareVersionInThread()
+{
+    QDateTime now = QDateTime::currentDateTime();
+
+    if (firmwareCheckedFor == firmwareKey() &&
+        firmwareChecked.isValid() && firmwareChecked <= now && firmwareChecked.secsTo(now) < FIRMWARE_CHECK_TTL) {
+        compareFirmwareVersion(latestFirmware);
+        return;
+    }
+
+    // Out of the way of the first sync started for the device
+    scheduleServiceCheck(ServiceCheckFirmware, FIRMWARE_CHECK_DELAY);
+}
+
+bool MovesCount::scheduleServiceCheck(ServiceCheck check, int delay)
+{
+    QDateTime due = QDateTime::currentDateTime().addMSecs(delay);
+
+    if (serviceChecksDue.contains(check) && serviceChecksDue[check] <= due) {
+        return false;
+    }
+
+    serviceChecksDue.insert(check, due);
+    restartServiceCheckTimer();
+
+    return true;
+}
+
+void MovesCount::restartServiceCheckTimer()
+{
+    QDateTime now = QDateTime::currentDateTime(), next;
+
+    foreach (QDateTime time, serviceChecksDue) {
+        if (!next.isValid() || time < next) {
+            next = time;
+        }
+    }
+
+    // One wake-up for the earliest check, the others are run with it if due
+    if (next.isValid()) {
+        serviceCheckTimer->start((int)qMax((qint64)0, now.msecsTo(next)));
+    }
+    else {
+        serviceCheckTimer->stop();
+    }
+}
+
+void MovesCount::startAuthorizationCheck()
 {
     if (authCheckReply == NULL) {
         authCheckReply = asyncGET("/members/private", "", true);
@@ -308,54 +747,298 @@ void MovesCount::checkAuthorizationInThread()
     }
 }
 
-void MovesCount::checkLatestFirmwareVersionInThread()
+void MovesCount::startFirmwareCheck()
 {
     if (firmwareCheckReply == NULL) {
-        firmwareCheckReply = asyncGET("/devices/" + QString("%1/%2.%3.%4")
-                                      .arg(device_info.model)
-                                      .arg(device_info.hw_version[0])
-                                      .arg(device_info.hw_version[1])
-                                      .arg(device_info.hw_version[2]), "", false);
+        firmwareCheckReply = asyncGET("/devices/" + firmwareKey(), "", false);
         connect(firmwareCheckReply, SIGNAL(finished()), this, SLOT(firmwareReplyFinished()));
     }
 }
 
+QString MovesCount::firmwareKey()
+{
+    return QString("%1/%2.%3.%4")
+           .arg(device_info.model)
+           .arg(device_info.hw_version[0])
+           .arg(device_info.hw_version[1])
+           .arg(device_info.hw_version[2]);
+}
+
+void MovesCount::compareFirmwareVersion(QByteArray latest)
+{
+    const u_int8_t *fw_version = (const u_int8_t*)latest.constData();
+
+    if (latest.length() != 3) {
+        return;
+    }
+
+    if (fw_version[0] > device_info.fw_version[0] ||
+        (fw_version[0] == device_info.fw_version[0] && (fw_version[1] > device_info.fw_version[1] ||
+         (fw_version[1] == device_info.fw_version[1] && (fw_version[2] > device_info.fw_version[2]))))) {
+        emit newerFirmwareExists(latest);
+    }
+}
+
 void MovesCount::writePersonalSettingsInThread(ambit_personal_settings_t *settings)
 {
     Q_UNUSED(settings);
 }
 
-void MovesCount::writeLogInThread(LogEntry *logEntry)
+void MovesCount::startUploads()
 {
+    LogEntry *logEntry;
     QByteArray output;
     QNetworkReply *reply;
-    QString moveId;
 
-    jsonParser.generateLogData(logEntry, output);
+    forever {
+        uploadMutex.lock();
+        if (exiting || offline || uploadQueue.isEmpty() || uploadReplies.count() >= uploadParallelism) {
+            uploadMutex.unlock();
+            return;
+        }
+        logEntry = uploadQueue.dequeue();
+        uploadMutex.unlock();
+
+        if (jsonParser.generateLogData(logEntry, output) != 0) {
+            qDebug() << "Failed to generate log data for upload";
+            finishUpload(logEntry, false);
+            continue;
+        }
 
 #ifdef QT_DEBUG
-    // Write json data to storage
-    writeJsonToStorage("log-" + logEntry->device + "-" + logEntry->time.toString("yyyy-MM-ddThh_mm_ss") + ".json", output);
+        // Write json data to storage
+        writeJsonToStorage("log-" + logEntry->device + "-" + logEntry->time.toString("yyyy-MM-ddThh_mm_ss") + ".json", output);
 #endif
 
-    reply = syncPOST("/moves/", "", output, true);
+        // Posted as one buffer, Qt 4 reads a sequential upload device of
+        // unknown length into memory anyway, and the length of the
+        // deflated parts is only known once they are written
+        reply = asyncPOST("/moves/", "", output, true);
+        connect(reply, SIGNAL(finished()), this, SLOT(uploadFinished()));
+
+        uploadMutex.lock();
+        uploadReplies.insert(reply, logEntry);
+        uploadMutex.unlock();
+    }
+}
+
+void MovesCount::uploadFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    LogEntry *logEntry;
+    QString moveId;
+
+    if (reply == NULL) {
+        return;
+    }
+
+    uploadMutex.lock();
+    logEntry = uploadReplies.take(reply);
+    uploadMutex.unlock();
+
+    if (logEntry != NULL) {
+        bool uploaded = false;
 
-    if (reply->error() == QNetworkReply::NoError) {
-        QByteArray data = reply->readAll();
-        if (jsonParser.parseLogReply(data, moveId) == 0) {
-            emit logMoveID(logEntry->device, logEntry->time, moveId);
+        // A rejected upload tells that the authorization is gone too
+        if (checkReplyAuthorization(reply) && reply->error() == QNetworkReply::NoError) {
+            QByteArray data = reply->readAll();
+            if (jsonParser.parseLogReply(data, moveId) == 0) {
+                emit logMoveID(logEntry->device, logEntry->time, moveId);
+                uploaded = true;
+            }
         }
+        else {
+            qDebug() << "Failed to upload log, movescount.com replied with \"" << reply->readAll() << "\"";
+        }
+
+        finishUpload(logEntry, uploaded);
+    }
+
+    reply->deleteLater();
+
+    startUploads();
+    scheduleRetry();
+}
+
+void MovesCount::finishUpload(LogEntry *logEntry, bool uploaded)
+{
+    uploadMutex.lock();
+    QMap<QString, PendingUpload>::iterator it = pendingUploads.find(uploadKey(logEntry->device, logEntry->time));
+    if (it != pendingUploads.end()) {
+        if (uploaded || it->attempts + 1 >= UPLOAD_RETRY_MAX_ATTEMPTS) {
+            // Given up logs are still found by the log checker
+            pendingUploads.erase(it);
+        }
+        else {
+            it->attempts++;
+            it->nextAttempt = QDateTime::currentDateTime().addSecs(qMin(UPLOAD_RETRY_BASE << (it->attempts - 1), UPLOAD_RETRY_MAX_DELAY));
+        }
+        saveUploadQueue();
+    }
+    uploadMutex.unlock();
+
+    delete logEntry;
+}
+
+void MovesCount::retryUploads()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QList<PendingUpload> due;
+    LogEntry *logEntry;
+
+    uploadMutex.lock();
+    loadUploadQueue();
+    if (!offline) {
+        foreach (PendingUpload pending, pendingUploads) {
+            if (pending.nextAttempt <= now && !isUploading(uploadKey(pending.device, pending.time))) {
+                due.append(pending);
+            }
+        }
+    }
+    uploadMutex.unlock();
+
+    // Only the pending logs are read, not the whole archive
+    foreach (PendingUpload pending, due) {
+        logEntry = logStore.read(pending.device, pending.time);
+
+        uploadMutex.lock();
+        if (logEntry != NULL) {
+            uploadQueue.enqueue(logEntry);
+        }
+        else {
+            pendingUploads.remove(uploadKey(pending.device, pending.time));
+            saveUploadQueue();
+        }
+        uploadMutex.unlock();
+    }
+
+    startUploads();
+    scheduleRetry();
+}
+
+QString MovesCount::uploadKey(QString device, QDateTime time)
+{
+    return device + "_" + time.toString("yyyy_MM_dd_hh_mm_ss");
+}
+
+bool MovesCount::isUploading(QString key)
+{
+    foreach (LogEntry *logEntry, uploadQueue) {
+        if (uploadKey(logEntry->device, logEntry->time) == key) {
+            return true;
+        }
+    }
+    foreach (LogEntry *logEntry, uploadReplies) {
+        if (uploadKey(logEntry->device, logEntry->time) == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MovesCount::loadUploadQueue()
+{
+    QString path = QString(getenv("HOME")) + "/.openambit/" + UPLOAD_QUEUE_FILENAME;
+    QFile queuefile(path);
+    quint32 magic = 0, version = 0, count = 0;
+    PendingUpload pending;
+
+    if (uploadQueueLoaded) {
+        return;
+    }
+    uploadQueueLoaded = true;
+
+    if (!queuefile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&queuefile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> magic >> version >> count;
+    if (magic != UPLOAD_QUEUE_MAGIC || version != UPLOAD_QUEUE_VERSION) {
+        return;
+    }
+    for (quint32 i=0; i<count && stream.status() == QDataStream::Ok; i++) {
+        stream >> pending.device >> pending.time >> pending.attempts >> pending.nextAttempt;
+        if (stream.status() == QDataStream::Ok) {
+            pendingUploads.insert(uploadKey(pending.device, pending.time), pending);
+        }
+    }
+}
+
+void MovesCount::saveUploadQueue()
+{
+    QString storagePath = QString(getenv("HOME")) + "/.openambit";
+    QString path = storagePath + "/" + UPLOAD_QUEUE_FILENAME;
+    bool written;
+
+    if (!QDir().mkpath(storagePath)) {
+        return;
+    }
+
+    QTemporaryFile tmpfile(path + ".XXXXXX");
+    tmpfile.setAutoRemove(false);
+    if (!tmpfile.open()) {
+        return;
+    }
+
+    QDataStream stream(&tmpfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << (quint32)UPLOAD_QUEUE_MAGIC << (quint32)UPLOAD_QUEUE_VERSION << (quint32)pendingUploads.count();
+    foreach (PendingUpload pending, pendingUploads) {
+        stream << pending.device << pending.time << pending.attempts << pending.nextAttempt;
+    }
+    written = stream.status() == QDataStream::Ok;
+    tmpfile.close();
+
+    if (!written || ::rename(QFile::encodeName(tmpfile.fileName()).constData(), QFile::encodeName(path).constData()) != 0) {
+        QFile::remove(tmpfile.fileName());
+    }
+}
+
+void MovesCount::scheduleRetry()
+{
+    QDateTime now = QDateTime::currentDateTime(), next;
+
+    uploadMutex.lock();
+    if (!offline) {
+        foreach (PendingUpload pending, pendingUploads) {
+            if (pending.attempts > 0 && (!next.isValid() || pending.nextAttempt < next)) {
+                next = pending.nextAttempt;
+            }
+        }
+    }
+    uploadMutex.unlock();
+
+    if (next.isValid()) {
+        retryTimer->start(next > now ? (int)qMin(now.secsTo(next) + 1, (int)UPLOAD_RETRY_MAX_DELAY) * 1000 : 0);
     }
     else {
-        qDebug() << "Failed to upload log, movescount.com replied with \"" << reply->readAll() << "\"";
+        retryTimer->stop();
     }
 }
 
 MovesCount::MovesCount() :
-    exiting(false), authorized(false), firmwareCheckReply(NULL), authCheckReply(NULL)
+    exiting(false), authorized(false), authStateKnown(false), firmwareCheckReply(NULL), authCheckReply(NULL),
+    authRecheckDelay(AUTH_CHECK_TIMEOUT),
+    uploadParallelism(UPLOAD_PARALLELISM_DEFAULT), uploadQueueLoaded(false), offline(false),
+    orbitCacheLoaded(false), orbitMaxAge(0), orbitReply(NULL), orbitPending(false)
 {
     this->manager = new QNetworkAccessManager(this);
 
+    this->serviceCheckTimer = new QTimer(this);
+    this->serviceCheckTimer->setSingleShot(true);
+    connect(this->serviceCheckTimer, SIGNAL(timeout()), this, SLOT(runServiceChecks()));
+
+    this->retryTimer = new QTimer(this);
+    this->retryTimer->setSingleShot(true);
+    connect(this->retryTimer, SIGNAL(timeout()), this, SLOT(retryUploads()));
+
+    this->logCheckTimer = new QTimer(this);
+    this->logCheckTimer->setSingleShot(true);
+    connect(this->logCheckTimer, SIGNAL(timeout()), this, SLOT(startLogCheck()));
+
     this->logChecker = new MovesCountLogChecker();
 
     this->moveToThread(&workerThread);
@@ -372,20 +1055,103 @@ MovesCount::~MovesCount()
 
 bool MovesCount::checkReplyAuthorization(QNetworkReply *reply)
 {
+    bool wasAuthorized = authorized;
+
+    // Every reply tells the state, only changes are signalled so that
+    // replies finishing together do not start checks of their own
     if (reply->error() == QNetworkReply::AuthenticationRequiredError) {
         authorized = false;
-        emit movesCountAuth(false);
-        QTimer::singleShot(AUTH_CHECK_TIMEOUT, this, SLOT(recheckAuthorization()));
+        if (wasAuthorized || !authStateKnown) {
+            emit movesCountAuth(false);
+        }
+        authValidated = QDateTime();
+        // Further rechecks back off while the authorization is missing
+        if (scheduleServiceCheck(ServiceCheckAuthorization, authRecheckDelay)) {
+            authRecheckDelay = qMin(authRecheckDelay*2, AUTH_RECHECK_MAX_DELAY);
+        }
+        authStateKnown = true;
     }
     else if(reply->error() == QNetworkReply::NoError) {
         authorized = true;
-        emit movesCountAuth(true);
+        if (!wasAuthorized || !authStateKnown) {
+            emit movesCountAuth(true);
+        }
+        authStateKnown = true;
+        authValidatedFor = username + ":" + userkey;
+        authValidated = QDateTime::currentDateTime();
+        authRecheckDelay = AUTH_CHECK_TIMEOUT;
     }
 
     return authorized;
 }
 
-QNetworkReply *MovesCount::asyncGET(QString path, QString additionalHeaders, bool auth)
+void MovesCount::loadOrbitCache()
+{
+    QString path = QString(getenv("HOME")) + "/.openambit/" + ORBIT_CACHE_FILENAME;
+    QFile cachefile(path);
+    quint32 magic = 0, version = 0;
+
+    if (orbitCacheLoaded) {
+        return;
+    }
+    orbitCacheLoaded = true;
+
+    if (!cachefile.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream stream(&cachefile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream >> magic >> version;
+    if (magic != ORBIT_CACHE_MAGIC || version != ORBIT_CACHE_VERSION) {
+        return;
+    }
+    stream >> orbitETag >> orbitLastModified >> orbitFetched >> orbitMaxAge >> orbitData;
+
+    if (stream.status() != QDataStream::Ok || orbitData.length() < GPS_ORBIT_DATA_MIN_SIZE) {
+        orbitData.clear();
+        orbitETag.clear();
+        orbitLastModified.clear();
+    }
+}
+
+void MovesCount::saveOrbitCache()
+{
+    QString storagePath = QString(getenv("HOME")) + "/.openambit";
+    QString path = storagePath + "/" + ORBIT_CACHE_FILENAME;
+    bool written;
+
+    if (!QDir().mkpath(storagePath)) {
+        return;
+    }
+
+    QTemporaryFile tmpfile(path + ".XXXXXX");
+    tmpfile.setAutoRemove(false);
+    if (!tmpfile.open()) {
+        return;
+    }
+
+    QDataStream stream(&tmpfile);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << (quint32)ORBIT_CACHE_MAGIC << (quint32)ORBIT_CACHE_VERSION
+           << orbitETag << orbitLastModified << orbitFetched << orbitMaxAge << orbitData;
+    written = stream.status() == QDataStream::Ok;
+    tmpfile.close();
+
+    if (!written || ::rename(QFile::encodeName(tmpfile.fileName()).constData(), QFile::encodeName(path).constData()) != 0) {
+        QFile::remove(tmpfile.fileName());
+    }
+}
+
+bool MovesCount::isOrbitCacheFresh()
+{
+    QDateTime now = QDateTime::currentDateTime();
+
+    // A clock set back makes the cache stale rather than fresh for ever
+    return orbitFetched.isValid() && orbitFetched <= now && orbitFetched.secsTo(now) < (int)orbitMaxAge;
+}
+
+QNetworkRequest MovesCount::buildRequest(QString path, QString additionalHeaders, bool auth)
 {
     QNetworkRequest req;
     QString url = this->baseAddress + path + "?appkey=" + this->appkey;
@@ -398,8 +1164,21 @@ QNetworkReply *MovesCount::asyncGET(QString path, QString additionalHeaders, boo
     }
 
     req.setRawHeader("User-Agent", "ArREST v1.0");
+    // All requests go through the one manager and share its persistent
+    // connections to the server
+    req.setRawHeader("Connection", "keep-alive");
     req.setUrl(QUrl(url));
 
+    return req;
+}
+
+QNetworkReply *MovesCount::asyncGET(QString path, QString additionalHeaders, bool auth)
+{
+    QNetworkRequest req = buildRequest(path, additionalHeaders, auth);
+
+    // Requests fired together, e.g. the month lists, may be pipelined
+    req.setAttribute(QNetworkRequest::HttpPipeliningAllowedAttribute, true);
+
     return this->manager->get(req);
 }
 
@@ -417,19 +1196,9 @@ QNetworkReply *MovesCount::syncGET(QString path, QString additionalHeaders, bool
 
 QNetworkReply *MovesCount::asyncPOST(QString path, QString additionalHeaders, QByteArray &postData, bool auth)
 {
-    QNetworkRequest req;
-    QString url = this->baseAddress + path + "?appkey=" + this->appkey;
+    QNetworkRequest req = buildRequest(path, additionalHeaders, auth);
 
-    if (auth) {
-        url += "&userkey=" + this->userkey + "&email=" + this->username;
-    }
-    if (additionalHeaders.length() > 0) {
-        url += "&" + additionalHeaders;
-    }
-
-    req.setRawHeader("User-Agent", "ArREST v1.0");
     req.setRawHeader("Content-Type", "application/json");
-    req.setUrl(QUrl(url));
 
     return this->manager->post(req, postData);
 }
@@ -447,7 +1216,6 @@ QNetworkReply *MovesCount::syncPOST(QString path, QString additionalHeaders, QBy
 }
 
 #ifdef QT_DEBUG
-#include <QDir>
 void MovesCount::writeJsonToStorage(QString filename, QByteArray &data)
 {
     QString storagePath = QString(getenv("HOME")) + "/.openambit/movescount";
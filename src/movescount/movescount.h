@@ -24,10 +24,15 @@
 
 #include <QObject>
 #include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QQueue>
 #include <QThread>
 #include <QTimer>
+#include <QWaitCondition>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
 
 #include <libambit.h>
 
@@ -54,14 +59,47 @@ public:
 
     bool isAuthorized();
     int getOrbitalData(u_int8_t **data);
+    /**
+     * Start fetching the orbit data in the background, a later
+     * getOrbitalData then only waits for what is left of it
+     */
+    void prefetchOrbitalData();
+    /**
+     * Check, without touching the network, if the cached orbit data is
+     * still fresh and already held by the device
+     * \param deviceHeader Header read with libambit_gps_orbit_header_read
+     */
+    bool isOrbitalDataCurrent(QByteArray deviceHeader);
     int getPersonalSettings(ambit_personal_settings_t *settings);
     void getDeviceSettings();
     QList<MovesCountLogDirEntry> getMovescountEntries(QDate startTime, QDate endTime);
+    /**
+     * Get the moves of several months, consecutive months are asked for
+     * in one request and all requests are in flight at once
+     * \param months Any date in each month
+     */
+    QList<MovesCountLogDirEntry> getMovescountEntries(QList<QDate> months);
 
     void checkAuthorization();
     void checkLatestFirmwareVersion();
     void writePersonalSettings(ambit_personal_settings_t *settings);
+    /**
+     * Queue a log for upload and return at once, logMoveID is emitted
+     * when it has been uploaded. The log is copied, logEntry stays
+     * owned by the caller
+     */
     void writeLog(LogEntry *logEntry);
+    void setUploadParallelism(int uploads);
+    /**
+     * Check if a log is waiting in the upload queue, either for its
+     * first attempt or for a retry
+     */
+    bool isUploadPending(QString device, QDateTime time);
+    /**
+     * While offline no uploads are started, logs written are kept in
+     * the upload queue until going online again
+     */
+    void setOfflineMode(bool offline);
 
 signals:
     void newerFirmwareExists(QByteArray fw_version);
@@ -71,18 +109,28 @@ signals:
 private slots:
     void authCheckFinished();
     void firmwareReplyFinished();
-    void recheckAuthorization();
+    void runServiceChecks();
     void handleAuthorizationSignal(bool authorized);
+    void startLogCheck();
+    void startUploads();
+    void uploadFinished();
+    void retryUploads();
 
     int getOrbitalDataInThread(u_int8_t **data);
+    int copyOrbitalDataInThread(u_int8_t **data);
+    bool isOrbitalDataCurrentInThread(QByteArray deviceHeader);
+    void prefetchOrbitalDataInThread();
+    void orbitReplyFinished();
     int getPersonalSettingsInThread(ambit_personal_settings_t *settings);
     void getDeviceSettingsInThread();
     QList<MovesCountLogDirEntry> getMovescountEntriesInThread(QDate startTime, QDate endTime);
+    QList<MovesCountLogDirEntry> getMovescountEntriesInThread(QList<QDate> months);
+    void requestMovescountEntriesInThread(void *ref, QList<QDate> months);
+    void entriesReplyFinished();
 
     void checkAuthorizationInThread();
     void checkLatestFirmwareVersionInThread();
     void writePersonalSettingsInThread(ambit_personal_settings_t *settings);
-    void writeLogInThread(LogEntry *logEntry);
 
 private:
     MovesCount();
@@ -90,18 +138,70 @@ private:
 
     bool checkReplyAuthorization(QNetworkReply *reply);
 
+    // Month lists asked for from another thread, the caller waits for
+    // entriesCondition instead of the worker thread running an event
+    // loop of its own
+    class EntriesRequest
+    {
+    public:
+        QList<QNetworkReply*> replies;
+        int pending;
+        QList<MovesCountLogDirEntry> entries;
+        bool done;
+    };
+
+    QList<QNetworkReply*> requestMonthLists(QList<QDate> months);
+    QList<MovesCountLogDirEntry> parseMonthLists(QList<QNetworkReply*> replies);
+    void finishEntriesRequest(EntriesRequest *request);
+    void setOrbitPending(bool pending);
+    void waitForOrbitalData();
+
+    enum ServiceCheck {
+        ServiceCheckAuthorization,
+        ServiceCheckFirmware
+    };
+
+    bool scheduleServiceCheck(ServiceCheck check, int delay);
+    void restartServiceCheckTimer();
+    void startAuthorizationCheck();
+    void startFirmwareCheck();
+    QString firmwareKey();
+    void compareFirmwareVersion(QByteArray latest);
+
+    class PendingUpload {
+    public:
+        QString device;
+        QDateTime time;
+        quint32 attempts;
+        QDateTime nextAttempt;
+    };
+
+    static QString uploadKey(QString device, QDateTime time);
+    bool isUploading(QString key);
+    void loadUploadQueue();
+    void saveUploadQueue();
+    void scheduleRetry();
+    void finishUpload(LogEntry *logEntry, bool uploaded);
+
+    QNetworkRequest buildRequest(QString path, QString additionalHeaders, bool auth);
     QNetworkReply *asyncGET(QString path, QString additionalHeaders, bool auth);
     QNetworkReply *syncGET(QString path, QString additionalHeaders, bool auth);
 
     QNetworkReply *asyncPOST(QString path, QString additionalHeaders, QByteArray &postData, bool auth);
     QNetworkReply *syncPOST(QString path, QString additionalHeaders, QByteArray &postData, bool auth);
 
+    void loadOrbitCache();
+    void saveOrbitCache();
+    bool isOrbitCacheFresh();
+    void waitForOrbitReply();
+
 #ifdef QT_DEBUG
     void writeJsonToStorage(QString filename, QByteArray &data);
 #endif
 
     bool exiting;
     bool authorized;
+    bool authStateKnown;
 
     QString baseAddress;
     QString appkey;
@@ -115,6 +215,50 @@ private:
     QNetworkReply *firmwareCheckReply;
     QNetworkReply *authCheckReply;
 
+    // Service checks share one timer, a check already due is not
+    // scheduled again. Results are kept for a while, replies of other
+    // calls validate the authorization as well
+    QTimer *serviceCheckTimer;
+    QMap<int, QDateTime> serviceChecksDue;
+    int authRecheckDelay;
+    QString authValidatedFor;
+    QDateTime authValidated;
+    QString firmwareCheckedFor;
+    QDateTime firmwareChecked;
+    QByteArray latestFirmware;
+
+    // Uploads waiting and in progress, started from the worker thread
+    QMutex uploadMutex;
+    QQueue<LogEntry*> uploadQueue;
+    QMap<QNetworkReply*, LogEntry*> uploadReplies;
+    int uploadParallelism;
+    // Uploads not yet done, kept on disk until they succeed
+    bool uploadQueueLoaded;
+    QMap<QString, PendingUpload> pendingUploads;
+    bool offline;
+    QTimer *retryTimer;
+    // Reconciliation with the server is not urgent, it waits for startup
+    // and the first sync to be done
+    QTimer *logCheckTimer;
+
+    // Last orbit data fetched and the validators to revalidate it with
+    bool orbitCacheLoaded;
+    QByteArray orbitData;
+    QByteArray orbitETag;
+    QByteArray orbitLastModified;
+    QDateTime orbitFetched;
+    quint32 orbitMaxAge;
+    QNetworkReply *orbitReply;
+    // Set while orbitReply is in flight, callers from other threads wait
+    // for orbitCondition
+    QMutex orbitMutex;
+    QWaitCondition orbitCondition;
+    bool orbitPending;
+
+    QMutex entriesMutex;
+    QWaitCondition entriesCondition;
+    QMap<QNetworkReply*, EntriesRequest*> entriesReplies;
+
     MovesCountJSON jsonParser;
 
     LogStore logStore;
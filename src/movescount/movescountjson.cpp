@@ -24,10 +24,287 @@
 #include <QRegExp>
 #include <QVariantMap>
 #include <QVariantList>
+#include <QVector>
 #include <qjson/parser.h>
-#include <qjson/serializer.h>
 #include <zlib.h>
 #include <math.h>
+#include <string.h>
+
+#define JSON_DOUBLE_PRECISION   16
+#define JSON_DEFLATE_BUFFER     16384
+
+/*
+ * Writes compact JSON as it is generated. Between beginCompressed() and
+ * endCompressed() the tokens go through a gzip stream instead, and the
+ * output of that is written base64 encoded as a string value.
+ */
+class JSONStreamWriter
+{
+public:
+    explicit JSONStreamWriter(QByteArray *output) :
+        output(output), afterKey(false), compressing(false), ok(true), base64PendingLength(0)
+    {
+        output->clear();
+        needComma.append(false);
+    }
+
+    ~JSONStreamWriter()
+    {
+        if (compressing) {
+            deflateEnd(&strm);
+        }
+    }
+
+    bool isOk() const
+    {
+        return ok && !compressing;
+    }
+
+    void beginObject()
+    {
+        separator();
+        write("{", 1);
+        needComma.append(false);
+    }
+
+    void endObject()
+    {
+        needComma.removeLast();
+        write("}", 1);
+    }
+
+    void beginArray()
+    {
+        separator();
+        write("[", 1);
+        needComma.append(false);
+    }
+
+    void endArray()
+    {
+        needComma.removeLast();
+        write("]", 1);
+    }
+
+    void key(const char *name)
+    {
+        separator();
+        writeString(QString::fromLatin1(name));
+        write(":", 1);
+        afterKey = true;
+    }
+
+    void value(const QVariant &value)
+    {
+        QByteArray number;
+
+        switch (value.type()) {
+        case QVariant::Map:
+        {
+            QVariantMap map = value.toMap();
+            beginObject();
+            for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+                key(it.key().toLatin1().constData());
+                this->value(it.value());
+            }
+            endObject();
+            break;
+        }
+        case QVariant::List:
+            beginArray();
+            foreach (QVariant item, value.toList()) {
+                this->value(item);
+            }
+            endArray();
+            break;
+        case QVariant::Bool:
+            separator();
+            write(value.toBool() ? "true" : "false", value.toBool() ? 4 : 5);
+            break;
+        case QVariant::Int:
+        case QVariant::LongLong:
+            separator();
+            write(QByteArray::number(value.toLongLong()));
+            break;
+        case QVariant::UInt:
+        case QVariant::ULongLong:
+            separator();
+            write(QByteArray::number(value.toULongLong()));
+            break;
+        case QVariant::Double:
+            separator();
+            number = QByteArray::number(value.toDouble(), 'g', JSON_DOUBLE_PRECISION);
+            // Same as the serializer, doubles always look like doubles
+            if (!number.contains('.') && !number.contains('e')) {
+                number += ".0";
+            }
+            write(number);
+            break;
+        case QVariant::Invalid:
+            separator();
+            write("null", 4);
+            break;
+        default:
+            separator();
+            writeString(value.toString());
+            break;
+        }
+    }
+
+    bool beginCompressed()
+    {
+        memset(&strm, 0, sizeof(z_stream));
+        memset(&header, 0, sizeof(gz_header));
+        header.os = 0x00; // FAT
+
+        separator();
+        write("\"", 1);
+
+        if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK ||
+            deflateSetHeader(&strm, &header) != Z_OK) {
+            ok = false;
+            return false;
+        }
+        compressing = true;
+        base64PendingLength = 0;
+
+        // The compressed document starts a comma state of its own
+        needComma.append(false);
+
+        return true;
+    }
+
+    bool endCompressed()
+    {
+        if (!compressing) {
+            return false;
+        }
+
+        needComma.removeLast();
+        deflateOutput(Z_FINISH);
+        deflateEnd(&strm);
+        compressing = false;
+
+        if (base64PendingLength > 0) {
+            output->append(QByteArray((const char*)base64Pending, base64PendingLength).toBase64());
+            base64PendingLength = 0;
+        }
+        write("\"", 1);
+
+        return ok;
+    }
+
+private:
+    void separator()
+    {
+        if (afterKey) {
+            afterKey = false;
+        }
+        else {
+            if (needComma.last()) {
+                write(",", 1);
+            }
+            needComma.last() = true;
+        }
+    }
+
+    void write(const QByteArray &data)
+    {
+        write(data.constData(), data.length());
+    }
+
+    void write(const char *data, int length)
+    {
+        if (!compressing) {
+            output->append(data, length);
+            return;
+        }
+
+        strm.next_in = (Bytef*)data;
+        strm.avail_in = length;
+        deflateOutput(Z_NO_FLUSH);
+    }
+
+    void writeString(const QString &string)
+    {
+        QByteArray escaped;
+        const QChar *c = string.unicode();
+        int i;
+
+        escaped.reserve(string.length() + 2);
+        escaped.append('"');
+        for (i=0; i<string.length(); i++) {
+            ushort u = c[i].unicode();
+            switch (u) {
+            case '"':  escaped.append("\\\""); break;
+            case '\\': escaped.append("\\\\"); break;
+            case '\b': escaped.append("\\b"); break;
+            case '\f': escaped.append("\\f"); break;
+            case '\n': escaped.append("\\n"); break;
+            case '\r': escaped.append("\\r"); break;
+            case '\t': escaped.append("\\t"); break;
+            default:
+                if (u < 0x20 || u > 0x7e) {
+                    escaped.append(QString("\\u%1").arg(u, 4, 16, QChar('0')).toLatin1());
+                }
+                else {
+                    escaped.append((char)u);
+                }
+                break;
+            }
+        }
+        escaped.append('"');
+
+        write(escaped);
+    }
+
+    void deflateOutput(int flush)
+    {
+        int res;
+
+        do {
+            strm.next_out = deflateBuffer;
+            strm.avail_out = sizeof(deflateBuffer);
+            res = deflate(&strm, flush);
+            if (res == Z_STREAM_ERROR) {
+                ok = false;
+                return;
+            }
+            writeBase64(deflateBuffer, sizeof(deflateBuffer) - strm.avail_out);
+        } while (strm.avail_out == 0 || (flush == Z_FINISH && res != Z_STREAM_END));
+    }
+
+    // Encodes whole groups of three bytes, the rest waits for more data
+    void writeBase64(const uchar *data, int length)
+    {
+        QByteArray chunk;
+        int whole;
+
+        if (length == 0) {
+            return;
+        }
+
+        chunk.reserve(base64PendingLength + length);
+        chunk.append((const char*)base64Pending, base64PendingLength);
+        chunk.append((const char*)data, length);
+        whole = chunk.length() - chunk.length() % 3;
+
+        output->append(chunk.left(whole).toBase64());
+        base64PendingLength = chunk.length() - whole;
+        memcpy(base64Pending, chunk.constData() + whole, base64PendingLength);
+    }
+
+    QByteArray *output;
+    QVector<bool> needComma;
+    bool afterKey;
+    bool compressing;
+    bool ok;
+    z_stream strm;
+    gz_header header;
+    uchar deflateBuffer[JSON_DEFLATE_BUFFER];
+    uchar base64Pending[3];
+    int base64PendingLength;
+};
 
 MovesCountJSON::MovesCountJSON(QObject *parent) :
     QObject(parent)
@@ -110,83 +387,238 @@ int MovesCountJSON::parseLogDirReply(QByteArray &input, QList<MovesCountLogDirEn
  * @note Fucked up facts about movescount:
  *  - The periodic samples timestamps are truncated to 10th of milliseconds by movescount
  *  - That would be fine, if it wasn't for the swimming logs where the periodic entries
- *    are matched to the time of entries in the marksContent list (which has ms precision).
- *  - Some of the entries that should match in marksContent are virtual created entries,
+ *    are matched to the time of entries in the marks list (which has ms precision).
+ *  - Some of the entries that should match in marks are virtual created entries,
  *    generated here. This can lead to time collisions.
  *  - To compensate for the collisions, samples might need to be shifted in time,
  *    hence the fuzz with dateTimeCompensate
+ * @note The document is written as it is generated, the compressed parts
+ *  are deflated and base64 encoded on the fly, so that no tree of the
+ *  samples or uncompressed copy of them is ever built
  */
 int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
 {
-    QJson::Serializer serializer;
-    bool ok, inPause = false;
-    QVariantMap content;
-    QVariantList IBIContent;
-    QVariantList marksContent;
-    QVariantList periodicSamplesContent;
-    QVariantList GPSSamplesContent;
-    QByteArray uncompressedData, compressedData;
+    JSONStreamWriter writer(&output);
+    ambit_log_header_t *header = &logEntry->logEntry->header;
+    bool hasIBI = false, hasSamples = false, hasTrack = false;
+    uint32_t i;
+
+    QDateTime localBaseTime(QDate(header->date_time.year,
+                                  header->date_time.month,
+                                  header->date_time.day),
+                            QTime(header->date_time.hour,
+                                  header->date_time.minute, 0).addMSecs(header->date_time.msec));
+
+    const uint32_t *order = libambit_log_entry_order(logEntry->logEntry);
+    if (order == NULL && logEntry->logEntry->samples_count > 0) {
+        // Out of memory, a move without its samples is no use
+        return -1;
+    }
+
+    // Empty compressed parts are left out
+    for (i=0; i<logEntry->logEntry->samples_count; i++) {
+        switch (logEntry->logEntry->samples[i].type) {
+        case ambit_log_sample_type_ibi:
+            hasIBI = hasIBI || logEntry->logEntry->samples[i].u.ibi.ibi_count > 0;
+            break;
+        case ambit_log_sample_type_periodic:
+        case ambit_log_sample_type_swimming_turn:
+        case ambit_log_sample_type_swimming_stroke:
+            hasSamples = true;
+            break;
+        case ambit_log_sample_type_gps_base:
+        case ambit_log_sample_type_gps_small:
+        case ambit_log_sample_type_gps_tiny:
+            hasTrack = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Keys in the order of the map based serializer used before
+    writer.beginObject();
+    writer.key("ActivityID");
+    writer.value(header->activity_type);
+    writer.key("AscentAltitude");
+    writer.value((double)header->ascent);
+    writer.key("AscentTime");
+    writer.value((double)header->ascent_time/1000.0);
+    writer.key("AvgCadence");
+    writer.value(header->cadence_avg);
+    writer.key("AvgHR");
+    writer.value(header->heartrate_avg);
+    writer.key("AvgSpeed");
+    writer.value((double)header->speed_avg/3600.0);
+    writer.key("DescentAltitude");
+    writer.value((double)header->descent);
+    writer.key("DescentTime");
+    writer.value((double)header->descent_time/1000.0);
+    writer.key("DeviceName");
+    writer.value(logEntry->deviceInfo.model);
+    writer.key("DeviceSerialNumber");
+    writer.value(logEntry->deviceInfo.serial);
+    writer.key("Distance");
+    writer.value(header->distance);
+    writer.key("Duration");
+    writer.value((double)header->duration/1000.0);
+    writer.key("Energy");
+    writer.value(header->energy_consumption);
+    writer.key("FlatTime");
+    writer.value(QVariant());
+    if (header->altitude_max >= -1000 && header->altitude_max <= 10000) {
+        writer.key("HighAltitude");
+        writer.value((double)header->altitude_max);
+    }
+    else {
+        writer.key("HighAltitude");
+        writer.value(QVariant());
+    }
+    if (hasIBI) {
+        writer.key("IBIData");
+        writer.beginObject();
+        writer.key("CompressedValues");
+        writeCompressedContent(&writer, logEntry, order, localBaseTime, SampleContentIBI);
+        writer.endObject();
+    }
+    writer.key("LocalStartTime");
+    writer.value(dateTimeString(localBaseTime));
+    if (header->altitude_min >= -1000 && header->altitude_min <= 10000) {
+        writer.key("LowAltitude");
+        writer.value((double)header->altitude_min);
+    }
+    writer.key("Marks");
+    writer.beginArray();
+    writeSampleContent(&writer, logEntry, order, localBaseTime, SampleContentMarks);
+    writer.endArray();
+    writer.key("MaxCadence");
+    writer.value(header->cadence_max);
+    writer.key("MaxSpeed");
+    writer.value((double)header->speed_max/3600.0);
+    if (header->temperature_max >= -1000 && header->temperature_max <= 1000) {
+        writer.key("MaxTemp");
+        writer.value((double)header->temperature_max/10.0);
+    }
+    writer.key("MinHR");
+    writer.value(header->heartrate_min);
+    if (header->temperature_min >= -1000 && header->temperature_min <= 1000) {
+        writer.key("MinTemp");
+        writer.value((double)header->temperature_min/10.0);
+    }
+    writer.key("PeakHR");
+    writer.value(header->heartrate_max);
+    writer.key("PeakTrainingEffect");
+    writer.value((double)header->peak_training_effect/10.0);
+    writer.key("RecoveryTime");
+    writer.value((double)header->recovery_time/1000.0);
+    if (hasSamples) {
+        writer.key("Samples");
+        writer.beginObject();
+        writer.key("CompressedSampleSets");
+        writeCompressedContent(&writer, logEntry, order, localBaseTime, SampleContentSamples);
+        writer.endObject();
+    }
+    writer.key("SerialNumber");
+    writer.value(QVariant());
+    writer.key("StartLatitude");
+    writer.value(QVariant());
+    writer.key("StartLongitude");
+    writer.value(QVariant());
+    if (hasTrack) {
+        writer.key("Track");
+        writer.beginObject();
+        writer.key("CompressedTrackPoints");
+        writeCompressedContent(&writer, logEntry, order, localBaseTime, SampleContentTrack);
+        writer.endObject();
+    }
+    writer.endObject();
+
+    return (writer.isOk() ? 0 : -1);
+}
+
+void MovesCountJSON::writeCompressedContent(JSONStreamWriter *writer, LogEntry *logEntry, const uint32_t *order, QDateTime localBaseTime, SampleContent content)
+{
+    writer->beginCompressed();
+    writer->beginArray();
+    writeSampleContent(writer, logEntry, order, localBaseTime, content);
+    writer->endArray();
+    writer->endCompressed();
+}
+
+/*
+ * The marks and periodic samples depend on each other through the time
+ * compensation, so every part runs the whole sequence and only writes
+ * its own entries
+ */
+void MovesCountJSON::writeSampleContent(JSONStreamWriter *writer, LogEntry *logEntry, const uint32_t *order, QDateTime localBaseTime, SampleContent content)
+{
+    bool inPause = false;
     ambit_log_sample_t *sample;
     QDateTime prevMarksDateTime;
     QDateTime prevPeriodicSamplesDateTime;
 
-    QDateTime localBaseTime(QDate(logEntry->logEntry->header.date_time.year,
-                                  logEntry->logEntry->header.date_time.month,
-                                  logEntry->logEntry->header.date_time.day),
-                            QTime(logEntry->logEntry->header.date_time.hour,
-                                  logEntry->logEntry->header.date_time.minute, 0).addMSecs(logEntry->logEntry->header.date_time.msec));
+    // No order without samples
+    int sampleCount = (order != NULL ? logEntry->logEntry->samples_count : 0);
 
-    // Loop through content
-    QList<int> order = rearrangeSamples(logEntry);
-    for (int i=0; i<order.length(); i++) {
+    for (int i=0; i<sampleCount; i++) {
         sample = &logEntry->logEntry->samples[order[i]];
 
         switch(sample->type) {
         case ambit_log_sample_type_periodic:
         {
-            QVariantMap tmpMap;
             prevPeriodicSamplesDateTime = dateTimeRound(dateTimeCompensate(dateTimeRound(localBaseTime.addMSecs(sample->time), 10), prevPeriodicSamplesDateTime, 0), 10);
-            tmpMap.insert("LocalTime", dateTimeString(prevPeriodicSamplesDateTime));
-            writePeriodicSample(sample, tmpMap);
-            periodicSamplesContent.append(tmpMap);
+            if (content == SampleContentSamples) {
+                QVariantMap tmpMap;
+                tmpMap.insert("LocalTime", dateTimeString(prevPeriodicSamplesDateTime));
+                writePeriodicSample(sample, tmpMap);
+                writer->value(tmpMap);
+            }
             break;
         }
         case ambit_log_sample_type_ibi:
-            for (int j=0; j<sample->u.ibi.ibi_count; j++) {
-                IBIContent.append(sample->u.ibi.ibi[j]);
+            if (content == SampleContentIBI) {
+                for (int j=0; j<sample->u.ibi.ibi_count; j++) {
+                    writer->value(sample->u.ibi.ibi[j]);
+                }
             }
             break;
         case ambit_log_sample_type_gps_base:
         {
-            QVariantMap tmpMap;
-            tmpMap.insert("Altitude", (double)sample->u.gps_base.altitude/100.0);
-            tmpMap.insert("EHPE", (double)sample->u.gps_base.ehpe/100.0);
-            tmpMap.insert("Latitude", (double)sample->u.gps_base.latitude/10000000);
-            tmpMap.insert("LocalTime", dateTimeString(localBaseTime.addMSecs(sample->time)));
-            tmpMap.insert("Longitude", (double)sample->u.gps_base.longitude/10000000);
-            GPSSamplesContent.append(tmpMap);
+            if (content == SampleContentTrack) {
+                QVariantMap tmpMap;
+                tmpMap.insert("Altitude", (double)sample->u.gps_base.altitude/100.0);
+                tmpMap.insert("EHPE", (double)sample->u.gps_base.ehpe/100.0);
+                tmpMap.insert("Latitude", (double)sample->u.gps_base.latitude/10000000);
+                tmpMap.insert("LocalTime", dateTimeString(localBaseTime.addMSecs(sample->time)));
+                tmpMap.insert("Longitude", (double)sample->u.gps_base.longitude/10000000);
+                writer->value(tmpMap);
+            }
             break;
         }
         case ambit_log_sample_type_gps_small:
         {
-            QVariantMap tmpMap;
-            tmpMap.insert("Altitude", (double)0);
-            tmpMap.insert("EHPE", (double)sample->u.gps_small.ehpe/100.0);
-            tmpMap.insert("Latitude", (double)sample->u.gps_small.latitude/10000000);
-            tmpMap.insert("LocalTime", dateTimeString(localBaseTime.addMSecs(sample->time)));
-            tmpMap.insert("Longitude", (double)sample->u.gps_small.longitude/10000000);
-            GPSSamplesContent.append(tmpMap);
+            if (content == SampleContentTrack) {
+                QVariantMap tmpMap;
+                tmpMap.insert("Altitude", (double)0);
+                tmpMap.insert("EHPE", (double)sample->u.gps_small.ehpe/100.0);
+                tmpMap.insert("Latitude", (double)sample->u.gps_small.latitude/10000000);
+                tmpMap.insert("LocalTime", dateTimeString(localBaseTime.addMSecs(sample->time)));
+                tmpMap.insert("Longitude", (double)sample->u.gps_small.longitude/10000000);
+                writer->value(tmpMap);
+            }
             break;
         }
         case ambit_log_sample_type_gps_tiny:
         {
-            QVariantMap tmpMap;
-            tmpMap.insert("Altitude", (double)0);
-            tmpMap.insert("EHPE", (double)sample->u.gps_tiny.ehpe/100.0);
-            tmpMap.insert("Latitude", (double)sample->u.gps_tiny.latitude/10000000);
-            tmpMap.insert("LocalTime", dateTimeString(localBaseTime.addMSecs(sample->time)));
-            tmpMap.insert("Longitude", (double)sample->u.gps_tiny.longitude/10000000);
-            GPSSamplesContent.append(tmpMap);
+            if (content == SampleContentTrack) {
+                QVariantMap tmpMap;
+                tmpMap.insert("Altitude", (double)0);
+                tmpMap.insert("EHPE", (double)sample->u.gps_tiny.ehpe/100.0);
+                tmpMap.insert("Latitude", (double)sample->u.gps_tiny.latitude/10000000);
+                tmpMap.insert("LocalTime", dateTimeString(localBaseTime.addMSecs(sample->time)));
+                tmpMap.insert("Longitude", (double)sample->u.gps_tiny.longitude/10000000);
+                writer->value(tmpMap);
+            }
             break;
         }
         case ambit_log_sample_type_lapinfo:
@@ -202,7 +634,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
                 }
                 tmpMap.insert("LocalTime", dateTimeString(prevMarksDateTime));
                 tmpMap.insert("Type", 5);
-                marksContent.append(tmpMap);
+                if (content == SampleContentMarks) {
+                    writer->value(tmpMap);
+                }
                 break;
             }
             case 0x01: /* manual = 0 */
@@ -220,7 +654,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
                     }
                     tmpMap.insert("LocalTime", dateTimeString(prevMarksDateTime));
                     tmpMap.insert("Type", 0);
-                    marksContent.append(tmpMap);
+                    if (content == SampleContentMarks) {
+                        writer->value(tmpMap);
+                    }
                 }
                 break;
             }
@@ -236,7 +672,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
                     prevMarksDateTime = localBaseTime.addMSecs(sample->time);
                     tmpMap.insert("LocalTime", dateTimeString(prevMarksDateTime));
                 }
-                marksContent.append(tmpMap);
+                if (content == SampleContentMarks) {
+                    writer->value(tmpMap);
+                }
 
                 inPause = false;
                 break;
@@ -252,7 +690,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
                 }
                 tmpMap.insert("LocalTime", dateTimeString(prevMarksDateTime));
                 tmpMap.insert("Type", 2);
-                marksContent.append(tmpMap);
+                if (content == SampleContentMarks) {
+                    writer->value(tmpMap);
+                }
 
                 inPause = true;
                 break;
@@ -269,7 +709,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
                 }
                 tmpMap.insert("LocalTime", dateTimeString(prevMarksDateTime));
                 tmpMap.insert("Type", 3);
-                marksContent.append(tmpMap);
+                if (content == SampleContentMarks) {
+                    writer->value(tmpMap);
+                }
                 break;
             }
             };
@@ -288,13 +730,13 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
             }
 
             // Find next swimming turn, to check what marks to generate
-            for (nextIndex=i+1; nextIndex<order.length(); nextIndex++) {
+            for (nextIndex=i+1; nextIndex<sampleCount; nextIndex++) {
                 next_swimming_turn = &logEntry->logEntry->samples[order[nextIndex]];
                 if (next_swimming_turn->type == ambit_log_sample_type_swimming_turn) {
                     break;
                 }
             }
-            if (nextIndex == order.length()) {
+            if (nextIndex == sampleCount) {
                 next_swimming_turn = NULL;
             }
             if (next_swimming_turn == NULL || sample->u.swimming_turn.style != next_swimming_turn->u.swimming_turn.style) {
@@ -307,7 +749,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
                     calibration.append(sample->u.swimming_turn.classification[k]);
                 }
                 tmpMap.insert("SwimmingStyleCalibration", calibration);
-                marksContent.append(tmpMap);
+                if (content == SampleContentMarks) {
+                    writer->value(tmpMap);
+                }
 
                 if (next_swimming_turn != NULL) {
                     style = next_swimming_turn->u.swimming_turn.style;
@@ -334,12 +778,16 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
             attribMap.insert("Value", "swimmingturn");
             attributes.append(attribMap);
             tmpMap.insert("Attributes", attributes);
-            marksContent.append(tmpMap);
+            if (content == SampleContentMarks) {
+                writer->value(tmpMap);
+            }
 
             QVariantMap periodicMap;
             periodicMap.insert("Distance", sample->u.swimming_turn.distance / 100);
             periodicMap.insert("LocalTime", dateTimeString(sampleDateTime));
-            periodicSamplesContent.append(periodicMap);
+            if (content == SampleContentSamples) {
+                writer->value(periodicMap);
+            }
 
             prevPeriodicSamplesDateTime = prevMarksDateTime = sampleDateTime;
 
@@ -351,7 +799,9 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
             prevPeriodicSamplesDateTime = dateTimeRound(dateTimeCompensate(dateTimeRound(localBaseTime.addMSecs(sample->time), 10), prevPeriodicSamplesDateTime, 0), 10);
             tmpMap.insert("LocalTime", dateTimeString(prevPeriodicSamplesDateTime));
             tmpMap.insert("SwimmingStrokeType", 0);
-            periodicSamplesContent.append(tmpMap);
+            if (content == SampleContentSamples) {
+                writer->value(tmpMap);
+            }
             break;
         }
         case ambit_log_sample_type_activity:
@@ -366,81 +816,15 @@ int MovesCountJSON::generateLogData(LogEntry *logEntry, QByteArray &output)
             tmpMap.insert("LocalTime", dateTimeString(prevMarksDateTime));
             tmpMap.insert("NextActivityID", sample->u.activity.activitytype);
             tmpMap.insert("Type", 8);
-            marksContent.append(tmpMap);
+            if (content == SampleContentMarks) {
+                writer->value(tmpMap);
+            }
             break;
         }
         default:
             break;
         }
     }
-
-    serializer.setDoublePrecision(16);
-    serializer.setIndentMode(QJson::IndentCompact);
-
-    content.insert("ActivityID", logEntry->logEntry->header.activity_type);
-    content.insert("AscentAltitude", (double)logEntry->logEntry->header.ascent);
-    content.insert("AscentTime", (double)logEntry->logEntry->header.ascent_time/1000.0);
-    content.insert("AvgCadence", logEntry->logEntry->header.cadence_avg);
-    content.insert("AvgHR", logEntry->logEntry->header.heartrate_avg);
-    content.insert("AvgSpeed", (double)logEntry->logEntry->header.speed_avg/3600.0);
-    content.insert("DescentAltitude", (double)logEntry->logEntry->header.descent);
-    content.insert("DescentTime", (double)logEntry->logEntry->header.descent_time/1000.0);
-    content.insert("DeviceName", logEntry->deviceInfo.model);
-    content.insert("DeviceSerialNumber", logEntry->deviceInfo.serial);
-    content.insert("Distance", logEntry->logEntry->header.distance);
-    content.insert("Duration", (double)logEntry->logEntry->header.duration/1000.0);
-    content.insert("Energy", logEntry->logEntry->header.energy_consumption);
-    content.insert("FlatTime", QVariant::Invalid);
-    if (logEntry->logEntry->header.altitude_max >= -1000 && logEntry->logEntry->header.altitude_max <= 10000) {
-        content.insert("HighAltitude", (double)logEntry->logEntry->header.altitude_max);
-    }
-    else {
-        content.insert("HighAltitude", QVariant::Invalid);
-    }
-    if (IBIContent.count() > 0) {
-        uncompressedData = serializer.serialize(IBIContent);
-        compressData(uncompressedData, compressedData);
-        QVariantMap IBIDataMap;
-        IBIDataMap.insert("CompressedValues", compressedData.toBase64());
-        content.insert("IBIData", IBIDataMap);                        /* compressed */
-    }
-    content.insert("LocalStartTime", dateTimeString(localBaseTime));
-    if (logEntry->logEntry->header.altitude_min >= -1000 && logEntry->logEntry->header.altitude_min <= 10000)
-        content.insert("LowAltitude", (double)logEntry->logEntry->header.altitude_min);
-    content.insert("Marks", marksContent);
-    content.insert("MaxCadence", logEntry->logEntry->header.cadence_max);
-    content.insert("MaxSpeed", (double)logEntry->logEntry->header.speed_max/3600.0);
-    if (logEntry->logEntry->header.temperature_max >= -1000 && logEntry->logEntry->header.temperature_max <= 1000) {
-        content.insert("MaxTemp", (double)logEntry->logEntry->header.temperature_max/10.0);
-    }
-    content.insert("MinHR", logEntry->logEntry->header.heartrate_min);
-    if (logEntry->logEntry->header.temperature_min >= -1000 && logEntry->logEntry->header.temperature_min <= 1000) {
-        content.insert("MinTemp", (double)logEntry->logEntry->header.temperature_min/10.0);
-    }
-    content.insert("PeakHR", logEntry->logEntry->header.heartrate_max);
-    content.insert("PeakTrainingEffect", (double)logEntry->logEntry->header.peak_training_effect/10.0);
-    content.insert("RecoveryTime", (double)logEntry->logEntry->header.recovery_time/1000.0);
-    if (periodicSamplesContent.count() > 0) {
-        uncompressedData = serializer.serialize(periodicSamplesContent);
-        compressData(uncompressedData, compressedData);
-        QVariantMap periodicSamplesDataMap;
-        periodicSamplesDataMap.insert("CompressedSampleSets", compressedData.toBase64());
-        content.insert("Samples", periodicSamplesDataMap);            /* compressed */
-    }
-    content.insert("SerialNumber", QVariant::Invalid);
-    content.insert("StartLatitude", QVariant::Invalid);
-    content.insert("StartLongitude", QVariant::Invalid);
-    if (GPSSamplesContent.count() > 0) {
-        uncompressedData = serializer.serialize(GPSSamplesContent);
-        compressData(uncompressedData, compressedData);
-        QVariantMap GPSSamplesDataMap;
-        GPSSamplesDataMap.insert("CompressedTrackPoints", compressedData.toBase64());
-        content.insert("Track", GPSSamplesDataMap);                   /* compressed */
-    }
-
-    output = serializer.serialize(content, &ok);
-
-    return (ok ? 0 : -1);
 }
 
 bool MovesCountJSON::writePeriodicSample(ambit_log_sample_t *sample, QVariantMap &output)
@@ -624,109 +1008,6 @@ bool MovesCountJSON::writePeriodicSample(ambit_log_sample_t *sample, QVariantMap
     return true;
 }
 
-int MovesCountJSON::compressData(QByteArray &content, QByteArray &output)
-{
-    int ret = -1, res, deflate_res;
-    z_stream strm;
-    gz_header header;
-    size_t destLen = compressBound(content.length());
-
-    memset(&strm, 0, sizeof(z_stream));
-    memset(&header, 0, sizeof(gz_header));
-
-    if (destLen > 0) {
-        u_int8_t *buf = (u_int8_t*)malloc(destLen);
-        strm.zalloc = Z_NULL;
-        strm.zfree = Z_NULL;
-        strm.opaque = Z_NULL;
-        header.os = 0x00; // FAT
-
-        res = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
-        res = deflateSetHeader(&strm, &header);
-
-        strm.next_in = reinterpret_cast<uint8_t *>(content.data());
-        strm.avail_in = content.length();
-        strm.next_out = buf;
-        strm.avail_out = destLen;
-
-        res = deflate(&strm, Z_NO_FLUSH);
-
-        if (res == Z_OK) {
-            deflate_res = Z_OK;
-            while (deflate_res == Z_OK) {
-                deflate_res = deflate(&strm, Z_FINISH);
-            }
-
-            if (deflate_res == Z_STREAM_END) {
-                output.setRawData((char*)buf, destLen - strm.avail_out);
-                ret = 0;
-            }
-        }
-
-        deflateEnd(&strm);
-    }
-
-    return ret;
-}
-
-QList<int> MovesCountJSON::rearrangeSamples(LogEntry *logEntry)
-{
-    QList<int> sampleList;
-    u_int32_t index = 0;
-    u_int32_t lastMatching = 0;
-
-    while (index < logEntry->logEntry->samples_count) {
-        // First find all entries with the same time
-        lastMatching = index;
-        while (lastMatching + 1 < logEntry->logEntry->samples_count &&
-               logEntry->logEntry->samples[index].time == logEntry->logEntry->samples[lastMatching+1].time) {
-            lastMatching++;
-        }
-
-        // Put start/stop at top
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type == ambit_log_sample_type_lapinfo &&
-                (logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1e ||
-                 logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1f)) {
-                sampleList.append(i);
-            }
-        }
-
-        // Then any gps-entries
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type == ambit_log_sample_type_gps_base ||
-                logEntry->logEntry->samples[i].type == ambit_log_sample_type_gps_small ||
-                logEntry->logEntry->samples[i].type == ambit_log_sample_type_gps_tiny) {
-                sampleList.append(i);
-            }
-        }
-
-        // Then periodic samples
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type == ambit_log_sample_type_periodic) {
-                sampleList.append(i);
-            }
-        }
-
-        // Then any other!
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type != ambit_log_sample_type_gps_base &&
-                logEntry->logEntry->samples[i].type != ambit_log_sample_type_gps_small &&
-                logEntry->logEntry->samples[i].type != ambit_log_sample_type_gps_tiny &&
-                logEntry->logEntry->samples[i].type != ambit_log_sample_type_periodic &&
-                !(logEntry->logEntry->samples[i].type == ambit_log_sample_type_lapinfo &&
-                    (logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1e ||
-                     logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1f))) {
-                sampleList.append(i);
-            }
-        }
-
-        index = lastMatching + 1;
-    }
-
-    return sampleList;
-}
-
 QString MovesCountJSON::dateTimeString(QDateTime dateTime)
 {
     if (dateTime.time().msec() != 0) {
@@ -30,6 +30,8 @@
 #include "logentry.h"
 #include "movescountlogdirentry.h"
 
+class JSONStreamWriter;
+
 class MovesCountJSON : public QObject
 {
     Q_OBJECT
@@ -47,10 +49,17 @@ signals:
 public slots:
 
 private:
+    enum SampleContent {
+        SampleContentIBI,
+        SampleContentMarks,
+        SampleContentSamples,
+        SampleContentTrack
+    };
+
+    void writeCompressedContent(JSONStreamWriter *writer, LogEntry *logEntry, const uint32_t *order, QDateTime localBaseTime, SampleContent content);
+    void writeSampleContent(JSONStreamWriter *writer, LogEntry *logEntry, const uint32_t *order, QDateTime localBaseTime, SampleContent content);
     bool writePeriodicSample(ambit_log_sample_t *sample, QVariantMap &output);
 
-    int compressData(QByteArray &content, QByteArray &output);
-    QList<int> rearrangeSamples(LogEntry *logEntry);
     QString dateTimeString(QDateTime dateTime);
     QDateTime dateTimeRound(QDateTime dateTime, int msecRoundFactor);
     QDateTime dateTimeCompensate(QDateTime dateTime, QDateTime prevDateTime, int minOffset);
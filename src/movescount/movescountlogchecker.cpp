@@ -1,6 +1,9 @@
 #include "movescountlogchecker.h"
 #include "movescount.h"
 
+#include <QMultiHash>
+#include <QMap>
+
 MovesCountLogChecker::MovesCountLogChecker(QObject *parent) :
     QObject(parent), running(false), cancelRun(false)
 {
@@ -18,6 +21,9 @@ MovesCountLogChecker::~MovesCountLogChecker()
 void MovesCountLogChecker::run()
 {
     if (!running) {
+        // Marked at once, so that calls made before the check starts
+        // share it
+        running = true;
         QMetaObject::invokeMethod(this, "checkUploadedLogs", Qt::AutoConnection);
     }
 }
@@ -34,9 +40,8 @@ void MovesCountLogChecker::cancel()
 
 void MovesCountLogChecker::checkUploadedLogs()
 {
-    QDateTime firstUnknown = QDateTime::currentDateTime();
-    QDateTime lastUnknown = QDateTime::fromTime_t(0);
-    QList<LogEntry*> missingEntries;
+    QMultiHash<quint64, LogStore::LogDirEntry> unknownEntries;
+    QMap<QDate, bool> unknownMonths;
     MovesCount *movescount = MovesCount::instance();
 
     running = true;
@@ -48,60 +53,67 @@ void MovesCountLogChecker::checkUploadedLogs()
             cancelRun = false;
             return;
         }
-        LogEntry *logEntry = logStore.read(entry);
-        if (logEntry != NULL) {
-            if (logEntry->movescountId.length() == 0) {
-                missingEntries.append(logEntry);
-                if (logEntry->time < firstUnknown) {
-                    firstUnknown = logEntry->time;
-                }
-                if (logEntry->time > lastUnknown) {
-                    lastUnknown = logEntry->time;
-                }
-            }
-            else {
-                delete logEntry;
-            }
+        // The index knows the movescount id, only logs that are still to
+        // be uploaded are checked
+        if (entry.movescountId.length() > 0) {
+            continue;
         }
+        unknownEntries.insert(timeKey(entry.time), entry);
+        unknownMonths.insert(QDate(entry.time.date().year(), entry.time.date().month(), 1), true);
     }
 
-    if (missingEntries.count() > 0) {
-        // This is a long operation, exit if application want to quit
-        if (cancelRun) {
-            cancelRun = false;
-            return;
-        }
-        QList<MovesCountLogDirEntry> movescountEntries = movescount->getMovescountEntries(firstUnknown.date(), lastUnknown.date());
+    if (unknownEntries.count() > 0) {
+        // Only the months with unknown logs are asked for, all at once
+        QList<MovesCountLogDirEntry> movescountEntries = movescount->getMovescountEntries(unknownMonths.keys());
         foreach(MovesCountLogDirEntry entry, movescountEntries) {
             // This is a long operation, exit if application want to quit
             if (cancelRun) {
                 cancelRun = false;
                 return;
             }
-            foreach(LogEntry *logEntry, missingEntries) {
-                if (entry.time == logEntry->time) {
-                    missingEntries.removeOne(logEntry);
-                    logStore.storeMovescountId(logEntry->device, logEntry->time, entry.moveId);
-                    delete logEntry;
-                    break;
-                }
+            QMultiHash<quint64, LogStore::LogDirEntry>::iterator match = unknownEntries.find(timeKey(entry.time));
+            if (match != unknownEntries.end()) {
+                logStore.storeMovescountId(match->device, match->time, entry.moveId);
+                unknownEntries.erase(match);
             }
         }
 
-        // Delete remaining entries
-        while (missingEntries.count() > 0) {
-            // This is a long operation, exit if application want to quit
-            if (cancelRun) {
-                cancelRun = false;
-                return;
+        // Only logs that really are missing are read, to be uploaded,
+        // those already in the upload queue are retried from there
+        QList<LogStore::LogDirEntry> missingEntries;
+        foreach(LogStore::LogDirEntry entry, unknownEntries) {
+            if (!movescount->isUploadPending(entry.device, entry.time)) {
+                missingEntries.append(entry);
             }
-            LogEntry *logEntry = missingEntries.first();
-            movescount->writeLog(logEntry);
-            missingEntries.removeOne(logEntry);
-            delete logEntry;
+        }
+        if (!logStore.forEach(missingEntries, &log_read_cb, this)) {
+            cancelRun = false;
+            return;
         }
     }
 
     cancelRun = false;
     running = false;
 }
+
+quint64 MovesCountLogChecker::timeKey(QDateTime time)
+{
+    return (quint64)time.toTime_t()*1000 + time.time().msec();
+}
+
+bool MovesCountLogChecker::log_read_cb(void *ref, int index, LogStore::LogDirEntry dirEntry, LogEntry *logEntry)
+{
+    MovesCountLogChecker *checker = static_cast<MovesCountLogChecker*> (ref);
+
+    Q_UNUSED(index);
+    Q_UNUSED(dirEntry);
+
+    if (logEntry != NULL) {
+        // Queued for upload, the upload has its own copy
+        MovesCount::instance()->writeLog(logEntry);
+        delete logEntry;
+    }
+
+    // Exit if application want to quit
+    return !checker->cancelRun;
+}
@@ -22,6 +22,9 @@ private slots:
     void checkUploadedLogs();
 
 private:
+    static quint64 timeKey(QDateTime time);
+    static bool log_read_cb(void *ref, int index, LogStore::LogDirEntry dirEntry, LogEntry *logEntry);
+
     bool running;
     bool cancelRun;
 
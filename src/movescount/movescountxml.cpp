@@ -267,9 +267,15 @@ bool MovesCountXML::XMLWriter::writeLogEntry()
     xml.writeEndElement();
     QList<quint16> ibis;
     xml.writeStartElement("Samples");
-    QList<int> order = rearrangeSamples();
-    foreach(int index, order) {
-        writeLogSample(&logEntry->logEntry->samples[index], &ibis);
+    // Computed once and kept with the log entry for the other exporters
+    const uint32_t *order = libambit_log_entry_order(logEntry->logEntry);
+    if (order == NULL && logEntry->logEntry->samples_count > 0) {
+        return false;
+    }
+    if (order != NULL) {
+        for (i=0; i<logEntry->logEntry->samples_count; i++) {
+            writeLogSample(&logEntry->logEntry->samples[order[i]], &ibis);
+        }
     }
 
     xml.writeEndElement();
@@ -748,61 +754,3 @@ QString MovesCountXML::XMLWriter::dateTimeString(QDateTime &dateTime)
         return dateTime.toString("yyyy-MM-ddThh:mm:ssZ");
     }
 }
-
-QList<int> MovesCountXML::XMLWriter::rearrangeSamples()
-{
-    QList<int> sampleList;
-    u_int32_t index = 0;
-    u_int32_t lastMatching = 0;
-
-    while (index < logEntry->logEntry->samples_count) {
-        // First find all entries with the same time
-        lastMatching = index;
-        while (lastMatching + 1 < logEntry->logEntry->samples_count &&
-               logEntry->logEntry->samples[index].time == logEntry->logEntry->samples[lastMatching+1].time) {
-            lastMatching++;
-        }
-
-        // Put start/stop at top
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type == ambit_log_sample_type_lapinfo &&
-                (logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1e ||
-                 logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1f)) {
-                sampleList.append(i);
-            }
-        }
-
-        // Then any gps-entries
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type == ambit_log_sample_type_gps_base ||
-                logEntry->logEntry->samples[i].type == ambit_log_sample_type_gps_small ||
-                logEntry->logEntry->samples[i].type == ambit_log_sample_type_gps_tiny) {
-                sampleList.append(i);
-            }
-        }
-
-        // Then periodic samples
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type == ambit_log_sample_type_periodic) {
-                sampleList.append(i);
-            }
-        }
-
-        // Then any other!
-        for (u_int32_t i=index; i<=lastMatching; i++) {
-            if (logEntry->logEntry->samples[i].type != ambit_log_sample_type_gps_base &&
-                logEntry->logEntry->samples[i].type != ambit_log_sample_type_gps_small &&
-                logEntry->logEntry->samples[i].type != ambit_log_sample_type_gps_tiny &&
-                logEntry->logEntry->samples[i].type != ambit_log_sample_type_periodic &&
-                !(logEntry->logEntry->samples[i].type == ambit_log_sample_type_lapinfo &&
-                    (logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1e ||
-                     logEntry->logEntry->samples[i].u.lapinfo.event_type == 0x1f))) {
-                sampleList.append(i);
-            }
-        }
-
-        index = lastMatching + 1;
-    }
-
-    return sampleList;
-}
@@ -56,7 +56,6 @@ private:
         bool writePeriodicSample(ambit_log_sample_t *sample);
 
         QString dateTimeString(QDateTime &dateTime);
-        QList<int> rearrangeSamples();
 
         LogEntry *logEntry;
         QXmlStreamWriter xml;
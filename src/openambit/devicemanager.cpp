@@ -22,10 +22,16 @@
 #include "devicemanager.h"
 
 #include <QTimer>
+#include <QSet>
 #include <libambit.h>
 
+#define CHARGE_POLL_INTERVAL_MIN    10000   /* ms */
+#define CHARGE_POLL_INTERVAL_MAX    300000  /* ms */
+#define SESSION_FAILURES_MAX        2
+
 DeviceManager::DeviceManager(QObject *parent) :
-    QObject(parent), deviceObject(NULL), udevListener(NULL)
+    QObject(parent), udevListener(NULL), enumerationStale(false), syncSuccess(true),
+    chargePolling(false), chargeInterval(CHARGE_POLL_INTERVAL_MIN)
 {
     movesCount = MovesCount::instance();
 }
@@ -35,18 +41,22 @@ DeviceManager::~DeviceManager()
     mutex.lock();
     delete udevListener;
     chargeTimer.stop();
+    foreach (QString path, sessions.keys()) {
+        closeSession(path);
+    }
     mutex.unlock();
 }
 
 void DeviceManager::start()
 {
+    // Started and stopped from the manager's thread, see setChargePolling
+    chargeTimer.moveToThread(this->thread());
     connect(&chargeTimer, SIGNAL(timeout()), this, SLOT(chargeTimerHit()));
-    chargeTimer.setInterval(10000);
-    chargeTimer.start();
+    chargeTimer.setInterval(chargeInterval);
 
-    // Connect udev listener, fire a chargeTimerHit (implicit device detect), if hit
+    // Connect udev listener, devices are only enumerated again on its events
     udevListener = new UdevListener();
-    connect(udevListener, SIGNAL(deviceEvent()), this, SLOT(chargeTimerHit()));
+    connect(udevListener, SIGNAL(deviceEvent()), this, SLOT(hotplugEvent()));
 
     // Connect movescount Id feedback to local handler
     connect(movesCount, SIGNAL(logMoveID(QString,QDateTime,QString)), this, SLOT(logMovescountID(QString,QDateTime,QString)));
@@ -54,114 +64,102 @@ void DeviceManager::start()
 
 void DeviceManager::detect()
 {
-    int res = -1;
-
     mutex.lock();
-    if (this->deviceObject != NULL) {
-        libambit_close(this->deviceObject);
-        this->deviceObject = NULL;
-        emit deviceRemoved();
+    sessionFailures.clear();
+    // Reopen all devices, waits for running syncs to end. With all of
+    // them closed, every device can be queried again
+    foreach (QString path, sessions.keys()) {
+        closeSession(path);
     }
-
-    ambit_device_info_t *devinfo = libambit_enumerate();
-    if (devinfo) {
-        this->currentDeviceInfo = *devinfo;
-        emit deviceDetected(this->currentDeviceInfo);
-        this->deviceObject = libambit_new(devinfo);
-    }
-    libambit_free_enumeration(devinfo);
+    enumerationStale = true;
+    updateSessions();
     mutex.unlock();
-
-    if (res == 0) {
-        chargeTimerHit();
-    }
 }
 
 void DeviceManager::startSync(bool readAllLogs = false, bool syncTime = true, bool syncOrbit = true, bool syncMovescount = false)
 {
-    int res = -1;
-    time_t current_time;
-    struct tm *local_time;
-    uint8_t *orbitData;
-    int orbitDataLen;
+    bool noSessions;
 
     mutex.lock();
-    this->syncMovescount = syncMovescount;
-    currentSyncPart = 0;
-    syncParts = 2;
-    if (syncTime) syncParts++;
-    if (syncOrbit) syncParts+=2;
-
-    if (this->deviceObject != NULL) {
-        emit this->syncProgressInform(QString(tr("Reading personal settings")), false, true, 0);
-        res = libambit_personal_settings_get(this->deviceObject, &currentPersonalSettings);
-        currentSyncPart++;
-
-        libambit_sync_display_show(this->deviceObject);
-
-        if (syncTime && res != -1) {
-            emit this->syncProgressInform(QString(tr("Setting date/time")), false, true, 100*currentSyncPart/syncParts);
-            current_time = time(NULL);
-            local_time = localtime(&current_time);
-            res = libambit_date_time_set(this->deviceObject, local_time);
-            currentSyncPart++;
-        }
-
-        if (res != -1) {
-            emit this->syncProgressInform(QString(tr("Reading log files")), false, true, 100*currentSyncPart/syncParts);
-            res = libambit_log_read(this->deviceObject, readAllLogs ? NULL : &log_skip_cb, &log_push_cb, &log_progress_cb, this);
-            currentSyncPart++;
+    noSessions = sessions.isEmpty();
+    if (!noSessions) {
+        if (syncProgress.isEmpty()) {
+            syncSuccess = true;
         }
-
-        if (syncOrbit && res != -1) {
-            emit this->syncProgressInform(QString(tr("Fetching orbital data")), false, true, 100*currentSyncPart/syncParts);
-            if ((orbitDataLen = movesCount->getOrbitalData(&orbitData)) != -1) {
-                currentSyncPart++;
-                emit this->syncProgressInform(QString(tr("Writing orbital data")), false, false, 100*currentSyncPart/syncParts);
-                res = libambit_gps_orbit_write(this->deviceObject, orbitData, orbitDataLen);
-                free(orbitData);
-            }
-            else {
-                currentSyncPart++;
-                emit this->syncProgressInform(QString(tr("Failed to get orbital data")), true, false, 100*currentSyncPart/syncParts);
-                res = -1;
+        foreach (DeviceSession *session, sessions) {
+            // Devices detected while others sync join in, the rest are busy already
+            if (syncProgress.contains(session->serial())) {
+                continue;
             }
-
-            currentSyncPart++;
+            syncProgress.insert(session->serial(), 0);
+            QMetaObject::invokeMethod(session, "startSync", Qt::QueuedConnection,
+                                      Q_ARG(bool, readAllLogs), Q_ARG(bool, syncTime),
+                                      Q_ARG(bool, syncOrbit), Q_ARG(bool, syncMovescount));
         }
-
-        libambit_sync_display_clear(this->deviceObject);
     }
     mutex.unlock();
 
-    emit syncFinished(res >= 0);
+    if (noSessions) {
+        emit syncFinished(false);
 
-    if (res == -1) {
-        // Failed to read! We better try another detect
+        // Nothing to sync! We better try another detect
         detect();
     }
 }
 
-void DeviceManager::chargeTimerHit()
+void DeviceManager::setChargePolling(bool enabled)
 {
-    int res = -1;
-    ambit_device_status_t status;
+    chargePolling = enabled;
+    chargeInterval = CHARGE_POLL_INTERVAL_MIN;
+    chargeTimer.setInterval(chargeInterval);
+
+    if (enabled) {
+        chargeTimer.start();
+        chargeTimerHit();
+    }
+    else {
+        chargeTimer.stop();
+    }
+}
 
+void DeviceManager::chargeTimerHit()
+{
+    // Attached devices come from hotplug events, nothing to enumerate here
     if (mutex.tryLock()) {
-        if (this->deviceObject != NULL) {
-            if ((res = libambit_device_status_get(this->deviceObject, &status)) == 0) {
-                emit deviceCharge(status.charge);
-            }
+        foreach (DeviceSession *session, sessions) {
+            QMetaObject::invokeMethod(session, "chargeCheck", Qt::QueuedConnection);
         }
         mutex.unlock();
     }
+}
+
+void DeviceManager::hotplugEvent()
+{
+    // Only devices at new paths are queried, those with a session are
+    // never opened again while they may be syncing on their own thread
+    mutex.lock();
+    sessionFailures.clear();
+    updateSessions();
+    mutex.unlock();
+
+    if (chargePolling) {
+        setChargePolling(true);
+    }
+}
+
+void DeviceManager::sessionCharge(QString serial, quint8 percent)
+{
+    // Back off while nothing changes, e.g. a full watch left attached
+    if (lastCharge.contains(serial) && lastCharge[serial] == percent) {
+        chargeInterval = qMin(chargeInterval*2, CHARGE_POLL_INTERVAL_MAX);
+    }
     else {
-        res = 0;
+        chargeInterval = CHARGE_POLL_INTERVAL_MIN;
     }
+    lastCharge.insert(serial, percent);
 
-    if (res != 0) {
-        // Failed to read! We better try another detect
-        detect();
+    if (chargePolling && chargeTimer.interval() != chargeInterval) {
+        chargeTimer.start(chargeInterval);
     }
 }
 
@@ -170,34 +168,159 @@ void DeviceManager::logMovescountID(QString device, QDateTime time, QString move
     logStore.storeMovescountId(device, time, moveID);
 }
 
-int DeviceManager::log_skip_cb(void *ref, ambit_log_header_t *log_header)
+void DeviceManager::sessionFailed(QString serial)
+{
+    Q_UNUSED(serial);
+
+    mutex.lock();
+    // Failed to read! We better try another detect of this device. The
+    // enumeration is redone, so that a device that is gone stays closed
+    QString path = sessions.key(qobject_cast<DeviceSession*>(sender()));
+    if (!path.isEmpty()) {
+        sessionFailures[path]++;
+        closeSession(path);
+        stalePaths.insert(path);
+        updateSessions();
+    }
+    mutex.unlock();
+}
+
+void DeviceManager::sessionSyncFinished(QString serial, bool success)
 {
-    DeviceManager *manager = static_cast<DeviceManager*> (ref);
-    if (manager->logStore.logExists(manager->currentDeviceInfo.serial, log_header)) {
-        return 0;
+    bool allFinished = false;
+
+    emit deviceSyncFinished(serial, success);
+
+    mutex.lock();
+    if (syncProgress.remove(serial) > 0) {
+        syncSuccess = syncSuccess && success;
+        allFinished = syncProgress.isEmpty();
+    }
+    mutex.unlock();
+
+    if (allFinished) {
+        emit syncFinished(syncSuccess);
+    }
+}
+
+void DeviceManager::sessionSyncProgressInform(QString serial, QString message, bool error, bool newRow, quint8 percentDone)
+{
+    bool multiple;
+
+    emit deviceSyncProgressInform(serial, message, error, newRow, percentDone);
+
+    percentDone = overallProgress(serial, percentDone, &multiple);
+    if (multiple) {
+        message = QString("%1: %2").arg(serial).arg(message);
+    }
+    emit syncProgressInform(message, error, newRow, percentDone);
+}
+
+void DeviceManager::sessionSyncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone)
+{
+    bool multiple;
+
+    emit deviceSyncLogProgress(serial, logCurrent, logCount, percentDone);
+
+    percentDone = overallProgress(serial, percentDone, &multiple);
+    emit syncLogProgress(multiple ? serial : QString(), logCurrent, logCount, percentDone);
+}
+
+quint8 DeviceManager::overallProgress(QString serial, quint8 percentDone, bool *multiple)
+{
+    // Overall progress is that of the slowest device
+    mutex.lock();
+    if (syncProgress.contains(serial)) {
+        syncProgress[serial] = percentDone;
     }
-    return 1;
+    *multiple = syncProgress.count() > 1;
+    foreach (quint8 percent, syncProgress) {
+        if (percent < percentDone) {
+            percentDone = percent;
+        }
+    }
+    mutex.unlock();
+
+    return percentDone;
 }
 
-void DeviceManager::log_push_cb(void *ref, ambit_log_entry_t *log_entry)
+void DeviceManager::updateSessions()
 {
-    DeviceManager *manager = static_cast<DeviceManager*> (ref);
-    LogEntry *entry = manager->logStore.store(manager->currentDeviceInfo, &manager->currentPersonalSettings, log_entry);
-    if (entry != NULL) {
-        //! TODO: make this optional, only used for debugging
-        manager->movesCountXML.writeLog(entry);
+    QSet<QString> present;
+    ambit_device_info_t *devinfo, *current;
 
-        if (manager->syncMovescount) {
-            manager->movesCount->writeLog(entry);
+    // Cached device info is only dropped for devices without a session
+    if (enumerationStale) {
+        libambit_enumerate_invalidate();
+        enumerationStale = false;
+    }
+    foreach (QString path, stalePaths) {
+        if (!sessions.contains(path)) {
+            libambit_enumerate_invalidate_path(path.toLocal8Bit().constData());
         }
+    }
+    stalePaths.clear();
 
-        delete entry;
+    devinfo = libambit_enumerate_cached();
+    for (current = devinfo; current != NULL; current = current->next) {
+        QString path = QString::fromLocal8Bit(current->path);
+        present.insert(path);
+        if (!sessions.contains(path) && sessionFailures.value(path, 0) < SESSION_FAILURES_MAX) {
+            openSession(current);
+        }
+    }
+    libambit_free_enumeration(devinfo);
+
+    foreach (QString path, sessions.keys()) {
+        if (!present.contains(path)) {
+            closeSession(path);
+        }
     }
 }
 
-void DeviceManager::log_progress_cb(void *ref, uint16_t log_count, uint16_t log_current, uint8_t progress_percent)
+void DeviceManager::openSession(ambit_device_info_t *devinfo)
 {
-    DeviceManager *manager = static_cast<DeviceManager*> (ref);
-    progress_percent = 100*manager->currentSyncPart/manager->syncParts + progress_percent*1/manager->syncParts;
-    emit manager->syncProgressInform(QString(tr("Downloading log %1 of %2")).arg(log_current).arg(log_count), false, false, progress_percent);
+    QString path = QString::fromLocal8Bit(devinfo->path);
+    QThread *thread = new QThread();
+    DeviceSession *session = new DeviceSession(devinfo, &logStore);
+
+    session->moveToThread(thread);
+    connect(session, SIGNAL(deviceCharge(QString,quint8)), this, SIGNAL(deviceCharge(QString,quint8)));
+    connect(session, SIGNAL(deviceCharge(QString,quint8)), this, SLOT(sessionCharge(QString,quint8)));
+    connect(session, SIGNAL(deviceFailed(QString)), this, SLOT(sessionFailed(QString)));
+    connect(session, SIGNAL(syncFinished(QString,bool)), this, SLOT(sessionSyncFinished(QString,bool)));
+    connect(session, SIGNAL(syncProgressInform(QString,QString,bool,bool,quint8)), this, SLOT(sessionSyncProgressInform(QString,QString,bool,bool,quint8)));
+    connect(session, SIGNAL(syncLogProgress(QString,quint16,quint16,quint8)), this, SLOT(sessionSyncLogProgress(QString,quint16,quint16,quint8)));
+    thread->start();
+
+    sessions.insert(path, session);
+    sessionThreads.insert(path, thread);
+
+    emit deviceDetected(session->deviceInfo());
+}
+
+void DeviceManager::closeSession(QString path)
+{
+    DeviceSession *session = sessions.take(path);
+    QThread *thread = sessionThreads.take(path);
+    QString serial = session->serial();
+    bool allFinished = false;
+
+    // Let a running sync end before the device is closed
+    thread->quit();
+    thread->wait();
+    delete session;
+    delete thread;
+    lastCharge.remove(serial);
+
+    // A sync in progress on the device won't be reported anymore
+    if (syncProgress.remove(serial) > 0) {
+        syncSuccess = false;
+        allFinished = syncProgress.isEmpty();
+    }
+
+    emit deviceRemoved(serial);
+    if (allFinished) {
+        emit syncFinished(false);
+    }
 }
@@ -28,11 +28,13 @@
 #include <QTimer>
 #include <QMetaType>
 #include <QSocketNotifier>
+#include <QMap>
+#include <QSet>
 
 #include "settings.h"
 #include <movescount/logstore.h>
 #include <movescount/movescount.h>
-#include <movescount/movescountxml.h>
+#include "devicesession.h"
 #include "udevlistener.h"
 #include <libambit.h>
 
@@ -47,37 +49,67 @@ public:
     void start();
 signals:
     void deviceDetected(const DeviceInfo& deviceInfo);
-    void deviceRemoved(void);
-    void deviceCharge(quint8 percent);
+    void deviceRemoved(QString serial);
+    void deviceCharge(QString serial, quint8 percent);
     void syncFinished(bool success);
     void syncProgressInform(QString message, bool error, bool newRow, quint8 percentDone);
+    /**
+     * Download progress of the current stage. The serial is only set
+     * while several devices sync, percentDone is that of all of them
+     */
+    void syncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone);
+    void deviceSyncFinished(QString serial, bool success);
+    void deviceSyncProgressInform(QString serial, QString message, bool error, bool newRow, quint8 percentDone);
+    void deviceSyncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone);
 public slots:
     void detect(void);
     void startSync(bool readAllLogs, bool syncTime, bool syncOrbit, bool syncMovescount);
+    /**
+     * Poll the charge of attached devices, only needed while it is shown.
+     * Attach and detach are seen from hotplug events either way
+     */
+    void setChargePolling(bool enabled);
 
 private slots:
     void chargeTimerHit();
+    void hotplugEvent();
+    void sessionCharge(QString serial, quint8 percent);
     void logMovescountID(QString device, QDateTime time, QString moveID);
+    void sessionFailed(QString serial);
+    void sessionSyncFinished(QString serial, bool success);
+    void sessionSyncProgressInform(QString serial, QString message, bool error, bool newRow, quint8 percentDone);
+    void sessionSyncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone);
 
 private:
-    static int log_skip_cb(void *ref, ambit_log_header_t *log_header);
-    static void log_push_cb(void *ref, ambit_log_entry_t *log_entry);
-    static void log_progress_cb(void *ref, uint16_t log_count, uint16_t log_current, uint8_t progress_percent);
+    void updateSessions();
+    void openSession(ambit_device_info_t *devinfo);
+    void closeSession(QString path);
+    quint8 overallProgress(QString serial, quint8 percentDone, bool *multiple);
 
-    ambit_object_t *deviceObject;
     UdevListener *udevListener;
+    bool enumerationStale;          /* all device info, while no session is open */
+    QSet<QString> stalePaths;       /* device info of paths without a session */
 
-    DeviceInfo currentDeviceInfo;
-    ambit_personal_settings_t currentPersonalSettings;
+    // Attached devices by device path, each session runs in its own thread
+    QMap<QString, DeviceSession*> sessions;
+    QMap<QString, QThread*> sessionThreads;
 
-    int syncParts;
-    int currentSyncPart;
-    bool syncMovescount;
+    // Progress of the sessions still syncing, by serial
+    QMap<QString, quint8> syncProgress;
+    bool syncSuccess;
+
+    // Failed sessions by device path, not reopened again until the next
+    // hotplug event or detect once they have failed too often
+    QMap<QString, int> sessionFailures;
+
+    // Charge is polled less often while it does not change
+    bool chargePolling;
+    int chargeInterval;
+    QMap<QString, quint8> lastCharge;
 
     QMutex mutex;
     QTimer chargeTimer;
     MovesCount *movesCount;
-    MovesCountXML movesCountXML;
     Settings settings;
     LogStore logStore;
 };
@@ -0,0 +1,438 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "devicesession.h"
+#include "settings.h"
+
+#include <QDebug>
+#include <QSet>
+
+// Download progress signals a second at most, each wakes the GUI thread
+#define SYNC_PROGRESS_RATE_MAX  10
+
+// Log read requests in flight, and logs read ahead of the one decoded
+#define LOG_READ_PIPELINE_DEPTH 4
+#define LOG_DECODE_QUEUE_DEPTH  2
+
+DeviceSession::DeviceSession(ambit_device_info_t *devinfo, LogStore *logStore, QObject *parent) :
+    QObject(parent), personalSettingsRead(false), personalSettingsFailed(false), logChunkSizeTuned(false), logStoreFailed(false),
+    progressPending(false), pendingLogCurrent(0), pendingLogCount(0), pendingPercent(0), logStore(logStore)
+{
+    this->currentDeviceInfo = *devinfo;
+    this->deviceObject = libambit_new(devinfo);
+    movesCount = MovesCount::instance();
+
+    if (this->deviceObject != NULL) {
+        // Keep the device busy while logs are decoded and stored, batch
+        // native devices (Ambit3) also decode in a thread of their own
+        libambit_log_pipeline_set(this->deviceObject, LOG_READ_PIPELINE_DEPTH);
+        if (libambit_log_read_batch_native(this->deviceObject)) {
+            libambit_log_decode_thread_set(this->deviceObject, LOG_DECODE_QUEUE_DEPTH);
+        }
+
+        // Use the chunk size tuned by an earlier session, as long as the
+        // firmware is the same
+        Settings settings;
+        settings.beginGroup("deviceSettings");
+        settings.beginGroup(currentDeviceInfo.serial);
+        uint chunkSize = settings.value("logChunkSize", 0).toUInt();
+        if (chunkSize > 0 && settings.value("logChunkSizeFirmware").toString() == firmwareVersion() &&
+            libambit_log_chunk_size_set(this->deviceObject, chunkSize) == 0) {
+            logChunkSizeTuned = true;
+        }
+        settings.endGroup();
+        settings.endGroup();
+    }
+}
+
+DeviceSession::~DeviceSession()
+{
+    mutex.lock();
+    if (this->deviceObject != NULL) {
+        libambit_close(this->deviceObject);
+        this->deviceObject = NULL;
+    }
+    mutex.unlock();
+}
+
+const DeviceInfo& DeviceSession::deviceInfo() const
+{
+    return currentDeviceInfo;
+}
+
+QString DeviceSession::serial() const
+{
+    return currentDeviceInfo.serial;
+}
+
+QString DeviceSession::firmwareVersion() const
+{
+    return QString("%1.%2.%3").arg(currentDeviceInfo.fw_version[0]).arg(currentDeviceInfo.fw_version[1]).arg(currentDeviceInfo.fw_version[2]);
+}
+
+void DeviceSession::startSync(bool readAllLogs, bool syncTime, bool syncOrbit, bool syncMovescount)
+{
+    int res = -1;
+    time_t current_time;
+    struct tm *local_time;
+    uint8_t *orbitData;
+    uint8_t orbitHeader[8];
+    int orbitDataLen;
+    QString serial = this->serial();
+    Settings settings;
+
+    settings.beginGroup("movescountSettings");
+    exporter.setXMLExport(settings.value("storeDebugFiles", false).toBool());
+    settings.endGroup();
+    settings.beginGroup("syncSettings");
+    bool unsyncedOnly = settings.value("syncUnsyncedOnly", false).toBool();
+    settings.endGroup();
+
+    mutex.lock();
+    this->syncMovescount = syncMovescount;
+    currentSyncPart = 0;
+    syncParts = 1;
+    if (syncTime) syncParts++;
+    if (syncOrbit) syncParts+=2;
+    personalSettingsRead = false;
+    personalSettingsFailed = false;
+    progressSent = QTime();
+    progressPending = false;
+
+    if (this->deviceObject != NULL) {
+        // Once per device and firmware, before the stats of the sync
+        if (!logChunkSizeTuned) {
+            logChunkSizeTuned = true;
+            int chunkSize = libambit_log_chunk_size_tune(this->deviceObject);
+            if (chunkSize > 0) {
+                settings.beginGroup("deviceSettings");
+                settings.beginGroup(serial);
+                settings.setValue("logChunkSize", chunkSize);
+                settings.setValue("logChunkSizeFirmware", firmwareVersion());
+                settings.endGroup();
+                settings.endGroup();
+            }
+        }
+
+        libambit_stats_reset(this->deviceObject);
+
+        // The download only needs the network, it runs while the device
+        // is busy with the logs
+        if (syncOrbit) {
+            movesCount->prefetchOrbitalData();
+        }
+
+        res = 0;
+        if (readAllLogs || !libambit_log_read_batch_native(this->deviceObject)) {
+            // Every log is read and needs the settings anyway, or the
+            // headers come one by one amid device commands that the
+            // settings read must not get in between of, fail early
+            reportProgress(tr("Reading personal settings"), false, true);
+            if (!readPersonalSettings()) {
+                res = -1;
+            }
+        }
+
+        libambit_sync_display_show(this->deviceObject);
+
+        if (syncTime && res != -1) {
+            reportProgress(tr("Setting date/time"), false, true);
+            current_time = time(NULL);
+            local_time = localtime(&current_time);
+            res = libambit_date_time_set(this->deviceObject, local_time);
+            currentSyncPart++;
+        }
+
+        if (res != -1) {
+            reportProgress(tr("Reading log files"), false, true);
+            // Logs synced by Moveslink are only read when asked for all
+            libambit_log_read_unsynced_only(this->deviceObject, unsyncedOnly && !readAllLogs);
+            if (readAllLogs) {
+                res = libambit_log_read(this->deviceObject, NULL, &log_push_cb, &log_progress_cb, this);
+            }
+            else {
+                // One directory listing instead of a lookup per header
+                storedLogTimes.clear();
+                foreach (LogStore::LogDirEntry dirEntry, logStore->dir(currentDeviceInfo.serial)) {
+                    storedLogTimes.insert(dirEntry.time.toTime_t());
+                }
+                applySyncCursor();
+                logStoreFailed = false;
+                res = libambit_log_read_batch(this->deviceObject, &log_select_cb, &log_push_cb, &log_progress_cb, this);
+                if (res >= 0) {
+                    saveSyncCursor();
+                }
+            }
+            flushLogProgress();
+            if (personalSettingsFailed) {
+                res = -1;
+            }
+            currentSyncPart++;
+
+            // Charge checks queued behind the sync are skipped, report it
+            // between the device stages instead
+            if (res != -1) {
+                reportCharge();
+            }
+        }
+
+        if (syncOrbit && res != -1) {
+            reportProgress(tr("Fetching orbital data"), false, true);
+            if (libambit_gps_orbit_header_read(this->deviceObject, orbitHeader) == 0 &&
+                movesCount->isOrbitalDataCurrent(QByteArray((const char*)orbitHeader, sizeof(orbitHeader)))) {
+                // The device already has the data we would fetch
+                currentSyncPart++;
+                reportProgress(tr("Orbital data is up to date"), false, false);
+            }
+            else if ((orbitDataLen = movesCount->getOrbitalData(&orbitData)) != -1) {
+                currentSyncPart++;
+                reportProgress(tr("Writing orbital data"), false, false);
+                res = libambit_gps_orbit_write(this->deviceObject, orbitData, orbitDataLen);
+                free(orbitData);
+            }
+            else {
+                currentSyncPart++;
+                reportProgress(tr("Failed to get orbital data"), true, false);
+                res = -1;
+            }
+
+            currentSyncPart++;
+        }
+
+        libambit_sync_display_clear(this->deviceObject);
+
+        logSyncStats();
+    }
+    mutex.unlock();
+
+    // The sync is done once the logs read are exported and queued for
+    // upload
+    exporter.waitForDone();
+
+    emit syncFinished(serial, res >= 0);
+
+    if (res == -1) {
+        // Failed to read! Let the manager try another detect
+        emit deviceFailed(serial);
+    }
+}
+
+void DeviceSession::reportCharge()
+{
+    ambit_device_status_t status;
+
+    if (libambit_device_status_get(this->deviceObject, &status) == 0) {
+        emit deviceCharge(serial(), status.charge);
+    }
+}
+
+void DeviceSession::chargeCheck()
+{
+    int res = -1;
+    ambit_device_status_t status;
+
+    if (mutex.tryLock()) {
+        if (this->deviceObject != NULL) {
+            if ((res = libambit_device_status_get(this->deviceObject, &status)) == 0) {
+                emit deviceCharge(serial(), status.charge);
+            }
+        }
+        mutex.unlock();
+    }
+    else {
+        res = 0;
+    }
+
+    if (res != 0) {
+        // Failed to read! Let the manager try another detect
+        emit deviceFailed(serial());
+    }
+}
+
+void DeviceSession::reportProgress(QString message, bool error, bool newRow)
+{
+    // Keep the order, download progress before the stage that follows it
+    flushLogProgress();
+    emit syncProgressInform(serial(), message, error, newRow, 100*currentSyncPart/syncParts);
+}
+
+void DeviceSession::reportLogProgress(quint16 logCurrent, quint16 logCount, quint8 percentDone)
+{
+    pendingLogCurrent = logCurrent;
+    pendingLogCount = logCount;
+    pendingPercent = percentDone;
+    progressPending = true;
+
+    // Updates in between are merged into the next one sent
+    if (progressSent.isNull() || progressSent.elapsed() >= 1000/SYNC_PROGRESS_RATE_MAX) {
+        flushLogProgress();
+    }
+}
+
+void DeviceSession::flushLogProgress()
+{
+    if (progressPending) {
+        progressPending = false;
+        progressSent.start();
+        emit syncLogProgress(serial(), pendingLogCurrent, pendingLogCount, pendingPercent);
+    }
+}
+
+bool DeviceSession::readPersonalSettings()
+{
+    if (!personalSettingsRead) {
+        if (libambit_personal_settings_get(this->deviceObject, &currentPersonalSettings) != 0) {
+            personalSettingsFailed = true;
+            return false;
+        }
+        personalSettingsRead = true;
+    }
+
+    return true;
+}
+
+void DeviceSession::applySyncCursor()
+{
+    Settings settings;
+    ambit_log_sync_cursor_t cursor;
+    QDateTime dateTime;
+    uint address;
+    bool ok = false;
+
+    settings.beginGroup("deviceSettings");
+    settings.beginGroup(serial());
+    dateTime = settings.value("syncCursorTime").toDateTime();
+    address = settings.value("syncCursorAddress").toUInt(&ok);
+    settings.endGroup();
+    settings.endGroup();
+
+    // Start after the newest log synced before, as long as it is still
+    // in the store, else walk all logs
+    if (ok && dateTime.isValid() && storedLogTimes.contains(dateTime.toTime_t())) {
+        cursor.date_time.year = dateTime.date().year();
+        cursor.date_time.month = dateTime.date().month();
+        cursor.date_time.day = dateTime.date().day();
+        cursor.date_time.hour = dateTime.time().hour();
+        cursor.date_time.minute = dateTime.time().minute();
+        cursor.date_time.msec = dateTime.time().second()*1000 + dateTime.time().msec();
+        cursor.address = address;
+        libambit_log_sync_cursor_set(this->deviceObject, &cursor);
+    }
+    else {
+        libambit_log_sync_cursor_set(this->deviceObject, NULL);
+    }
+}
+
+void DeviceSession::saveSyncCursor()
+{
+    Settings settings;
+    ambit_log_sync_cursor_t cursor;
+
+    settings.beginGroup("deviceSettings");
+    settings.beginGroup(serial());
+    if (logStoreFailed) {
+        // A log that was read but not stored must be read again
+        libambit_log_sync_cursor_set(this->deviceObject, NULL);
+        settings.remove("syncCursorTime");
+        settings.remove("syncCursorAddress");
+    }
+    else if (libambit_log_sync_cursor_get(this->deviceObject, &cursor) == 0) {
+        QDateTime dateTime(QDate(cursor.date_time.year, cursor.date_time.month, cursor.date_time.day),
+                           QTime(cursor.date_time.hour, cursor.date_time.minute, 0).addMSecs(cursor.date_time.msec));
+        settings.setValue("syncCursorTime", dateTime);
+        settings.setValue("syncCursorAddress", cursor.address);
+    }
+    settings.endGroup();
+    settings.endGroup();
+}
+
+void DeviceSession::logSyncStats()
+{
+    ambit_command_stats_t stats[32];
+    int count, i;
+
+    count = libambit_stats_get(this->deviceObject, stats, sizeof(stats)/sizeof(stats[0]));
+    if (count > (int)(sizeof(stats)/sizeof(stats[0]))) {
+        count = sizeof(stats)/sizeof(stats[0]);
+    }
+
+    for (i=0; i<count; i++) {
+        qDebug() << QString("Sync %1: command 0x%2, %3 calls, %4 failures, %5 bytes out, %6 bytes in, average %7 ms, max %8 ms")
+                    .arg(serial())
+                    .arg(stats[i].command, 4, 16, QChar('0'))
+                    .arg(stats[i].calls)
+                    .arg(stats[i].failures)
+                    .arg(stats[i].bytes_out)
+                    .arg(stats[i].bytes_in)
+                    .arg(stats[i].replies > 0 ? stats[i].latency_total/stats[i].replies/1000.0 : 0.0, 0, 'f', 1)
+                    .arg(stats[i].latency_max/1000.0, 0, 'f', 1);
+    }
+}
+
+void DeviceSession::log_select_cb(void *ref, ambit_log_header_t *log_headers, size_t count, bool *read)
+{
+    DeviceSession *session = static_cast<DeviceSession*> (ref);
+    bool wanted = false;
+    size_t i;
+
+    for (i=0; i<count; i++) {
+        ambit_date_time_t *date_time = &log_headers[i].date_time;
+        QDateTime dateTime(QDate(date_time->year, date_time->month, date_time->day),
+                           QTime(date_time->hour, date_time->minute, date_time->msec/1000));
+        read[i] = !session->storedLogTimes.contains(dateTime.toTime_t());
+        wanted = wanted || read[i];
+    }
+
+    // The settings are stored with each log, only read them once there
+    // is a log to store, most syncs have none. Devices that are not batch
+    // native already have them from before the read.
+    if (wanted && !session->readPersonalSettings()) {
+        // Nothing gets read, the failed sync offers the logs again next
+        // time rather than counting them as stored
+        for (i=0; i<count; i++) {
+            read[i] = false;
+        }
+    }
+}
+
+// Called from the libambit decode thread on devices that have one, the
+// log store and exporter are shared between threads anyway, and
+// logStoreFailed is only read once the log read has returned
+void DeviceSession::log_push_cb(void *ref, ambit_log_entry_t *log_entry)
+{
+    DeviceSession *session = static_cast<DeviceSession*> (ref);
+    LogEntry *entry = session->logStore->store(session->currentDeviceInfo, &session->currentPersonalSettings, log_entry);
+    if (entry != NULL) {
+        // Stored, export and upload without holding up the device
+        session->exporter.enqueue(entry, session->syncMovescount);
+    }
+    else {
+        session->logStoreFailed = true;
+        libambit_log_entry_free(log_entry);
+    }
+}
+
+void DeviceSession::log_progress_cb(void *ref, uint16_t log_count, uint16_t log_current, uint8_t progress_percent)
+{
+    DeviceSession *session = static_cast<DeviceSession*> (ref);
+    progress_percent = 100*session->currentSyncPart/session->syncParts + progress_percent*1/session->syncParts;
+    session->reportLogProgress(log_current, log_count, progress_percent);
+}
@@ -0,0 +1,105 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef DEVICESESSION_H
+#define DEVICESESSION_H
+
+#include <QObject>
+#include <QMutex>
+#include <QSet>
+#include <QTime>
+
+#include <movescount/logstore.h>
+#include <movescount/movescount.h>
+#include <libambit.h>
+
+#include "logexporter.h"
+
+/**
+ * One attached device. Each session is moved to a thread of its own by
+ * DeviceManager, so that several devices can be synced at the same time.
+ */
+class DeviceSession : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DeviceSession(ambit_device_info_t *devinfo, LogStore *logStore, QObject *parent = 0);
+    ~DeviceSession();
+
+    const DeviceInfo& deviceInfo() const;
+    QString serial() const;
+    QString firmwareVersion() const;
+signals:
+    void deviceCharge(QString serial, quint8 percent);
+    void deviceFailed(QString serial);
+    void syncFinished(QString serial, bool success);
+    void syncProgressInform(QString serial, QString message, bool error, bool newRow, quint8 percentDone);
+    /**
+     * Download progress, merged to at most SYNC_PROGRESS_RATE_MAX
+     * signals a second. Stage messages and the end of a download are
+     * always sent
+     */
+    void syncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone);
+public slots:
+    void startSync(bool readAllLogs, bool syncTime, bool syncOrbit, bool syncMovescount);
+    void chargeCheck();
+
+private:
+    void logSyncStats();
+    bool readPersonalSettings();
+    void applySyncCursor();
+    void saveSyncCursor();
+    void reportCharge();
+    void reportProgress(QString message, bool error, bool newRow);
+    void reportLogProgress(quint16 logCurrent, quint16 logCount, quint8 percentDone);
+    void flushLogProgress();
+
+    static void log_select_cb(void *ref, ambit_log_header_t *log_headers, size_t count, bool *read);
+    static void log_push_cb(void *ref, ambit_log_entry_t *log_entry);
+    static void log_progress_cb(void *ref, uint16_t log_count, uint16_t log_current, uint8_t progress_percent);
+
+    ambit_object_t *deviceObject;
+    DeviceInfo currentDeviceInfo;
+    ambit_personal_settings_t currentPersonalSettings;
+    bool personalSettingsRead;
+    bool personalSettingsFailed;
+    bool logChunkSizeTuned;
+    bool logStoreFailed;
+    QSet<uint> storedLogTimes;
+
+    int syncParts;
+    int currentSyncPart;
+    bool syncMovescount;
+
+    // Download progress not yet sent
+    QTime progressSent;
+    bool progressPending;
+    quint16 pendingLogCurrent;
+    quint16 pendingLogCount;
+    quint8 pendingPercent;
+
+    QMutex mutex;
+    MovesCount *movesCount;
+    LogExporter exporter;
+    LogStore *logStore;
+};
+
+#endif // DEVICESESSION_H
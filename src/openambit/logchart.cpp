@@ -0,0 +1,268 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logchart.h"
+
+#include <QMouseEvent>
+#include <QPainter>
+#include <QPolygonF>
+#include <QWheelEvent>
+#include <qmath.h>
+
+// Shortest time range zoomed to, in ms
+#define CHART_MIN_SPAN      10000
+// Zoom per wheel step of 120
+#define CHART_ZOOM_FACTOR   0.8
+
+typedef struct chart_series_s {
+    LogChartData::Series series;
+    const char *name;
+    QRgb color;
+} chart_series_t;
+
+static const chart_series_t chartSeries[] = {
+    { LogChartData::HeartRate, QT_TRANSLATE_NOOP("LogChart", "HR (bpm)"), 0xc0392b },
+    { LogChartData::Altitude, QT_TRANSLATE_NOOP("LogChart", "Altitude (m)"), 0x27ae60 },
+    { LogChartData::Speed, QT_TRANSLATE_NOOP("LogChart", "Speed (km/h)"), 0x2980b9 }
+};
+
+LogChart::LogChart(QWidget *parent) :
+    QWidget(parent), chartData(NULL), viewFrom(0), viewTo(0), dragging(false), dragX(0), dragFrom(0)
+{
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Preferred);
+    hide();
+}
+
+LogChart::~LogChart()
+{
+    delete chartData;
+}
+
+void LogChart::showChart(LogChartData *chartData)
+{
+    delete this->chartData;
+    this->chartData = chartData;
+    dragging = false;
+
+    if (chartData == NULL || chartData->duration() == 0) {
+        hide();
+        return;
+    }
+
+    viewFrom = 0;
+    viewTo = chartData->duration();
+    show();
+    update();
+}
+
+void LogChart::hideChart()
+{
+    showChart(NULL);
+}
+
+QSize LogChart::sizeHint() const
+{
+    return QSize(400, 240);
+}
+
+void LogChart::paintEvent(QPaintEvent *event)
+{
+    QList<LogChartData::Series> shown;
+    QRect plot = contentsRect();
+    int axisHeight = fontMetrics().height() + 4;
+    int laneHeight, i;
+
+    Q_UNUSED(event);
+
+    if (chartData == NULL) {
+        return;
+    }
+
+    for (i=0; i<(int)(sizeof(chartSeries)/sizeof(chartSeries[0])); i++) {
+        if (!chartData->isEmpty(chartSeries[i].series)) {
+            shown.append(chartSeries[i].series);
+        }
+    }
+    if (shown.isEmpty() || plot.height() <= axisHeight) {
+        return;
+    }
+
+    QPainter painter(this);
+    painter.fillRect(plot, palette().base());
+
+    plot.setBottom(plot.bottom() - axisHeight);
+    laneHeight = plot.height()/shown.count();
+    for (i=0; i<shown.count(); i++) {
+        paintSeries(&painter, shown[i], QRect(plot.left(), plot.top() + i*laneHeight, plot.width(), laneHeight));
+    }
+
+    painter.setPen(palette().text().color());
+    QRect axis(plot.left() + 4, plot.bottom() + 2, plot.width() - 8, axisHeight - 2);
+    painter.drawText(axis, Qt::AlignLeft | Qt::AlignVCenter, msecToHHMMSS(viewFrom));
+    painter.drawText(axis, Qt::AlignRight | Qt::AlignVCenter, msecToHHMMSS(viewTo));
+}
+
+void LogChart::paintSeries(QPainter *painter, LogChartData::Series series, const QRect &rect)
+{
+    QPolygonF upper, lower;
+    float min, max;
+    double span = viewTo - viewFrom, xScale, yScale;
+    const chart_series_t *info = &chartSeries[0];
+    int i;
+
+    if (!chartData->range(series, &min, &max) || span <= 0 || rect.height() <= 2) {
+        return;
+    }
+    if (max - min < 1) {
+        min -= 0.5;
+        max += 0.5;
+    }
+
+    // About one bucket per pixel, the pyramid picks the level
+    QVector<LogChartData::Bucket> buckets = chartData->buckets(series, viewFrom, viewTo, rect.width());
+    xScale = rect.width()/span;
+    yScale = (rect.height() - 2)/(max - min);
+    foreach (const LogChartData::Bucket &bucket, buckets) {
+        double x = rect.left() + ((double)bucket.time - viewFrom)*xScale;
+        upper.append(QPointF(x, rect.bottom() - 1 - (bucket.max - min)*yScale));
+        lower.append(QPointF(x, rect.bottom() - 1 - (bucket.min - min)*yScale));
+    }
+
+    for (i=0; i<(int)(sizeof(chartSeries)/sizeof(chartSeries[0])); i++) {
+        if (chartSeries[i].series == series) {
+            info = &chartSeries[i];
+        }
+    }
+
+    painter->save();
+    painter->setClipRect(rect);
+
+    // Buckets of coarse levels draw as their min/max envelope
+    QColor color(info->color);
+    QColor fill(color);
+    fill.setAlpha(96);
+    painter->setPen(color);
+    painter->setBrush(fill);
+    for (i=lower.count()-1; i>=0; i--) {
+        upper.append(lower[i]);
+    }
+    painter->drawPolygon(upper);
+
+    painter->setPen(palette().text().color());
+    painter->drawText(rect.adjusted(4, 2, -4, -2), Qt::AlignLeft | Qt::AlignTop,
+                      QString("%1  %2 - %3").arg(tr(info->name)).arg(min, 0, 'f', 0).arg(max, 0, 'f', 0));
+    painter->restore();
+}
+
+void LogChart::wheelEvent(QWheelEvent *event)
+{
+    double factor;
+    qint64 anchor;
+
+    if (chartData == NULL) {
+        event->ignore();
+        return;
+    }
+
+    factor = qPow(CHART_ZOOM_FACTOR, event->delta()/120.0);
+    anchor = timeAt(event->pos().x());
+    setView(anchor - (qint64)((anchor - viewFrom)*factor), anchor + (qint64)((viewTo - anchor)*factor));
+    event->accept();
+}
+
+void LogChart::mousePressEvent(QMouseEvent *event)
+{
+    if (chartData != NULL && event->button() == Qt::LeftButton) {
+        dragging = true;
+        dragX = event->pos().x();
+        dragFrom = viewFrom;
+        setCursor(Qt::ClosedHandCursor);
+    }
+}
+
+void LogChart::mouseMoveEvent(QMouseEvent *event)
+{
+    qint64 span = viewTo - viewFrom, from;
+
+    if (dragging && contentsRect().width() > 0) {
+        from = dragFrom - (qint64)(event->pos().x() - dragX)*span/contentsRect().width();
+        setView(from, from + span);
+    }
+}
+
+void LogChart::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (dragging && event->button() == Qt::LeftButton) {
+        dragging = false;
+        unsetCursor();
+    }
+}
+
+void LogChart::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    Q_UNUSED(event);
+
+    if (chartData != NULL) {
+        setView(0, chartData->duration());
+    }
+}
+
+QString LogChart::msecToHHMMSS(quint32 msec)
+{
+    quint32 hours;
+    quint8 minutes;
+    quint8 seconds;
+
+    hours = msec / (3600000);
+    minutes = (msec - hours*3600000) / 60000;
+    seconds = (msec - hours*3600000 - minutes*60000) / 1000;
+
+    return QString("%1:%2:%3").arg(hours, 2, 10, QChar('0')).arg(minutes, 2, 10, QChar('0')).arg(seconds, 2, 10, QChar('0'));
+}
+
+qint64 LogChart::timeAt(int x) const
+{
+    QRect rect = contentsRect();
+
+    if (rect.width() <= 0) {
+        return viewFrom;
+    }
+
+    return viewFrom + (qint64)(x - rect.left())*(viewTo - viewFrom)/rect.width();
+}
+
+void LogChart::setView(qint64 from, qint64 to)
+{
+    qint64 duration = chartData->duration();
+    qint64 span = qBound(qMin((qint64)CHART_MIN_SPAN, duration), to - from, duration);
+
+    // Keep the span when running into either end of the log
+    if (from < 0) {
+        from = 0;
+    }
+    if (from + span > duration) {
+        from = duration - span;
+    }
+
+    viewFrom = from;
+    viewTo = from + span;
+    update();
+}
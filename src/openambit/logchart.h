@@ -0,0 +1,72 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGCHART_H
+#define LOGCHART_H
+
+#include <QWidget>
+
+#include <movescount/logchartdata.h>
+
+class QPainter;
+
+/**
+ * HR, altitude and speed of a log over time. The wheel zooms around the
+ * pointer, dragging pans and a double click shows the whole log again
+ */
+class LogChart : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit LogChart(QWidget *parent = 0);
+    ~LogChart();
+
+    /**
+     * Show chart data, the chart takes ownership. NULL hides the chart
+     */
+    void showChart(LogChartData *chartData);
+    void hideChart();
+
+    QSize sizeHint() const;
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void wheelEvent(QWheelEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseReleaseEvent(QMouseEvent *event);
+    void mouseDoubleClickEvent(QMouseEvent *event);
+
+private:
+    void paintSeries(QPainter *painter, LogChartData::Series series, const QRect &rect);
+    QString msecToHHMMSS(quint32 msec);
+    qint64 timeAt(int x) const;
+    void setView(qint64 from, qint64 to);
+
+    LogChartData *chartData;
+    quint32 viewFrom;
+    quint32 viewTo;
+    bool dragging;
+    int dragX;
+    quint32 dragFrom;
+};
+
+#endif // LOGCHART_H
@@ -0,0 +1,150 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "logexporter.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+// Logs decoded but not yet exported, bounds the memory used when the
+// network is slower than the device
+#define LOG_EXPORT_QUEUE_MAX    4
+
+class LogExporter::XMLTask : public QRunnable
+{
+public:
+    XMLTask(LogExporter *exporter, LogEntry *entry) :
+        exporter(exporter), entry(entry)
+    {
+    }
+
+    void run()
+    {
+        exporter->movesCountXML.writeLog(entry);
+        delete entry;
+
+        exporter->freeXMLSlots.release();
+    }
+
+private:
+    LogExporter *exporter;
+    LogEntry *entry;
+};
+
+LogExporter::LogExporter(QObject *parent) :
+    QObject(parent), pending(0), freeSlots(LOG_EXPORT_QUEUE_MAX), xmlExport(false),
+    freeXMLSlots(qMax(2, 2*QThread::idealThreadCount()))
+{
+
+    movesCount = MovesCount::instance();
+
+    this->moveToThread(&workerThread);
+    workerThread.start();
+}
+
+LogExporter::~LogExporter()
+{
+    waitForDone();
+    xmlPool.waitForDone();
+    workerThread.exit();
+    workerThread.wait();
+}
+
+void LogExporter::enqueue(LogEntry *entry, bool upload)
+{
+    Job job;
+
+    job.entry = entry;
+    job.upload = upload;
+
+    freeSlots.acquire();
+
+    mutex.lock();
+    jobs.enqueue(job);
+    pending++;
+    mutex.unlock();
+
+    QMetaObject::invokeMethod(this, "processQueue", Qt::QueuedConnection);
+}
+
+void LogExporter::setXMLExport(bool enabled)
+{
+    mutex.lock();
+    xmlExport = enabled;
+    mutex.unlock();
+}
+
+void LogExporter::exportXML(LogEntry *entry)
+{
+    // Bounds the logs held in memory while the pool is busy
+    freeXMLSlots.acquire();
+    xmlPool.start(new XMLTask(this, entry));
+}
+
+void LogExporter::waitForXMLExports()
+{
+    xmlPool.waitForDone();
+}
+
+void LogExporter::waitForDone()
+{
+    QMutexLocker locker(&mutex);
+
+    while (pending > 0) {
+        done.wait(&mutex);
+    }
+}
+
+void LogExporter::processQueue()
+{
+    Job job;
+    bool xml;
+
+    forever {
+        mutex.lock();
+        if (jobs.isEmpty()) {
+            mutex.unlock();
+            return;
+        }
+        job = jobs.dequeue();
+        xml = xmlExport;
+        mutex.unlock();
+
+        if (xml) {
+            // Copies share the samples, the upload is not held up
+            exportXML(new LogEntry(*job.entry));
+        }
+
+        if (job.upload) {
+            movesCount->writeLog(job.entry);
+        }
+
+        delete job.entry;
+
+        mutex.lock();
+        if (--pending == 0) {
+            done.wakeAll();
+        }
+        mutex.unlock();
+
+        freeSlots.release();
+    }
+}
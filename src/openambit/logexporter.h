@@ -0,0 +1,103 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGEXPORTER_H
+#define LOGEXPORTER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSemaphore>
+#include <QQueue>
+#include <QThreadPool>
+
+#include <movescount/logentry.h>
+#include <movescount/movescount.h>
+#include <movescount/movescountxml.h>
+
+/**
+ * Exports stored logs and queues them for upload on a thread of its
+ * own, so that reading logs from a device never waits for the disk or
+ * the network. The optional Movescount XML files are written on a pool
+ * of their own.
+ */
+class LogExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LogExporter(QObject *parent = 0);
+    ~LogExporter();
+
+    /**
+     * Queue a stored log for export and optionally upload. Blocks only
+     * while the queue is full
+     * \param entry Log entry, owned by the exporter from now on
+     * \param upload Also upload to Movescount
+     */
+    void enqueue(LogEntry *entry, bool upload);
+    /**
+     * Write Movescount XML files of the logs enqueued from now on, off
+     * by default as they are only used for debugging
+     */
+    void setXMLExport(bool enabled);
+    /**
+     * Write the Movescount XML file of a log, using all cores when many
+     * are exported. Blocks only while the pool is busy
+     * \param entry Log entry, owned by the exporter from now on
+     */
+    void exportXML(LogEntry *entry);
+    /**
+     * Wait until all queued logs have been exported
+     */
+    void waitForDone();
+    /**
+     * Wait until all Movescount XML files queued have been written
+     */
+    void waitForXMLExports();
+private slots:
+    void processQueue();
+
+private:
+    class Job
+    {
+    public:
+        LogEntry *entry;
+        bool upload;
+    };
+
+    class XMLTask;
+
+    QMutex mutex;
+    QWaitCondition done;
+    QQueue<Job> jobs;
+    int pending;                /* queued or being exported */
+    QSemaphore freeSlots;
+    bool xmlExport;
+    QSemaphore freeXMLSlots;
+    QThreadPool xmlPool;
+
+    MovesCount *movesCount;
+    MovesCountXML movesCountXML;
+    QThread workerThread;
+};
+
+#endif // LOGEXPORTER_H
@@ -0,0 +1,184 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "loglistmodel.h"
+
+#include <QRunnable>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+// Rows given to the view at a time
+#define LOG_LIST_FETCH_BATCH    200
+
+class LogListModel::LoadTask : public QRunnable
+{
+public:
+    LoadTask(LogListModel *model) :
+        model(model)
+    {
+    }
+
+    void run()
+    {
+        QList<LogStore::LogDirEntry> entries = model->logStore->dir();
+
+        model->mutex.lock();
+        model->loadedEntries = entries;
+        model->loadPending = true;
+        model->mutex.unlock();
+
+        QMetaObject::invokeMethod(model, "directoryLoaded", Qt::QueuedConnection);
+    }
+
+private:
+    LogListModel *model;
+};
+
+static bool newerFirst(const LogStore::LogDirEntry &a, const LogStore::LogDirEntry &b)
+{
+    return a.time > b.time;
+}
+
+LogListModel::LogListModel(LogStore *logStore, QObject *parent) :
+    QAbstractListModel(parent), logStore(logStore), fetched(0), loadPending(false)
+{
+    // One directory read at a time, a refresh while one runs waits for it
+    loadPool.setMaxThreadCount(1);
+}
+
+LogListModel::~LogListModel()
+{
+    loadPool.waitForDone();
+}
+
+int LogListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : fetched;
+}
+
+QVariant LogListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= fetched) {
+        return QVariant();
+    }
+
+    switch (role) {
+    case Qt::DisplayRole:
+        return entries[index.row()].time.toString();
+    case Qt::UserRole:
+        return entries[index.row()].filename;
+    default:
+        return QVariant();
+    }
+}
+
+bool LogListModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && fetched < entries.count();
+}
+
+void LogListModel::fetchMore(const QModelIndex &parent)
+{
+    int count = qMin(LOG_LIST_FETCH_BATCH, entries.count() - fetched);
+
+    if (parent.isValid() || count <= 0) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), fetched, fetched + count - 1);
+    fetched += count;
+    endInsertRows();
+}
+
+void LogListModel::refresh()
+{
+    loadPool.start(new LoadTask(this));
+}
+
+void LogListModel::directoryLoaded()
+{
+    QList<LogStore::LogDirEntry> loaded, added;
+    QSet<QString> loadedFilenames;
+    int row;
+
+    mutex.lock();
+    if (!loadPending) {
+        mutex.unlock();
+        return;
+    }
+    loaded = loadedEntries;
+    loadedEntries.clear();
+    loadPending = false;
+    mutex.unlock();
+
+    std::stable_sort(loaded.begin(), loaded.end(), newerFirst);
+    foreach (LogStore::LogDirEntry entry, loaded) {
+        loadedFilenames.insert(entry.filename);
+    }
+
+    if (entries.isEmpty()) {
+        beginResetModel();
+        entries = loaded;
+        filenames = loadedFilenames;
+        fetched = 0;
+        endResetModel();
+        return;
+    }
+
+    // Logs that have gone away, rare
+    for (row = entries.count() - 1; row >= 0; row--) {
+        if (!loadedFilenames.contains(entries[row].filename)) {
+            if (row < fetched) {
+                beginRemoveRows(QModelIndex(), row, row);
+                filenames.remove(entries[row].filename);
+                entries.removeAt(row);
+                fetched--;
+                endRemoveRows();
+            }
+            else {
+                filenames.remove(entries[row].filename);
+                entries.removeAt(row);
+            }
+        }
+    }
+
+    // New logs, usually a few from the last sync and newer than all others
+    foreach (LogStore::LogDirEntry entry, loaded) {
+        if (!filenames.contains(entry.filename)) {
+            added.append(entry);
+        }
+    }
+    foreach (LogStore::LogDirEntry entry, added) {
+        QList<LogStore::LogDirEntry>::iterator pos = std::upper_bound(entries.begin(), entries.end(), entry, newerFirst);
+        row = pos - entries.begin();
+        if (row <= fetched) {
+            beginInsertRows(QModelIndex(), row, row);
+            entries.insert(row, entry);
+            fetched++;
+            endInsertRows();
+        }
+        else {
+            entries.insert(row, entry);
+        }
+        filenames.insert(entry.filename);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef LOGLISTMODEL_H
+#define LOGLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QMutex>
+#include <QThreadPool>
+#include <QList>
+#include <QSet>
+
+#include <movescount/logstore.h>
+
+/**
+ * List of the stored logs, newest first, backed by the log store index.
+ * The directory is read in the background and rows are handed to the
+ * view in batches as it scrolls. A refresh only inserts the logs that
+ * are new since the last one.
+ */
+class LogListModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit LogListModel(LogStore *logStore, QObject *parent = 0);
+    ~LogListModel();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+
+    /**
+     * Read the directory again in the background
+     */
+    void refresh();
+private slots:
+    void directoryLoaded();
+
+private:
+    class LoadTask;
+
+    LogStore *logStore;
+
+    QList<LogStore::LogDirEntry> entries;   /* all logs, newest first */
+    QSet<QString> filenames;
+    int fetched;                            /* rows shown so far */
+
+    QMutex mutex;
+    QList<LogStore::LogDirEntry> loadedEntries;
+    bool loadPending;
+    QThreadPool loadPool;
+};
+
+#endif // LOGLISTMODEL_H
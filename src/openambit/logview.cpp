@@ -5,9 +5,10 @@ LogView::LogView(QWidget *parent):
 {
 }
 
-void LogView::showLog(LogEntry *entry)
+void LogView::showLog(LogEntry *entry, const LogStatistics *statistics)
 {
     QString log_html;
+    int i;
 
     if (entry != NULL && entry->logEntry != NULL) {
         log_html += "<h1>" + QString::fromUtf8(entry->logEntry->header.activity_name) + "</h1>";
@@ -26,6 +27,29 @@ void LogView::showLog(LogEntry *entry)
         log_html += "<h4>" + tr("Max HR: %1 bpm").arg(QString::number(entry->logEntry->header.heartrate_max)) + "</h4>";
         log_html += "<h4>" + tr("Min HR: %1 bpm").arg(QString::number(entry->logEntry->header.heartrate_min)) + "</h4>";
         log_html += "<h4>" + tr("PTE: %1").arg(QString::number(entry->logEntry->header.peak_training_effect/10.0)) + "</h4>";
+        if (statistics != NULL && statistics->isValid()) {
+            log_html += "<h4>" + tr("Ascent: %1 m").arg(QString::number(statistics->ascent)) + "</h4>";
+            log_html += "<h4>" + tr("Descent: %1 m").arg(QString::number(statistics->descent)) + "</h4>";
+            if (statistics->zoneMaxHeartRate > 0) {
+                log_html += "<h2>" + tr("HR zones") + "</h2>";
+                for (i=0; i<LogStatistics::HeartRateZoneCount; i++) {
+                    log_html += "<h4>" + tr("Zone %1: %2").arg(i + 1).arg(msecToHHMMSS(statistics->heartRateZones[i])) + "</h4>";
+                }
+            }
+            if (statistics->laps.count() > 1) {
+                log_html += "<h2>" + tr("Laps") + "</h2>";
+                for (i=0; i<statistics->laps.count(); i++) {
+                    const LogStatistics::Lap &lap = statistics->laps[i];
+                    log_html += "<h4>" + tr("Lap %1: %2, %3 m, avg HR %4 bpm").arg(i + 1).arg(msecToHHMMSS(lap.duration)).arg(lap.distance).arg(lap.heartRateAvg) + "</h4>";
+                }
+            }
+            if (statistics->splits.count() > 0) {
+                log_html += "<h2>" + tr("Splits") + "</h2>";
+                for (i=0; i<statistics->splits.count(); i++) {
+                    log_html += "<h4>" + tr("Km %1: %2").arg(i + 1).arg(msecToHHMMSS(statistics->splits[i])) + "</h4>";
+                }
+            }
+        }
         log_html += "<h2>" + tr("Device") + "</h2>";
         log_html += "<h4>" + tr("Name: %1").arg(entry->deviceInfo.name) + "</h4>";
         log_html += "<h4>" + tr("Variant: %1").arg(entry->deviceInfo.model) + "</h4>";
@@ -4,6 +4,7 @@
 #include <QTextBrowser>
 
 #include <movescount/logentry.h>
+#include <movescount/logstatistics.h>
 
 class LogView : public QTextBrowser
 {
@@ -11,7 +12,7 @@ class LogView : public QTextBrowser
 public:
     explicit LogView(QWidget *parent = 0);
 
-    void showLog(LogEntry *entry);
+    void showLog(LogEntry *entry, const LogStatistics *statistics = NULL);
     void hideLog();
 
 signals:
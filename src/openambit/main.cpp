@@ -24,14 +24,21 @@
 #include <QSettings>
 #include <QTranslator>
 #include <QLibraryInfo>
+#include <QTime>
+#include <QDebug>
 
 #include "single_application.h"
 #include "signalhandler.h"
+#include "startuptrace.h"
 
 static void initTranslations(void);
 
+static QTime startupTime;
+
 int main(int argc, char *argv[])
 {
+    startupTime.start();
+
     // Handle foreground arguments
     // NOTE: It would be preferable to handle all arguments at the same place,
     // but fork needs to be done before Qt initialize it seems
@@ -79,8 +86,10 @@ int main(int argc, char *argv[])
 
     // Initialize translations
     initTranslations();
+    startupTrace("application");
 
     MainWindow w;
+    startupTrace("main window");
 
     // Connect single application message bus
     QObject::connect(&a, SIGNAL(messageAvailable(QString)), &w, SLOT(singleApplicationMsgRecv(QString)));
@@ -94,6 +103,11 @@ int main(int argc, char *argv[])
     return a.exec();
 }
 
+void startupTrace(const char *stage)
+{
+    qDebug() << QString("Startup: %1 after %2 ms").arg(stage).arg(startupTime.elapsed());
+}
+
 static void initTranslations(void)
 {
     QLocale locale;
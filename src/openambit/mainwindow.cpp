@@ -21,18 +21,16 @@
  */
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "startuptrace.h"
 
 #include <QCloseEvent>
-#include <QListWidgetItem>
 #include <QMessageBox>
 
-#define APPKEY                 "HpF9f1qV5qrDJ1hY1QK1diThyPsX10Mh4JvCw9xVQSglJNLdcwr3540zFyLzIC3e"
-#define MOVESCOUNT_DEFAULT_URL "https://uiservices.movescount.com/"
-
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
     forceClose(false),
+    startupDeferred(true),
     movesCount(NULL),
     currentLogMessageRow(NULL)
 {
@@ -87,32 +85,36 @@ MainWindow::MainWindow(QWidget *parent) :
     trayIcon->setContextMenu(trayIconMenu);
     connect(trayIcon, SIGNAL(activated(QSystemTrayIcon::ActivationReason)), this, SLOT(trayIconClicked(QSystemTrayIcon::ActivationReason)));
     trayIcon->setVisible(true);
+    startupTrace("tray icon");
 
     // Setup device manager
     deviceManager = new DeviceManager();
     deviceManager->moveToThread(&deviceWorkerThread);
     qRegisterMetaType<DeviceInfo>("DeviceInfo");
     connect(deviceManager, SIGNAL(deviceDetected(const DeviceInfo&)), this, SLOT(deviceDetected(const DeviceInfo&)), Qt::QueuedConnection);
-    connect(deviceManager, SIGNAL(deviceRemoved()), this, SLOT(deviceRemoved()), Qt::QueuedConnection);
-    connect(deviceManager, SIGNAL(deviceCharge(quint8)), this, SLOT(deviceCharge(quint8)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceRemoved(QString)), this, SLOT(deviceRemoved(QString)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceCharge(QString,quint8)), this, SLOT(deviceCharge(QString,quint8)), Qt::QueuedConnection);
     connect(deviceManager, SIGNAL(syncFinished(bool)), this, SLOT(syncFinished(bool)), Qt::QueuedConnection);
     connect(deviceManager, SIGNAL(syncProgressInform(QString,bool,bool,quint8)), this, SLOT(syncProgressInform(QString,bool,bool,quint8)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(syncLogProgress(QString,quint16,quint16,quint8)), this, SLOT(syncLogProgress(QString,quint16,quint16,quint8)), Qt::QueuedConnection);
     connect(ui->buttonDeviceReload, SIGNAL(clicked()), deviceManager, SLOT(detect()));
     connect(ui->buttonSyncNow, SIGNAL(clicked()), this, SLOT(syncNowClicked()));
     connect(this, SIGNAL(syncNow(bool,bool,bool,bool)), deviceManager, SLOT(startSync(bool,bool,bool,bool)));
     deviceWorkerThread.start();
     deviceManager->start();
-    deviceManager->detect();
+    // Enumerated on the manager's thread, not before the window shows
+    QMetaObject::invokeMethod(deviceManager, "detect", Qt::QueuedConnection);
 
     // Setup log list
-    connect(ui->logsList, SIGNAL(currentItemChanged(QListWidgetItem*,QListWidgetItem*)), this, SLOT(logItemSelected(QListWidgetItem*,QListWidgetItem*)));
+    logListModel = new LogListModel(&logStore, this);
+    ui->logsList->setModel(logListModel);
+    ui->logsList->setUniformItemSizes(true);
+    connect(ui->logsList->selectionModel(), SIGNAL(currentChanged(QModelIndex,QModelIndex)), this, SLOT(logItemSelected(QModelIndex,QModelIndex)));
     ui->logsList->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(ui->logsList, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(showContextMenuForLogItem(QPoint)));
 
-    updateLogList();
-
-    // Setup Movescount
-    movesCountSetup();
+    // The log list and Movescount are set up in startupFinished(), after
+    // the first paint
 }
 
 MainWindow::~MainWindow()
@@ -159,13 +161,22 @@ void MainWindow::changeEvent(QEvent *event)
 
 void MainWindow::showEvent(QShowEvent *event)
 {
+    if (startupDeferred) {
+        // Timers fire once the posted paint events are done
+        startupDeferred = false;
+        QTimer::singleShot(0, this, SLOT(startupFinished()));
+    }
+
     trayIconMinimizeRestoreAction->setText(tr("Minimize"));
+    // Charge is only shown, and polled, while the window is
+    QMetaObject::invokeMethod(deviceManager, "setChargePolling", Qt::QueuedConnection, Q_ARG(bool, true));
     event->accept();
 }
 
 void MainWindow::hideEvent(QHideEvent *event)
 {
     trayIconMinimizeRestoreAction->setText(tr("Restore"));
+    QMetaObject::invokeMethod(deviceManager, "setChargePolling", Qt::QueuedConnection, Q_ARG(bool, false));
     event->accept();
 }
 
@@ -193,6 +204,18 @@ void MainWindow::closeRequested()
     close();
 }
 
+void MainWindow::startupFinished()
+{
+    startupTrace("first paint");
+
+    // Both only start background work, neither depends on the size of
+    // the log archive here
+    updateLogList();
+    movesCountSetup();
+
+    startupTrace("deferred startup");
+}
+
 void MainWindow::showHideWindow()
 {
     if (!sysTraySupported() || isHidden()) {
@@ -297,8 +320,13 @@ void MainWindow::deviceDetected(const DeviceInfo& deviceInfo)
     }
 }
 
-void MainWindow::deviceRemoved(void)
+void MainWindow::deviceRemoved(QString serial)
 {
+    // Other attached devices don't affect the one shown
+    if (serial != ui->labelSerial->text()) {
+        return;
+    }
+
     ui->labelDeviceDetected->setText(tr("No device detected"));
     ui->labelSerial->setText("");
     ui->labelNotSupportedIcon->setHidden(true);
@@ -318,8 +346,12 @@ void MainWindow::deviceRemoved(void)
     trayIcon->setIcon(QIcon(":/icon_disconnected"));
 }
 
-void MainWindow::deviceCharge(quint8 percent)
+void MainWindow::deviceCharge(QString serial, quint8 percent)
 {
+    if (serial != ui->labelSerial->text()) {
+        return;
+    }
+
     ui->chargeIndicator->setValue(percent);
     trayIcon->setToolTip(QString(tr("Charging %1%")).arg(percent));
 }
@@ -381,6 +413,17 @@ void MainWindow::syncProgressInform(QString message, bool error, bool newRow, qu
     trayIcon->setToolTip(QString(tr("Downloading %1%")).arg(percentDone));
 }
 
+void MainWindow::syncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone)
+{
+    // Formatted here, the sync only sends the numbers
+    QString message = QString(tr("Downloading log %1 of %2")).arg(logCurrent).arg(logCount);
+
+    if (!serial.isEmpty()) {
+        message = QString("%1: %2").arg(serial).arg(message);
+    }
+    syncProgressInform(message, false, false, percentDone);
+}
+
 void MainWindow::newerFirmwareExists(QByteArray fw_version)
 {
     ui->labelNewFirmware->setText(QString(tr("Newer firmware exists (%1.%2.%3)")).arg((int)fw_version[0]).arg((int)fw_version[1]).arg((int)(fw_version[2])));
@@ -394,19 +437,27 @@ void MainWindow::movesCountAuth(bool authorized)
     ui->labelMovescountAuthIcon->setHidden(authorized);
 }
 
-void MainWindow::logItemSelected(QListWidgetItem *current,QListWidgetItem *previous)
+void MainWindow::logItemSelected(const QModelIndex &current, const QModelIndex &previous)
 {
     LogEntry *logEntry = NULL;
 
     Q_UNUSED(previous);
 
-    if (current != NULL) {
-        logEntry = logStore.read(current->data(Qt::UserRole).toString());
+    if (current.isValid()) {
+        // The details view only shows header values and the statistics
+        // computed when the log was stored
+        logEntry = logStore.readHeader(current.data(Qt::UserRole).toString());
         if (logEntry != NULL) {
-            ui->logDetail->showLog(logEntry);
+            LogStatistics statistics;
+            bool hasStatistics = logStore.readStatistics(current.data(Qt::UserRole).toString(), &statistics);
+            ui->logDetail->showLog(logEntry, hasStatistics ? &statistics : NULL);
         }
 
         delete logEntry;
+
+        // Only the first view of a log reads its samples, the chart
+        // pyramid is cached after that
+        ui->logChart->showChart(logStore.readChartData(current.data(Qt::UserRole).toString()));
     }
 }
 
@@ -422,8 +473,13 @@ void MainWindow::showContextMenuForLogItem(const QPoint &pos)
 void MainWindow::logItemWriteMovescount()
 {
     LogEntry *logEntry = NULL;
+    QModelIndex current = ui->logsList->currentIndex();
 
-    logEntry = logStore.read(ui->logsList->selectedItems().at(0)->data(Qt::UserRole).toString());
+    if (!current.isValid()) {
+        return;
+    }
+
+    logEntry = logStore.read(current.data(Qt::UserRole).toString());
     if (logEntry != NULL) {
         if (movesCount != NULL) {
             movesCount->writeLog(logEntry);
@@ -435,14 +491,8 @@ void MainWindow::logItemWriteMovescount()
 
 void MainWindow::updateLogList()
 {
-    QList<LogStore::LogDirEntry> entries = logStore.dir();
-    ui->logsList->clear();
-    foreach (LogStore::LogDirEntry entry, entries) {
-        QListWidgetItem *item = new QListWidgetItem(entry.time.toString());
-        item->setText(entry.time.toString());
-        item->setData(Qt::UserRole, QVariant(entry.filename));
-        ui->logsList->insertItem(0, item);
-    }
+    // Read in the background, only logs new since last time are added
+    logListModel->refresh();
 }
 
 void MainWindow::startSync()
@@ -501,6 +551,7 @@ void MainWindow::movesCountSetup()
             connect(movesCount, SIGNAL(newerFirmwareExists(QByteArray)), this, SLOT(newerFirmwareExists(QByteArray)), Qt::QueuedConnection);
             connect(movesCount, SIGNAL(movesCountAuth(bool)), this, SLOT(movesCountAuth(bool)), Qt::QueuedConnection);
         }
+        movesCount->setOfflineMode(settings.value("movescountOffline", false).toBool());
         if (movescountEnable) {
             movesCount->setUsername(settings.value("email").toString());
         }
@@ -25,6 +25,7 @@
 #include "devicemanager.h"
 #include "settingsdialog.h"
 #include "confirmbetadialog.h"
+#include "loglistmodel.h"
 #include <movescount/deviceinfo.h>
 #include <movescount/movescount.h>
 #include <QMainWindow>
@@ -70,19 +71,21 @@ private slots:
     void syncNowClicked();
 
     void deviceDetected(const DeviceInfo& deviceInfo);
-    void deviceRemoved();
-    void deviceCharge(quint8 percent);
+    void deviceRemoved(QString serial);
+    void deviceCharge(QString serial, quint8 percent);
     void syncFinished(bool success);
     void syncProgressInform(QString message, bool error, bool newRow, quint8 percentDone);
+    void syncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone);
 
     void newerFirmwareExists(QByteArray fw_version);
     void movesCountAuth(bool authorized);
 
-    void logItemSelected(QListWidgetItem *current,QListWidgetItem *previous);
+    void logItemSelected(const QModelIndex &current, const QModelIndex &previous);
     void showContextMenuForLogItem(const QPoint &pos);
     void logItemWriteMovescount();
     void updateLogList();
-    
+    void startupFinished();
+
 private:
     void startSync();
 
@@ -92,6 +95,7 @@ private:
 
     Ui::MainWindow *ui;
     bool forceClose;
+    bool startupDeferred;
 
     QSystemTrayIcon *trayIcon;
     QMenu *trayIconMenu;
@@ -103,6 +107,7 @@ private:
     ConfirmBetaDialog *confirmBetaDialog;
     DeviceManager *deviceManager;
     LogStore logStore;
+    LogListModel *logListModel;
     MovesCountXML movesCountXML;
     MovesCount *movesCount;
     QThread deviceWorkerThread;
@@ -0,0 +1,104 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+
+#include "syncdaemon.h"
+#include "signalhandler.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s <control socket>]\n", name);
+    fprintf(stderr, "       %s --export-xml <directory>\n", name);
+}
+
+/*
+ * Write every stored log as an XML .log file, the format of logs stored
+ * before the binary one, for tools like openambit2gpx.py
+ */
+static int exportXML(QString directory)
+{
+    LogStore logStore;
+    LogEntry *entry;
+    int res = 0;
+
+    if (!QDir().mkpath(directory)) {
+        fprintf(stderr, "Failed to create %s\n", directory.toLocal8Bit().constData());
+        return 1;
+    }
+
+    foreach (LogStore::LogDirEntry dirEntry, logStore.dir()) {
+        QString path = directory + "/" + QFileInfo(dirEntry.filename).completeBaseName() + ".log";
+        if ((entry = logStore.read(dirEntry)) == NULL || !logStore.exportXML(entry, path)) {
+            fprintf(stderr, "Failed to export %s\n", dirEntry.filename.toLocal8Bit().constData());
+            res = 1;
+        }
+        delete entry;
+    }
+
+    return res;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QString storagePath = QString(getenv("HOME")) + "/.openambit";
+    QString socketPath = storagePath + "/openambitd.sock";
+    QStringList arguments = a.arguments();
+    int i;
+
+    // Set application settings, shared with the GUI
+    QCoreApplication::setApplicationVersion(APP_VERSION);
+    QCoreApplication::setOrganizationName("Openambit");
+    QCoreApplication::setApplicationName("Openambit");
+
+    for (i=1; i<arguments.count(); i++) {
+        if (arguments[i] == "-s" && i+1 < arguments.count()) {
+            socketPath = arguments[++i];
+        }
+        else if (arguments[i] == "--export-xml" && i+1 < arguments.count()) {
+            return exportXML(arguments[i+1]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // The log store creates it too, but only once a log is stored
+    QDir().mkpath(storagePath);
+
+    SyncDaemon daemon;
+    if (!daemon.start(socketPath)) {
+        return 1;
+    }
+
+    // Handle signals
+    SignalHandler sigHandler;
+    QObject::connect(&sigHandler, SIGNAL(signalReceived(int)), &a, SLOT(quit()));
+
+    return a.exec();
+}
@@ -24,6 +24,10 @@
 
 #include <QSettings>
 
+// Shared by the GUI and the sync daemon
+#define APPKEY                 "HpF9f1qV5qrDJ1hY1QK1diThyPsX10Mh4JvCw9xVQSglJNLdcwr3540zFyLzIC3e"
+#define MOVESCOUNT_DEFAULT_URL "https://uiservices.movescount.com/"
+
 class Settings : public QSettings
 {
     Q_OBJECT
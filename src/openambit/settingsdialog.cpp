@@ -76,13 +76,14 @@ void SettingsDialog::readSettings()
     ui->checkBoxSyncAutomatically->setChecked(settings.value("syncAutomatically", false).toBool());
     ui->checkBoxSyncTime->setChecked(settings.value("syncTime", true).toBool());
     ui->checkBoxSyncOrbit->setChecked(settings.value("syncOrbit", true).toBool());
+    ui->checkBoxSyncUnsyncedOnly->setChecked(settings.value("syncUnsyncedOnly", false).toBool());
     settings.endGroup();
 
     settings.beginGroup("movescountSettings");
     ui->checkBoxNewVersions->setChecked(settings.value("checkNewVersions", true).toBool());
     ui->checkBoxMovescountEnable->setChecked(settings.value("movescountEnable", false).toBool());
     ui->lineEditEmail->setText(settings.value("email", "").toString());
-    ui->checkBoxDebugFiles->setChecked(settings.value("storeDebugFiles", true).toBool());
+    ui->checkBoxDebugFiles->setChecked(settings.value("storeDebugFiles", false).toBool());
     settings.endGroup();
 }
 
@@ -97,6 +98,7 @@ void SettingsDialog::writeSettings()
     settings.setValue("syncAutomatically", ui->checkBoxSyncAutomatically->isChecked());
     settings.setValue("syncTime", ui->checkBoxSyncTime->isChecked());
     settings.setValue("syncOrbit", ui->checkBoxSyncOrbit->isChecked());
+    settings.setValue("syncUnsyncedOnly", ui->checkBoxSyncUnsyncedOnly->isChecked());
     settings.endGroup();
 
     settings.beginGroup("movescountSettings");
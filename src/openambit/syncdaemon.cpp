@@ -0,0 +1,331 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#include "syncdaemon.h"
+
+#include <QLocalSocket>
+
+#include <QDebug>
+
+// How long to wait for a daemon already listening on the socket, in ms
+#define CONTROL_PROBE_TIMEOUT   1000
+
+SyncDaemon::SyncDaemon(QObject *parent) :
+    QObject(parent),
+    deviceManager(NULL),
+    movesCount(NULL)
+{
+}
+
+SyncDaemon::~SyncDaemon()
+{
+    controlServer.close();
+
+    if (deviceManager != NULL) {
+        deviceWorkerThread.quit();
+        deviceWorkerThread.wait();
+        delete deviceManager;
+    }
+
+    if (movesCount != NULL) {
+        movesCount->exit();
+    }
+}
+
+bool SyncDaemon::start(QString socketPath)
+{
+    QLocalSocket probe;
+
+    // A socket left behind by a daemon that died is removed, one that is
+    // still answered is not
+    probe.connectToServer(socketPath);
+    if (probe.waitForConnected(CONTROL_PROBE_TIMEOUT)) {
+        qWarning() << "Another daemon is listening on " << socketPath;
+        return false;
+    }
+    QLocalServer::removeServer(socketPath);
+
+    connect(&controlServer, SIGNAL(newConnection()), this, SLOT(controlConnection()));
+    if (!controlServer.listen(socketPath)) {
+        qWarning() << "Failed to listen on " << socketPath << ": " << controlServer.errorString();
+        return false;
+    }
+
+    // Movescount is needed by the sessions as soon as a device syncs
+    movesCountSetup();
+
+    // Same device manager setup as the GUI, only without charge polling,
+    // a station has nothing to show it on
+    deviceManager = new DeviceManager();
+    deviceManager->moveToThread(&deviceWorkerThread);
+    qRegisterMetaType<DeviceInfo>("DeviceInfo");
+    connect(deviceManager, SIGNAL(deviceDetected(const DeviceInfo&)), this, SLOT(deviceDetected(const DeviceInfo&)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceRemoved(QString)), this, SLOT(deviceRemoved(QString)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceCharge(QString,quint8)), this, SLOT(deviceCharge(QString,quint8)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceSyncFinished(QString,bool)), this, SLOT(deviceSyncFinished(QString,bool)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceSyncProgressInform(QString,QString,bool,bool,quint8)), this, SLOT(deviceSyncProgressInform(QString,QString,bool,bool,quint8)), Qt::QueuedConnection);
+    connect(deviceManager, SIGNAL(deviceSyncLogProgress(QString,quint16,quint16,quint8)), this, SLOT(deviceSyncLogProgress(QString,quint16,quint16,quint8)), Qt::QueuedConnection);
+    connect(this, SIGNAL(syncNow(bool,bool,bool,bool)), deviceManager, SLOT(startSync(bool,bool,bool,bool)), Qt::QueuedConnection);
+    deviceWorkerThread.start();
+    deviceManager->start();
+    QMetaObject::invokeMethod(deviceManager, "detect", Qt::QueuedConnection);
+
+    qDebug() << "Listening on " << socketPath;
+
+    return true;
+}
+
+void SyncDaemon::deviceDetected(const DeviceInfo& deviceInfo)
+{
+    DeviceStatus device;
+
+    if (0 != deviceInfo.access_status || !deviceInfo.is_supported) {
+        qDebug() << "Ignoring unsupported device " << deviceInfo.name << " " << deviceInfo.serial;
+        return;
+    }
+
+    device.deviceInfo = deviceInfo;
+    devices.insert(deviceInfo.serial, device);
+    qDebug() << "Device " << deviceInfo.name << " " << deviceInfo.serial << " attached";
+
+    movesCountSetup();
+    if (movesCount != NULL) {
+        movesCount->setDevice(deviceInfo);
+    }
+
+    // A station syncs whatever is attached, devices syncing already are
+    // left alone by the manager
+    startSync(false);
+}
+
+void SyncDaemon::deviceRemoved(QString serial)
+{
+    if (devices.remove(serial) > 0) {
+        qDebug() << "Device " << serial << " removed";
+    }
+}
+
+void SyncDaemon::deviceCharge(QString serial, quint8 percent)
+{
+    if (devices.contains(serial)) {
+        devices[serial].charge = percent;
+    }
+}
+
+void SyncDaemon::deviceSyncFinished(QString serial, bool success)
+{
+    if (devices.contains(serial)) {
+        DeviceStatus &device = devices[serial];
+        device.syncing = false;
+        device.lastSyncSuccess = success;
+        device.lastSync = QDateTime::currentDateTime();
+    }
+    qDebug() << "Sync of " << serial << (success ? " finished" : " failed");
+}
+
+void SyncDaemon::deviceSyncProgressInform(QString serial, QString message, bool error, bool newRow, quint8 percentDone)
+{
+    Q_UNUSED(newRow);
+
+    if (devices.contains(serial)) {
+        DeviceStatus &device = devices[serial];
+        device.syncing = true;
+        device.percentDone = percentDone;
+        device.message = message;
+        device.logCount = 0;
+    }
+    if (error) {
+        qWarning() << serial << ": " << message;
+    }
+}
+
+void SyncDaemon::deviceSyncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone)
+{
+    if (devices.contains(serial)) {
+        DeviceStatus &device = devices[serial];
+        device.syncing = true;
+        device.percentDone = percentDone;
+        device.logCurrent = logCurrent;
+        device.logCount = logCount;
+    }
+}
+
+void SyncDaemon::controlConnection()
+{
+    QLocalSocket *socket;
+
+    while ((socket = controlServer.nextPendingConnection()) != NULL) {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(controlRead()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void SyncDaemon::controlRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+
+    if (socket == NULL) {
+        return;
+    }
+
+    while (socket->canReadLine()) {
+        QString command = QString::fromUtf8(socket->readLine()).trimmed();
+        QString reply;
+
+        if (command == "status") {
+            reply = status();
+        }
+        else if (command == "sync" || command == "resync") {
+            startSync(command == "resync");
+            reply = "ok\n";
+        }
+        else if (command.startsWith("rollup")) {
+            reply = rollup(command.split(' ', QString::SkipEmptyParts));
+        }
+        else if (command == "detect") {
+            QMetaObject::invokeMethod(deviceManager, "detect", Qt::QueuedConnection);
+            reply = "ok\n";
+        }
+        else if (command != "") {
+            reply = QString("error unknown command %1\n").arg(command);
+        }
+
+        socket->write(reply.toUtf8());
+    }
+}
+
+void SyncDaemon::startSync(bool readAllLogs)
+{
+    bool syncTime, syncOrbit, syncMovescount;
+
+    settings.sync();
+    settings.beginGroup("syncSettings");
+    syncTime = settings.value("syncTime", true).toBool();
+    syncOrbit = settings.value("syncOrbit", true).toBool();
+    settings.endGroup();
+    settings.beginGroup("movescountSettings");
+    syncMovescount = settings.value("movescountEnable", false).toBool();
+    settings.endGroup();
+
+    movesCountSetup();
+
+    emit syncNow(readAllLogs, syncTime, syncOrbit, syncMovescount);
+}
+
+void SyncDaemon::movesCountSetup()
+{
+    bool syncOrbit = false;
+    bool movescountEnable = false;
+
+    settings.beginGroup("syncSettings");
+    syncOrbit = settings.value("syncOrbit", true).toBool();
+    settings.endGroup();
+
+    settings.beginGroup("movescountSettings");
+    movescountEnable = settings.value("movescountEnable", false).toBool();
+    if (syncOrbit || movescountEnable) {
+        if (movesCount == NULL) {
+            movesCount = MovesCount::instance();
+            movesCount->setAppkey(APPKEY);
+            movesCount->setBaseAddress(settings.value("movescountBaseAddress", MOVESCOUNT_DEFAULT_URL).toString());
+            if (settings.value("movescountUserkey", "").toString().length() == 0) {
+                settings.setValue("movescountUserkey", movesCount->generateUserkey());
+            }
+            movesCount->setUserkey(settings.value("movescountUserkey").toString());
+        }
+        movesCount->setOfflineMode(settings.value("movescountOffline", false).toBool());
+        if (movescountEnable) {
+            movesCount->setUsername(settings.value("email").toString());
+        }
+    }
+    settings.endGroup();
+}
+
+QString SyncDaemon::rollup(QStringList args)
+{
+    LogRollup::Period period;
+    QString reply;
+    bool ok = true;
+    int days = 365;
+
+    if (args.count() < 2 || args.count() > 3) {
+        return "error usage rollup day|week|month [days]\n";
+    }
+    if (args[1] == "day") {
+        period = LogRollup::Day;
+    }
+    else if (args[1] == "week") {
+        period = LogRollup::Week;
+    }
+    else if (args[1] == "month") {
+        period = LogRollup::Month;
+    }
+    else {
+        return QString("error unknown period %1\n").arg(args[1]);
+    }
+    if (args.count() == 3) {
+        days = args[2].toInt(&ok);
+    }
+    if (!ok || days < 1) {
+        return QString("error invalid days %1\n").arg(args[2]);
+    }
+
+    QDate today = QDate::currentDate();
+    foreach (const LogRollup::Bucket &bucket, logStore.rollup(period, today.addDays(1 - days), today)) {
+        reply += QString("%1 logs %2 duration %3 distance %4 ascent %5 descent %6\n")
+                 .arg(bucket.start.toString(Qt::ISODate))
+                 .arg(bucket.totals.count)
+                 .arg(bucket.totals.duration/1000)
+                 .arg(bucket.totals.distance)
+                 .arg(bucket.totals.ascent)
+                 .arg(bucket.totals.descent);
+    }
+    reply += "ok\n";
+
+    return reply;
+}
+
+QString SyncDaemon::status()
+{
+    QString reply;
+
+    // The index keeps this cheap however many logs are stored
+    reply += QString("devices %1 logs %2\n").arg(devices.count()).arg(logStore.dir().count());
+
+    foreach (const DeviceStatus &device, devices) {
+        reply += QString("%1 \"%2\" charge %3").arg(device.deviceInfo.serial).arg(device.deviceInfo.name).arg(device.charge);
+        if (device.syncing) {
+            reply += QString(" syncing %1 \"%2\"").arg(device.percentDone).arg(device.message);
+            if (device.logCount > 0) {
+                reply += QString(" log %1 of %2").arg(device.logCurrent).arg(device.logCount);
+            }
+        }
+        else if (!device.lastSync.isNull()) {
+            reply += QString(" %1 %2").arg(device.lastSyncSuccess ? "synced" : "failed").arg(device.lastSync.toString(Qt::ISODate));
+        }
+        else {
+            reply += " idle";
+        }
+        reply += "\n";
+    }
+
+    return reply;
+}
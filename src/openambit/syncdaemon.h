@@ -0,0 +1,111 @@
+/*
+ * (C) Copyright 2013 Emil Ljungdahl
+ *
+ * This file is part of Openambit.
+ *
+ * Openambit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contributors:
+ *
+ */
+#ifndef SYNCDAEMON_H
+#define SYNCDAEMON_H
+
+#include <QObject>
+#include <QThread>
+#include <QDateTime>
+#include <QMap>
+#include <QLocalServer>
+#include <QStringList>
+
+#include "devicemanager.h"
+#include "settings.h"
+#include <movescount/deviceinfo.h>
+#include <movescount/logstore.h>
+#include <movescount/movescount.h>
+
+class QLocalSocket;
+
+/**
+ * Headless counterpart of MainWindow. Every supported device that is
+ * attached is synced with the GUI's settings, status is reported and
+ * syncs are started through a line based control socket:
+ *   status   one line per attached device
+ *   sync     sync new logs of all attached devices
+ *   resync   sync all logs of all attached devices
+ *   detect   reopen all devices
+ *   rollup day|week|month [days]
+ *            totals per period of the logs of the last days, default 365
+ */
+class SyncDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SyncDaemon(QObject *parent = 0);
+    ~SyncDaemon();
+
+    /**
+     * Start listening on the control socket and open attached devices
+     * \return false if the socket can't be used, e.g. when another daemon
+     * is listening on it already
+     */
+    bool start(QString socketPath);
+
+signals:
+    void syncNow(bool readAllLogs, bool syncTime, bool syncOrbit, bool syncMovescount);
+
+private slots:
+    void deviceDetected(const DeviceInfo& deviceInfo);
+    void deviceRemoved(QString serial);
+    void deviceCharge(QString serial, quint8 percent);
+    void deviceSyncFinished(QString serial, bool success);
+    void deviceSyncProgressInform(QString serial, QString message, bool error, bool newRow, quint8 percentDone);
+    void deviceSyncLogProgress(QString serial, quint16 logCurrent, quint16 logCount, quint8 percentDone);
+    void controlConnection();
+    void controlRead();
+
+private:
+    void startSync(bool readAllLogs);
+    void movesCountSetup();
+    QString status();
+    QString rollup(QStringList args);
+
+    class DeviceStatus
+    {
+    public:
+        DeviceStatus() : charge(0), syncing(false), percentDone(0), logCurrent(0), logCount(0), lastSyncSuccess(false) {}
+
+        DeviceInfo deviceInfo;
+        quint8 charge;              /* percent */
+        bool syncing;
+        quint8 percentDone;
+        QString message;
+        quint16 logCurrent;         /* of the download in progress */
+        quint16 logCount;
+        bool lastSyncSuccess;
+        QDateTime lastSync;         /* null until synced once */
+    };
+
+    // Attached devices by serial
+    QMap<QString, DeviceStatus> devices;
+
+    QLocalServer controlServer;
+    DeviceManager *deviceManager;
+    QThread deviceWorkerThread;
+    MovesCount *movesCount;
+    LogStore logStore;
+    Settings settings;
+};
+
+#endif // SYNCDAEMON_H
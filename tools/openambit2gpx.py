@@ -1,6 +1,8 @@
 #!/usr/bin/python
 
 """ converts the *.log files produced by openambit in ~/.openambit/ to standard gpx format.
+Logs stored in the binary *.bin format are exported as *.log files with
+openambitd --export-xml <directory> first.
 usage: ./openambit2gpx.py inputfile outputFile
 """
 
@@ -21,7 +23,9 @@ else:
 Convert Openambit *.log files to standard GPX format
 usage: {} inputfile outputfile 
 
-Openambit *.log files can normally be found in ~/.openambit/
+Openambit *.log files can normally be found in ~/.openambit/, logs stored
+as *.bin files are exported to *.log files with
+  openambitd --export-xml <directory>
 """.format(sys.argv[0]))
     sys.exit(1)
 
@@ -7,24 +7,25 @@
 #include <epan/reassemble.h>
 #include <epan/dissectors/packet-usb.h>
 
-typedef struct ambit_reassembly_entry {
-    guint8 valid;
+#define AMBIT_NO_FRAME 0xffffffff
+
+/* A message split over several frames, keyed by its first frame */
+typedef struct ambit_message {
     guint32 command;
-    guint32 frame_index;
     guint32 frame_total;
     guint32 size;
     unsigned char *data;
-    struct {
-        guint32 entry_size;
-        unsigned char *entry;
-        guint32 start_frame;
-    } log;
-    struct {
-        guint32 entry_size;
-        unsigned char *entry;
-        guint32 start_frame;
-    } log_header;
-} ambit_reassembly_entry_t;
+} ambit_message_t;
+
+/* What the first pass learned about a frame, later passes only read it */
+typedef struct ambit_frame {
+    guint8 valid;               /* 1 = single frame message, 2 = part of a message */
+    guint32 command;
+    guint32 frame_index;
+    guint32 message_frame;      /* key of the message in ambit_messages */
+    guint32 log_start_frame;    /* key of the log entry in ambit_logs */
+    guint32 log_header_start_frame;     /* key in ambit_log_headers */
+} ambit_frame_t;
 
 typedef struct ambit_protocol_type {
     guint32 command;
@@ -271,8 +272,26 @@ static gint ett_ambit_log_sample = -1;
 static gint ett_ambit3_log_headers = -1;
 static gint ett_ambit3_log_header = -1;
 
-static ambit_reassembly_entry_t *reassembly_entries = NULL;
-static guint32 reassembly_entries_alloc = 0;
+/* Only frames of the Ambit protocol are in these, keyed by frame number.
+ * Log entries and log headers grow as GByteArray, so appending a frame
+ * doesn't copy everything gathered before it */
+static GHashTable *ambit_frames = NULL;
+static GHashTable *ambit_messages = NULL;
+static GHashTable *ambit_logs = NULL;
+static GHashTable *ambit_log_headers = NULL;
+
+/* Reassembly progress of the first pass, reset with the tables when a
+ * capture is (re)loaded */
+static struct {
+    guint32 fragments_start_frame;
+    guint32 fragments_offset;
+    guint32 fragments_data_len;
+    guint32 current_log_start_frame;
+    guint32 log_after_end_of_use;
+    guint32 log_last_known_address;
+    guint32 current_log_header_start_frame;
+    guint32 current_log_header_end_found;
+} reassembly;
 
 static guint32 address_to_frame_lookup[4096];
 
@@ -390,19 +409,12 @@ static const ambit_protocol_type_t subdissectors[] = {
     { 0, NULL, NULL }
 };
 
+/* subdissectors by command, built once at registration */
+static GHashTable *subdissector_lookup = NULL;
+
 static const ambit_protocol_type_t *find_subdissector(guint32 command)
 {
-    int i = 0;
-    const ambit_protocol_type_t *entry = &subdissectors[i++];
-
-    while (entry->command != 0) {
-        if (entry->command == command) {
-            return entry;
-        }
-        entry = &subdissectors[i++];
-    }
-
-    return NULL;
+    return (const ambit_protocol_type_t*)g_hash_table_lookup(subdissector_lookup, GUINT_TO_POINTER(command));
 }
 
 static void dissect_ambit_add_unknown(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, gint offset, gint len)
@@ -1849,19 +1861,12 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
     guint32 command = tvb_get_ntohl(tvb, 8);
     guint32 pkt_len = tvb_get_letohl(tvb, 16);
     tvbuff_t *new_tvb = NULL, *next_tvb = NULL, *log_tvb = NULL, *log_header_tvb = NULL;
-    static guint32 fragments_start_frame;
-    static guint16 fragments_offset;
-    static guint16 fragments_data_len;
     int data_len = 0;
     int data_offset = 0;
     const ambit_protocol_type_t *subdissector;
-
-    static guint32 current_log_start_frame = 0xffffffff;
-    static guint32 log_after_end_of_use = 0xffffffff;
-    static guint32 log_last_known_address;
-
-    static guint32 current_log_header_start_frame = 0xffffffff;
-    static guint32 current_log_header_end_found = 0;
+    ambit_frame_t *frame;
+    ambit_message_t *message = NULL;
+    GByteArray *log = NULL, *log_header = NULL;
 
     if (usbid == D_AMBIT_USBID) {
         if (msg_part == 0x5d) {
@@ -1873,45 +1878,49 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
             data_offset = 8;
         }
 
-        while (pinfo->fd->num + 1 > reassembly_entries_alloc) {
-            reassembly_entries = g_realloc(reassembly_entries, sizeof(ambit_reassembly_entry_t)*(reassembly_entries_alloc + 10000));
-            memset(reassembly_entries+reassembly_entries_alloc, 0, sizeof(ambit_reassembly_entry_t)*10000);
-            reassembly_entries_alloc += 10000;
-        }
-        if (!pinfo->fd->flags.visited) {
+        frame = (ambit_frame_t*)g_hash_table_lookup(ambit_frames, GUINT_TO_POINTER(pinfo->fd->num));
+        if (frame == NULL) {
+            // First pass, or a frame the first pass didn't get to
+            frame = g_new0(ambit_frame_t, 1);
+            frame->message_frame = AMBIT_NO_FRAME;
+            frame->log_start_frame = AMBIT_NO_FRAME;
+            frame->log_header_start_frame = AMBIT_NO_FRAME;
+            g_hash_table_insert(ambit_frames, GUINT_TO_POINTER(pinfo->fd->num), frame);
+
             if (msg_part == 0x5d && msg_count > 1) {
-                reassembly_entries[pinfo->fd->num].valid = 2;
-                reassembly_entries[pinfo->fd->num].command = command;
-                reassembly_entries[pinfo->fd->num].frame_index = 0;
-                reassembly_entries[pinfo->fd->num].frame_total = msg_count;
-                reassembly_entries[pinfo->fd->num].size = pkt_len;
-                reassembly_entries[pinfo->fd->num].data = (unsigned char*)g_malloc(pkt_len);
-                fragments_start_frame = pinfo->fd->num;
-                fragments_offset = data_len;
-                fragments_data_len = pkt_len;
-
-                tvb_memcpy(tvb, reassembly_entries[pinfo->fd->num].data, data_offset, data_len);
+                message = g_new0(ambit_message_t, 1);
+                message->command = command;
+                message->frame_total = msg_count;
+                message->size = pkt_len;
+                message->data = (unsigned char*)g_malloc(pkt_len);
+                g_hash_table_insert(ambit_messages, GUINT_TO_POINTER(pinfo->fd->num), message);
+
+                frame->valid = 2;
+                frame->command = command;
+                frame->frame_index = 0;
+                frame->message_frame = pinfo->fd->num;
+                reassembly.fragments_start_frame = pinfo->fd->num;
+                reassembly.fragments_offset = data_len;
+                reassembly.fragments_data_len = pkt_len;
+
+                tvb_memcpy(tvb, message->data, data_offset, MIN((guint32)data_len, pkt_len));
             }
             else if (msg_part == 0x5e) {
-                if (fragments_data_len >= fragments_offset + data_len) {
-                    //fragments_start_frame = pinfo->fd->num-msg_count;
-                    reassembly_entries[pinfo->fd->num].valid = 2;
-                    reassembly_entries[pinfo->fd->num].command = reassembly_entries[fragments_start_frame].command;
-                    reassembly_entries[pinfo->fd->num].frame_index = msg_count;
-                    reassembly_entries[pinfo->fd->num].frame_total = reassembly_entries[fragments_start_frame].frame_total;
-                    reassembly_entries[pinfo->fd->num].size = fragments_data_len;
-                    reassembly_entries[pinfo->fd->num].data = reassembly_entries[fragments_start_frame].data;
-                    tvb_memcpy(tvb, &(reassembly_entries[fragments_start_frame].data[fragments_offset]), data_offset, data_len);
-                    fragments_offset += data_len;
-
-                    command = reassembly_entries[fragments_start_frame].command;
-                }
-                else {
+                message = (ambit_message_t*)g_hash_table_lookup(ambit_messages, GUINT_TO_POINTER(reassembly.fragments_start_frame));
+                if (message != NULL && reassembly.fragments_data_len >= reassembly.fragments_offset + data_len) {
+                    frame->valid = 2;
+                    frame->command = message->command;
+                    frame->frame_index = msg_count;
+                    frame->message_frame = reassembly.fragments_start_frame;
+                    tvb_memcpy(tvb, &message->data[reassembly.fragments_offset], data_offset, data_len);
+                    reassembly.fragments_offset += data_len;
+
+                    command = message->command;
                 }
             }
             else {
-                reassembly_entries[pinfo->fd->num].valid = 1;
-                reassembly_entries[pinfo->fd->num].command = command;
+                frame->valid = 1;
+                frame->command = command;
             }
 
             // Handle dissection of logs
@@ -1919,14 +1928,15 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
                 // First check for initial known header
                 if (msg_part == 0x5d) {
                     guint32 address = tvb_get_letohl(tvb, data_offset);
-                    guint32 length = tvb_get_letohl(tvb, data_offset + 4);
 
-                    log_last_known_address = address;
+                    reassembly.log_last_known_address = address;
                     if (address == 0x000f4240) {
-                        log_after_end_of_use = tvb_get_letohl(tvb, data_offset + 20);
+                        reassembly.log_after_end_of_use = tvb_get_letohl(tvb, data_offset + 20);
                     }
                     // Set address to lookup table
-                    address_to_frame_lookup[(log_last_known_address - 0x000f4240) / 0x400] = pinfo->fd->num + 19;
+                    if (address >= 0x000f4240 && (address - 0x000f4240) / 0x400 < G_N_ELEMENTS(address_to_frame_lookup)) {
+                        address_to_frame_lookup[(address - 0x000f4240) / 0x400] = pinfo->fd->num + 19;
+                    }
 
                     // Adjust data pointers for extra address and length fields
                     data_offset += 8;
@@ -1943,36 +1953,34 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
                         d = tvb_get_guint8(tvb, data_offset+i+3);
 
                         if (b == 'M' && c == 'E' && d == 'M') {
-                            if (current_log_start_frame != 0xffffffff) {
-                                reassembly_entries[current_log_start_frame].log.entry = g_realloc(reassembly_entries[current_log_start_frame].log.entry, reassembly_entries[current_log_start_frame].log.entry_size + i);
-                                tvb_memcpy(tvb, &reassembly_entries[current_log_start_frame].log.entry[reassembly_entries[current_log_start_frame].log.entry_size], data_offset, i);
-                                reassembly_entries[current_log_start_frame].log.entry_size += i;
+                            if (reassembly.current_log_start_frame != AMBIT_NO_FRAME) {
+                                log = (GByteArray*)g_hash_table_lookup(ambit_logs, GUINT_TO_POINTER(reassembly.current_log_start_frame));
+                                g_byte_array_append(log, tvb_get_ptr(tvb, data_offset, i), i);
                             }
-                            reassembly_entries[pinfo->fd->num].log.entry = (unsigned char*)g_malloc(data_len-i);
-                            tvb_memcpy(tvb, reassembly_entries[pinfo->fd->num].log.entry, data_offset+i, data_len-i);
-                            reassembly_entries[pinfo->fd->num].log.entry_size = data_len-i;
-                            current_log_start_frame = pinfo->fd->num;
+                            log = g_byte_array_sized_new(data_len-i);
+                            g_byte_array_append(log, tvb_get_ptr(tvb, data_offset+i, data_len-i), data_len-i);
+                            g_hash_table_insert(ambit_logs, GUINT_TO_POINTER(pinfo->fd->num), log);
+                            reassembly.current_log_start_frame = pinfo->fd->num;
                             break;
                         }
                     }
                 }
 
-                if (i == data_len && current_log_start_frame != 0xffffffff) {
+                if (i == data_len && reassembly.current_log_start_frame != AMBIT_NO_FRAME) {
                     // No new PMEM found
-                    reassembly_entries[current_log_start_frame].log.entry = g_realloc(reassembly_entries[current_log_start_frame].log.entry, reassembly_entries[current_log_start_frame].log.entry_size + data_len);
-                    tvb_memcpy(tvb, &reassembly_entries[current_log_start_frame].log.entry[reassembly_entries[current_log_start_frame].log.entry_size], data_offset, data_len);
-
-                    reassembly_entries[current_log_start_frame].log.entry_size += data_len;
+                    log = (GByteArray*)g_hash_table_lookup(ambit_logs, GUINT_TO_POINTER(reassembly.current_log_start_frame));
+                    g_byte_array_append(log, tvb_get_ptr(tvb, data_offset, data_len), data_len);
                 }
+                log = NULL;
 
                 // Increment address
-                log_last_known_address += data_len;
+                reassembly.log_last_known_address += data_len;
 
-                reassembly_entries[pinfo->fd->num].log.start_frame = current_log_start_frame;
+                frame->log_start_frame = reassembly.current_log_start_frame;
 
-                if (log_last_known_address >= log_after_end_of_use) {
+                if (reassembly.log_last_known_address >= reassembly.log_after_end_of_use) {
                     // If we are after end of file, reset log entry!
-                    current_log_start_frame = 0xffffffff;
+                    reassembly.current_log_start_frame = AMBIT_NO_FRAME;
                 }
             }
 
@@ -1986,7 +1994,7 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
                         tvb_get_guint8(tvb, data_offset+3) == 0x00 &&
                         tvb_get_guint8(tvb, data_offset+4) == 0x01 &&
                         tvb_get_guint8(tvb, data_offset+5) == 0x00) {
-                        current_log_header_end_found = 1;
+                        reassembly.current_log_header_end_found = 1;
                     }
 
                     // Adjust data pointers for extra address and length fields
@@ -1999,28 +2007,38 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
                     tvb_get_guint8(tvb, data_offset+1) == 'B' &&
                     tvb_get_guint8(tvb, data_offset+2) == 'E' &&
                     tvb_get_guint8(tvb, data_offset+3) == 'M') {
-                    reassembly_entries[pinfo->fd->num].log_header.entry = (unsigned char*)g_malloc(data_len);
-                    tvb_memcpy(tvb, reassembly_entries[pinfo->fd->num].log_header.entry, data_offset, data_len);
-                    reassembly_entries[pinfo->fd->num].log_header.entry_size = data_len;
-                    current_log_header_start_frame = pinfo->fd->num;
+                    log_header = g_byte_array_sized_new(data_len);
+                    g_byte_array_append(log_header, tvb_get_ptr(tvb, data_offset, data_len), data_len);
+                    g_hash_table_insert(ambit_log_headers, GUINT_TO_POINTER(pinfo->fd->num), log_header);
+                    reassembly.current_log_header_start_frame = pinfo->fd->num;
                 }
-                else if (current_log_header_start_frame != 0xffffffff) {
+                else if (reassembly.current_log_header_start_frame != AMBIT_NO_FRAME) {
                     // Append to current entry
-                    reassembly_entries[current_log_header_start_frame].log_header.entry = g_realloc(reassembly_entries[current_log_header_start_frame].log_header.entry, reassembly_entries[current_log_header_start_frame].log_header.entry_size + data_len);
-                    tvb_memcpy(tvb, &reassembly_entries[current_log_header_start_frame].log_header.entry[reassembly_entries[current_log_header_start_frame].log_header.entry_size], data_offset, data_len);
-
-                    reassembly_entries[current_log_header_start_frame].log_header.entry_size += data_len;
+                    log_header = (GByteArray*)g_hash_table_lookup(ambit_log_headers, GUINT_TO_POINTER(reassembly.current_log_header_start_frame));
+                    g_byte_array_append(log_header, tvb_get_ptr(tvb, data_offset, data_len), data_len);
                 }
+                log_header = NULL;
 
-                reassembly_entries[pinfo->fd->num].log_header.start_frame = current_log_header_start_frame;
+                frame->log_header_start_frame = reassembly.current_log_header_start_frame;
 
                 // If we have reached last packet in last chunk, reset "pointers"
-                if (reassembly_entries[pinfo->fd->num].frame_index + 1 == reassembly_entries[pinfo->fd->num].frame_total &&
-                    current_log_header_end_found == 1) {
-                    current_log_header_start_frame = 0xffffffff;
-                    current_log_header_end_found = 0;
+                if (message != NULL && frame->frame_index + 1 == message->frame_total &&
+                    reassembly.current_log_header_end_found == 1) {
+                    reassembly.current_log_header_start_frame = AMBIT_NO_FRAME;
+                    reassembly.current_log_header_end_found = 0;
                 }
             }
+
+            // Offsets into the payload are those of the frame again
+            if (msg_part == 0x5d) {
+                data_len = data_header_len - 12;
+            }
+            else {
+                data_len = data_header_len;
+            }
+        }
+        else if (frame->message_frame != AMBIT_NO_FRAME) {
+            message = (ambit_message_t*)g_hash_table_lookup(ambit_messages, GUINT_TO_POINTER(frame->message_frame));
         }
 
         if (tree) { /* we are being asked for details */
@@ -2062,36 +2080,36 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
                 offset += 4;
             }
 
-            if (reassembly_entries[pinfo->fd->num].valid == 1) {
+            if (frame->valid == 1) {
                 new_tvb = tvb_new_subset_remaining(tvb, offset);
                 pkt_len = data_len;
                 col_set_str(pinfo->cinfo, COL_INFO, "");
             }
-            else if (reassembly_entries[pinfo->fd->num].frame_index + 1 == reassembly_entries[pinfo->fd->num].frame_total) {
-                new_tvb = tvb_new_real_data(reassembly_entries[pinfo->fd->num].data, reassembly_entries[pinfo->fd->num].size, reassembly_entries[pinfo->fd->num].size);
+            else if (message != NULL && frame->frame_index + 1 == message->frame_total) {
+                new_tvb = tvb_new_real_data(message->data, message->size, message->size);
                 //tvb_set_child_real_data_tvbuff(tvb, new_tvb);
                 add_new_data_source(pinfo, new_tvb, "Reassembled");
-                pkt_len = reassembly_entries[pinfo->fd->num].size;
+                pkt_len = message->size;
 
-                col_add_fstr(pinfo->cinfo, COL_INFO, " (#%u of #%u) Reassembled", reassembly_entries[pinfo->fd->num].frame_index + 1, reassembly_entries[pinfo->fd->num].frame_total);
+                col_add_fstr(pinfo->cinfo, COL_INFO, " (#%u of #%u) Reassembled", frame->frame_index + 1, message->frame_total);
 
-                if (reassembly_entries[pinfo->fd->num].log.start_frame != 0xffffffff &&
-                    reassembly_entries[reassembly_entries[pinfo->fd->num].log.start_frame].log.entry != NULL) {
-                    log_tvb = tvb_new_real_data(reassembly_entries[reassembly_entries[pinfo->fd->num].log.start_frame].log.entry, reassembly_entries[reassembly_entries[pinfo->fd->num].log.start_frame].log.entry_size, reassembly_entries[reassembly_entries[pinfo->fd->num].log.start_frame].log.entry_size);
+                if (frame->log_start_frame != AMBIT_NO_FRAME &&
+                    (log = (GByteArray*)g_hash_table_lookup(ambit_logs, GUINT_TO_POINTER(frame->log_start_frame))) != NULL) {
+                    log_tvb = tvb_new_real_data(log->data, log->len, log->len);
                     add_new_data_source(pinfo, log_tvb, "Log");
                 }
 
-                if (reassembly_entries[pinfo->fd->num].log_header.start_frame != 0xffffffff &&
-                    reassembly_entries[reassembly_entries[pinfo->fd->num].log_header.start_frame].log_header.entry != NULL) {
-                    log_header_tvb = tvb_new_real_data(reassembly_entries[reassembly_entries[pinfo->fd->num].log_header.start_frame].log_header.entry, reassembly_entries[reassembly_entries[pinfo->fd->num].log_header.start_frame].log_header.entry_size, reassembly_entries[reassembly_entries[pinfo->fd->num].log_header.start_frame].log_header.entry_size);
+                if (frame->log_header_start_frame != AMBIT_NO_FRAME &&
+                    (log_header = (GByteArray*)g_hash_table_lookup(ambit_log_headers, GUINT_TO_POINTER(frame->log_header_start_frame))) != NULL) {
+                    log_header_tvb = tvb_new_real_data(log_header->data, log_header->len, log_header->len);
                     add_new_data_source(pinfo, log_header_tvb, "Log header");
                 }
             }
             else {
-                col_add_fstr(pinfo->cinfo, COL_INFO, " (#%u of #%u)", reassembly_entries[pinfo->fd->num].frame_index + 1, reassembly_entries[pinfo->fd->num].frame_total);
+                col_add_fstr(pinfo->cinfo, COL_INFO, " (#%u of #%u)", frame->frame_index + 1, message != NULL ? message->frame_total : 0);
             }
 
-            subdissector = find_subdissector(reassembly_entries[pinfo->fd->num].command);
+            subdissector = find_subdissector(frame->command);
             if (subdissector != NULL) {
                 col_prepend_fstr(pinfo->cinfo, COL_INFO, "%s", subdissector->name);
             }
@@ -2113,13 +2131,13 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
             if (log_tvb != NULL) {
                 data_ti = proto_tree_add_text(ambit_tree, new_tvb, 0, pkt_len, "Full log entry");
                 data_tree = proto_item_add_subtree(data_ti, ett_ambit_log_data);
-                dissect_ambit_log_data_content(log_tvb, pinfo, data_tree, data, 0, reassembly_entries[reassembly_entries[pinfo->fd->num].log.start_frame].log.entry_size);
+                dissect_ambit_log_data_content(log_tvb, pinfo, data_tree, data, 0, log->len);
             }
 
             if (log_header_tvb != NULL) {
                 data_ti = proto_tree_add_text(ambit_tree, new_tvb, 0, pkt_len, "Full log headers");
                 data_tree = proto_item_add_subtree(data_ti, ett_ambit_log_data);
-                dissect_ambit3_log_headers_content(log_header_tvb, pinfo, data_tree, data, 0, reassembly_entries[reassembly_entries[pinfo->fd->num].log_header.start_frame].log_header.entry_size);
+                dissect_ambit3_log_headers_content(log_header_tvb, pinfo, data_tree, data, 0, log_header->len);
             }
 
             offset += data_len;
@@ -2137,9 +2155,48 @@ dissect_ambit(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *data _U
     return 0;
 }
 
+static void
+ambit_message_free(gpointer data)
+{
+    ambit_message_t *message = (ambit_message_t*)data;
+
+    g_free(message->data);
+    g_free(message);
+}
+
+static void
+ambit_byte_array_free(gpointer data)
+{
+    g_byte_array_free((GByteArray*)data, TRUE);
+}
+
+static void
+ambit_reassembly_init(void)
+{
+    if (ambit_frames != NULL) {
+        g_hash_table_destroy(ambit_frames);
+        g_hash_table_destroy(ambit_messages);
+        g_hash_table_destroy(ambit_logs);
+        g_hash_table_destroy(ambit_log_headers);
+    }
+    ambit_frames = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    ambit_messages = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, ambit_message_free);
+    ambit_logs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, ambit_byte_array_free);
+    ambit_log_headers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, ambit_byte_array_free);
+
+    memset(&reassembly, 0, sizeof(reassembly));
+    reassembly.fragments_start_frame = AMBIT_NO_FRAME;
+    reassembly.current_log_start_frame = AMBIT_NO_FRAME;
+    reassembly.log_after_end_of_use = AMBIT_NO_FRAME;
+    reassembly.current_log_header_start_frame = AMBIT_NO_FRAME;
+    memset(address_to_frame_lookup, 0, sizeof(address_to_frame_lookup));
+}
+
 void
 proto_register_ambit(void)
 {
+    int i;
+
     static hf_register_info hf[] = {
         { &hf_ambit_unknown,
           { "Unknown", "ambit.unknown", FT_BYTES, BASE_NONE, NULL, 0x0, NULL, HFILL } },
@@ -2514,6 +2571,12 @@ proto_register_ambit(void)
 
     proto_register_field_array(proto_ambit, hf, array_length(hf));
     proto_register_subtree_array(ett, array_length(ett));
+    register_init_routine(ambit_reassembly_init);
+
+    subdissector_lookup = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (i=0; subdissectors[i].command != 0; i++) {
+        g_hash_table_insert(subdissector_lookup, GUINT_TO_POINTER(subdissectors[i].command), (gpointer)&subdissectors[i]);
+    }
     //register_dissector("ambit", dissect_ambit, proto_ambit);
 }
 